@@ -0,0 +1,660 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+// winsock2.h, also included by udp.h, has to come before Windows.h
+#include <winsock2.h>
+#include <Windows.h>
+#include <wsipv6ok.h>
+#include <conio.h>
+#include "windows_getopt.h"
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "posix_conio.h"
+
+#define INVALID_SOCKET (-1)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define DEFAULT_AGC_BANDWIDTH (5)
+
+#include "DuoEngine.h"
+#include "DuoParse.h"
+#include "DuoChannelize.h"
+#include "udp.h"
+#include "wav.h"
+
+
+static const char* USAGE = "\
+Usage: DuoChan.exe [-h] [-a agchz] [-t agcdb] [-l lna] [-d decim] [-n notch]\n\
+                   [-w warmup] [-N channels] [-T taps] [-S] [-m mtu] [-H]\n\
+                   [-u [ipaddr][:port]] [-o prefix] [-k] [-x]\n\
+                   -c list freq\n\
+\n\
+Split both tuners into equal width channels with a polyphase filterbank\n\
+and deliver the selected channels as separate streams. Each stream is\n\
+32-bit float (Ia, Qa, Ib, Qb) frames at the channel sample rate.\n\
+\n\
+Options:\n\
+  -h: print this help message\n\
+  -a 0|5|50|100: AGC loop bandwidth in Hz (default=5)\n\
+  -t [-72-0]: AGC set point in dBFS (default=-30)\n\
+  -l 0-9: LNA state where 0 provides the least RF gain reduction.\n\
+      Default value is 4 (20-37 dB reduction depending on frequency).\n\
+  -d 1|2|4|8|16|32: Decimation factor (default=1)\n\
+      For factors 4, 8, 16, and 32, the analog bandwidth will \n\
+      be reduced to 600, 300, 200, and 200 kHz respectively unless \n\
+      the -x option is also specified. In which case the analog \n\
+      bandwidth remains 1.536 MHz.\n\
+  -n mwfm|dab: Enable MW/FM or DAB notch filter\n\
+      Both filters can be enabled by providing the -n option twice\n\
+      (once for each filter). By default, both filters are disabled.\n\
+  -w seconds: Run the radio for the specified number of seconds to\n\
+      warm up and stabilize performance before streaming (default=2).\n\
+      During the warmup period, samples are discarded.\n\
+  -N channels: Number of channels, a power of two >= 4 (default=16)\n\
+      Channel c is centered at freq + (c - channels/2) * fs / channels\n\
+  -T taps: Prototype filter taps per channel (default=8)\n\
+  -S: Critically sample the channels at fs / channels instead of\n\
+      oversampling them by two. Halves the CPU load and output rate\n\
+      but signals near the channel edges alias.\n\
+  -c list: Comma separated channel numbers to deliver (e.g. 3,8,12)\n\
+  -m mtu: UDP packet MTU (default=1500)\n\
+  -H: Start each UDP packet with a DuoUDP metadata header\n\
+  -u [ipaddr][:port]: Send each channel to the specified IPv4\n\
+      address (default=127.0.0.1) on port + channel number\n\
+      (default port=1234). Use \":port\" to change only the port.\n\
+  -o prefix: Write each channel to a 4 channel float WAV file named\n\
+      prefix_chN.wav\n\
+  -k: Use USB bulk transfer mode instead of isochronous\n\
+  -x: Use the maximum 8 MHz master sample rate.\n\
+      This will deliver 12 bit ADC resolution, but with slightly \n\
+      better anti-aliaising performance at the widest bandwidth.\n\
+      This mode is only available at 1.536 MHz analog bandwidth.\n\
+      The default mode is to use a 6 MHz master sample clock.\n\
+      That mode delivers 14 bit ADC resolution, but with slightly\n\
+      inferior anti-aliaising performance at the widest bandwidth.\n\
+      The default mode is also compatible with analog bandwidths of\n\
+      1.536 MHz, 600 kHz, 300 kHz, and 200 kHz. 6 MHz operation\n\
+      should result in a slightly lower CPU load.\n\
+\n\
+Arguments:\n\
+  freq: Tuner RF frequency in Hz is mandatory.\n\
+      Can be specified with k, K, m, M, g, or G suffix to indicate\n\
+      the value is in kHz, MHz, or GHz respectively (e.g. 1.42G)\n\
+\n";
+
+
+// (Ia, Qa, Ib, Qb) as 32-bit floats
+#define FRAME_SIZE (4 * sizeof(float))
+// Largest number of channels that can be selected
+#define MAX_CHANNELS (4096)
+
+
+struct ChannelOutput {
+    unsigned int channel;
+    char* path;
+    FILE* out;
+    struct WavHeader wav;
+    size_t bytesWritten;
+    struct sockaddr_in dest;
+    // metadata header, if enabled, followed by the frames
+    char* packet;
+    unsigned int packetFrames;
+    uint32_t sequence;
+};
+
+
+struct Context {
+    struct DuoChannelizer chanA;
+    struct DuoChannelizer chanB;
+    // channelizer outputs of the current transfer
+    float* blocksA;
+    float* blocksB;
+    unsigned int maxBlocks;
+    // frames of one channel from the current transfer
+    float* frames;
+    struct ChannelOutput* outputs;
+    unsigned int numOutputs;
+    bool udp;
+    bool header;
+    size_t headerSize;
+    unsigned int maxPacketFrames;
+#if defined(_WIN32) || (_WIN64)
+    SOCKET sock;
+#else
+    int sock;
+#endif
+    time_t startTime;
+    bool started;
+    bool done;
+};
+
+
+/**
+* Parse a comma separated list of channel numbers
+*
+* @param arg string to parse
+* @param channels array of at least MAX_CHANNELS entries
+* @param numChannels set to the number of channels parsed
+*
+* @return zero if parsing was successful, non-zero otherwise
+*/
+static int parseChannelList(char* arg, unsigned int* channels, unsigned int* numChannels) {
+    *numChannels = 0;
+    char* token = strtok(arg, ",");
+    while (token) {
+        if (*numChannels == MAX_CHANNELS || parseUintArg(token, &channels[*numChannels], 10)) {
+            return 1;
+        }
+        for (unsigned int idx = 0; idx < *numChannels; idx++) {
+            if (channels[idx] == channels[*numChannels]) {
+                return 1;
+            }
+        }
+        (*numChannels)++;
+        token = strtok(NULL, ",");
+    }
+    return *numChannels == 0;
+}
+
+
+static void sendPacket(struct Context* context, struct ChannelOutput* output) {
+    if (context->header) {
+        udpHeaderUpdate((struct DuoUdpHeader*)output->packet, output->sequence, output->packetFrames);
+    }
+    int rcode = sendto(
+        context->sock, output->packet,
+        (int)(context->headerSize + output->packetFrames * FRAME_SIZE), 0,
+        (struct sockaddr*)&output->dest, sizeof(output->dest));
+#if defined(_WIN32) || defined(_WIN64)
+    if (rcode == SOCKET_ERROR) {
+        printf("sendto failed with error=%d\n", WSAGetLastError());
+    }
+#else
+    if (rcode == -1) {
+        perror("sendto failed");
+    }
+#endif
+    output->sequence++;
+    output->packetFrames = 0;
+}
+
+
+static void deliver(struct Context* context, struct ChannelOutput* output, unsigned int numFrames) {
+    size_t numBytes = numFrames * FRAME_SIZE;
+    if (output->out) {
+        if (output->bytesWritten + numBytes > UINT32_MAX - sizeof(struct WavHeader)) {
+            printf("%s reached the WAV size limit\n", output->path);
+            context->done = true;
+            return;
+        }
+        if (fwrite(context->frames, FRAME_SIZE, numFrames, output->out) != numFrames) {
+            printf("failed to write %s\n", output->path);
+            context->done = true;
+            return;
+        }
+        output->bytesWritten += numBytes;
+    }
+    if (context->udp) {
+        unsigned int frameIdx = 0;
+        while (frameIdx < numFrames) {
+            unsigned int count = context->maxPacketFrames - output->packetFrames;
+            if (count > numFrames - frameIdx) {
+                count = numFrames - frameIdx;
+            }
+            memcpy(output->packet + context->headerSize + output->packetFrames * FRAME_SIZE,
+                   context->frames + 4 * frameIdx, count * FRAME_SIZE);
+            output->packetFrames += count;
+            frameIdx += count;
+            if (output->packetFrames == context->maxPacketFrames) {
+                sendPacket(context, output);
+            }
+        }
+    }
+}
+
+
+static void transferCallback(struct DuoEngineTransfer* transfer, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    if (!context->started) {
+        if (time(NULL) >= context->startTime) {
+            context->started = true;
+        }
+        return;
+    }
+    if (context->done) {
+        return;
+    }
+
+    unsigned int maxBlocks = duoChannelizerMaxBlocks(&context->chanA, transfer->numFrames);
+    if (maxBlocks > context->maxBlocks) {
+        unsigned int size = context->chanA.numChannels;
+        free(context->blocksA);
+        free(context->blocksB);
+        free(context->frames);
+        context->blocksA = (float*)malloc((size_t)maxBlocks * size * 2 * sizeof(float));
+        context->blocksB = (float*)malloc((size_t)maxBlocks * size * 2 * sizeof(float));
+        context->frames = (float*)malloc((size_t)maxBlocks * FRAME_SIZE);
+        if (context->blocksA == NULL || context->blocksB == NULL || context->frames == NULL) {
+            printf("failed to allocate channel buffers\n");
+            context->maxBlocks = 0;
+            context->done = true;
+            return;
+        }
+        context->maxBlocks = maxBlocks;
+    }
+
+    const float* data = (const float*)transfer->data;
+    unsigned int numBlocks = duoChannelizerPush(
+        &context->chanA, data, 4, transfer->numFrames, context->blocksA);
+    duoChannelizerPush(&context->chanB, data + 2, 4, transfer->numFrames, context->blocksB);
+    if (numBlocks == 0) {
+        return;
+    }
+
+    unsigned int size = context->chanA.numChannels;
+    for (unsigned int outIdx = 0; outIdx < context->numOutputs && !context->done; outIdx++) {
+        struct ChannelOutput* output = &context->outputs[outIdx];
+        const float* a = context->blocksA + 2 * output->channel;
+        const float* b = context->blocksB + 2 * output->channel;
+        float* frame = context->frames;
+        for (unsigned int blockIdx = 0; blockIdx < numBlocks; blockIdx++) {
+            frame[0] = a[0];
+            frame[1] = a[1];
+            frame[2] = b[0];
+            frame[3] = b[1];
+            frame += 4;
+            a += 2 * size;
+            b += 2 * size;
+        }
+        deliver(context, output, numBlocks);
+    }
+}
+
+
+static int controlCallback(struct DuoEngineControl* control, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    if (_kbhit()) {
+        char ctrl = _getch();
+        if (ctrl == 'q') {
+            context->done = true;
+            return 1;
+        }
+    }
+    if (context->done) {
+        return 1;
+    }
+    return 0;
+}
+
+
+static void messageCallback(const char* msg, void* userContext) {
+    printf("%s\n", msg);
+}
+
+
+static void usage(void) {
+    printf(USAGE);
+}
+
+
+int main(int argc, char** argv) {
+    char opt = 0;
+    unsigned int numChannels = 16;
+    unsigned int tapsPerChannel = 8;
+    bool oversample = true;
+    unsigned int mtu = 1500;
+    unsigned int warmup = 2;
+    unsigned int port = 1234;
+    char defaultAddr[] = "127.0.0.1";
+    char* ipStr = defaultAddr;
+    unsigned long ipAddr = inet_addr(defaultAddr);
+    char* outputPrefix = NULL;
+    static unsigned int selected[MAX_CHANNELS];
+    unsigned int numSelected = 0;
+    int rcode = 0;
+
+    struct DuoEngine engine;
+    duoEngineInit(&engine);
+
+    struct Context context;
+    memset(&context, 0, sizeof(context));
+    context.sock = INVALID_SOCKET;
+
+    while ((opt = getopt(argc, argv, "ha:t:l:d:n:w:N:T:Sc:m:Hu:o:kx")) != -1) {
+        switch (opt) {
+        case 'a':
+            if (parseAgcBandwidth(optarg, &engine.agcBandwidth)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            if (parseAgcSetPoint(optarg, &engine.agcSetPoint)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'l':
+            if (parseLnaState(optarg, &engine.lnaState)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'd':
+            if (parseDecimFactor(optarg, &engine.decimFactor)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            if (parseNotchFilter(optarg, &engine.notchMwfm, &engine.notchDab)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'w':
+            if (parseUintArg(optarg, &warmup, 10)) {
+                printf("invalid warmup time, must be an unsigned int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            if (parseUintArg(optarg, &numChannels, 10) || numChannels < 4 ||
+                numChannels > MAX_CHANNELS || !duoFFTValidSize(numChannels)) {
+                printf("invalid number of channels, must be a power of two in [4-%u]\n", MAX_CHANNELS);
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            if (parseUintArg(optarg, &tapsPerChannel, 10) || tapsPerChannel == 0 || tapsPerChannel > 64) {
+                printf("invalid taps per channel, must be in [1-64]\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S':
+            oversample = false;
+            break;
+        case 'c':
+            if (parseChannelList(optarg, selected, &numSelected)) {
+                printf("invalid channel list\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'm':
+            if (parseUintArg(optarg, &mtu, 10)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'H':
+            context.header = true;
+            break;
+        case 'u':
+            if (parseAddrPort(optarg, &ipStr, &ipAddr, &port)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            context.udp = true;
+            break;
+        case 'o':
+            outputPrefix = optarg;
+            break;
+        case 'k':
+            engine.usbBulkMode = true;
+            break;
+        case 'x':
+            engine.maxSampleRate = true;
+            break;
+        case 'h':
+            usage();
+            return EXIT_SUCCESS;
+        default:
+            printf("unrecognized option\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Handle remaining positional arguments
+    if (optind == (argc - 1)) {
+        if (parseFrequency(argv[optind], &engine.tuneFreq)) {
+            printf("invalid frequency argument\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        printf("invalid number of arguments\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (numSelected == 0) {
+        printf("at least one channel must be selected with -c\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+    for (unsigned int idx = 0; idx < numSelected; idx++) {
+        if (selected[idx] >= numChannels) {
+            printf("invalid channel %u, must be less than %u\n", selected[idx], numChannels);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!context.udp && outputPrefix == NULL) {
+        printf("no destination, specify -u and/or -o\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (context.udp && port + numChannels - 1 > 65535) {
+        printf("UDP port range %u-%u is invalid\n", port, port + numChannels - 1);
+        return EXIT_FAILURE;
+    }
+
+    context.headerSize = context.header ? sizeof(struct DuoUdpHeader) : 0;
+    // subtract IP and UDP headers
+    if (mtu < 20 + 8 + context.headerSize + FRAME_SIZE) {
+        printf("MTU of %u bytes is too small\n", mtu);
+        return EXIT_FAILURE;
+    }
+    context.maxPacketFrames = (unsigned int)((mtu - 20 - 8 - context.headerSize) / FRAME_SIZE);
+
+    if (duoChannelizerInit(&context.chanA, numChannels, oversample, tapsPerChannel) ||
+        duoChannelizerInit(&context.chanB, numChannels, oversample, tapsPerChannel)) {
+        printf("failed to initialize channelizer\n");
+        duoChannelizerFree(&context.chanA);
+        return EXIT_FAILURE;
+    }
+    double sampleRate = duoEngineSampleRate(&engine);
+    double channelRate = duoChannelizerRate(&context.chanA, sampleRate);
+    double channelSpacing = sampleRate / numChannels;
+
+    printf("RF Tune Frequency: %f Hz\n", engine.tuneFreq);
+    printf("AGC Loop Bandwidth: %u Hz\n", engine.agcBandwidth);
+    if (engine.agcBandwidth > 0) {
+        printf("AGC Set Point: %d dBFS\n", engine.agcSetPoint);
+    }
+    printf("Warmup: %u seconds\n", warmup);
+    printf("LNA State: %u\n", engine.lnaState);
+    printf("Decimation Factor: %u\n", engine.decimFactor);
+    printf("USB Bulk Mode: %s\n", engine.usbBulkMode ? "true" : "false");
+    printf("Max Fs Mode: %s\n", engine.maxSampleRate ? "true" : "false");
+    printf("Sample Rate: %.0f Hz\n", sampleRate);
+    printf("Channels: %u\n", numChannels);
+    printf("Channel Spacing: %.1f Hz\n", channelSpacing);
+    printf("Channel Sample Rate: %.1f Hz\n", channelRate);
+    printf("Taps Per Channel: %u\n", tapsPerChannel);
+    printf("Oversampled: %s\n", oversample ? "true" : "false");
+    if (context.udp) {
+        printf("Destination IP Address: %s\n", ipStr);
+        printf("Packet MTU: %u bytes\n", mtu);
+        printf("Metadata Header: %s\n", context.header ? "true" : "false");
+    }
+
+    context.outputs = (struct ChannelOutput*)calloc(numSelected, sizeof(struct ChannelOutput));
+    if (context.outputs == NULL) {
+        printf("failed to allocate outputs\n");
+        rcode = 1;
+    }
+    else {
+        context.numOutputs = numSelected;
+    }
+
+    if (rcode == 0 && context.udp) {
+#if defined(_WIN32) || (_WIN64)
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 0), &wsaData) != 0) {
+            printf("WSAStartup() failed");
+            rcode = 1;
+        }
+#endif
+        if (rcode == 0 && (context.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
+#if defined(_WIN32) || (_WIN64)
+            printf("socket creation failed error=%u", WSAGetLastError());
+#else
+            perror("socket creation failed:");
+#endif
+            rcode = 1;
+        }
+    }
+
+    for (unsigned int idx = 0; rcode == 0 && idx < context.numOutputs; idx++) {
+        struct ChannelOutput* output = &context.outputs[idx];
+        output->channel = selected[idx];
+        printf("Channel %u: %.0f Hz", output->channel,
+               engine.tuneFreq + ((int)output->channel - (int)numChannels / 2) * channelSpacing);
+
+        if (context.udp) {
+            output->packet = (char*)malloc(mtu);
+            if (output->packet == NULL) {
+                printf("\nfailed to allocate packet buffer\n");
+                rcode = 1;
+                break;
+            }
+            if (context.header) {
+                udpHeaderInit((struct DuoUdpHeader*)output->packet, DUO_FORMAT_FLOAT32, 32,
+                              DUO_LAYOUT_INTERLEAVED, DUO_OUTPUT_BOTH, (uint32_t)(channelRate + 0.5));
+            }
+            memset(&output->dest, 0, sizeof(output->dest));
+            output->dest.sin_family = AF_INET;
+            output->dest.sin_addr.s_addr = ipAddr;
+            output->dest.sin_port = htons((unsigned short)(port + output->channel));
+            printf(" UDP port %u", port + output->channel);
+        }
+
+        if (outputPrefix) {
+            size_t pathSize = strlen(outputPrefix) + 32;
+            output->path = (char*)malloc(pathSize);
+            if (output->path == NULL) {
+                printf("\nfailed to allocate path\n");
+                rcode = 1;
+                break;
+            }
+            snprintf(output->path, pathSize, "%s_ch%u.wav", outputPrefix, output->channel);
+            // Rates are rounded to whole Hz in the WAV header
+            wavHeaderInit(&output->wav, (uint32_t)(channelRate + 0.5), 4, sizeof(float), true);
+            output->out = fopen(output->path, "wb");
+            if (output->out == NULL) {
+                printf("\n");
+                perror(output->path);
+                rcode = 1;
+                break;
+            }
+            if (fwrite(&output->wav, sizeof(output->wav), 1, output->out) != 1) {
+                printf("\nfailed to write WAV header to %s\n", output->path);
+                rcode = 1;
+                break;
+            }
+            printf(" file %s", output->path);
+        }
+        printf("\n");
+    }
+
+    if (rcode == 0) {
+        // The channelizer works on interleaved floating point frames
+        engine.format = DUO_FORMAT_FLOAT32;
+        engine.userContext = &context;
+        engine.transferCallback = transferCallback;
+        engine.controlCallback = controlCallback;
+        engine.messageCallback = messageCallback;
+
+        // Configure warmup start time if needed
+        context.started = warmup == 0;
+        context.startTime = time(NULL) + warmup;
+
+        printf("PRESS q to QUIT\n");
+        rcode = duoEngineRun(&engine);
+    }
+
+    for (unsigned int idx = 0; idx < context.numOutputs; idx++) {
+        struct ChannelOutput* output = &context.outputs[idx];
+        if (output->packet && output->packetFrames > 0 && context.sock != INVALID_SOCKET) {
+            sendPacket(&context, output);
+        }
+        if (output->out) {
+            wavHeaderUpdate(&output->wav, (uint32_t)output->bytesWritten);
+            fseek(output->out, 0, SEEK_SET);
+            if (fwrite(&output->wav, sizeof(output->wav), 1, output->out) != 1) {
+                printf("failed to update WAV header of %s\n", output->path);
+            }
+            fclose(output->out);
+        }
+        free(output->packet);
+        free(output->path);
+    }
+    if (context.sock != INVALID_SOCKET) {
+#if defined(_WIN32) || defined(_WIN64)
+        closesocket(context.sock);
+#else
+        close(context.sock);
+#endif
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    if (context.udp) {
+        WSACleanup();
+    }
+#endif
+    free(context.outputs);
+    free(context.blocksA);
+    free(context.blocksB);
+    free(context.frames);
+    duoChannelizerFree(&context.chanA);
+    duoChannelizerFree(&context.chanB);
+
+    return rcode == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,584 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#include <conio.h>
+#include "windows_getopt.h"
+#else
+#include <unistd.h>
+#include <getopt.h>
+#include "posix_conio.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define DEFAULT_AGC_BANDWIDTH (5)
+
+#include "DuoEngine.h"
+#include "DuoParse.h"
+#include "wav.h"
+#include "corr.h"
+
+
+static const char* USAGE = "\
+Usage: DuoCorr.exe [-h] [-a agchz] [-t agcdb] [-l lna] [-d decim]\n\
+                   [-n notch] [-w warmup] [-N fftsize] [-i ms] [-c count]\n\
+                   [-o path] [-r path] [-I] [-K path] [-U path] [-k] [-x]\n\
+                   [freq]\n\
+\n\
+Streaming cross-correlation of the two tuners. For each integration\n\
+interval, prints the lag and phase of tuner B relative to tuner A.\n\
+\n\
+Options:\n\
+  -h: print this help message\n\
+  -a 0|5|50|100: AGC loop bandwidth in Hz (default=5)\n\
+  -t [-72-0]: AGC set point in dBFS (default=-30)\n\
+  -l 0-9: LNA state where 0 provides the least RF gain reduction.\n\
+      Default value is 4 (20-37 dB reduction depending on frequency).\n\
+  -d 1|2|4|8|16|32: Decimation factor (default=1)\n\
+      For factors 4, 8, 16, and 32, the analog bandwidth will \n\
+      be reduced to 600, 300, 200, and 200 kHz respectively unless \n\
+      the -x option is also specified. In which case the analog \n\
+      bandwidth remains 1.536 MHz.\n\
+  -n mwfm|dab: Enable MW/FM or DAB notch filter\n\
+      Both filters can be enabled by providing the -n option twice\n\
+      (once for each filter). By default, both filters are disabled.\n\
+  -w seconds: Run the radio for the specified number of seconds to\n\
+      warm up and stabilize performance before correlating (default=2).\n\
+      During the warmup period, samples are discarded.\n\
+  -N fftsize: FFT size, a power of two >= 8 (default=1024)\n\
+      Lags up to +/- fftsize/4 samples can be measured.\n\
+  -i ms: Integration interval in milliseconds (default=1000)\n\
+  -c count: Exit after the specified number of intervals\n\
+      (default=0, run until q is pressed)\n\
+  -o path: Write a record with the mean cross-power spectrum for\n\
+      each interval to the specified file\n\
+  -r path: Replay a 4 channel DuoWAV file (16-bit or floating point)\n\
+      instead of using the device. The freq argument is not used.\n\
+  -I: Remove the DC offset and I/Q gain and phase imbalance of each\n\
+      tuner before correlating and print the estimates with each\n\
+      interval. Not available with -r.\n\
+  -K path: Remove the phase, delay, and gain of tuner B relative to\n\
+      tuner A using the calibration table at path before correlating.\n\
+      Not available with -r.\n\
+  -U path: Average the phase, delay, and gain of tuner B relative to\n\
+      tuner A over all intervals and store them for freq in the\n\
+      calibration table at path, which is created if missing. The\n\
+      table is applied while measuring, so what remains is folded into\n\
+      the stored point and repeated runs refine it.\n\
+      Not available with -r.\n\
+  -k: Use USB bulk transfer mode instead of isochronous\n\
+  -x: Use the maximum 8 MHz master sample rate.\n\
+      This will deliver 12 bit ADC resolution, but with slightly \n\
+      better anti-aliaising performance at the widest bandwidth.\n\
+      This mode is only available at 1.536 MHz analog bandwidth.\n\
+      The default mode is to use a 6 MHz master sample clock.\n\
+      That mode delivers 14 bit ADC resolution, but with slightly\n\
+      inferior anti-aliaising performance at the widest bandwidth.\n\
+      The default mode is also compatible with analog bandwidths of\n\
+      1.536 MHz, 600 kHz, 300 kHz, and 200 kHz. 6 MHz operation\n\
+      should result in a slightly lower CPU load.\n\
+\n\
+Arguments:\n\
+  freq: Tuner RF frequency in Hz is mandatory unless -r is specified.\n\
+      Can be specified with k, K, m, M, g, or G suffix to indicate\n\
+      the value is in kHz, MHz, or GHz respectively (e.g. 1.42G)\n\
+\n";
+
+
+// Frames converted per read while replaying a WAV file
+#define REPLAY_FRAMES (4096)
+
+
+struct Context {
+    struct DuoCorr corr;
+    float sampleRate;
+    // number of intervals to run, zero to run until stopped
+    unsigned int maxIntervals;
+    FILE* out;
+    // latest correction estimates from the control callback
+    bool iqCorrection;
+    struct DuoEngineIQEstimate iqA;
+    struct DuoEngineIQEstimate iqB;
+    // sums of the measured residual calibration, only used with -U
+    bool measureCal;
+    double calSumRe;
+    double calSumIm;
+    double calSumLag;
+    double calSumGain;
+    unsigned int calCount;
+    time_t startTime;
+    bool started;
+    bool done;
+};
+
+
+static void resultCallback(const struct DuoCorrResult* result, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    printf("interval=%u lag=%.3f samples (%.3f us) phase=%.2f deg coefficient=%.4f\n",
+           result->interval, result->lag, result->lag / context->sampleRate * 1e6,
+           result->phase * 180.0 / DUOFFT_PI, result->coefficient);
+    if (context->iqCorrection) {
+        const struct DuoEngineIQEstimate* iq[2] = {&context->iqA, &context->iqB};
+        for (unsigned int tuner = 0; tuner < 2; tuner++) {
+            printf("    tuner %c dc=(%.5f, %.5f) gain=%.4f phase=%.2f deg image rejection=%.1f dB\n",
+                   'A' + tuner, iq[tuner]->dcI, iq[tuner]->dcQ, iq[tuner]->gain,
+                   iq[tuner]->phase, iq[tuner]->imageRejection);
+        }
+    }
+
+    if (context->out) {
+        struct DuoCorrRecord record;
+        record.magic[0] = 'D';
+        record.magic[1] = 'C';
+        record.magic[2] = 'O';
+        record.magic[3] = 'R';
+        record.fftSize = context->corr.fftSize;
+        record.interval = result->interval;
+        record.numHops = result->numHops;
+        record.sampleRate = context->sampleRate;
+        record.lag = result->lag;
+        record.phase = result->phase;
+        record.coefficient = result->coefficient;
+        record.powerA = result->powerA;
+        record.powerB = result->powerB;
+        bool ok = fwrite(&record, sizeof(record), 1, context->out) == 1;
+        for (unsigned int idx = 0; ok && idx < record.fftSize; idx++) {
+            float bin[2] = {result->crossRe[idx], result->crossIm[idx]};
+            ok = fwrite(bin, sizeof(bin), 1, context->out) == 1;
+        }
+        if (!ok) {
+            printf("failed to write record for interval %u\n", result->interval);
+            context->done = true;
+        }
+    }
+
+    if (context->measureCal && result->powerA > 0.0f && result->powerB > 0.0f) {
+        // Weight the phase by the coherence of each interval
+        context->calSumRe += result->coefficient * cos(result->phase);
+        context->calSumIm += result->coefficient * sin(result->phase);
+        context->calSumLag += result->lag;
+        context->calSumGain += sqrt(result->powerB / result->powerA);
+        context->calCount++;
+    }
+
+    if (context->maxIntervals && result->interval + 1 >= context->maxIntervals) {
+        context->done = true;
+    }
+}
+
+
+static void transferCallback(struct DuoEngineTransfer* transfer, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    if (context->started && !context->done) {
+        duoCorrPush(&context->corr, (const float*)transfer->data, transfer->numFrames);
+    }
+    else if (!context->started) {
+        if (time(NULL) >= context->startTime) {
+            context->started = true;
+        }
+    }
+}
+
+
+static int controlCallback(struct DuoEngineControl* control, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    context->iqA = control->iqA;
+    context->iqB = control->iqB;
+    if (_kbhit()) {
+        char ctrl = _getch();
+        if (ctrl == 'q') {
+            context->done = true;
+            return 1;
+        }
+    }
+    if (context->done) {
+        return 1;
+    }
+    return 0;
+}
+
+
+static void messageCallback(const char* msg, void* userContext) {
+    printf("%s\n", msg);
+}
+
+
+static void usage(void) {
+    printf(USAGE);
+}
+
+
+/**
+* Fold the measured residual into the calibration point at freq
+*
+* @param context DuoCorr context with the residual sums
+* @param table calibration table that was applied while measuring
+* @param freq RF frequency in Hz
+* @param path file to save the table to
+*
+* @return zero on success, non-zero otherwise
+*/
+static int updateCalibration(
+        struct Context* context, struct DuoCalTable* table, float freq, const char* path) {
+    if (context->calCount == 0) {
+        printf("no intervals measured, calibration not updated\n");
+        return 1;
+    }
+    struct DuoCalPoint point;
+    duoCalTableLookup(table, freq, &point);
+    double phase = atan2(context->calSumIm, context->calSumRe);
+    double delay = context->calSumLag / context->calCount / context->sampleRate;
+    double gain = context->calSumGain / context->calCount;
+    point.freq = freq;
+    point.phase += phase;
+    point.delay += delay;
+    point.gain *= gain;
+    printf("Residual: phase=%.2f deg delay=%.2f ns gain=%.4f\n",
+           phase * 180.0 / DUOFFT_PI, delay * 1e9, gain);
+    printf("Calibration at %.0f Hz: phase=%.2f deg delay=%.2f ns gain=%.4f\n",
+           point.freq, duoCalWrap(point.phase) * 180.0 / DUOFFT_PI, point.delay * 1e9, point.gain);
+    if (duoCalTableSet(table, &point) || duoCalTableSave(table, path)) {
+        printf("failed to save calibration table %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+
+/**
+* Feed the correlator from a WAV file captured with DuoWAV
+*
+* @param context DuoCorr context, sampleRate is set from the file
+* @param in WAV file positioned at the start of the samples
+* @param info WAV format details
+*
+* @return zero on success, non-zero otherwise
+*/
+static int replay(struct Context* context, FILE* in, const struct WavInfo* info) {
+    bool floatingPoint = info->audioFormat == 3 && info->bitsPerSample == 32;
+    bool pcm = info->audioFormat == 1 && info->bitsPerSample == 16;
+    if (info->numChannels != 4 || (!floatingPoint && !pcm)) {
+        printf("replay requires 4 channels of 16-bit PCM or 32-bit floating point samples\n");
+        return 1;
+    }
+
+    size_t scalarSize = info->bitsPerSample / 8;
+    float* frames = (float*)malloc(REPLAY_FRAMES * 4 * sizeof(float));
+    int16_t* raw = (int16_t*)malloc(REPLAY_FRAMES * 4 * sizeof(int16_t));
+    if (frames == NULL || raw == NULL) {
+        printf("failed to allocate replay buffers\n");
+        free(frames);
+        free(raw);
+        return 1;
+    }
+
+    // A size of zero means the capture was not finalized, read to EOF
+    size_t framesLeft = info->dataSize ? info->dataSize / (scalarSize * 4) : SIZE_MAX;
+    while (!context->done && framesLeft > 0) {
+        size_t count = framesLeft < REPLAY_FRAMES ? framesLeft : REPLAY_FRAMES;
+        if (floatingPoint) {
+            count = fread(frames, scalarSize * 4, count, in);
+        }
+        else {
+            count = fread(raw, scalarSize * 4, count, in);
+            // Same scaling DuoEngine uses for floating point output
+            for (size_t idx = 0; idx < count * 4; idx++) {
+                frames[idx] = raw[idx] / (float)32767.0;
+            }
+        }
+        if (count == 0) {
+            break;
+        }
+        duoCorrPush(&context->corr, frames, count);
+        framesLeft -= count;
+    }
+
+    free(frames);
+    free(raw);
+    return 0;
+}
+
+
+int main(int argc, char** argv) {
+    char opt = 0;
+    unsigned int fftSize = 1024;
+    unsigned int intervalMs = 1000;
+    unsigned int warmup = 2;
+    char* outputPath = NULL;
+    char* replayPath = NULL;
+    char* updatePath = NULL;
+    FILE* replayFile = NULL;
+    struct WavInfo replayInfo;
+    int rcode = 0;
+
+    struct DuoEngine engine;
+    duoEngineInit(&engine);
+    struct DuoCalTable calTable;
+    duoCalTableInit(&calTable);
+
+    struct Context context;
+    memset(&context, 0, sizeof(context));
+
+    while ((opt = getopt(argc, argv, "ha:t:l:d:n:w:N:i:c:o:r:IK:U:kx")) != -1) {
+        switch (opt) {
+        case 'a':
+            if (parseAgcBandwidth(optarg, &engine.agcBandwidth)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            if (parseAgcSetPoint(optarg, &engine.agcSetPoint)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'l':
+            if (parseLnaState(optarg, &engine.lnaState)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'd':
+            if (parseDecimFactor(optarg, &engine.decimFactor)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            if (parseNotchFilter(optarg, &engine.notchMwfm, &engine.notchDab)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'w':
+            if (parseUintArg(optarg, &warmup, 10)) {
+                printf("invalid warmup time, must be an unsigned int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            if (parseUintArg(optarg, &fftSize, 10) || fftSize < 8 || !duoFFTValidSize(fftSize)) {
+                printf("invalid FFT size, must be a power of two >= 8\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'i':
+            if (parseUintArg(optarg, &intervalMs, 10) || intervalMs == 0) {
+                printf("invalid integration interval, must be a positive number of milliseconds\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            if (parseUintArg(optarg, &context.maxIntervals, 10)) {
+                printf("invalid interval count, must be an unsigned int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'o':
+            outputPath = optarg;
+            break;
+        case 'r':
+            replayPath = optarg;
+            break;
+        case 'I':
+            engine.iqCorrection = true;
+            break;
+        case 'K':
+            if (parseCalibrationTable(optarg, &calTable)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            engine.calibration = &calTable;
+            break;
+        case 'U':
+            updatePath = optarg;
+            break;
+        case 'k':
+            engine.usbBulkMode = true;
+            break;
+        case 'x':
+            engine.maxSampleRate = true;
+            break;
+        case 'h':
+            usage();
+            return EXIT_SUCCESS;
+        default:
+            printf("unrecognized option\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Handle remaining positional arguments
+    if (optind == (argc - 1)) {
+        if (parseFrequency(argv[optind], &engine.tuneFreq)) {
+            printf("invalid frequency argument\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    else if (optind != argc || replayPath == NULL) {
+        printf("invalid number of arguments\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (replayPath && (engine.iqCorrection || engine.calibration || updatePath)) {
+        printf("-I, -K, and -U are not available with -r\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (engine.calibration && updatePath) {
+        printf("-K and -U cannot be combined, -U applies the table it updates\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (updatePath) {
+        // A missing table starts out empty
+        FILE* exists = fopen(updatePath, "r");
+        if (exists) {
+            fclose(exists);
+            if (parseCalibrationTable(updatePath, &calTable)) {
+                return EXIT_FAILURE;
+            }
+        }
+        engine.calibration = &calTable;
+        context.measureCal = true;
+    }
+    context.iqCorrection = engine.iqCorrection;
+
+    if (replayPath) {
+        replayFile = fopen(replayPath, "rb");
+        if (replayFile == NULL) {
+            perror(replayPath);
+            return EXIT_FAILURE;
+        }
+        if (wavReadHeader(replayFile, &replayInfo)) {
+            printf("%s is not a WAV file\n", replayPath);
+            fclose(replayFile);
+            return EXIT_FAILURE;
+        }
+        context.sampleRate = (float)replayInfo.sampleRate;
+    }
+    else {
+        context.sampleRate = (float)duoEngineSampleRate(&engine);
+    }
+
+    // Round the interval to a whole number of hops
+    unsigned int hopsPerInterval = (unsigned int)
+        (context.sampleRate * intervalMs / 1000.0 / (fftSize / 2) + 0.5);
+    if (hopsPerInterval == 0) {
+        hopsPerInterval = 1;
+    }
+
+    if (replayPath) {
+        printf("Replay File: %s\n", replayPath);
+    }
+    else {
+        printf("RF Tune Frequency: %f Hz\n", engine.tuneFreq);
+        printf("AGC Loop Bandwidth: %u Hz\n", engine.agcBandwidth);
+        if (engine.agcBandwidth > 0) {
+            printf("AGC Set Point: %d dBFS\n", engine.agcSetPoint);
+        }
+        printf("Warmup: %u seconds\n", warmup);
+        printf("LNA State: %u\n", engine.lnaState);
+        printf("Decimation Factor: %u\n", engine.decimFactor);
+        printf("USB Bulk Mode: %s\n", engine.usbBulkMode ? "true" : "false");
+        printf("Max Fs Mode: %s\n", engine.maxSampleRate ? "true" : "false");
+        printf("IQ Correction: %s\n", engine.iqCorrection ? "true" : "false");
+        if (engine.calibration) {
+            printf("Calibration Points: %u\n", calTable.numPoints);
+        }
+        if (updatePath) {
+            printf("Calibration Update: %s\n", updatePath);
+        }
+    }
+    printf("Sample Rate: %.0f Hz\n", context.sampleRate);
+    printf("FFT Size: %u\n", fftSize);
+    printf("Maximum Lag: %u samples\n", fftSize / 4);
+    printf("Integration Interval: %.1f ms\n", hopsPerInterval * (fftSize / 2) / context.sampleRate * 1000.0);
+    if (outputPath) {
+        printf("Output File: %s\n", outputPath);
+    }
+
+    if (duoCorrInit(&context.corr, fftSize, hopsPerInterval, resultCallback, &context)) {
+        printf("failed to initialize correlator\n");
+        if (replayFile) {
+            fclose(replayFile);
+        }
+        return EXIT_FAILURE;
+    }
+
+    if (outputPath) {
+        context.out = fopen(outputPath, "wb");
+        if (context.out == NULL) {
+            perror(outputPath);
+            duoCorrFree(&context.corr);
+            if (replayFile) {
+                fclose(replayFile);
+            }
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (replayFile) {
+        rcode = replay(&context, replayFile, &replayInfo);
+        fclose(replayFile);
+    }
+    else {
+        // The correlator works on interleaved floating point frames
+        engine.format = DUO_FORMAT_FLOAT32;
+        engine.userContext = &context;
+        engine.transferCallback = transferCallback;
+        engine.controlCallback = controlCallback;
+        engine.messageCallback = messageCallback;
+
+        // Configure warmup start time if needed
+        context.started = warmup == 0;
+        context.startTime = time(NULL) + warmup;
+
+        printf("PRESS q to QUIT\n");
+        rcode = duoEngineRun(&engine);
+        if (rcode == 0 && updatePath) {
+            rcode = updateCalibration(&context, &calTable, engine.tuneFreq, updatePath);
+        }
+    }
+
+    if (context.out) {
+        fclose(context.out);
+    }
+    duoCorrFree(&context.corr);
+    duoCalTableFree(&calTable);
+
+    return rcode == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,355 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CORR_H
+#define CORR_H
+
+/**
+* Streaming overlap-save FX cross-correlator for the two tuners.
+*
+* Samples are processed in hops of N/2 frames, where N is the FFT
+* size. For each hop, tuner B is transformed over the last N samples
+* and tuner A over the middle N/2 of those samples, zero-padded to N.
+* The product B * conj(A) is accumulated over the integration
+* interval. Because the zero-padded tuner A segments tile the stream
+* exactly, the inverse FFT of the accumulated spectrum is the exact
+* linear cross-correlation for lags in [-N/4, N/4] with no edge loss
+* between hops.
+*
+* The correlation is c[k] = sum(b[n] * conj(a[n - k])), so a positive
+* lag means tuner B is delayed relative to tuner A and the phase is
+* that of tuner B relative to tuner A.
+*
+* Memory use is fixed by the FFT size regardless of the integration
+* time or the length of the stream.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "DuoFFT.h"
+
+
+/**
+* Results for one integration interval
+*/
+struct DuoCorrResult {
+    // zero-based integration interval counter
+    uint32_t interval;
+    // number of hops accumulated in the interval
+    uint32_t numHops;
+    // lag of the correlation peak in samples, with sub-sample interpolation
+    float lag;
+    // phase of tuner B relative to tuner A at the peak in radians
+    float phase;
+    // peak magnitude normalized by the tuner powers, in [0, 1]
+    float coefficient;
+    // mean tuner powers over the interval
+    float powerA;
+    float powerB;
+    /**
+    * mean cross-power spectrum B * conj(A), fftSize bins in FFT order
+    * (DC first). Only valid until the next push.
+    */
+    const float* crossRe;
+    const float* crossIm;
+};
+
+
+/**
+* Record written to a DuoCorr output file for each interval.
+* Followed by fftSize complex bins of the mean cross-power spectrum
+* as interleaved 32-bit floats (re, im) in FFT order.
+* Fields are in the byte order of the writing machine.
+*/
+struct DuoCorrRecord {
+    // "DCOR"
+    int8_t magic[4];
+    uint32_t fftSize;
+    uint32_t interval;
+    uint32_t numHops;
+    float sampleRate;
+    float lag;
+    float phase;
+    float coefficient;
+    float powerA;
+    float powerB;
+};
+
+
+typedef void (*DuoCorrResultCallback)(const struct DuoCorrResult* result, void* userContext);
+
+
+struct DuoCorr {
+    struct DuoFFT fft;
+    unsigned int fftSize;
+    unsigned int hopSize;
+    unsigned int maxLag;
+    unsigned int hopsPerInterval;
+    DuoCorrResultCallback callback;
+    void* userContext;
+    // last fftSize samples of each tuner, newest hop in the second half
+    float* histARe;
+    float* histAIm;
+    float* histBRe;
+    float* histBIm;
+    // frames received in the current hop and total hops received
+    unsigned int fill;
+    unsigned int hopsReceived;
+    // FFT work buffers
+    float* workARe;
+    float* workAIm;
+    float* workBRe;
+    float* workBIm;
+    // interval accumulators
+    float* crossRe;
+    float* crossIm;
+    double powerA;
+    double powerB;
+    unsigned int numHops;
+    uint32_t interval;
+    // single allocation backing all of the arrays above
+    float* memory;
+};
+
+
+/**
+* Initialize a correlator
+*
+* @param corr pointer to struct to initialize
+* @param fftSize FFT size N, a power of two >= 8
+* @param hopsPerInterval number of N/2 frame hops in each integration
+*                        interval (e.g. integration time * rate / (N/2))
+* @param callback function called with the results of each interval
+* @param userContext pointer passed back to callback
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoCorrInit(
+        struct DuoCorr* corr, unsigned int fftSize, unsigned int hopsPerInterval,
+        DuoCorrResultCallback callback, void* userContext) {
+    memset(corr, 0, sizeof(struct DuoCorr));
+    if (fftSize < 8 || !duoFFTValidSize(fftSize) || hopsPerInterval == 0) {
+        return 1;
+    }
+    if (duoFFTInit(&corr->fft, fftSize)) {
+        return 1;
+    }
+    corr->memory = (float*)calloc((size_t)fftSize * 10, sizeof(float));
+    if (corr->memory == NULL) {
+        duoFFTFree(&corr->fft);
+        return 1;
+    }
+    corr->fftSize = fftSize;
+    corr->hopSize = fftSize / 2;
+    corr->maxLag = fftSize / 4;
+    corr->hopsPerInterval = hopsPerInterval;
+    corr->callback = callback;
+    corr->userContext = userContext;
+    corr->histARe = corr->memory;
+    corr->histAIm = corr->histARe + fftSize;
+    corr->histBRe = corr->histAIm + fftSize;
+    corr->histBIm = corr->histBRe + fftSize;
+    corr->workARe = corr->histBIm + fftSize;
+    corr->workAIm = corr->workARe + fftSize;
+    corr->workBRe = corr->workAIm + fftSize;
+    corr->workBIm = corr->workBRe + fftSize;
+    corr->crossRe = corr->workBIm + fftSize;
+    corr->crossIm = corr->crossRe + fftSize;
+    return 0;
+}
+
+
+/**
+* Release the memory allocated by duoCorrInit()
+*/
+static void duoCorrFree(struct DuoCorr* corr) {
+    duoFFTFree(&corr->fft);
+    free(corr->memory);
+    corr->memory = NULL;
+}
+
+
+/**
+* Finish an integration interval and report the results
+*/
+static void duoCorrFinishInterval(struct DuoCorr* corr) {
+    unsigned int size = corr->fftSize;
+    float* corrRe = corr->workARe;
+    float* corrIm = corr->workAIm;
+    struct DuoCorrResult result;
+
+    memcpy(corrRe, corr->crossRe, size * sizeof(float));
+    memcpy(corrIm, corr->crossIm, size * sizeof(float));
+    duoFFTInverse(&corr->fft, corrRe, corrIm);
+
+    // Search the valid lags, negative lags wrap to the end
+    int peakLag = 0;
+    float peakMag = -1.0f;
+    for (int lag = -(int)corr->maxLag; lag <= (int)corr->maxLag; lag++) {
+        unsigned int idx = (unsigned int)(lag + (int)size) % size;
+        float mag = corrRe[idx] * corrRe[idx] + corrIm[idx] * corrIm[idx];
+        if (mag > peakMag) {
+            peakMag = mag;
+            peakLag = lag;
+        }
+    }
+    unsigned int peakIdx = (unsigned int)(peakLag + (int)size) % size;
+    float lag = (float)peakLag;
+    if (peakLag > -(int)corr->maxLag && peakLag < (int)corr->maxLag) {
+        // Parabolic interpolation of the magnitude around the peak
+        unsigned int prev = (peakIdx + size - 1) % size;
+        unsigned int next = (peakIdx + 1) % size;
+        float m0 = sqrtf(corrRe[prev] * corrRe[prev] + corrIm[prev] * corrIm[prev]);
+        float m1 = sqrtf(peakMag);
+        float m2 = sqrtf(corrRe[next] * corrRe[next] + corrIm[next] * corrIm[next]);
+        float denom = m0 - 2.0f * m1 + m2;
+        if (denom < 0.0f) {
+            lag += 0.5f * (m0 - m2) / denom;
+        }
+    }
+
+    result.interval = corr->interval;
+    result.numHops = corr->numHops;
+    result.lag = lag;
+    result.phase = atan2f(corrIm[peakIdx], corrRe[peakIdx]);
+    // The inverse FFT is unnormalized, divide by N
+    double norm = sqrt(corr->powerA * corr->powerB);
+    result.coefficient = norm > 0.0 ? (float)(sqrt((double)peakMag) / size / norm) : 0.0f;
+    double count = (double)corr->numHops * corr->hopSize;
+    result.powerA = (float)(corr->powerA / count);
+    result.powerB = (float)(corr->powerB / count);
+
+    for (unsigned int idx = 0; idx < size; idx++) {
+        corr->crossRe[idx] /= corr->numHops;
+        corr->crossIm[idx] /= corr->numHops;
+    }
+    result.crossRe = corr->crossRe;
+    result.crossIm = corr->crossIm;
+
+    if (corr->callback) {
+        corr->callback(&result, corr->userContext);
+    }
+
+    memset(corr->crossRe, 0, size * sizeof(float));
+    memset(corr->crossIm, 0, size * sizeof(float));
+    corr->powerA = 0.0;
+    corr->powerB = 0.0;
+    corr->numHops = 0;
+    corr->interval++;
+}
+
+
+/**
+* Correlate one hop once the history holds fftSize frames
+*/
+static void duoCorrProcessHop(struct DuoCorr* corr) {
+    unsigned int size = corr->fftSize;
+    unsigned int quarter = size / 4;
+    unsigned int half = size / 2;
+    double powerA = 0.0;
+    double powerB = 0.0;
+
+    memcpy(corr->workBRe, corr->histBRe, size * sizeof(float));
+    memcpy(corr->workBIm, corr->histBIm, size * sizeof(float));
+    memset(corr->workARe, 0, size * sizeof(float));
+    memset(corr->workAIm, 0, size * sizeof(float));
+    memcpy(corr->workARe + quarter, corr->histARe + quarter, half * sizeof(float));
+    memcpy(corr->workAIm + quarter, corr->histAIm + quarter, half * sizeof(float));
+
+    for (unsigned int idx = quarter; idx < quarter + half; idx++) {
+        powerA += corr->histARe[idx] * corr->histARe[idx] + corr->histAIm[idx] * corr->histAIm[idx];
+        powerB += corr->histBRe[idx] * corr->histBRe[idx] + corr->histBIm[idx] * corr->histBIm[idx];
+    }
+
+    duoFFTForward(&corr->fft, corr->workARe, corr->workAIm);
+    duoFFTForward(&corr->fft, corr->workBRe, corr->workBIm);
+
+    const float* aRe = corr->workARe;
+    const float* aIm = corr->workAIm;
+    const float* bRe = corr->workBRe;
+    const float* bIm = corr->workBIm;
+    float* crossRe = corr->crossRe;
+    float* crossIm = corr->crossIm;
+    for (unsigned int idx = 0; idx < size; idx++) {
+        // B * conj(A)
+        crossRe[idx] += bRe[idx] * aRe[idx] + bIm[idx] * aIm[idx];
+        crossIm[idx] += bIm[idx] * aRe[idx] - bRe[idx] * aIm[idx];
+    }
+
+    corr->powerA += powerA;
+    corr->powerB += powerB;
+    corr->numHops++;
+    if (corr->numHops == corr->hopsPerInterval) {
+        duoCorrFinishInterval(corr);
+    }
+}
+
+
+/**
+* Push interleaved floating point frames (Ia, Qa, Ib, Qb) through the
+* correlator. Results are reported via the callback as each
+* integration interval completes.
+*
+* @param corr correlator from duoCorrInit()
+* @param frames pointer to frames
+* @param numFrames number of frames
+*/
+static void duoCorrPush(struct DuoCorr* corr, const float* frames, size_t numFrames) {
+    unsigned int half = corr->hopSize;
+    size_t frameIdx = 0;
+    while (frameIdx < numFrames) {
+        size_t count = half - corr->fill;
+        if (count > numFrames - frameIdx) {
+            count = numFrames - frameIdx;
+        }
+        unsigned int dst = half + corr->fill;
+        const float* in = frames + frameIdx * 4;
+        for (size_t idx = 0; idx < count; idx++) {
+            corr->histARe[dst + idx] = in[0];
+            corr->histAIm[dst + idx] = in[1];
+            corr->histBRe[dst + idx] = in[2];
+            corr->histBIm[dst + idx] = in[3];
+            in += 4;
+        }
+        corr->fill += (unsigned int)count;
+        frameIdx += count;
+
+        if (corr->fill == half) {
+            corr->fill = 0;
+            corr->hopsReceived++;
+            // The first hop only fills half of the history
+            if (corr->hopsReceived > 1) {
+                duoCorrProcessHop(corr);
+            }
+            memmove(corr->histARe, corr->histARe + half, half * sizeof(float));
+            memmove(corr->histAIm, corr->histAIm + half, half * sizeof(float));
+            memmove(corr->histBRe, corr->histBRe + half, half * sizeof(float));
+            memmove(corr->histBIm, corr->histBIm + half, half * sizeof(float));
+        }
+    }
+}
+
+
+#endif
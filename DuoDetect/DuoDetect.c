@@ -0,0 +1,436 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#include <winsock.h>
+#include <wsipv6ok.h>
+#include <conio.h>
+#include "windows_getopt.h"
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "posix_conio.h"
+
+#define INVALID_SOCKET (-1)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_AGC_BANDWIDTH (5)
+
+#include "DuoEngine.h"
+#include "DuoFFT.h"
+#include "DuoParse.h"
+#include "detect.h"
+
+
+static const char* USAGE = "\
+Usage: DuoDetect.exe [-h] [-a agchz] [-t agcdb] [-l lna] [-d decim]\n\
+                     [-n notch] [-N fftsize] [-A averages] [-T threshold]\n\
+                     [-S seconds] [-I] [-c count] [-u [ipaddr][:port]]\n\
+                     [-o path] [-k] [-x] freq\n\
+\n\
+Detects signals in both tuners with a per-bin CFAR threshold and\n\
+reports each new signal once, so only a few bytes are produced for\n\
+each signal instead of the full sample stream.\n\
+\n\
+Options:\n\
+  -h: print this help message\n\
+  -a 0|5|50|100: AGC loop bandwidth in Hz (default=5)\n\
+  -t [-72-0]: AGC set point in dBFS (default=-30)\n\
+  -l 0-9: LNA state where 0 provides the least RF gain reduction.\n\
+      Default value is 4 (20-37 dB reduction depending on frequency).\n\
+  -d 1|2|4|8|16|32: Decimation factor (default=1)\n\
+      For factors 4, 8, 16, and 32, the analog bandwidth will \n\
+      be reduced to 600, 300, 200, and 200 kHz respectively unless \n\
+      the -x option is also specified. In which case the analog \n\
+      bandwidth remains 1.536 MHz.\n\
+  -n mwfm|dab: Enable MW/FM or DAB notch filter\n\
+      Both filters can be enabled by providing the -n option twice\n\
+      (once for each filter). By default, both filters are disabled.\n\
+  -N fftsize: FFT size, a power of two >= 16 (default=1024)\n\
+  -A averages: FFT frames averaged for each decision (default=8)\n\
+  -T threshold: Detection threshold in dB above the noise floor of\n\
+      each bin (default=10)\n\
+  -S seconds: Averaging time of the noise floor of each bin\n\
+      (default=1). Nothing is reported during the first period while\n\
+      the floor is established.\n\
+  -I: Remove the DC offset and I/Q gain and phase imbalance of each\n\
+      tuner with slowly adapting estimators (default=off)\n\
+  -c count: Exit after the specified number of detections\n\
+      (default=0, run until q is pressed)\n\
+  -u [ipaddr][:port]: Send each detection as a UDP packet to the\n\
+      specified IPv4 address (default=127.0.0.1) and port\n\
+      (default=1234). Use \":port\" to change only the port.\n\
+  -o path: Append each detection as a line of CSV text to the\n\
+      specified file\n\
+  -k: Use USB bulk transfer mode instead of isochronous\n\
+  -x: Use the maximum 8 MHz master sample rate.\n\
+      This will deliver 12 bit ADC resolution, but with slightly \n\
+      better anti-aliaising performance at the widest bandwidth.\n\
+      This mode is only available at 1.536 MHz analog bandwidth.\n\
+      The default mode is to use a 6 MHz master sample clock.\n\
+      That mode delivers 14 bit ADC resolution, but with slightly\n\
+      inferior anti-aliaising performance at the widest bandwidth.\n\
+      The default mode is also compatible with analog bandwidths of\n\
+      1.536 MHz, 600 kHz, 300 kHz, and 200 kHz. 6 MHz operation\n\
+      should result in a slightly lower CPU load.\n\
+\n\
+Arguments:\n\
+  freq: Tuner RF frequency in Hz is mandatory.\n\
+      Can be specified with k, K, m, M, g, or G suffix to indicate\n\
+      the value is in kHz, MHz, or GHz respectively (e.g. 1.42G)\n\
+\n";
+
+
+struct Context {
+    struct DuoDetectRecord record;
+    double centerFreq;
+    // number of detections to report, zero to run until stopped
+    unsigned int maxDetections;
+    FILE* out;
+    bool udp;
+#if defined(_WIN32) || (_WIN64)
+    SOCKET sock;
+#else
+    int sock;
+#endif
+    struct sockaddr_in dest;
+    bool done;
+};
+
+
+static void detectionCallback(const struct DuoEngineDetection* detection, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    struct DuoDetectRecord* record = &context->record;
+    struct timespec now;
+    if (context->done) {
+        return;
+    }
+    timespec_get(&now, TIME_UTC);
+    record->sampleNumber = detection->sampleNumber;
+    record->unixTime = now.tv_sec + now.tv_nsec * 1e-9;
+    record->freq = context->centerFreq + detection->freq;
+    record->bin = detection->bin;
+    record->power = detection->power;
+    record->snrA = detection->snrA;
+    record->snrB = detection->snrB;
+    record->phase = detection->phase;
+
+    printf("sequence=%u time=%.3f s freq=%.0f Hz power=%.1f dBFS snrA=%.1f dB snrB=%.1f dB phase=%.1f deg\n",
+           record->sequence, detection->time, record->freq, record->power,
+           record->snrA, record->snrB, record->phase);
+
+    if (context->out) {
+        if (fprintf(context->out, "%.6f,%u,%llu,%.1f,%u,%.2f,%.2f,%.2f,%.2f\n",
+                    record->unixTime, record->sequence,
+                    (unsigned long long)record->sampleNumber, record->freq, record->bin,
+                    record->power, record->snrA, record->snrB, record->phase) < 0 ||
+            fflush(context->out) != 0) {
+            printf("failed to write detection %u\n", record->sequence);
+            context->done = true;
+        }
+    }
+    if (context->udp) {
+        int rcode = sendto(
+            context->sock, (const char*)record, (int)sizeof(*record), 0,
+            (struct sockaddr*)&context->dest, sizeof(context->dest));
+#if defined(_WIN32) || defined(_WIN64)
+        if (rcode == SOCKET_ERROR) {
+            printf("sendto failed with error=%d\n", WSAGetLastError());
+        }
+#else
+        if (rcode == -1) {
+            perror("sendto failed");
+        }
+#endif
+    }
+
+    record->sequence++;
+    if (context->maxDetections && record->sequence >= context->maxDetections) {
+        context->done = true;
+    }
+}
+
+
+static int controlCallback(struct DuoEngineControl* control, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    if (_kbhit()) {
+        char ctrl = _getch();
+        if (ctrl == 'q') {
+            context->done = true;
+            return 1;
+        }
+    }
+    if (context->done) {
+        return 1;
+    }
+    return 0;
+}
+
+
+static void messageCallback(const char* msg, void* userContext) {
+    printf("%s\n", msg);
+}
+
+
+static void usage(void) {
+    printf(USAGE);
+}
+
+
+int main(int argc, char** argv) {
+    char opt = 0;
+    unsigned int port = 1234;
+    char defaultAddr[] = "127.0.0.1";
+    char* ipStr = defaultAddr;
+    unsigned long ipAddr = inet_addr(defaultAddr);
+    char* outputPath = NULL;
+    int rcode = 0;
+
+    struct DuoEngine engine;
+    duoEngineInit(&engine);
+    engine.detectSize = 1024;
+
+    struct Context context;
+    memset(&context, 0, sizeof(context));
+    context.sock = INVALID_SOCKET;
+
+    while ((opt = getopt(argc, argv, "ha:t:l:d:n:N:A:T:S:Ic:u:o:kx")) != -1) {
+        switch (opt) {
+        case 'a':
+            if (parseAgcBandwidth(optarg, &engine.agcBandwidth)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            if (parseAgcSetPoint(optarg, &engine.agcSetPoint)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'l':
+            if (parseLnaState(optarg, &engine.lnaState)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'd':
+            if (parseDecimFactor(optarg, &engine.decimFactor)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            if (parseNotchFilter(optarg, &engine.notchMwfm, &engine.notchDab)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            if (parseUintArg(optarg, &engine.detectSize, 10) || engine.detectSize < 16 ||
+                !duoFFTValidSize(engine.detectSize)) {
+                printf("invalid FFT size, must be a power of two >= 16\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'A':
+            if (parseUintArg(optarg, &engine.detectAverages, 10) || engine.detectAverages == 0) {
+                printf("invalid number of averages, must be a positive int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            if (parseFloatArg(optarg, &engine.detectThreshold) || engine.detectThreshold <= 0.0f) {
+                printf("invalid threshold, must be a positive number of dB\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S':
+            if (parseFloatArg(optarg, &engine.detectTimeConstant) || engine.detectTimeConstant <= 0.0f) {
+                printf("invalid averaging time, must be a positive number of seconds\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'I':
+            engine.iqCorrection = true;
+            break;
+        case 'c':
+            if (parseUintArg(optarg, &context.maxDetections, 10)) {
+                printf("invalid detection count, must be an unsigned int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'u':
+            if (parseAddrPort(optarg, &ipStr, &ipAddr, &port)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            context.udp = true;
+            break;
+        case 'o':
+            outputPath = optarg;
+            break;
+        case 'k':
+            engine.usbBulkMode = true;
+            break;
+        case 'x':
+            engine.maxSampleRate = true;
+            break;
+        case 'h':
+            usage();
+            return EXIT_SUCCESS;
+        default:
+            printf("unrecognized option\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Handle remaining positional arguments
+    if (optind == (argc - 1)) {
+        if (parseFrequency(argv[optind], &engine.tuneFreq)) {
+            printf("invalid frequency argument\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        printf("invalid number of arguments\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    double sampleRate = duoEngineSampleRate(&engine);
+    context.centerFreq = engine.tuneFreq;
+
+    printf("RF Tune Frequency: %f Hz\n", engine.tuneFreq);
+    printf("AGC Loop Bandwidth: %u Hz\n", engine.agcBandwidth);
+    if (engine.agcBandwidth > 0) {
+        printf("AGC Set Point: %d dBFS\n", engine.agcSetPoint);
+    }
+    printf("LNA State: %u\n", engine.lnaState);
+    printf("Decimation Factor: %u\n", engine.decimFactor);
+    printf("IQ Correction: %s\n", engine.iqCorrection ? "true" : "false");
+    printf("USB Bulk Mode: %s\n", engine.usbBulkMode ? "true" : "false");
+    printf("Max Fs Mode: %s\n", engine.maxSampleRate ? "true" : "false");
+    printf("Sample Rate: %.0f Hz\n", sampleRate);
+    printf("FFT Size: %u\n", engine.detectSize);
+    printf("Resolution Bandwidth: %.1f Hz\n", sampleRate / engine.detectSize);
+    printf("Averages: %u\n", engine.detectAverages);
+    printf("Decision Interval: %.1f ms\n",
+           (double)engine.detectSize * engine.detectAverages / sampleRate * 1000.0);
+    printf("Threshold: %.1f dB\n", engine.detectThreshold);
+    printf("Noise Floor Averaging: %.1f seconds\n", engine.detectTimeConstant);
+    if (context.udp) {
+        printf("Destination IP Address: %s\n", ipStr);
+        printf("Destination UDP Port: %u\n", port);
+    }
+    if (outputPath) {
+        printf("Output File: %s\n", outputPath);
+    }
+
+    struct DuoDetectRecord* record = &context.record;
+    record->magic[0] = 'D';
+    record->magic[1] = 'D';
+    record->magic[2] = 'E';
+    record->magic[3] = 'T';
+    record->fftSize = engine.detectSize;
+
+    if (outputPath) {
+        context.out = fopen(outputPath, "a");
+        if (context.out == NULL) {
+            perror(outputPath);
+            rcode = 1;
+        }
+        else if (ftell(context.out) == 0) {
+            fprintf(context.out, "unix_time,sequence,sample,freq_hz,bin,power_dbfs,snr_a_db,snr_b_db,phase_deg\n");
+        }
+    }
+
+    if (rcode == 0 && context.udp) {
+#if defined(_WIN32) || (_WIN64)
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 0), &wsaData) != 0) {
+            printf("WSAStartup() failed");
+            rcode = 1;
+        }
+#endif
+        if (rcode == 0 && (context.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
+#if defined(_WIN32) || (_WIN64)
+            printf("socket creation failed error=%u", WSAGetLastError());
+#else
+            perror("socket creation failed:");
+#endif
+            rcode = 1;
+        }
+        memset(&context.dest, 0, sizeof(context.dest));
+        context.dest.sin_family = AF_INET;
+        context.dest.sin_addr.s_addr = ipAddr;
+        context.dest.sin_port = htons((unsigned short)port);
+    }
+
+    if (rcode == 0) {
+        // Only detections are delivered, the samples never leave DuoEngine
+        engine.userContext = &context;
+        engine.transferCallback = NULL;
+        engine.detectionCallback = detectionCallback;
+        engine.controlCallback = controlCallback;
+        engine.messageCallback = messageCallback;
+
+        printf("PRESS q to QUIT\n");
+        rcode = duoEngineRun(&engine);
+    }
+
+    if (context.sock != INVALID_SOCKET) {
+#if defined(_WIN32) || defined(_WIN64)
+        closesocket(context.sock);
+#else
+        close(context.sock);
+#endif
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    if (context.udp) {
+        WSACleanup();
+    }
+#endif
+    if (context.out) {
+        fclose(context.out);
+    }
+
+    return rcode == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,61 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DETECT_H
+#define DETECT_H
+
+/**
+* Detection record sent and logged by DuoDetect.
+* One record is produced for each new signal found by the DuoEngine
+* detector (see DuoDetect.h), so the rate is far below the sample rate.
+* All values are in the byte order of the sending machine, as with
+* DuoUDP samples.
+*/
+
+#include <stdint.h>
+
+
+struct DuoDetectRecord {
+    // "DDET"
+    int8_t magic[4];
+    // record counter, incremented by one for each record
+    uint32_t sequence;
+    // delivered frame number of the first sample of the detecting average
+    uint64_t sampleNumber;
+    // UTC time the record was produced in seconds since the Unix epoch
+    double unixTime;
+    // RF frequency of the detected bin in Hz
+    double freq;
+    // FFT bin in centered order and FFT size
+    uint32_t bin;
+    uint32_t fftSize;
+    // average power of the two tuners in dBFS
+    float power;
+    // signal to noise floor ratio of each tuner in dB
+    float snrA;
+    float snrB;
+    // phase of tuner B relative to tuner A in degrees
+    float phase;
+};
+
+
+#endif
@@ -0,0 +1,360 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/**
+* Emulated sdrplay_api for building and testing the tools without an
+* RSPduo. Both tuners deliver the same tone with a fixed phase offset
+* plus a little noise, in callbacks of SAMPLES_PER_CALLBACK samples.
+*/
+
+#include <string.h>
+#include <math.h>
+
+#include "DuoThread.h"
+#include "sdrplay_api.h"
+#include "DuoEmulate.h"
+
+
+#define SAMPLES_PER_CALLBACK (1008)
+#define SAMPLE_RATE (2e6)
+#define TONE_AMPLITUDE (2000.0)
+#define TONE_STEP (0.05)
+#define TONE_OFFSET_B (0.7)
+#define NOISE_AMPLITUDE (100)
+#define MAX_LAG_MS (1000.0)
+
+
+struct Emulator {
+    DuoMutex lock;
+    DuoCond cond;
+    bool initialized;
+
+    sdrplay_api_DevParamsT devParams;
+    sdrplay_api_RxChannelParamsT chanA;
+    sdrplay_api_RxChannelParamsT chanB;
+    sdrplay_api_DeviceParamsT params;
+
+    sdrplay_api_CallbackFnsT callbacks;
+    void* cbContext;
+    DuoThread thread;
+    bool streaming;
+    bool stopRequested;
+    unsigned int sessions;
+
+    // Faults from duoEmulateRemove() and duoEmulateStall()
+    bool removeRequested;
+    bool removed;
+    bool stalled;
+    unsigned long long hiddenUntilMs;
+};
+
+static struct Emulator emulator;
+
+
+static void initEmulator(void) {
+    if (!emulator.initialized) {
+        duoMutexInit(&emulator.lock);
+        duoCondInit(&emulator.cond);
+        emulator.params.devParams = &emulator.devParams;
+        emulator.params.rxChannelA = &emulator.chanA;
+        emulator.params.rxChannelB = &emulator.chanB;
+        emulator.initialized = true;
+    }
+}
+
+
+/**
+* The lock must be held
+*/
+static bool deviceHidden(void) {
+    return duoClockMs() < emulator.hiddenUntilMs;
+}
+
+
+static short noise(unsigned int* seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return (short)((int)((*seed >> 16) % (2 * NOISE_AMPLITUDE + 1)) - NOISE_AMPLITUDE);
+}
+
+
+static void streamThread(void* arg) {
+    short xiA[SAMPLES_PER_CALLBACK];
+    short xqA[SAMPLES_PER_CALLBACK];
+    short xiB[SAMPLES_PER_CALLBACK];
+    short xqB[SAMPLES_PER_CALLBACK];
+    sdrplay_api_StreamCbParamsT cbParams;
+    sdrplay_api_EventParamsT eventParams;
+    unsigned int reset = 1;
+    unsigned int seed = 1;
+    double phase = 0.0;
+    double dueMs = (double)duoClockMs();
+    (void)arg;
+
+    memset(&cbParams, 0, sizeof(cbParams));
+    memset(&eventParams, 0, sizeof(eventParams));
+
+    duoMutexLock(&emulator.lock);
+    while (!emulator.stopRequested) {
+        if (emulator.removeRequested) {
+            emulator.removeRequested = false;
+            emulator.removed = true;
+            duoMutexUnlock(&emulator.lock);
+            emulator.callbacks.EventCbFn(
+                sdrplay_api_DeviceRemoved, sdrplay_api_Tuner_Both, &eventParams, emulator.cbContext);
+            duoMutexLock(&emulator.lock);
+            continue;
+        }
+        if (emulator.removed || emulator.stalled) {
+            duoCondWait(&emulator.cond, &emulator.lock);
+            continue;
+        }
+        // Like the driver, settings are read as the caller left them before sdrplay_api_Update
+        unsigned int decimation = emulator.chanA.ctrlParams.decimation.enable ?
+            emulator.chanA.ctrlParams.decimation.decimationFactor : 1;
+        duoMutexUnlock(&emulator.lock);
+
+        for (unsigned int idx = 0; idx < SAMPLES_PER_CALLBACK; idx++) {
+            phase += TONE_STEP;
+            xiA[idx] = (short)(TONE_AMPLITUDE * cos(phase)) + noise(&seed);
+            xqA[idx] = (short)(TONE_AMPLITUDE * sin(phase)) + noise(&seed);
+            xiB[idx] = (short)(TONE_AMPLITUDE * cos(phase + TONE_OFFSET_B)) + noise(&seed);
+            xqB[idx] = (short)(TONE_AMPLITUDE * sin(phase + TONE_OFFSET_B)) + noise(&seed);
+        }
+        cbParams.numSamples = SAMPLES_PER_CALLBACK;
+        emulator.callbacks.StreamACbFn(xiA, xqA, &cbParams, SAMPLES_PER_CALLBACK, reset, emulator.cbContext);
+        emulator.callbacks.StreamBCbFn(xiB, xqB, &cbParams, SAMPLES_PER_CALLBACK, reset, emulator.cbContext);
+        cbParams.firstSampleNum += SAMPLES_PER_CALLBACK;
+        reset = 0;
+
+        dueMs += SAMPLES_PER_CALLBACK * decimation * 1000.0 / SAMPLE_RATE;
+        duoMutexLock(&emulator.lock);
+        double nowMs = (double)duoClockMs();
+        if (dueMs < nowMs - MAX_LAG_MS) {
+            // Do not burst to catch up after the process was suspended
+            dueMs = nowMs;
+        }
+        else if (dueMs >= nowMs + 1.0) {
+            duoCondTimedWait(&emulator.cond, &emulator.lock, (unsigned int)(dueMs - nowMs));
+        }
+    }
+    duoMutexUnlock(&emulator.lock);
+}
+
+
+sdrplay_api_ErrT sdrplay_api_Open(void) {
+    initEmulator();
+    return sdrplay_api_Success;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_Close(void) {
+    return sdrplay_api_Success;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_ApiVersion(float *apiVer) {
+    *apiVer = SDRPLAY_API_VERSION;
+    return sdrplay_api_Success;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_LockDeviceApi(void) {
+    return sdrplay_api_Success;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_UnlockDeviceApi(void) {
+    return sdrplay_api_Success;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_GetDevices(
+        sdrplay_api_DeviceT *devices, unsigned int *numDevs, unsigned int maxDevs) {
+    duoMutexLock(&emulator.lock);
+    *numDevs = 0;
+    if (maxDevs > 0 && !deviceHidden()) {
+        memset(&devices[0], 0, sizeof(devices[0]));
+        strcpy(devices[0].SerNo, "DuoEmulate");
+        devices[0].hwVer = SDRPLAY_RSPduo_ID;
+        devices[0].tuner = sdrplay_api_Tuner_Both;
+        devices[0].rspDuoMode = (sdrplay_api_RspDuoModeT)(
+            sdrplay_api_RspDuoMode_Single_Tuner | sdrplay_api_RspDuoMode_Dual_Tuner |
+            sdrplay_api_RspDuoMode_Master);
+        devices[0].dev = &emulator;
+        *numDevs = 1;
+    }
+    duoMutexUnlock(&emulator.lock);
+    return sdrplay_api_Success;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_SelectDevice(sdrplay_api_DeviceT *device) {
+    sdrplay_api_ErrT err = sdrplay_api_Success;
+    (void)device;
+    duoMutexLock(&emulator.lock);
+    if (deviceHidden()) {
+        err = sdrplay_api_HwError;
+    }
+    else {
+        memset(&emulator.devParams, 0, sizeof(emulator.devParams));
+        memset(&emulator.chanA, 0, sizeof(emulator.chanA));
+        memset(&emulator.chanB, 0, sizeof(emulator.chanB));
+    }
+    duoMutexUnlock(&emulator.lock);
+    return err;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_ReleaseDevice(sdrplay_api_DeviceT *device) {
+    (void)device;
+    return sdrplay_api_Success;
+}
+
+
+const char* sdrplay_api_GetErrorString(sdrplay_api_ErrT err) {
+    switch (err) {
+        case sdrplay_api_Success:
+            return "sdrplay_api_Success";
+        case sdrplay_api_Fail:
+            return "sdrplay_api_Fail";
+        case sdrplay_api_InvalidParam:
+            return "sdrplay_api_InvalidParam";
+        case sdrplay_api_NotInitialised:
+            return "sdrplay_api_NotInitialised";
+        case sdrplay_api_HwError:
+            return "sdrplay_api_HwError";
+    }
+    return "unknown error";
+}
+
+
+sdrplay_api_ErrT sdrplay_api_DebugEnable(HANDLE dev, sdrplay_api_DbgLvl_t dbgLvl) {
+    (void)dev;
+    (void)dbgLvl;
+    return sdrplay_api_Success;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_GetDeviceParams(HANDLE dev, sdrplay_api_DeviceParamsT **deviceParams) {
+    (void)dev;
+    *deviceParams = &emulator.params;
+    return sdrplay_api_Success;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_Init(HANDLE dev, sdrplay_api_CallbackFnsT *callbackFns, void *cbContext) {
+    sdrplay_api_ErrT err = sdrplay_api_Success;
+    (void)dev;
+    duoMutexLock(&emulator.lock);
+    if (emulator.streaming) {
+        err = sdrplay_api_Fail;
+    }
+    else if (deviceHidden()) {
+        err = sdrplay_api_HwError;
+    }
+    else {
+        emulator.callbacks = *callbackFns;
+        emulator.cbContext = cbContext;
+        emulator.stopRequested = false;
+        emulator.removeRequested = false;
+        emulator.removed = false;
+        emulator.stalled = false;
+        if (duoThreadCreate(&emulator.thread, streamThread, NULL) != 0) {
+            err = sdrplay_api_Fail;
+        }
+        else {
+            emulator.streaming = true;
+            emulator.sessions++;
+        }
+    }
+    duoMutexUnlock(&emulator.lock);
+    return err;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_Uninit(HANDLE dev) {
+    sdrplay_api_ErrT err = sdrplay_api_Success;
+    (void)dev;
+    duoMutexLock(&emulator.lock);
+    if (!emulator.streaming) {
+        duoMutexUnlock(&emulator.lock);
+        return sdrplay_api_NotInitialised;
+    }
+    emulator.stopRequested = true;
+    duoCondBroadcast(&emulator.cond);
+    duoMutexUnlock(&emulator.lock);
+
+    duoThreadJoin(emulator.thread);
+
+    duoMutexLock(&emulator.lock);
+    emulator.streaming = false;
+    if (emulator.removed) {
+        err = sdrplay_api_Fail;
+    }
+    duoMutexUnlock(&emulator.lock);
+    return err;
+}
+
+
+sdrplay_api_ErrT sdrplay_api_Update(
+        HANDLE dev, sdrplay_api_TunerSelectT tuner,
+        sdrplay_api_ReasonForUpdateT reasonForUpdate,
+        sdrplay_api_ReasonForUpdateExtension1T reasonForUpdateExt1) {
+    sdrplay_api_ErrT err = sdrplay_api_Success;
+    (void)dev;
+    (void)tuner;
+    (void)reasonForUpdate;
+    (void)reasonForUpdateExt1;
+    duoMutexLock(&emulator.lock);
+    if (emulator.removed) {
+        err = sdrplay_api_HwError;
+    }
+    duoMutexUnlock(&emulator.lock);
+    return err;
+}
+
+
+void duoEmulateRemove(unsigned int absentMs) {
+    duoMutexLock(&emulator.lock);
+    emulator.hiddenUntilMs = duoClockMs() + absentMs;
+    if (emulator.streaming) {
+        emulator.removeRequested = true;
+        duoCondBroadcast(&emulator.cond);
+    }
+    duoMutexUnlock(&emulator.lock);
+}
+
+
+void duoEmulateStall(void) {
+    duoMutexLock(&emulator.lock);
+    emulator.stalled = true;
+    duoMutexUnlock(&emulator.lock);
+}
+
+
+unsigned int duoEmulateSessions(void) {
+    unsigned int sessions;
+    duoMutexLock(&emulator.lock);
+    sessions = emulator.sessions;
+    duoMutexUnlock(&emulator.lock);
+    return sessions;
+}
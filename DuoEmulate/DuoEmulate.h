@@ -0,0 +1,62 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOEMULATE_H
+#define DUOEMULATE_H
+
+/**
+* Fault injection for the emulated RSPduo of DUO_EMULATE builds. The
+* emulator streams a tone plus noise on both tuners at 2 MHz divided by
+* the decimation of tuner A, paced to real time. These are only valid
+* once the engine has opened the API.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+* Unplug the emulated device. The stream thread fires
+* sdrplay_api_DeviceRemoved and stops calling back, sdrplay_api_Uninit
+* fails, and the device is missing from sdrplay_api_GetDevices for the
+* specified time.
+*
+* @param absentMs milliseconds before the device can be opened again
+*/
+void duoEmulateRemove(unsigned int absentMs);
+
+/**
+* Stop stream callbacks without any event, as a wedged USB transfer
+* would. Cleared by the next sdrplay_api_Init.
+*/
+void duoEmulateStall(void);
+
+/**
+* @return number of successful sdrplay_api_Init calls so far
+*/
+unsigned int duoEmulateSessions(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,301 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef SDRPLAY_API_H
+#define SDRPLAY_API_H
+
+/**
+* The subset of sdrplay_api 3.x used by DuoEngine, with the same names
+* and values, for builds with DUO_EMULATE. Only DuoEmulate.c implements
+* these; do not mix it with the real sdrplay_api headers or library.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SDRPLAY_API_VERSION ((float)(3.07))
+#define SDRPLAY_MAX_DEVICES (16)
+#define SDRPLAY_RSPduo_ID (3)
+
+typedef void* HANDLE;
+
+
+typedef enum {
+    sdrplay_api_Success = 0,
+    sdrplay_api_Fail = 1,
+    sdrplay_api_InvalidParam = 2,
+    sdrplay_api_NotInitialised = 4,
+    sdrplay_api_HwError = 6,
+} sdrplay_api_ErrT;
+
+
+typedef enum {
+    sdrplay_api_DbgLvl_Disable = 0,
+    sdrplay_api_DbgLvl_Verbose = 1,
+} sdrplay_api_DbgLvl_t;
+
+
+typedef enum {
+    sdrplay_api_Tuner_Neither = 0,
+    sdrplay_api_Tuner_A = 1,
+    sdrplay_api_Tuner_B = 2,
+    sdrplay_api_Tuner_Both = 3,
+} sdrplay_api_TunerSelectT;
+
+
+typedef enum {
+    sdrplay_api_RspDuoMode_Unknown = 0,
+    sdrplay_api_RspDuoMode_Single_Tuner = 1,
+    sdrplay_api_RspDuoMode_Dual_Tuner = 2,
+    sdrplay_api_RspDuoMode_Master = 4,
+    sdrplay_api_RspDuoMode_Slave = 8,
+} sdrplay_api_RspDuoModeT;
+
+
+typedef struct {
+    char SerNo[64];
+    unsigned char hwVer;
+    sdrplay_api_TunerSelectT tuner;
+    sdrplay_api_RspDuoModeT rspDuoMode;
+    double rspDuoSampleFreq;
+    HANDLE dev;
+} sdrplay_api_DeviceT;
+
+
+typedef enum {
+    sdrplay_api_ISOCH = 0,
+    sdrplay_api_BULK = 1,
+} sdrplay_api_TransferModeT;
+
+
+typedef struct {
+    double fsHz;
+    unsigned char syncUpdate;
+    unsigned char reCal;
+} sdrplay_api_FsFreqT;
+
+
+typedef struct {
+    double ppm;
+    sdrplay_api_FsFreqT fsFreq;
+    sdrplay_api_TransferModeT mode;
+} sdrplay_api_DevParamsT;
+
+
+typedef enum {
+    sdrplay_api_BW_Undefined = 0,
+    sdrplay_api_BW_0_200 = 200,
+    sdrplay_api_BW_0_300 = 300,
+    sdrplay_api_BW_0_600 = 600,
+    sdrplay_api_BW_1_536 = 1536,
+    sdrplay_api_BW_5_000 = 5000,
+    sdrplay_api_BW_6_000 = 6000,
+    sdrplay_api_BW_7_000 = 7000,
+    sdrplay_api_BW_8_000 = 8000,
+} sdrplay_api_Bw_MHzT;
+
+
+typedef enum {
+    sdrplay_api_IF_Undefined = -1,
+    sdrplay_api_IF_Zero = 0,
+    sdrplay_api_IF_0_450 = 450,
+    sdrplay_api_IF_1_620 = 1620,
+    sdrplay_api_IF_2_048 = 2048,
+} sdrplay_api_If_kHzT;
+
+
+typedef struct {
+    double rfHz;
+    unsigned char syncUpdate;
+} sdrplay_api_RfFreqT;
+
+
+typedef struct {
+    int gRdB;
+    unsigned char LNAstate;
+} sdrplay_api_GainT;
+
+
+typedef struct {
+    sdrplay_api_Bw_MHzT bwType;
+    sdrplay_api_If_kHzT ifType;
+    sdrplay_api_GainT gain;
+    sdrplay_api_RfFreqT rfFreq;
+} sdrplay_api_TunerParamsT;
+
+
+typedef enum {
+    sdrplay_api_AGC_DISABLE = 0,
+    sdrplay_api_AGC_100HZ = 1,
+    sdrplay_api_AGC_50HZ = 2,
+    sdrplay_api_AGC_5HZ = 3,
+    sdrplay_api_AGC_CTRL_EN = 4,
+} sdrplay_api_AgcControlT;
+
+
+typedef struct {
+    sdrplay_api_AgcControlT enable;
+    int setPoint_dBfs;
+} sdrplay_api_AgcT;
+
+
+typedef struct {
+    unsigned char enable;
+    unsigned char decimationFactor;
+    unsigned char wideBandSignal;
+} sdrplay_api_DecimationT;
+
+
+typedef struct {
+    sdrplay_api_AgcT agc;
+    sdrplay_api_DecimationT decimation;
+} sdrplay_api_ControlParamsT;
+
+
+typedef struct {
+    int biasTEnable;
+    int tuner1AmPortSel;
+    int tuner1AmNotchEnable;
+    int rfNotchEnable;
+    int rfDabNotchEnable;
+} sdrplay_api_RspDuoTunerParamsT;
+
+
+typedef struct {
+    sdrplay_api_TunerParamsT tunerParams;
+    sdrplay_api_ControlParamsT ctrlParams;
+    sdrplay_api_RspDuoTunerParamsT rspDuoTunerParams;
+} sdrplay_api_RxChannelParamsT;
+
+
+typedef struct {
+    sdrplay_api_DevParamsT* devParams;
+    sdrplay_api_RxChannelParamsT* rxChannelA;
+    sdrplay_api_RxChannelParamsT* rxChannelB;
+} sdrplay_api_DeviceParamsT;
+
+
+typedef struct {
+    unsigned int firstSampleNum;
+    int grChanged;
+    int rfChanged;
+    int fsChanged;
+    unsigned int numSamples;
+} sdrplay_api_StreamCbParamsT;
+
+
+typedef enum {
+    sdrplay_api_GainChange = 0,
+    sdrplay_api_PowerOverloadChange = 1,
+    sdrplay_api_DeviceRemoved = 2,
+    sdrplay_api_RspDuoModeChange = 3,
+    sdrplay_api_DeviceFailure = 4,
+} sdrplay_api_EventT;
+
+
+typedef enum {
+    sdrplay_api_Overload_Detected = 0,
+    sdrplay_api_Overload_Corrected = 1,
+} sdrplay_api_PowerOverloadCbEventIdT;
+
+
+typedef struct {
+    unsigned int gRdB;
+    unsigned int lnaGRdB;
+    double currGain;
+} sdrplay_api_GainCbParamT;
+
+
+typedef struct {
+    sdrplay_api_PowerOverloadCbEventIdT powerOverloadChangeType;
+} sdrplay_api_PowerOverloadCbParamT;
+
+
+typedef union {
+    sdrplay_api_GainCbParamT gainParams;
+    sdrplay_api_PowerOverloadCbParamT powerOverloadParams;
+} sdrplay_api_EventParamsT;
+
+
+typedef void (*sdrplay_api_StreamCallback_t)(
+        short *xi, short *xq, sdrplay_api_StreamCbParamsT *params,
+        unsigned int numSamples, unsigned int reset, void *cbContext);
+
+typedef void (*sdrplay_api_EventCallback_t)(
+        sdrplay_api_EventT eventId, sdrplay_api_TunerSelectT tuner,
+        sdrplay_api_EventParamsT *params, void *cbContext);
+
+
+typedef struct {
+    sdrplay_api_StreamCallback_t StreamACbFn;
+    sdrplay_api_StreamCallback_t StreamBCbFn;
+    sdrplay_api_EventCallback_t EventCbFn;
+} sdrplay_api_CallbackFnsT;
+
+
+typedef enum {
+    sdrplay_api_Update_None = 0x00000000,
+    sdrplay_api_Update_Dev_Fs = 0x00000001,
+    sdrplay_api_Update_Dev_Ppm = 0x00000002,
+    sdrplay_api_Update_Tuner_Gr = 0x00008000,
+    sdrplay_api_Update_Tuner_GrLimits = 0x00010000,
+    sdrplay_api_Update_Tuner_Frf = 0x00020000,
+    sdrplay_api_Update_Tuner_BwType = 0x00040000,
+    sdrplay_api_Update_Tuner_IfType = 0x00080000,
+    sdrplay_api_Update_Ctrl_Decimation = 0x00800000,
+    sdrplay_api_Update_Ctrl_Agc = 0x01000000,
+    sdrplay_api_Update_Ctrl_OverloadMsgAck = 0x04000000,
+    sdrplay_api_Update_RspDuo_RfNotchControl = 0x40000000,
+    sdrplay_api_Update_RspDuo_RfDabNotchControl = (int)0x80000000,
+} sdrplay_api_ReasonForUpdateT;
+
+
+typedef enum {
+    sdrplay_api_Update_Ext1_None = 0x00000000,
+} sdrplay_api_ReasonForUpdateExtension1T;
+
+
+sdrplay_api_ErrT sdrplay_api_Open(void);
+sdrplay_api_ErrT sdrplay_api_Close(void);
+sdrplay_api_ErrT sdrplay_api_ApiVersion(float *apiVer);
+sdrplay_api_ErrT sdrplay_api_LockDeviceApi(void);
+sdrplay_api_ErrT sdrplay_api_UnlockDeviceApi(void);
+sdrplay_api_ErrT sdrplay_api_GetDevices(
+        sdrplay_api_DeviceT *devices, unsigned int *numDevs, unsigned int maxDevs);
+sdrplay_api_ErrT sdrplay_api_SelectDevice(sdrplay_api_DeviceT *device);
+sdrplay_api_ErrT sdrplay_api_ReleaseDevice(sdrplay_api_DeviceT *device);
+const char* sdrplay_api_GetErrorString(sdrplay_api_ErrT err);
+sdrplay_api_ErrT sdrplay_api_DebugEnable(HANDLE dev, sdrplay_api_DbgLvl_t dbgLvl);
+sdrplay_api_ErrT sdrplay_api_GetDeviceParams(HANDLE dev, sdrplay_api_DeviceParamsT **deviceParams);
+sdrplay_api_ErrT sdrplay_api_Init(HANDLE dev, sdrplay_api_CallbackFnsT *callbackFns, void *cbContext);
+sdrplay_api_ErrT sdrplay_api_Uninit(HANDLE dev);
+sdrplay_api_ErrT sdrplay_api_Update(
+        HANDLE dev, sdrplay_api_TunerSelectT tuner,
+        sdrplay_api_ReasonForUpdateT reasonForUpdate,
+        sdrplay_api_ReasonForUpdateExtension1T reasonForUpdateExt1);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
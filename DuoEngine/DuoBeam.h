@@ -0,0 +1,167 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOBEAM_H
+#define DUOBEAM_H
+
+/**
+* Two-element beamformer for the tuner A and B sample streams.
+*
+* Each beam is the weighted complex sum
+*
+*     y = wA * A + wB * B
+*
+* formed per sample with one complex multiply-add per tuner. Steering
+* a beam by phase uses wA = 1/2 and wB = e^{j phase} / 2, so a phase of
+* 0 matches the sum stream and 180 degrees matches the difference.
+* The beam is rounded and saturated to the 16-bit sample range.
+*/
+
+#include <stdint.h>
+#include <math.h>
+
+#include "DuoEngine.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DUOBEAM_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DUOBEAM_NEON
+#endif
+
+
+/**
+* Set the weights of a beam steered by phase
+*
+* @param beam beam weights to set
+* @param phase phase applied to tuner B in degrees
+* @param gain amplitude of tuner B relative to tuner A
+*/
+static void duoBeamSteer(struct DuoEngineBeam* beam, float phase, float gain) {
+    double radians = phase * 3.14159265358979323846 / 180.0;
+    beam->weightAI = 0.5f;
+    beam->weightAQ = 0.0f;
+    beam->weightBI = (float)(0.5 * gain * cos(radians));
+    beam->weightBQ = (float)(0.5 * gain * sin(radians));
+}
+
+
+static short duoBeamSaturate(float value) {
+    value = value < 0.0f ? value - 0.5f : value + 0.5f;
+    if (value >= 32767.0f) {
+        return 32767;
+    }
+    if (value <= -32768.0f) {
+        return -32768;
+    }
+    return (short)value;
+}
+
+
+/**
+* Form one beam from a block of tuner A and B samples
+*
+* @param beam beam weights
+* @param ai tuner A real samples
+* @param aq tuner A imaginary samples
+* @param bi tuner B real samples
+* @param bq tuner B imaginary samples
+* @param numSamples number of samples from each tuner
+* @param yi real beam samples
+* @param yq imaginary beam samples
+*/
+static void duoBeamForm(
+        const struct DuoEngineBeam* beam,
+        const short* ai, const short* aq, const short* bi, const short* bq,
+        unsigned int numSamples, short* yi, short* yq) {
+    float wAI = beam->weightAI;
+    float wAQ = beam->weightAQ;
+    float wBI = beam->weightBI;
+    float wBQ = beam->weightBQ;
+    unsigned int idx = 0;
+#if defined(DUOBEAM_SSE)
+    __m128 vAI = _mm_set1_ps(wAI);
+    __m128 vAQ = _mm_set1_ps(wAQ);
+    __m128 vBI = _mm_set1_ps(wBI);
+    __m128 vBQ = _mm_set1_ps(wBQ);
+    for (; idx + 8 <= numSamples; idx += 8) {
+        __m128i raw[4];
+        __m128 lo[4];
+        __m128 hi[4];
+        raw[0] = _mm_loadu_si128((const __m128i*)(ai + idx));
+        raw[1] = _mm_loadu_si128((const __m128i*)(aq + idx));
+        raw[2] = _mm_loadu_si128((const __m128i*)(bi + idx));
+        raw[3] = _mm_loadu_si128((const __m128i*)(bq + idx));
+        for (unsigned int k = 0; k < 4; k++) {
+            // Sign extend by unpacking into the high half and shifting down
+            lo[k] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw[k], raw[k]), 16));
+            hi[k] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(raw[k], raw[k]), 16));
+        }
+        __m128 i0 = _mm_add_ps(
+            _mm_sub_ps(_mm_mul_ps(vAI, lo[0]), _mm_mul_ps(vAQ, lo[1])),
+            _mm_sub_ps(_mm_mul_ps(vBI, lo[2]), _mm_mul_ps(vBQ, lo[3])));
+        __m128 i1 = _mm_add_ps(
+            _mm_sub_ps(_mm_mul_ps(vAI, hi[0]), _mm_mul_ps(vAQ, hi[1])),
+            _mm_sub_ps(_mm_mul_ps(vBI, hi[2]), _mm_mul_ps(vBQ, hi[3])));
+        __m128 q0 = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(vAI, lo[1]), _mm_mul_ps(vAQ, lo[0])),
+            _mm_add_ps(_mm_mul_ps(vBI, lo[3]), _mm_mul_ps(vBQ, lo[2])));
+        __m128 q1 = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(vAI, hi[1]), _mm_mul_ps(vAQ, hi[0])),
+            _mm_add_ps(_mm_mul_ps(vBI, hi[3]), _mm_mul_ps(vBQ, hi[2])));
+        _mm_storeu_si128((__m128i*)(yi + idx), _mm_packs_epi32(_mm_cvtps_epi32(i0), _mm_cvtps_epi32(i1)));
+        _mm_storeu_si128((__m128i*)(yq + idx), _mm_packs_epi32(_mm_cvtps_epi32(q0), _mm_cvtps_epi32(q1)));
+    }
+#elif defined(DUOBEAM_NEON)
+    float32x4_t vHalf = vdupq_n_f32(0.5f);
+    uint32x4_t vSign = vdupq_n_u32(0x80000000u);
+    for (; idx + 4 <= numSamples; idx += 4) {
+        float32x4_t sAI = vcvtq_f32_s32(vmovl_s16(vld1_s16(ai + idx)));
+        float32x4_t sAQ = vcvtq_f32_s32(vmovl_s16(vld1_s16(aq + idx)));
+        float32x4_t sBI = vcvtq_f32_s32(vmovl_s16(vld1_s16(bi + idx)));
+        float32x4_t sBQ = vcvtq_f32_s32(vmovl_s16(vld1_s16(bq + idx)));
+        float32x4_t i0 = vmulq_n_f32(sAI, wAI);
+        i0 = vmlsq_n_f32(i0, sAQ, wAQ);
+        i0 = vmlaq_n_f32(i0, sBI, wBI);
+        i0 = vmlsq_n_f32(i0, sBQ, wBQ);
+        float32x4_t q0 = vmulq_n_f32(sAQ, wAI);
+        q0 = vmlaq_n_f32(q0, sAI, wAQ);
+        q0 = vmlaq_n_f32(q0, sBQ, wBI);
+        q0 = vmlaq_n_f32(q0, sBI, wBQ);
+        // Round half away from zero, then truncate and saturate to 16 bits
+        float32x4_t halfI = vreinterpretq_f32_u32(vorrq_u32(
+            vandq_u32(vreinterpretq_u32_f32(i0), vSign), vreinterpretq_u32_f32(vHalf)));
+        float32x4_t halfQ = vreinterpretq_f32_u32(vorrq_u32(
+            vandq_u32(vreinterpretq_u32_f32(q0), vSign), vreinterpretq_u32_f32(vHalf)));
+        vst1_s16(yi + idx, vqmovn_s32(vcvtq_s32_f32(vaddq_f32(i0, halfI))));
+        vst1_s16(yq + idx, vqmovn_s32(vcvtq_s32_f32(vaddq_f32(q0, halfQ))));
+    }
+#endif
+    for (; idx < numSamples; idx++) {
+        yi[idx] = duoBeamSaturate(wAI * ai[idx] - wAQ * aq[idx] + wBI * bi[idx] - wBQ * bq[idx]);
+        yq[idx] = duoBeamSaturate(wAI * aq[idx] + wAQ * ai[idx] + wBI * bq[idx] + wBQ * bi[idx]);
+    }
+}
+
+
+#endif
@@ -0,0 +1,533 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOCAL_H
+#define DUOCAL_H
+
+/**
+* Inter-tuner calibration of the RSPDuo.
+*
+* The tuners share a clock but not their RF paths, so tuner B differs
+* from tuner A by a frequency dependent phase, delay, and gain:
+*
+*     b[n] = gain * exp(j * phase) * a[n - delay]
+*
+* which are the quantities measured by DuoCorr. A calibration table
+* holds them at a set of RF frequencies and is interpolated at the
+* tuning frequency.
+*
+* The corrector removes them from tuner B with a single complex FIR
+* that combines the fractional delay, the rotation, and the gain, and
+* delays tuner A by the integer latency of that filter so the two
+* streams stay aligned.
+*
+* Tables are stored as CSV text with one point per line:
+*
+*     freq_hz,phase_deg,delay_ns,gain
+*
+* Lines starting with # are ignored.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DUOCAL_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DUOCAL_NEON
+#endif
+
+#define DUOCAL_PI (3.14159265358979323846)
+
+// Latency of the correction in samples, also the delay applied to tuner A
+#define DUO_CAL_HALF_TAPS (16)
+#define DUO_CAL_TAPS (2 * DUO_CAL_HALF_TAPS)
+// Largest delay that will be corrected in samples
+#define DUO_CAL_MAX_DELAY (DUO_CAL_HALF_TAPS / 2)
+// Points closer than this in Hz are the same point
+#define DUO_CAL_FREQ_TOLERANCE (0.5)
+#define DUO_CAL_MAX_LINE (256)
+
+
+struct DuoCalPoint {
+    // RF frequency in Hz
+    double freq;
+    // phase of tuner B relative to tuner A in radians
+    double phase;
+    // delay of tuner B relative to tuner A in seconds
+    double delay;
+    // amplitude of tuner B relative to tuner A
+    double gain;
+};
+
+
+struct DuoCalTable {
+    // sorted by increasing frequency
+    struct DuoCalPoint* points;
+    unsigned int numPoints;
+    unsigned int capacity;
+};
+
+
+/**
+* Initialize an empty table
+*/
+static void duoCalTableInit(struct DuoCalTable* table) {
+    memset(table, 0, sizeof(struct DuoCalTable));
+}
+
+
+/**
+* Release the memory of a table
+*/
+static void duoCalTableFree(struct DuoCalTable* table) {
+    free(table->points);
+    memset(table, 0, sizeof(struct DuoCalTable));
+}
+
+
+/**
+* The identity point, no correction
+*/
+static void duoCalPointIdentity(struct DuoCalPoint* point, double freq) {
+    point->freq = freq;
+    point->phase = 0.0;
+    point->delay = 0.0;
+    point->gain = 1.0;
+}
+
+
+/**
+* Wrap a phase in radians to [-pi, pi)
+*/
+static double duoCalWrap(double phase) {
+    return phase - 2.0 * DUOCAL_PI * floor((phase + DUOCAL_PI) / (2.0 * DUOCAL_PI));
+}
+
+
+/**
+* Add or replace the point at the same frequency
+*
+* @return zero on success, non-zero if memory could not be allocated
+*/
+static int duoCalTableSet(struct DuoCalTable* table, const struct DuoCalPoint* point) {
+    unsigned int idx = 0;
+    while (idx < table->numPoints && table->points[idx].freq < point->freq - DUO_CAL_FREQ_TOLERANCE) {
+        idx++;
+    }
+    if (idx < table->numPoints && fabs(table->points[idx].freq - point->freq) <= DUO_CAL_FREQ_TOLERANCE) {
+        table->points[idx] = *point;
+        table->points[idx].phase = duoCalWrap(point->phase);
+        return 0;
+    }
+    if (table->numPoints == table->capacity) {
+        unsigned int capacity = table->capacity ? 2 * table->capacity : 16;
+        struct DuoCalPoint* points = (struct DuoCalPoint*)realloc(
+            table->points, capacity * sizeof(struct DuoCalPoint));
+        if (points == NULL) {
+            return 1;
+        }
+        table->points = points;
+        table->capacity = capacity;
+    }
+    memmove(&table->points[idx + 1], &table->points[idx],
+            (table->numPoints - idx) * sizeof(struct DuoCalPoint));
+    table->points[idx] = *point;
+    table->points[idx].phase = duoCalWrap(point->phase);
+    table->numPoints++;
+    return 0;
+}
+
+
+/**
+* Interpolate the table at the specified frequency.
+* Frequencies outside the table use the nearest point and an empty
+* table gives the identity.
+*
+* @param table calibration table
+* @param freq RF frequency in Hz
+* @param point receives the interpolated calibration
+*/
+static void duoCalTableLookup(const struct DuoCalTable* table, double freq, struct DuoCalPoint* point) {
+    if (table == NULL || table->numPoints == 0) {
+        duoCalPointIdentity(point, freq);
+        return;
+    }
+    const struct DuoCalPoint* points = table->points;
+    unsigned int last = table->numPoints - 1;
+    if (freq <= points[0].freq || last == 0) {
+        *point = points[0];
+    }
+    else if (freq >= points[last].freq) {
+        *point = points[last];
+    }
+    else {
+        unsigned int idx = 1;
+        while (points[idx].freq < freq) {
+            idx++;
+        }
+        const struct DuoCalPoint* lo = &points[idx - 1];
+        const struct DuoCalPoint* hi = &points[idx];
+        double frac = (freq - lo->freq) / (hi->freq - lo->freq);
+        // Interpolate the phase the short way around the circle
+        point->phase = duoCalWrap(lo->phase + frac * duoCalWrap(hi->phase - lo->phase));
+        point->delay = lo->delay + frac * (hi->delay - lo->delay);
+        point->gain = lo->gain + frac * (hi->gain - lo->gain);
+    }
+    point->freq = freq;
+}
+
+
+/**
+* Load a table from a CSV file, replacing its contents
+*
+* @return zero on success, non-zero if the file could not be read
+*/
+static int duoCalTableLoad(struct DuoCalTable* table, const char* path) {
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        return 1;
+    }
+    table->numPoints = 0;
+    char line[DUO_CAL_MAX_LINE];
+    int rcode = 0;
+    while (rcode == 0 && fgets(line, sizeof(line), in)) {
+        char* start = line;
+        while (*start == ' ' || *start == '\t') {
+            start++;
+        }
+        if (*start == '#' || *start == '\r' || *start == '\n' || *start == '\0') {
+            continue;
+        }
+        double phaseDeg = 0.0;
+        double delayNs = 0.0;
+        struct DuoCalPoint point;
+        if (sscanf(start, "%lf,%lf,%lf,%lf", &point.freq, &phaseDeg, &delayNs, &point.gain) != 4 ||
+            point.gain <= 0.0) {
+            rcode = 1;
+            break;
+        }
+        point.phase = phaseDeg * DUOCAL_PI / 180.0;
+        point.delay = delayNs * 1e-9;
+        rcode = duoCalTableSet(table, &point);
+    }
+    fclose(in);
+    return rcode;
+}
+
+
+/**
+* Save a table to a CSV file
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoCalTableSave(const struct DuoCalTable* table, const char* path) {
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        return 1;
+    }
+    int rcode = fprintf(out, "# freq_hz,phase_deg,delay_ns,gain\n") < 0;
+    for (unsigned int idx = 0; rcode == 0 && idx < table->numPoints; idx++) {
+        const struct DuoCalPoint* point = &table->points[idx];
+        rcode = fprintf(out, "%.0f,%.4f,%.4f,%.6f\n", point->freq,
+                        point->phase * 180.0 / DUOCAL_PI, point->delay * 1e9, point->gain) < 0;
+    }
+    if (fclose(out) != 0) {
+        rcode = 1;
+    }
+    return rcode;
+}
+
+
+/**
+* Stream state that applies one calibration point
+*/
+struct DuoCalCorrector {
+    // complex taps for tuner B, oldest sample first
+    float tapsRe[DUO_CAL_TAPS];
+    float tapsIm[DUO_CAL_TAPS];
+    // taps waiting to be picked up by the stream thread
+    float stagedRe[DUO_CAL_TAPS];
+    float stagedIm[DUO_CAL_TAPS];
+    _Atomic bool staged;
+    // tuner B history, the last DUO_CAL_TAPS - 1 samples then the current block
+    float* histI;
+    float* histQ;
+    unsigned int histLen;
+    // tuner A delay line
+    short delayI[DUO_CAL_HALF_TAPS];
+    short delayQ[DUO_CAL_HALF_TAPS];
+};
+
+
+/**
+* Design the tuner B taps for a calibration point
+*
+* @param point calibration to remove
+* @param sampleRate stream sample rate in Hz
+* @param tapsRe receives DUO_CAL_TAPS real parts, oldest sample first
+* @param tapsIm receives DUO_CAL_TAPS imaginary parts
+*/
+static void duoCalDesign(
+        const struct DuoCalPoint* point, double sampleRate, float* tapsRe, float* tapsIm) {
+    double delay = point->delay * sampleRate;
+    if (delay > DUO_CAL_MAX_DELAY) {
+        delay = DUO_CAL_MAX_DELAY;
+    }
+    else if (delay < -DUO_CAL_MAX_DELAY) {
+        delay = -DUO_CAL_MAX_DELAY;
+    }
+    // Output is b[n - HALF_TAPS + delay], which lines up with a[n - HALF_TAPS]
+    double center = DUO_CAL_HALF_TAPS - delay;
+    double taps[DUO_CAL_TAPS];
+    double sum = 0.0;
+    for (unsigned int k = 0; k < DUO_CAL_TAPS; k++) {
+        double t = k - center;
+        double sinc = fabs(t) < 1e-9 ? 1.0 : sin(DUOCAL_PI * t) / (DUOCAL_PI * t);
+        double x = (t + DUO_CAL_HALF_TAPS) / DUO_CAL_TAPS;
+        double window = (x <= 0.0 || x >= 1.0) ? 0.0 :
+            0.42 - 0.5 * cos(2.0 * DUOCAL_PI * x) + 0.08 * cos(4.0 * DUOCAL_PI * x);
+        taps[k] = sinc * window;
+        sum += taps[k];
+    }
+    // Unity gain at DC, then undo the gain and phase of tuner B
+    double gain = point->gain > 0.0 ? point->gain : 1.0;
+    double scaleRe = cos(-point->phase) / (gain * sum);
+    double scaleIm = sin(-point->phase) / (gain * sum);
+    // Reverse so taps line up with the history from oldest to newest
+    for (unsigned int k = 0; k < DUO_CAL_TAPS; k++) {
+        tapsRe[DUO_CAL_TAPS - 1 - k] = (float)(taps[k] * scaleRe);
+        tapsIm[DUO_CAL_TAPS - 1 - k] = (float)(taps[k] * scaleIm);
+    }
+}
+
+
+/**
+* Initialize a corrector that applies the specified calibration
+*
+* @param corr pointer to struct to initialize
+* @param point calibration to remove
+* @param sampleRate stream sample rate in Hz
+*/
+static void duoCalInit(struct DuoCalCorrector* corr, const struct DuoCalPoint* point, double sampleRate) {
+    memset(corr, 0, sizeof(struct DuoCalCorrector));
+    duoCalDesign(point, sampleRate, corr->tapsRe, corr->tapsIm);
+}
+
+
+/**
+* Release the memory of a corrector
+*/
+static void duoCalFree(struct DuoCalCorrector* corr) {
+    free(corr->histI);
+    free(corr->histQ);
+    corr->histI = NULL;
+    corr->histQ = NULL;
+    corr->histLen = 0;
+}
+
+
+/**
+* Clear the sample history, e.g. after a stream reset
+*/
+static void duoCalReset(struct DuoCalCorrector* corr) {
+    if (corr->histI) {
+        memset(corr->histI, 0, (DUO_CAL_TAPS - 1) * sizeof(float));
+        memset(corr->histQ, 0, (DUO_CAL_TAPS - 1) * sizeof(float));
+    }
+    memset(corr->delayI, 0, sizeof(corr->delayI));
+    memset(corr->delayQ, 0, sizeof(corr->delayQ));
+}
+
+
+/**
+* Hand new taps to the stream thread, e.g. after retuning.
+* Called from a different thread than the process functions.
+*
+* @return zero if staged, non-zero if the previous taps have not been
+*         picked up yet and the caller should try again later
+*/
+static int duoCalStage(struct DuoCalCorrector* corr, const struct DuoCalPoint* point, double sampleRate) {
+    if (atomic_load_explicit(&corr->staged, memory_order_acquire)) {
+        return 1;
+    }
+    duoCalDesign(point, sampleRate, corr->stagedRe, corr->stagedIm);
+    atomic_store_explicit(&corr->staged, true, memory_order_release);
+    return 0;
+}
+
+
+/**
+* Delay a block of tuner A samples by the latency of the tuner B filter
+*
+* @param corr corrector from duoCalInit()
+* @param xi real input samples
+* @param xq imaginary input samples
+* @param numSamples number of samples in xi and xq
+* @param yi real output samples, may not alias xi
+* @param yq imaginary output samples, may not alias xq
+*/
+static void duoCalProcessA(
+        struct DuoCalCorrector* corr, const short* xi, const short* xq,
+        unsigned int numSamples, short* yi, short* yq) {
+    unsigned int fromLine = numSamples < DUO_CAL_HALF_TAPS ? numSamples : DUO_CAL_HALF_TAPS;
+    memcpy(yi, corr->delayI, fromLine * sizeof(short));
+    memcpy(yq, corr->delayQ, fromLine * sizeof(short));
+    if (numSamples >= DUO_CAL_HALF_TAPS) {
+        memcpy(yi + fromLine, xi, (numSamples - fromLine) * sizeof(short));
+        memcpy(yq + fromLine, xq, (numSamples - fromLine) * sizeof(short));
+        memcpy(corr->delayI, xi + numSamples - DUO_CAL_HALF_TAPS, sizeof(corr->delayI));
+        memcpy(corr->delayQ, xq + numSamples - DUO_CAL_HALF_TAPS, sizeof(corr->delayQ));
+    }
+    else {
+        // Shift the line along by a short block
+        unsigned int keep = DUO_CAL_HALF_TAPS - numSamples;
+        memmove(corr->delayI, corr->delayI + numSamples, keep * sizeof(short));
+        memmove(corr->delayQ, corr->delayQ + numSamples, keep * sizeof(short));
+        memcpy(corr->delayI + keep, xi, numSamples * sizeof(short));
+        memcpy(corr->delayQ + keep, xq, numSamples * sizeof(short));
+    }
+}
+
+
+static short duoCalSaturate(float value) {
+    value = value < 0.0f ? value - 0.5f : value + 0.5f;
+    if (value >= 32767.0f) {
+        return 32767;
+    }
+    if (value <= -32768.0f) {
+        return -32768;
+    }
+    return (short)value;
+}
+
+
+/**
+* Apply the calibration to a block of tuner B samples
+*
+* @param corr corrector from duoCalInit()
+* @param xi real input samples
+* @param xq imaginary input samples
+* @param numSamples number of samples in xi and xq
+* @param yi real output samples, may not alias xi
+* @param yq imaginary output samples, may not alias xq
+*
+* @return zero on success, non-zero if memory could not be allocated
+*/
+static int duoCalProcessB(
+        struct DuoCalCorrector* corr, const short* xi, const short* xq,
+        unsigned int numSamples, short* yi, short* yq) {
+    unsigned int needed = DUO_CAL_TAPS - 1 + numSamples;
+    if (needed > corr->histLen) {
+        // Only grows if the API delivers more samples than ever before
+        float* histI = (float*)realloc(corr->histI, needed * sizeof(float));
+        if (histI != NULL) {
+            corr->histI = histI;
+        }
+        float* histQ = (float*)realloc(corr->histQ, needed * sizeof(float));
+        if (histQ != NULL) {
+            corr->histQ = histQ;
+        }
+        if (histI == NULL || histQ == NULL) {
+            return 1;
+        }
+        if (corr->histLen == 0) {
+            memset(corr->histI, 0, (DUO_CAL_TAPS - 1) * sizeof(float));
+            memset(corr->histQ, 0, (DUO_CAL_TAPS - 1) * sizeof(float));
+        }
+        corr->histLen = needed;
+    }
+    if (atomic_load_explicit(&corr->staged, memory_order_acquire)) {
+        memcpy(corr->tapsRe, corr->stagedRe, sizeof(corr->tapsRe));
+        memcpy(corr->tapsIm, corr->stagedIm, sizeof(corr->tapsIm));
+        atomic_store_explicit(&corr->staged, false, memory_order_release);
+    }
+
+    float* histI = corr->histI;
+    float* histQ = corr->histQ;
+    for (unsigned int idx = 0; idx < numSamples; idx++) {
+        histI[DUO_CAL_TAPS - 1 + idx] = xi[idx];
+        histQ[DUO_CAL_TAPS - 1 + idx] = xq[idx];
+    }
+
+    const float* tapsRe = corr->tapsRe;
+    const float* tapsIm = corr->tapsIm;
+    for (unsigned int idx = 0; idx < numSamples; idx++) {
+        const float* wi = histI + idx;
+        const float* wq = histQ + idx;
+        float outI = 0.0f;
+        float outQ = 0.0f;
+#if defined(DUOCAL_SSE)
+        __m128 accI = _mm_setzero_ps();
+        __m128 accQ = _mm_setzero_ps();
+        for (unsigned int k = 0; k < DUO_CAL_TAPS; k += 4) {
+            __m128 tr = _mm_loadu_ps(tapsRe + k);
+            __m128 ti = _mm_loadu_ps(tapsIm + k);
+            __m128 si = _mm_loadu_ps(wi + k);
+            __m128 sq = _mm_loadu_ps(wq + k);
+            accI = _mm_add_ps(accI, _mm_sub_ps(_mm_mul_ps(tr, si), _mm_mul_ps(ti, sq)));
+            accQ = _mm_add_ps(accQ, _mm_add_ps(_mm_mul_ps(tr, sq), _mm_mul_ps(ti, si)));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, accI);
+        outI = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm_storeu_ps(lanes, accQ);
+        outQ = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(DUOCAL_NEON)
+        float32x4_t accI = vdupq_n_f32(0.0f);
+        float32x4_t accQ = vdupq_n_f32(0.0f);
+        for (unsigned int k = 0; k < DUO_CAL_TAPS; k += 4) {
+            float32x4_t tr = vld1q_f32(tapsRe + k);
+            float32x4_t ti = vld1q_f32(tapsIm + k);
+            float32x4_t si = vld1q_f32(wi + k);
+            float32x4_t sq = vld1q_f32(wq + k);
+            accI = vmlsq_f32(vmlaq_f32(accI, tr, si), ti, sq);
+            accQ = vmlaq_f32(vmlaq_f32(accQ, tr, sq), ti, si);
+        }
+        float lanes[4];
+        vst1q_f32(lanes, accI);
+        outI = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        vst1q_f32(lanes, accQ);
+        outQ = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+        for (unsigned int k = 0; k < DUO_CAL_TAPS; k++) {
+            outI += tapsRe[k] * wi[k] - tapsIm[k] * wq[k];
+            outQ += tapsRe[k] * wq[k] + tapsIm[k] * wi[k];
+        }
+#endif
+        yi[idx] = duoCalSaturate(outI);
+        yq[idx] = duoCalSaturate(outQ);
+    }
+
+    memmove(histI, histI + numSamples, (DUO_CAL_TAPS - 1) * sizeof(float));
+    memmove(histQ, histQ + numSamples, (DUO_CAL_TAPS - 1) * sizeof(float));
+    return 0;
+}
+
+
+#endif
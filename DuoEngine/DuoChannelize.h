@@ -0,0 +1,289 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOCHANNELIZE_H
+#define DUOCHANNELIZE_H
+
+/**
+* Polyphase filterbank channelizer for a complex floating point stream.
+*
+* The band is split into N equal channels. Channel c is centered at
+* (c - N/2) * fs / N, so channel N/2 is the tuning frequency, the same
+* centered order used by DuoPSD and DuoSpec.
+*
+* Every D input samples the newest N*T samples are multiplied by a
+* windowed-sinc prototype low-pass filter, folded into N points, and
+* transformed with one N point FFT that produces one output sample
+* for every channel. D is N for critical sampling or N/2 for 2x
+* oversampling, which keeps the channel edges free of aliasing. The
+* cost is therefore one fold and one FFT per D inputs no matter how
+* many channels are used.
+*
+* Outputs are at fs / D and have unity gain for a tone at the channel
+* center. The fold uses SSE or NEON when available.
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "DuoFFT.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DUOCHANNELIZE_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DUOCHANNELIZE_NEON
+#endif
+
+// Extra history, in blocks, kept so the history only shifts occasionally
+#define DUO_CHANNELIZE_SLACK (32)
+
+
+struct DuoChannelizer {
+    struct DuoFFT fft;
+    // number of channels N, a power of two
+    unsigned int numChannels;
+    // input samples per output block D
+    unsigned int decim;
+    // prototype filter length N * T
+    unsigned int numTaps;
+    float* taps;
+    // input history, the newest sample is at histEnd - 1
+    float* histRe;
+    float* histIm;
+    unsigned int histLen;
+    unsigned int histEnd;
+    // input samples since the last block
+    unsigned int pending;
+    // index of the oldest windowed sample modulo N, keeps channel phase continuous
+    unsigned int rotation;
+    // folded block and FFT buffers
+    float* foldRe;
+    float* foldIm;
+    float* workRe;
+    float* workIm;
+};
+
+
+/**
+* Design the prototype filter and allocate the channelizer state
+*
+* @param ch pointer to struct to initialize
+* @param numChannels number of channels N, a power of two >= 4
+* @param oversample true for outputs at 2 * fs / N, false for fs / N
+* @param tapsPerChannel prototype filter length in multiples of N,
+*                       longer filters give sharper channel edges
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoChannelizerInit(
+        struct DuoChannelizer* ch, unsigned int numChannels, bool oversample,
+        unsigned int tapsPerChannel) {
+    memset(ch, 0, sizeof(struct DuoChannelizer));
+    if (numChannels < 4 || !duoFFTValidSize(numChannels) || tapsPerChannel == 0) {
+        return 1;
+    }
+    if (duoFFTInit(&ch->fft, numChannels)) {
+        return 1;
+    }
+    ch->numChannels = numChannels;
+    ch->decim = oversample ? numChannels / 2 : numChannels;
+    ch->numTaps = numChannels * tapsPerChannel;
+    ch->histLen = ch->numTaps + DUO_CHANNELIZE_SLACK * ch->decim;
+
+    ch->taps = (float*)malloc(ch->numTaps * sizeof(float));
+    ch->histRe = (float*)calloc(ch->histLen, sizeof(float));
+    ch->histIm = (float*)calloc(ch->histLen, sizeof(float));
+    ch->foldRe = (float*)malloc(numChannels * sizeof(float));
+    ch->foldIm = (float*)malloc(numChannels * sizeof(float));
+    ch->workRe = (float*)malloc(numChannels * sizeof(float));
+    ch->workIm = (float*)malloc(numChannels * sizeof(float));
+    if (ch->taps == NULL || ch->histRe == NULL || ch->histIm == NULL ||
+        ch->foldRe == NULL || ch->foldIm == NULL || ch->workRe == NULL || ch->workIm == NULL) {
+        free(ch->taps);
+        free(ch->histRe);
+        free(ch->histIm);
+        free(ch->foldRe);
+        free(ch->foldIm);
+        free(ch->workRe);
+        free(ch->workIm);
+        duoFFTFree(&ch->fft);
+        memset(ch, 0, sizeof(struct DuoChannelizer));
+        return 1;
+    }
+
+    // Windowed sinc with its -6 dB point at the channel edge
+    double center = (ch->numTaps - 1) / 2.0;
+    double sum = 0.0;
+    for (unsigned int idx = 0; idx < ch->numTaps; idx++) {
+        double t = (idx - center) / numChannels;
+        double sinc = (t == 0.0) ? 1.0 : sin(DUOFFT_PI * t) / (DUOFFT_PI * t);
+        double phase = 2.0 * DUOFFT_PI * (idx + 0.5) / ch->numTaps;
+        double window = 0.42 - 0.5 * cos(phase) + 0.08 * cos(2.0 * phase);
+        ch->taps[idx] = (float)(sinc * window);
+        sum += sinc * window;
+    }
+    for (unsigned int idx = 0; idx < ch->numTaps; idx++) {
+        ch->taps[idx] = (float)(ch->taps[idx] / sum);
+    }
+
+    // Start with a history of zeros
+    ch->histEnd = ch->numTaps;
+    ch->pending = 0;
+    ch->rotation = 0;
+    return 0;
+}
+
+
+/**
+* Release the memory allocated by duoChannelizerInit()
+*/
+static void duoChannelizerFree(struct DuoChannelizer* ch) {
+    free(ch->taps);
+    free(ch->histRe);
+    free(ch->histIm);
+    free(ch->foldRe);
+    free(ch->foldIm);
+    free(ch->workRe);
+    free(ch->workIm);
+    duoFFTFree(&ch->fft);
+    memset(ch, 0, sizeof(struct DuoChannelizer));
+}
+
+
+/**
+* Output sample rate of each channel
+*/
+static double duoChannelizerRate(const struct DuoChannelizer* ch, double inputRate) {
+    return inputRate / ch->decim;
+}
+
+
+/**
+* Upper bound on the number of blocks produced from numSamples inputs
+*/
+static unsigned int duoChannelizerMaxBlocks(const struct DuoChannelizer* ch, unsigned int numSamples) {
+    return (ch->pending + numSamples) / ch->decim + 1;
+}
+
+
+/**
+* Window and fold the newest numTaps samples into N points
+*/
+static void duoChannelizerFold(struct DuoChannelizer* ch) {
+    unsigned int size = ch->numChannels;
+    const float* xRe = ch->histRe + ch->histEnd - ch->numTaps;
+    const float* xIm = ch->histIm + ch->histEnd - ch->numTaps;
+    float* foldRe = ch->foldRe;
+    float* foldIm = ch->foldIm;
+
+    memset(foldRe, 0, size * sizeof(float));
+    memset(foldIm, 0, size * sizeof(float));
+    for (unsigned int base = 0; base < ch->numTaps; base += size) {
+        const float* taps = ch->taps + base;
+        unsigned int idx = 0;
+#if defined(DUOCHANNELIZE_SSE)
+        for (; idx + 4 <= size; idx += 4) {
+            __m128 tap = _mm_loadu_ps(taps + idx);
+            __m128 re = _mm_mul_ps(tap, _mm_loadu_ps(xRe + base + idx));
+            __m128 im = _mm_mul_ps(tap, _mm_loadu_ps(xIm + base + idx));
+            _mm_storeu_ps(foldRe + idx, _mm_add_ps(_mm_loadu_ps(foldRe + idx), re));
+            _mm_storeu_ps(foldIm + idx, _mm_add_ps(_mm_loadu_ps(foldIm + idx), im));
+        }
+#elif defined(DUOCHANNELIZE_NEON)
+        for (; idx + 4 <= size; idx += 4) {
+            float32x4_t tap = vld1q_f32(taps + idx);
+            vst1q_f32(foldRe + idx, vmlaq_f32(vld1q_f32(foldRe + idx), tap, vld1q_f32(xRe + base + idx)));
+            vst1q_f32(foldIm + idx, vmlaq_f32(vld1q_f32(foldIm + idx), tap, vld1q_f32(xIm + base + idx)));
+        }
+#endif
+        for (; idx < size; idx++) {
+            foldRe[idx] += taps[idx] * xRe[base + idx];
+            foldIm[idx] += taps[idx] * xIm[base + idx];
+        }
+    }
+}
+
+
+/**
+* Push complex samples through the channelizer
+*
+* @param ch channelizer from duoChannelizerInit()
+* @param in pointer to the I scalar of the first sample, Q follows it
+* @param stride distance in floats between consecutive samples, e.g. 4
+*               for one tuner of interleaved (Ia, Qa, Ib, Qb) frames
+* @param numSamples number of input samples
+* @param out interleaved (I, Q) outputs, numChannels samples per block
+*            in centered channel order, room for at least
+*            duoChannelizerMaxBlocks() blocks
+*
+* @return number of blocks written
+*/
+static unsigned int duoChannelizerPush(
+        struct DuoChannelizer* ch, const float* in, unsigned int stride,
+        unsigned int numSamples, float* out) {
+    unsigned int size = ch->numChannels;
+    unsigned int half = size / 2;
+    unsigned int numBlocks = 0;
+    for (unsigned int sampleIdx = 0; sampleIdx < numSamples; sampleIdx++) {
+        if (ch->histEnd == ch->histLen) {
+            // Keep just the samples the next window can reach
+            memmove(ch->histRe, ch->histRe + ch->histEnd - ch->numTaps, ch->numTaps * sizeof(float));
+            memmove(ch->histIm, ch->histIm + ch->histEnd - ch->numTaps, ch->numTaps * sizeof(float));
+            ch->histEnd = ch->numTaps;
+        }
+        ch->histRe[ch->histEnd] = in[0];
+        ch->histIm[ch->histEnd] = in[1];
+        ch->histEnd++;
+        in += stride;
+
+        if (++ch->pending < ch->decim) {
+            continue;
+        }
+        ch->pending = 0;
+        ch->rotation = (ch->rotation + ch->decim) % size;
+
+        // Rotating the fold by the window start keeps channel phase continuous
+        duoChannelizerFold(ch);
+        unsigned int rot = ch->rotation;
+        memcpy(ch->workRe + rot, ch->foldRe, (size - rot) * sizeof(float));
+        memcpy(ch->workIm + rot, ch->foldIm, (size - rot) * sizeof(float));
+        memcpy(ch->workRe, ch->foldRe + size - rot, rot * sizeof(float));
+        memcpy(ch->workIm, ch->foldIm + size - rot, rot * sizeof(float));
+        duoFFTForward(&ch->fft, ch->workRe, ch->workIm);
+
+        float* block = out + (size_t)numBlocks * size * 2;
+        for (unsigned int chan = 0; chan < size; chan++) {
+            unsigned int bin = chan < half ? chan + half : chan - half;
+            block[2 * chan] = ch->workRe[bin];
+            block[2 * chan + 1] = ch->workIm[bin];
+        }
+        numBlocks++;
+    }
+    return numBlocks;
+}
+
+
+#endif
@@ -0,0 +1,398 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUODETECT_H
+#define DUODETECT_H
+
+/**
+* Streaming CFAR signal detector for the two tuners.
+*
+* Both tuners are split into consecutive Hann windowed frames of N
+* samples. The power of each bin and the cross spectrum B * conj(A)
+* are averaged over a number of frames, and each average is one
+* detection decision.
+*
+* Every bin keeps its own noise floor for each tuner, a slowly
+* averaged power that is only updated while the bin is quiet, so the
+* false alarm rate of each bin stays constant as the floor changes
+* with frequency and gain. A bin is detected when the combined power
+* of both tuners exceeds the combined floor by the threshold, and
+* stays detected until it falls 3 dB below the threshold. Adjacent
+* detected bins are one signal, reported once at its strongest bin
+* when none of its bins were detected in the previous decision.
+*
+* The first decisions within one time constant only establish the
+* noise floor and report nothing.
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "DuoEngine.h"
+#include "DuoFFT.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DUODETECT_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DUODETECT_NEON
+#endif
+
+// Release threshold below the detection threshold
+#define DUO_DETECT_HYSTERESIS (0.5f)
+
+
+struct DuoDetector {
+    struct DuoFFT fft;
+    unsigned int size;
+    unsigned int numAverages;
+    double sampleRate;
+    // linear power ratio for detection
+    float threshold;
+    // noise floor update weight per decision
+    float alpha;
+    // decisions that only establish the noise floor
+    unsigned int primeDecisions;
+    unsigned int numDecisions;
+    float* window;
+    // samples of the frame being filled
+    float* frameARe;
+    float* frameAIm;
+    float* frameBRe;
+    float* frameBIm;
+    unsigned int fill;
+    // FFT work buffers
+    float* workARe;
+    float* workAIm;
+    float* workBRe;
+    float* workBIm;
+    // accumulated power and cross spectrum of the current average
+    float* accA;
+    float* accB;
+    float* accCrossRe;
+    float* accCrossIm;
+    unsigned int numFrames;
+    // noise floor of each tuner in natural bin order
+    float* floorA;
+    float* floorB;
+    // detected state of each bin in the previous decision
+    bool* active;
+    bool* detected;
+    // scale from accumulated power to full scale squared per frame
+    float powerScale;
+    // delivered samples before the frame being filled and the current average
+    unsigned long long sampleNumber;
+    unsigned long long averageStart;
+};
+
+
+/**
+* Release the memory allocated by duoDetectorInit()
+*/
+static void duoDetectorFree(struct DuoDetector* det) {
+    free(det->window);
+    free(det->frameARe);
+    free(det->frameAIm);
+    free(det->frameBRe);
+    free(det->frameBIm);
+    free(det->workARe);
+    free(det->workAIm);
+    free(det->workBRe);
+    free(det->workBIm);
+    free(det->accA);
+    free(det->accB);
+    free(det->accCrossRe);
+    free(det->accCrossIm);
+    free(det->floorA);
+    free(det->floorB);
+    free(det->active);
+    free(det->detected);
+    duoFFTFree(&det->fft);
+    memset(det, 0, sizeof(struct DuoDetector));
+}
+
+
+/**
+* Allocate the detector state
+*
+* @param det pointer to struct to initialize
+* @param size FFT size N, a power of two >= 16
+* @param numAverages frames averaged for each decision
+* @param threshold detection threshold in dB above the noise floor
+* @param timeConstant averaging time of the noise floors in seconds
+* @param sampleRate sample rate of the pushed samples in Hz
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoDetectorInit(
+        struct DuoDetector* det, unsigned int size, unsigned int numAverages,
+        float threshold, float timeConstant, double sampleRate) {
+    memset(det, 0, sizeof(struct DuoDetector));
+    if (size < 16 || !duoFFTValidSize(size) || numAverages == 0 || timeConstant <= 0.0f) {
+        return 1;
+    }
+    if (duoFFTInit(&det->fft, size)) {
+        return 1;
+    }
+    det->size = size;
+    det->numAverages = numAverages;
+    det->sampleRate = sampleRate;
+    det->threshold = powf(10.0f, threshold / 10.0f);
+    double period = (double)size * numAverages / sampleRate;
+    det->alpha = (float)(1.0 - exp(-period / timeConstant));
+    det->primeDecisions = (unsigned int)ceil(timeConstant / period);
+
+    float** buffers[] = {
+        &det->window, &det->frameARe, &det->frameAIm, &det->frameBRe, &det->frameBIm,
+        &det->workARe, &det->workAIm, &det->workBRe, &det->workBIm,
+        &det->accA, &det->accB, &det->accCrossRe, &det->accCrossIm,
+        &det->floorA, &det->floorB};
+    bool failed = false;
+    for (unsigned int idx = 0; idx < sizeof(buffers) / sizeof(buffers[0]); idx++) {
+        *buffers[idx] = (float*)calloc(size, sizeof(float));
+        failed = failed || *buffers[idx] == NULL;
+    }
+    det->active = (bool*)calloc(size, sizeof(bool));
+    det->detected = (bool*)calloc(size, sizeof(bool));
+    if (failed || det->active == NULL || det->detected == NULL) {
+        duoDetectorFree(det);
+        return 1;
+    }
+
+    duoFFTWindow(DUO_WINDOW_HANN, det->window, size);
+    double sum = 0.0;
+    for (unsigned int idx = 0; idx < size; idx++) {
+        sum += det->window[idx];
+    }
+    // A full scale tone in the center of a bin reads 0 dBFS
+    det->powerScale = (float)(1.0 / (32767.0 * 32767.0 * sum * sum));
+    return 0;
+}
+
+
+/**
+* Window and transform the filled frame and add it to the average
+*/
+static void duoDetectorFrame(struct DuoDetector* det) {
+    unsigned int size = det->size;
+    const float* window = det->window;
+    unsigned int idx = 0;
+#if defined(DUODETECT_SSE)
+    for (; idx + 4 <= size; idx += 4) {
+        __m128 w = _mm_loadu_ps(window + idx);
+        _mm_storeu_ps(det->workARe + idx, _mm_mul_ps(w, _mm_loadu_ps(det->frameARe + idx)));
+        _mm_storeu_ps(det->workAIm + idx, _mm_mul_ps(w, _mm_loadu_ps(det->frameAIm + idx)));
+        _mm_storeu_ps(det->workBRe + idx, _mm_mul_ps(w, _mm_loadu_ps(det->frameBRe + idx)));
+        _mm_storeu_ps(det->workBIm + idx, _mm_mul_ps(w, _mm_loadu_ps(det->frameBIm + idx)));
+    }
+#elif defined(DUODETECT_NEON)
+    for (; idx + 4 <= size; idx += 4) {
+        float32x4_t w = vld1q_f32(window + idx);
+        vst1q_f32(det->workARe + idx, vmulq_f32(w, vld1q_f32(det->frameARe + idx)));
+        vst1q_f32(det->workAIm + idx, vmulq_f32(w, vld1q_f32(det->frameAIm + idx)));
+        vst1q_f32(det->workBRe + idx, vmulq_f32(w, vld1q_f32(det->frameBRe + idx)));
+        vst1q_f32(det->workBIm + idx, vmulq_f32(w, vld1q_f32(det->frameBIm + idx)));
+    }
+#endif
+    for (; idx < size; idx++) {
+        det->workARe[idx] = window[idx] * det->frameARe[idx];
+        det->workAIm[idx] = window[idx] * det->frameAIm[idx];
+        det->workBRe[idx] = window[idx] * det->frameBRe[idx];
+        det->workBIm[idx] = window[idx] * det->frameBIm[idx];
+    }
+    duoFFTForward(&det->fft, det->workARe, det->workAIm);
+    duoFFTForward(&det->fft, det->workBRe, det->workBIm);
+
+    const float* aRe = det->workARe;
+    const float* aIm = det->workAIm;
+    const float* bRe = det->workBRe;
+    const float* bIm = det->workBIm;
+    idx = 0;
+#if defined(DUODETECT_SSE)
+    for (; idx + 4 <= size; idx += 4) {
+        __m128 ar = _mm_loadu_ps(aRe + idx);
+        __m128 ai = _mm_loadu_ps(aIm + idx);
+        __m128 br = _mm_loadu_ps(bRe + idx);
+        __m128 bi = _mm_loadu_ps(bIm + idx);
+        __m128 powA = _mm_add_ps(_mm_mul_ps(ar, ar), _mm_mul_ps(ai, ai));
+        __m128 powB = _mm_add_ps(_mm_mul_ps(br, br), _mm_mul_ps(bi, bi));
+        __m128 crossRe = _mm_add_ps(_mm_mul_ps(br, ar), _mm_mul_ps(bi, ai));
+        __m128 crossIm = _mm_sub_ps(_mm_mul_ps(bi, ar), _mm_mul_ps(br, ai));
+        _mm_storeu_ps(det->accA + idx, _mm_add_ps(_mm_loadu_ps(det->accA + idx), powA));
+        _mm_storeu_ps(det->accB + idx, _mm_add_ps(_mm_loadu_ps(det->accB + idx), powB));
+        _mm_storeu_ps(det->accCrossRe + idx, _mm_add_ps(_mm_loadu_ps(det->accCrossRe + idx), crossRe));
+        _mm_storeu_ps(det->accCrossIm + idx, _mm_add_ps(_mm_loadu_ps(det->accCrossIm + idx), crossIm));
+    }
+#elif defined(DUODETECT_NEON)
+    for (; idx + 4 <= size; idx += 4) {
+        float32x4_t ar = vld1q_f32(aRe + idx);
+        float32x4_t ai = vld1q_f32(aIm + idx);
+        float32x4_t br = vld1q_f32(bRe + idx);
+        float32x4_t bi = vld1q_f32(bIm + idx);
+        vst1q_f32(det->accA + idx, vmlaq_f32(vmlaq_f32(vld1q_f32(det->accA + idx), ar, ar), ai, ai));
+        vst1q_f32(det->accB + idx, vmlaq_f32(vmlaq_f32(vld1q_f32(det->accB + idx), br, br), bi, bi));
+        vst1q_f32(det->accCrossRe + idx, vmlaq_f32(vmlaq_f32(vld1q_f32(det->accCrossRe + idx), br, ar), bi, ai));
+        vst1q_f32(det->accCrossIm + idx, vmlsq_f32(vmlaq_f32(vld1q_f32(det->accCrossIm + idx), bi, ar), br, ai));
+    }
+#endif
+    for (; idx < size; idx++) {
+        det->accA[idx] += aRe[idx] * aRe[idx] + aIm[idx] * aIm[idx];
+        det->accB[idx] += bRe[idx] * bRe[idx] + bIm[idx] * bIm[idx];
+        det->accCrossRe[idx] += bRe[idx] * aRe[idx] + bIm[idx] * aIm[idx];
+        det->accCrossIm[idx] += bIm[idx] * aRe[idx] - bRe[idx] * aIm[idx];
+    }
+    det->numFrames++;
+}
+
+
+/**
+* Decide which bins are detected, update the noise floors, and report
+* each new signal
+*/
+static void duoDetectorDecide(
+        struct DuoDetector* det, DuoEngineDetectionCallback callback, void* userContext) {
+    unsigned int size = det->size;
+    unsigned int half = size / 2;
+    float scale = det->powerScale / det->numFrames;
+    bool priming = det->numDecisions < det->primeDecisions;
+    float alpha = det->numDecisions == 0 ? 1.0f : det->alpha;
+    if (priming && det->numDecisions > 0) {
+        // Plain running mean while the floor is established
+        alpha = 1.0f / (det->numDecisions + 1);
+    }
+
+    for (unsigned int bin = 0; bin < size; bin++) {
+        float powA = det->accA[bin] * scale;
+        float powB = det->accB[bin] * scale;
+        float ratio = (powA + powB) / (det->floorA[bin] + det->floorB[bin] + 1e-30f);
+        bool hit = !priming &&
+            ratio > (det->active[bin] ? det->threshold * DUO_DETECT_HYSTERESIS : det->threshold);
+        det->detected[bin] = hit;
+        if (!hit) {
+            det->floorA[bin] += alpha * (powA - det->floorA[bin]);
+            det->floorB[bin] += alpha * (powB - det->floorB[bin]);
+        }
+    }
+
+    // Walk the bins in centered order so a signal around 0 Hz is one cluster
+    unsigned int chan = 0;
+    while (chan < size) {
+        unsigned int bin = chan < half ? chan + half : chan - half;
+        if (!det->detected[bin]) {
+            chan++;
+            continue;
+        }
+        bool isNew = true;
+        unsigned int peakChan = chan;
+        float peakPower = -1.0f;
+        for (; chan < size; chan++) {
+            bin = chan < half ? chan + half : chan - half;
+            if (!det->detected[bin]) {
+                break;
+            }
+            isNew = isNew && !det->active[bin];
+            float power = det->accA[bin] + det->accB[bin];
+            if (power > peakPower) {
+                peakPower = power;
+                peakChan = chan;
+            }
+        }
+        if (isNew && callback != NULL) {
+            unsigned int peak = peakChan < half ? peakChan + half : peakChan - half;
+            float powA = det->accA[peak] * scale;
+            float powB = det->accB[peak] * scale;
+            struct DuoEngineDetection detection;
+            detection.sampleNumber = det->averageStart;
+            detection.time = det->averageStart / det->sampleRate;
+            detection.bin = peakChan;
+            detection.freq = (float)(((int)peakChan - (int)half) * det->sampleRate / size);
+            detection.power = 10.0f * log10f((powA + powB) / 2.0f + 1e-30f);
+            detection.snrA = 10.0f * log10f(powA / (det->floorA[peak] + 1e-30f) + 1e-30f);
+            detection.snrB = 10.0f * log10f(powB / (det->floorB[peak] + 1e-30f) + 1e-30f);
+            detection.phase = (float)(atan2(det->accCrossIm[peak], det->accCrossRe[peak]) * 180.0 / DUOFFT_PI);
+            callback(&detection, userContext);
+        }
+    }
+
+    bool* previous = det->active;
+    det->active = det->detected;
+    det->detected = previous;
+    memset(det->accA, 0, size * sizeof(float));
+    memset(det->accB, 0, size * sizeof(float));
+    memset(det->accCrossRe, 0, size * sizeof(float));
+    memset(det->accCrossIm, 0, size * sizeof(float));
+    det->numFrames = 0;
+    det->numDecisions++;
+}
+
+
+/**
+* Push a block of samples from both tuners through the detector
+*
+* @param det detector from duoDetectorInit()
+* @param ai tuner A real samples
+* @param aq tuner A imaginary samples
+* @param bi tuner B real samples
+* @param bq tuner B imaginary samples
+* @param numSamples number of samples from each tuner
+* @param callback function to report new signals, NULL for none
+* @param userContext passed to callback
+*/
+static void duoDetectorPush(
+        struct DuoDetector* det,
+        const short* ai, const short* aq, const short* bi, const short* bq,
+        unsigned int numSamples, DuoEngineDetectionCallback callback, void* userContext) {
+    unsigned int inIdx = 0;
+    while (inIdx < numSamples) {
+        unsigned int count = det->size - det->fill;
+        if (count > numSamples - inIdx) {
+            count = numSamples - inIdx;
+        }
+        for (unsigned int idx = 0; idx < count; idx++) {
+            det->frameARe[det->fill + idx] = ai[inIdx + idx];
+            det->frameAIm[det->fill + idx] = aq[inIdx + idx];
+            det->frameBRe[det->fill + idx] = bi[inIdx + idx];
+            det->frameBIm[det->fill + idx] = bq[inIdx + idx];
+        }
+        det->fill += count;
+        inIdx += count;
+        if (det->fill < det->size) {
+            break;
+        }
+
+        det->fill = 0;
+        if (det->numFrames == 0) {
+            det->averageStart = det->sampleNumber;
+        }
+        det->sampleNumber += det->size;
+        duoDetectorFrame(det);
+        if (det->numFrames == det->numAverages) {
+            duoDetectorDecide(det, callback, userContext);
+        }
+    }
+}
+
+
+#endif
@@ -20,6 +20,11 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+// CPU affinity of the engine threads, see DuoRealtime.h
+#define _GNU_SOURCE
+#endif
+
 #if defined(_WIN32) || defined(_WIN64)
 #include <Windows.h>
 #include <conio.h>
@@ -32,14 +37,30 @@ SOFTWARE.
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 
 #include "sdrplay_api.h"
 
 #include "DuoEngine.h"
+#include "DuoPack.h"
+#include "DuoResample.h"
+#include "DuoIQ.h"
+#include "DuoCal.h"
+#include "DuoBeam.h"
+#include "DuoNCO.h"
+#include "DuoDetect.h"
+#include "DuoPower.h"
+#include "DuoThread.h"
+#include "DuoRing.h"
+#include "DuoRealtime.h"
 
 
 #define MAX_DEVS (6)
 #define MAX_MSG_LEN (1024)
+// Interval between calls of the control callback
+#define CONTROL_INTERVAL_MS (100)
+// Interval between attempts to bring back a lost device
+#define RECOVER_RETRY_MS (1000)
 
 static const float SAMPLE_FREQ_DEFAULT = 6000000.0;
 static const float SAMPLE_FREQ_MAXFS = 8000000.0;
@@ -54,13 +75,137 @@ struct Context {
     void* buffer;
     unsigned int bufferSize;
     unsigned int bufferLen;
+    // size of each scalar in buffer (short or float)
+    unsigned int scalarSize;
+    // transfer memory for packed formats, NULL if buffer is transferred directly
+    void* packBuffer;
+    // output stream index for A, B, sum, diff, and each beam, -1 if not selected
+    int streamIdx[DUO_MAX_STREAMS];
+    // copy of tuner A samples for the sum, difference, beam streams, and detector
+    bool needStash;
+    short* stashI;
+    short* stashQ;
+    unsigned int stashLen;
+    // DC and I/Q imbalance correction, only used if correct is true
+    bool correct;
+    struct DuoIQCorrector correctorA;
+    struct DuoIQCorrector correctorB;
+    // corrector output for the current callback
+    short* correctedI;
+    short* correctedQ;
+    unsigned int correctedLen;
+    // inter-tuner calibration, only used if calibrate is true
+    bool calibrate;
+    const struct DuoCalTable* calTable;
+    struct DuoCalCorrector calibrator;
+    double calRate;
+    // tuning frequency of the applied calibration and the latest tuning frequency
+    float calFreq;
+    float calTarget;
+    // calibrator output for the current callback
+    short* calibratedI;
+    short* calibratedQ;
+    unsigned int calibratedLen;
+    // beam streams, only formed if beamform is true
+    bool beamform;
+    // beam weights used by the stream callbacks
+    struct DuoEngineBeam beams[DUO_MAX_BEAMS];
+    // latest weights from the control callback and the copy handed to the stream callbacks
+    struct DuoEngineBeam beamTarget[DUO_MAX_BEAMS];
+    struct DuoEngineBeam beamStaged[DUO_MAX_BEAMS];
+    bool beamPending;
+    _Atomic bool beamUpdate;
+    // beam output for the current callback
+    short* beamI[DUO_MAX_BEAMS];
+    short* beamQ[DUO_MAX_BEAMS];
+    unsigned int beamLen[DUO_MAX_BEAMS];
+    // frequency shift, mixed with the same phase for both tuners
+    struct DuoNCO nco;
+    double ncoRate;
+    // true if the current pair of callbacks mixes, decided by tuner A
+    bool mixing;
+    // latest shift from the control callback and the copy handed to the stream callbacks
+    float shiftTarget;
+    float shiftStaged;
+    bool shiftPending;
+    _Atomic bool shiftUpdate;
+    // mixer output for the current callback when there is no resampler
+    short* mixedI;
+    short* mixedQ;
+    unsigned int mixedLen;
+    // identical resamplers for each tuner, only used if resample is true
+    bool resample;
+    struct DuoResampler resamplerA;
+    struct DuoResampler resamplerB;
+    // resampler output for the current callback
+    short* resampledI;
+    short* resampledQ;
+    unsigned int resampledLen;
+    // signal detector on the delivered samples, only used if detect is true
+    bool detect;
+    struct DuoDetector detector;
+    // sums of squares of each tuner for the transfer being filled, only used if measurePower is true
+    bool measurePower;
+    uint64_t powerSumA;
+    uint64_t powerSumB;
+    // true if transfers reach transferCallback or the ring
+    bool deliver;
+    // ring of delivered frames pulled by duoEngineRead(), only used if read is true
+    bool read;
+    struct DuoRing ring;
+    // real-time settings of the stream callback threads, applied at their first callback
+    enum DuoEngineSched schedPolicy;
+    int schedPriority;
+    unsigned long long streamCpus;
+    bool threadReadyA;
+    bool threadReadyB;
+    // Layout of each transfer segment of the buffer in scalars
+    unsigned int chanOffset[DUO_MAX_STREAMS];
+    unsigned int chanStride;
+    unsigned int quadOffset;
+    // configuration of the current epoch, with the sample rate settings of the latest change
+    struct DuoEngine config;
+    // latest sample rate settings from the control callback
+    unsigned int decimTarget;
+    bool maxFsTarget;
+    unsigned int outputRateTarget;
+    bool ratePending;
+    // configuration and state of a new sample rate handed to the stream callbacks,
+    // which swap it with the state of the old rate for the control thread to release
+    struct DuoEngine rateStaged;
+    bool resampleStaged;
+    struct DuoResampler resamplerStagedA;
+    struct DuoResampler resamplerStagedB;
+    bool detectStaged;
+    struct DuoDetector detectorStaged;
+    _Atomic bool rateUpdate;
+    // frames after which a partial transfer is flushed, zero to only transfer whole segments
+    unsigned int flushFrames;
+    // partial transfers are a multiple of this many frames to keep packed blocks byte aligned
+    unsigned int flushAlign;
+    // tuner A callbacks so far and a removal event, watched by the control thread for recovery
+    _Atomic unsigned int callbackCount;
+    _Atomic bool deviceRemoved;
+    // true while a stream thread is in transferCallback or detectionCallback, which may block
+    _Atomic bool inUserCallback;
+    // true while the device is lost, control changes are then kept in lastControl
+    bool recovering;
+    // device settings restored to the device once it is back
+    struct DuoEngineControl lastControl;
+    // true once a transfer was delivered and until the next transfer after a reset
+    bool delivered;
+    bool discontinuity;
+    _Atomic unsigned int discontinuities;
     // Buffer state
     unsigned int numSamplesA;
     unsigned int numSamplesB;
+    // start of the segment being filled and the next frame within it
     unsigned int rxIdx;
+    unsigned int rxFrame;
     unsigned int txIdx;
     // User parameters
     DuoEngineTransferCallback transferCallback;
+    DuoEngineDetectionCallback detectionCallback;
     DuoEngineControlCallback controlCallback;
     DuoEngineMessageCallback messageCallback;
     void* userContext;
@@ -91,10 +236,611 @@ static void doMessage(struct Context* context, const char *fmt, ...) {
 * @params context DuoEngine context
 */
 static void doTransfer(struct Context* context) {
-    unsigned int offset = context->txIdx * context->transfer.scalarSize;
+    unsigned int offset = context->txIdx * context->scalarSize;
     context->transfer.data = (char*)context->buffer + offset;
+    if (context->packBuffer && context->transfer.format == DUO_FORMAT_FLOAT16) {
+        duoPackFloat16(
+            (const float*)context->transfer.data, (uint16_t*)context->packBuffer,
+            context->transfer.numScalars);
+        context->transfer.data = context->packBuffer;
+    }
+    else if (context->packBuffer) {
+        duoPack(
+            context->transfer.format, (const int16_t*)context->transfer.data,
+            context->packBuffer, context->transfer.numScalars);
+        context->transfer.data = context->packBuffer;
+    }
     context->txIdx = (context->txIdx + context->transfer.numScalars) % context->bufferLen;
-    context->transferCallback(&context->transfer, context->userContext);
+    context->transfer.discontinuity = context->discontinuity;
+    context->discontinuity = false;
+    context->delivered = true;
+    if (context->read) {
+        duoRingWrite(&context->ring, context->transfer.data, context->transfer.numFrames);
+    }
+    if (context->transferCallback) {
+        atomic_store_explicit(&context->inUserCallback, true, memory_order_release);
+        context->transferCallback(&context->transfer, context->userContext);
+        atomic_store_explicit(&context->inUserCallback, false, memory_order_release);
+    }
+}
+
+
+/**
+* Apply the real-time settings to the calling thread and report the
+* outcome of each
+*
+* @param context DuoEngine context
+* @param name thread name used in messages
+* @param cpus bitmask of CPUs to pin the thread to, zero to leave unpinned
+*/
+static void configureThread(struct Context* context, const char* name, unsigned long long cpus) {
+    int error = 0;
+    if (context->schedPolicy != DUO_SCHED_DEFAULT) {
+        const char* policy = context->schedPolicy == DUO_SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR";
+        error = duoRtSetScheduling(context->schedPolicy == DUO_SCHED_FIFO, context->schedPriority);
+        if (error) {
+            doMessage(context, "failed to set %s priority %d for %s thread: %s",
+                      policy, context->schedPriority, name, duoRtReason(error));
+        }
+        else {
+            doMessage(context, "%s thread running with %s priority %d", name, policy, context->schedPriority);
+        }
+    }
+    if (cpus) {
+        error = duoRtSetAffinity(cpus);
+        if (error) {
+            doMessage(context, "failed to pin %s thread to CPUs 0x%llx: %s", name, cpus, duoRtReason(error));
+        }
+        else {
+            doMessage(context, "%s thread pinned to CPUs 0x%llx", name, cpus);
+        }
+    }
+}
+
+
+/**
+* Writes a run of samples for one output stream into a transfer
+* segment of the buffer. Runs never cross a segment boundary so each
+* run is a simple strided copy.
+*
+* @param context DuoEngine context
+* @param stream index of the output stream within each frame
+* @param xi real data buffer
+* @param xq imaginary data buffer
+* @param yi real data buffer to combine with xi, NULL to copy xi
+* @param yq imaginary data buffer to combine with xq
+* @param sign 1 for (x + y) / 2 or -1 for (x - y) / 2
+* @param segIdx start of the segment in the buffer
+* @param frame first frame within the segment to write
+* @param count number of samples to write
+*/
+static void writeRun(
+        struct Context* context, unsigned int stream,
+        const short* xi, const short* xq, const short* yi, const short* yq, int sign,
+        unsigned int segIdx, unsigned int frame, unsigned int count) {
+    unsigned int stride = context->chanStride;
+    unsigned int quad = context->quadOffset;
+    unsigned int bufIdx = segIdx + context->chanOffset[stream] + frame * stride;
+    unsigned int inIdx = 0;
+
+    if (context->transfer.floatingPoint) {
+        float* floatBuffer = (float*)context->buffer + bufIdx;
+        if (yi == NULL) {
+            for (inIdx = 0; inIdx < count; inIdx++) {
+                floatBuffer[0] = xi[inIdx] / (float)32767.0;
+                floatBuffer[quad] = xq[inIdx] / (float)32767.0;
+                floatBuffer += stride;
+            }
+        }
+        else {
+            for (inIdx = 0; inIdx < count; inIdx++) {
+                floatBuffer[0] = (xi[inIdx] + sign * yi[inIdx]) / (float)65534.0;
+                floatBuffer[quad] = (xq[inIdx] + sign * yq[inIdx]) / (float)65534.0;
+                floatBuffer += stride;
+            }
+        }
+    }
+    else {
+        short* shortBuffer = (short*)context->buffer + bufIdx;
+        if (yi == NULL) {
+            for (inIdx = 0; inIdx < count; inIdx++) {
+                shortBuffer[0] = xi[inIdx];
+                shortBuffer[quad] = xq[inIdx];
+                shortBuffer += stride;
+            }
+        }
+        else {
+            for (inIdx = 0; inIdx < count; inIdx++) {
+                // Half of the sum or difference always fits in a short
+                shortBuffer[0] = (short)((xi[inIdx] + sign * yi[inIdx]) >> 1);
+                shortBuffer[quad] = (short)((xq[inIdx] + sign * yq[inIdx]) >> 1);
+                shortBuffer += stride;
+            }
+        }
+    }
+}
+
+
+/**
+* Set the frames after which a partial transfer is flushed for the
+* maxLatency of the configuration and the current sample rate.
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+*/
+static void configureFlush(struct Context* context) {
+    context->flushFrames = 0;
+    context->flushAlign = 1;
+    if (context->config.maxLatency > 0.0f) {
+        context->flushFrames = (unsigned int)(context->config.maxLatency * context->transfer.sampleRate);
+        if (context->transfer.layout != DUO_LAYOUT_INTERLEAVED) {
+            context->flushAlign = 4;
+        }
+        else if (context->transfer.frameSize == 0) {
+            context->flushAlign = 2;
+        }
+        if (context->flushFrames < context->flushAlign) {
+            context->flushFrames = context->flushAlign;
+        }
+    }
+}
+
+
+/**
+* Transfers the frames of the segment being filled before it is
+* complete, so that no frame waits longer than maxLatency. The filled
+* part of each plane of the segment is moved together and any frames
+* that cannot be packed on their own are carried over to the start of
+* the next segment.
+*
+* @param context DuoEngine context
+* @param carry false to drop the frames that cannot be packed, e.g. at
+*              a change of sample rate
+*/
+static void flushTransfer(struct Context* context, bool carry) {
+    struct DuoEngineTransfer* transfer = &context->transfer;
+    unsigned int numFrames = transfer->numFrames;
+    unsigned int filled = context->rxFrame;
+    unsigned int count = filled - filled % context->flushAlign;
+    unsigned int left = filled - count;
+    unsigned int nextIdx = (context->rxIdx + transfer->numScalars) % context->bufferLen;
+    unsigned int numPlanes = 1;
+    if (count == 0) {
+        context->rxFrame = carry ? filled : 0;
+        return;
+    }
+
+    // Interleaved frames are one plane, planar has one per stream, split one per I and Q of each stream
+    if (transfer->layout == DUO_LAYOUT_PLANAR) {
+        numPlanes = transfer->numStreams;
+    }
+    else if (transfer->layout == DUO_LAYOUT_SPLIT) {
+        numPlanes = transfer->numStreams * 2;
+    }
+    // bytes of one frame within each plane
+    size_t unit = (size_t)transfer->numScalars / numFrames / numPlanes * context->scalarSize;
+    char* seg = (char*)context->buffer + (size_t)context->rxIdx * context->scalarSize;
+    char* next = (char*)context->buffer + (size_t)nextIdx * context->scalarSize;
+    for (unsigned int plane = 0; plane < numPlanes; plane++) {
+        memcpy(next + plane * numFrames * unit, seg + (plane * numFrames + count) * unit, left * unit);
+    }
+    for (unsigned int plane = 1; plane < numPlanes; plane++) {
+        memmove(seg + plane * count * unit, seg + plane * numFrames * unit, count * unit);
+    }
+
+    if (context->measurePower) {
+        transfer->powerA = duoPowerDb(context->powerSumA, filled);
+        transfer->powerB = duoPowerDb(context->powerSumB, filled);
+        context->powerSumA = 0;
+        context->powerSumB = 0;
+    }
+    unsigned int numBytes = transfer->numBytes;
+    transfer->numFrames = count;
+    transfer->numSamples = count * transfer->numStreams;
+    transfer->numScalars = transfer->numSamples * 2;
+    transfer->numBytes = (unsigned int)((unsigned long long)transfer->numScalars * transfer->bitsPerScalar / 8);
+    context->txIdx = context->rxIdx;
+    doTransfer(context);
+    transfer->numFrames = numFrames;
+    transfer->numSamples = numFrames * transfer->numStreams;
+    transfer->numScalars = transfer->numSamples * 2;
+    transfer->numBytes = numBytes;
+
+    context->txIdx = nextIdx;
+    context->rxIdx = nextIdx;
+    context->rxFrame = carry ? left : 0;
+}
+
+
+/**
+* Writes the selected output streams for one tuner callback into the
+* buffer at the current receive position.
+* Tuner A only writes its own stream. Tuner B writes its own stream,
+* the sum and difference streams from the samples stashed by tuner A,
+* and the beams formed by formBeams(), then advances the receive
+* position and transfers each completed segment.
+*
+* @param context DuoEngine context
+* @param xi real data buffer
+* @param xq imaginary data buffer
+* @param numSamples number of samples available from xi and xq
+* @param tunerB true for the tuner B callback
+*/
+static void writeSamples(
+        struct Context* context, short* xi, short* xq,
+        unsigned int numSamples, bool tunerB) {
+    unsigned int segIdx = context->rxIdx;
+    unsigned int frame = context->rxFrame;
+    unsigned int numFrames = context->transfer.numFrames;
+    unsigned int inIdx = 0;
+
+    if (!context->deliver) {
+        // Only detections are delivered
+        return;
+    }
+    while (inIdx < numSamples) {
+        unsigned int count = numFrames - frame;
+        if (count > numSamples - inIdx) {
+            count = numSamples - inIdx;
+        }
+
+        if (!tunerB) {
+            if (context->streamIdx[0] >= 0) {
+                writeRun(context, context->streamIdx[0], xi + inIdx, xq + inIdx,
+                         NULL, NULL, 0, segIdx, frame, count);
+            }
+        }
+        else {
+            const short* ai = context->stashI + inIdx;
+            const short* aq = context->stashQ + inIdx;
+            if (context->measurePower) {
+                context->powerSumA += duoPowerSum(ai, aq, count);
+                context->powerSumB += duoPowerSum(xi + inIdx, xq + inIdx, count);
+            }
+            if (context->streamIdx[1] >= 0) {
+                writeRun(context, context->streamIdx[1], xi + inIdx, xq + inIdx,
+                         NULL, NULL, 0, segIdx, frame, count);
+            }
+            if (context->streamIdx[2] >= 0) {
+                writeRun(context, context->streamIdx[2], ai, aq,
+                         xi + inIdx, xq + inIdx, 1, segIdx, frame, count);
+            }
+            if (context->streamIdx[3] >= 0) {
+                writeRun(context, context->streamIdx[3], ai, aq,
+                         xi + inIdx, xq + inIdx, -1, segIdx, frame, count);
+            }
+            for (unsigned int beam = 0; beam < DUO_MAX_BEAMS; beam++) {
+                if (context->streamIdx[4 + beam] >= 0) {
+                    writeRun(context, context->streamIdx[4 + beam],
+                             context->beamI[beam] + inIdx, context->beamQ[beam] + inIdx,
+                             NULL, NULL, 0, segIdx, frame, count);
+                }
+            }
+        }
+
+        inIdx += count;
+        frame += count;
+        if (frame == numFrames) {
+            // Segment is complete, the next one starts after it
+            frame = 0;
+            segIdx = (segIdx + context->transfer.numScalars) % context->bufferLen;
+            if (tunerB) {
+                if (context->measurePower) {
+                    context->transfer.powerA = duoPowerDb(context->powerSumA, numFrames);
+                    context->transfer.powerB = duoPowerDb(context->powerSumB, numFrames);
+                    context->powerSumA = 0;
+                    context->powerSumB = 0;
+                }
+                // we have a full transfer ready to go
+                doTransfer(context);
+            }
+        }
+    }
+
+    if (tunerB) {
+        context->rxIdx = segIdx;
+        context->rxFrame = frame;
+        if (context->flushFrames && frame >= context->flushFrames) {
+            flushTransfer(context, true);
+        }
+    }
+}
+
+
+/**
+* Switches the stream callbacks to the sample rate staged by
+* updateRate(). Called by tuner A before it processes a callback, when
+* both tuners have handled the same samples. The frames received at
+* the old rate are transferred first, and the resamplers and detector
+* of the old rate are left in the staged slots for the control thread
+* to release.
+*
+* @param context DuoEngine context
+*/
+static void switchRate(struct Context* context) {
+    if (context->deliver && context->rxFrame > 0) {
+        flushTransfer(context, false);
+    }
+    context->config = context->rateStaged;
+
+    bool resample = context->resample;
+    struct DuoResampler resamplerA = context->resamplerA;
+    struct DuoResampler resamplerB = context->resamplerB;
+    context->resample = context->resampleStaged;
+    context->resamplerA = context->resamplerStagedA;
+    context->resamplerB = context->resamplerStagedB;
+    context->resampleStaged = resample;
+    context->resamplerStagedA = resamplerA;
+    context->resamplerStagedB = resamplerB;
+    bool detect = context->detect;
+    struct DuoDetector detector = context->detector;
+    context->detect = context->detectStaged;
+    context->detector = context->detectorStaged;
+    context->detectStaged = detect;
+    context->detectorStaged = detector;
+
+    unsigned int hardwareRate = duoEngineHardwareRate(&context->config);
+    context->transfer.sampleRate = (float)duoEngineSampleRate(&context->config);
+    context->transfer.epoch++;
+    configureFlush(context);
+    if (context->correct) {
+        duoIQSetRate(&context->correctorA, hardwareRate, context->config.iqTimeConstant);
+        duoIQSetRate(&context->correctorB, hardwareRate, context->config.iqTimeConstant);
+    }
+    if (context->calibrate) {
+        // The delay of tuner B is a different number of samples at the new rate
+        struct DuoCalPoint point;
+        context->calRate = hardwareRate;
+        duoCalTableLookup(context->calTable, context->calFreq, &point);
+        duoCalDesign(&point, context->calRate, context->calibrator.tapsRe, context->calibrator.tapsIm);
+        duoCalReset(&context->calibrator);
+    }
+    context->ncoRate = hardwareRate;
+    duoNCOSetFrequency(&context->nco, context->shiftStaged, context->ncoRate);
+    context->powerSumA = 0;
+    context->powerSumB = 0;
+    if (context->read) {
+        duoRingMark(&context->ring, context->transfer.sampleRate);
+    }
+    atomic_store_explicit(&context->rateUpdate, false, memory_order_release);
+}
+
+
+/**
+* Keeps a copy of the tuner A samples for the sum and difference
+* streams, which are written by the tuner B callback.
+*
+* @param context DuoEngine context
+* @param xi real data buffer
+* @param xq imaginary data buffer
+* @param numSamples number of samples available from xi and xq
+*
+* @return zero on success, non-zero otherwise
+*/
+static int stashSamples(struct Context* context, short* xi, short* xq, unsigned int numSamples) {
+    if (numSamples > context->stashLen) {
+        // Only grows if the API delivers more samples than ever before
+        short* stashI = (short*)realloc(context->stashI, numSamples * sizeof(short));
+        if (stashI != NULL) {
+            context->stashI = stashI;
+        }
+        short* stashQ = (short*)realloc(context->stashQ, numSamples * sizeof(short));
+        if (stashQ != NULL) {
+            context->stashQ = stashQ;
+        }
+        if (stashI == NULL || stashQ == NULL) {
+            return 1;
+        }
+        context->stashLen = numSamples;
+    }
+    memcpy(context->stashI, xi, numSamples * sizeof(short));
+    memcpy(context->stashQ, xq, numSamples * sizeof(short));
+    return 0;
+}
+
+
+/**
+* Make sure a pair of per-callback sample buffers can hold numSamples
+*
+* @param bufI pointer to real sample buffer
+* @param bufQ pointer to imaginary sample buffer
+* @param bufLen pointer to the current capacity of both buffers
+* @param numSamples number of samples needed
+*
+* @return zero on success, non-zero otherwise
+*/
+static int reserveSamples(short** bufI, short** bufQ, unsigned int* bufLen, unsigned int numSamples) {
+    if (numSamples <= *bufLen) {
+        return 0;
+    }
+    // Only grows if the API delivers more samples than ever before
+    short* newI = (short*)realloc(*bufI, numSamples * sizeof(short));
+    if (newI != NULL) {
+        *bufI = newI;
+    }
+    short* newQ = (short*)realloc(*bufQ, numSamples * sizeof(short));
+    if (newQ != NULL) {
+        *bufQ = newQ;
+    }
+    if (newI == NULL || newQ == NULL) {
+        return 1;
+    }
+    *bufLen = numSamples;
+    return 0;
+}
+
+
+/**
+* Forms each selected beam from the samples stashed by tuner A and the
+* tuner B samples, picking up any weights staged by updateBeams().
+*
+* @param context DuoEngine context
+* @param xi tuner B real data buffer
+* @param xq tuner B imaginary data buffer
+* @param numSamples number of samples available from xi and xq
+*
+* @return zero on success, non-zero otherwise
+*/
+static int formBeams(struct Context* context, const short* xi, const short* xq, unsigned int numSamples) {
+    if (atomic_load_explicit(&context->beamUpdate, memory_order_acquire)) {
+        memcpy(context->beams, context->beamStaged, sizeof(context->beams));
+        atomic_store_explicit(&context->beamUpdate, false, memory_order_release);
+    }
+    for (unsigned int beam = 0; beam < DUO_MAX_BEAMS; beam++) {
+        if (context->streamIdx[4 + beam] < 0) {
+            continue;
+        }
+        if (reserveSamples(&context->beamI[beam], &context->beamQ[beam], &context->beamLen[beam], numSamples)) {
+            return 1;
+        }
+        duoBeamForm(&context->beams[beam], context->stashI, context->stashQ, xi, xq,
+                    numSamples, context->beamI[beam], context->beamQ[beam]);
+    }
+    return 0;
+}
+
+
+/**
+* Runs one tuner's samples through its DC and I/Q imbalance corrector.
+* On success xi and xq are replaced with the corrected block, which is
+* valid until the next call.
+*
+* @param context DuoEngine context
+* @param corrector corrector for the tuner
+* @param xi pointer to real data buffer
+* @param xq pointer to imaginary data buffer
+* @param numSamples number of samples available from xi and xq
+*
+* @return zero on success, non-zero otherwise
+*/
+static int correctSamples(
+        struct Context* context, struct DuoIQCorrector* corrector,
+        short** xi, short** xq, unsigned int numSamples) {
+    if (reserveSamples(&context->correctedI, &context->correctedQ, &context->correctedLen, numSamples)) {
+        return 1;
+    }
+    duoIQProcess(corrector, *xi, *xq, numSamples, context->correctedI, context->correctedQ);
+    *xi = context->correctedI;
+    *xq = context->correctedQ;
+    return 0;
+}
+
+
+/**
+* Runs one tuner's samples through the inter-tuner calibration.
+* Tuner B is corrected and tuner A is delayed to stay aligned with it.
+* On success xi and xq are replaced with the calibrated block, which
+* is valid until the next call.
+*
+* @param context DuoEngine context
+* @param tunerB true for tuner B, false for tuner A
+* @param xi pointer to real data buffer
+* @param xq pointer to imaginary data buffer
+* @param numSamples number of samples available from xi and xq
+*
+* @return zero on success, non-zero otherwise
+*/
+static int calibrateSamples(
+        struct Context* context, bool tunerB, short** xi, short** xq, unsigned int numSamples) {
+    if (reserveSamples(&context->calibratedI, &context->calibratedQ, &context->calibratedLen, numSamples)) {
+        return 1;
+    }
+    if (tunerB) {
+        if (duoCalProcessB(&context->calibrator, *xi, *xq, numSamples,
+                           context->calibratedI, context->calibratedQ)) {
+            return 1;
+        }
+    }
+    else {
+        duoCalProcessA(&context->calibrator, *xi, *xq, numSamples,
+                       context->calibratedI, context->calibratedQ);
+    }
+    *xi = context->calibratedI;
+    *xq = context->calibratedQ;
+    return 0;
+}
+
+
+/**
+* Mixes one tuner's samples with the frequency shift NCO into mixedI
+* and mixedQ, for when there is no resampler to mix them on its input.
+* The NCO is not advanced, so tuner B sees the same phase as tuner A.
+* On success xi and xq are replaced with the mixed block, which is
+* valid until the next call.
+*
+* @param context DuoEngine context
+* @param xi pointer to real data buffer
+* @param xq pointer to imaginary data buffer
+* @param numSamples number of samples available from xi and xq
+*
+* @return zero on success, non-zero otherwise
+*/
+static int shiftSamples(struct Context* context, short** xi, short** xq, unsigned int numSamples) {
+    if (reserveSamples(&context->mixedI, &context->mixedQ, &context->mixedLen, numSamples)) {
+        return 1;
+    }
+    duoNCOMix(&context->nco, *xi, *xq, numSamples, context->mixedI, context->mixedQ);
+    *xi = context->mixedI;
+    *xq = context->mixedQ;
+    return 0;
+}
+
+
+/**
+* Runs one tuner's samples through its resampler.
+* On success xi, xq, and numSamples are replaced with the resampled
+* block, which is valid until the next call.
+*
+* @param context DuoEngine context
+* @param resampler resampler for the tuner
+* @param nco frequency shift NCO to mix the input with, NULL for none.
+*            It is not advanced.
+* @param xi pointer to real data buffer
+* @param xq pointer to imaginary data buffer
+* @param numSamples pointer to number of samples available from xi and xq
+*
+* @return zero on success, non-zero otherwise
+*/
+static int resampleSamples(
+        struct Context* context, struct DuoResampler* resampler, const struct DuoNCO* nco,
+        short** xi, short** xq, unsigned int* numSamples) {
+    unsigned int maxOutput = duoResamplerMaxOutput(resampler, *numSamples);
+    if (reserveSamples(&context->resampledI, &context->resampledQ, &context->resampledLen, maxOutput)) {
+        return 1;
+    }
+    *numSamples = duoResamplerProcess(
+        resampler, nco, *xi, *xq, *numSamples, context->resampledI, context->resampledQ);
+    *xi = context->resampledI;
+    *xq = context->resampledQ;
+    return 0;
+}
+
+
+/**
+* Clear the buffer state for a stream that starts again, dropping the
+* frames of the segment being filled. The next transfer is marked as
+* a discontinuity unless it will be the first.
+*
+* @param context DuoEngine context
+*/
+static void resetStream(struct Context* context) {
+    context->numSamplesA = 0;
+    context->numSamplesB = 0;
+    context->rxIdx = 0;
+    context->rxFrame = 0;
+    context->txIdx = 0;
+    context->powerSumA = 0;
+    context->powerSumB = 0;
+    if (context->calibrate) {
+        duoCalReset(&context->calibrator);
+    }
+    if (context->resample) {
+        duoResamplerReset(&context->resamplerA);
+        duoResamplerReset(&context->resamplerB);
+    }
+    if (context->delivered && !context->discontinuity) {
+        context->discontinuity = true;
+        atomic_fetch_add_explicit(&context->discontinuities, 1, memory_order_relaxed);
+    }
 }
 
 
@@ -112,12 +858,14 @@ static void callbackStreamA(
         short *xi, short *xq, sdrplay_api_StreamCbParamsT *params,
         unsigned int numSamples, unsigned int reset, void *cbContext) {
     struct Context* context = (struct Context*)cbContext;
+    if (!context->threadReadyA) {
+        context->threadReadyA = true;
+        configureThread(context, "stream A", context->streamCpus);
+    }
+    atomic_fetch_add_explicit(&context->callbackCount, 1, memory_order_relaxed);
     if (reset) {
         doMessage(context, "sdrplay_api_StreamACallback: numSamples=%d", numSamples);
-        context->numSamplesA = 0;
-        context->numSamplesB = 0;
-        context->rxIdx = 0;
-        context->txIdx = 0;
+        resetStream(context);
     }
 
     if (!reset && (context->numSamplesA || context->numSamplesB == 0)) {
@@ -127,31 +875,41 @@ static void callbackStreamA(
         doMessage(context, "buffer out of sync: numSamplesA=%u numSamplesB=%u", numSamples, context->numSamplesB);
     }
     else {
-        context->numSamplesA = numSamples;
-
-        unsigned int inIdx = 0;
-        unsigned int bufIdx = context->rxIdx;
-
-        if (context->transfer.floatingPoint) {
-            float* floatBuffer = (float*)context->buffer;
-            for (inIdx = 0; inIdx < numSamples; inIdx++) {
-                floatBuffer[bufIdx++] = xi[inIdx] / (float)32767.0;
-                floatBuffer[bufIdx++] = xq[inIdx] / (float)32767.0;
-                // skip stream B samples
-                bufIdx = (bufIdx + 2) % context->bufferLen;
-                // Only need to take modulo at end of frame
-            }
+        if (atomic_load_explicit(&context->rateUpdate, memory_order_acquire)) {
+            switchRate(context);
         }
-        else {
-            short* shortBuffer = (short*)context->buffer;
-            for (inIdx = 0; inIdx < numSamples; inIdx++) {
-                shortBuffer[bufIdx++] = xi[inIdx];
-                shortBuffer[bufIdx++] = xq[inIdx];
-                // skip stream B samples
-                bufIdx = (bufIdx + 2) % context->bufferLen;
-                // Only need to take modulo at end of frame
-            }
+        if (context->correct && correctSamples(context, &context->correctorA, &xi, &xq, numSamples)) {
+            doMessage(context, "failed to allocate corrector output: numSamples=%u", numSamples);
+            return;
+        }
+        if (context->calibrate && calibrateSamples(context, false, &xi, &xq, numSamples)) {
+            doMessage(context, "failed to allocate calibration output: numSamples=%u", numSamples);
+            return;
         }
+        if (atomic_load_explicit(&context->shiftUpdate, memory_order_acquire)) {
+            duoNCOSetFrequency(&context->nco, context->shiftStaged, context->ncoRate);
+            atomic_store_explicit(&context->shiftUpdate, false, memory_order_release);
+        }
+        // Tuner B mixes with the same phase and then advances it
+        context->mixing = !duoNCOIdle(&context->nco);
+        const struct DuoNCO* nco = context->mixing ? &context->nco : NULL;
+        if (context->mixing && !context->resample && shiftSamples(context, &xi, &xq, numSamples)) {
+            doMessage(context, "failed to allocate mixer output: numSamples=%u", numSamples);
+            return;
+        }
+        // Both resamplers see the same input counts so produce the same output counts
+        unsigned int numOutput = numSamples;
+        if (context->resample && resampleSamples(context, &context->resamplerA, nco, &xi, &xq, &numOutput)) {
+            doMessage(context, "failed to allocate resampler output: numSamples=%u", numSamples);
+            return;
+        }
+        if (context->needStash && stashSamples(context, xi, xq, numOutput)) {
+            doMessage(context, "failed to allocate sample stash: numSamples=%u", numOutput);
+            return;
+        }
+        context->numSamplesA = numSamples;
+        // stream B callback advances the buffer state
+        writeSamples(context, xi, xq, numOutput, false);
     }
 }
 
@@ -170,6 +928,10 @@ static void callbackStreamB(
         short *xi, short *xq, sdrplay_api_StreamCbParamsT *params,
         unsigned int numSamples, unsigned int reset, void *cbContext) {
     struct Context* context = (struct Context*)cbContext;
+    if (!context->threadReadyB) {
+        context->threadReadyB = true;
+        configureThread(context, "stream B", context->streamCpus);
+    }
     if (reset) {
         doMessage(context, "sdrplay_api_StreamBCallback: numSamples=%d", numSamples);
     }
@@ -181,44 +943,41 @@ static void callbackStreamB(
         doMessage(context, "buffer out of sync: numSamplesA=%u numSamplesB=%u", context->numSamplesA, numSamples);
     }
     else {
+        unsigned int numOutput = numSamples;
         context->numSamplesB = numSamples;
-
-        unsigned int inIdx = 0;
-        unsigned int bufIdx = context->rxIdx;
-
-        if (context->transfer.floatingPoint) {
-            float* floatBuffer = (float*)context->buffer;
-            for (inIdx = 0; inIdx < numSamples; inIdx++) {
-                // skip stream A samples
-                bufIdx += 2;
-                floatBuffer[bufIdx++] = xi[inIdx] / (float)32767.0;
-                floatBuffer[bufIdx++] = xq[inIdx] / (float)32767.0;
-                // Only need to take modulo at end of frame
-                bufIdx = bufIdx % context->bufferLen;
-                if ((bufIdx % context->transfer.numScalars) == 0) {
-                    // we have a full packet ready to go
-                    doTransfer(context);
-                }
-            }
+        if (context->correct) {
+            // Never allocates, stream A already sized the output for numSamples
+            correctSamples(context, &context->correctorB, &xi, &xq, numSamples);
+        }
+        if (context->calibrate && calibrateSamples(context, true, &xi, &xq, numSamples)) {
+            doMessage(context, "failed to allocate calibration history: numSamples=%u", numSamples);
+        }
+        const struct DuoNCO* nco = context->mixing ? &context->nco : NULL;
+        if (context->mixing && !context->resample) {
+            // Never allocates, stream A already sized the output for numSamples
+            shiftSamples(context, &xi, &xq, numSamples);
+        }
+        if (context->resample) {
+            // Never allocates, stream A already sized the output for numSamples
+            resampleSamples(context, &context->resamplerB, nco, &xi, &xq, &numOutput);
+        }
+        if (context->mixing) {
+            duoNCOAdvance(&context->nco, numSamples);
+        }
+        if (context->detect) {
+            atomic_store_explicit(&context->inUserCallback, true, memory_order_release);
+            duoDetectorPush(
+                &context->detector, context->stashI, context->stashQ, xi, xq, numOutput,
+                context->detectionCallback, context->userContext);
+            atomic_store_explicit(&context->inUserCallback, false, memory_order_release);
+        }
+        if (context->beamform && formBeams(context, xi, xq, numOutput)) {
+            doMessage(context, "failed to allocate beam output: numSamples=%u", numOutput);
         }
         else {
-            short* shortBuffer = (short*)context->buffer;
-            for (inIdx = 0; inIdx < numSamples; inIdx++) {
-                // skip stream A samples
-                bufIdx += 2;
-                shortBuffer[bufIdx++] = xi[inIdx];
-                shortBuffer[bufIdx++] = xq[inIdx];
-                // Only need to take modulo at end of frame
-                bufIdx = bufIdx % context->bufferLen;
-                if ((bufIdx % context->transfer.numScalars) == 0) {
-                    // we have a full transfer ready to go
-                    doTransfer(context);
-                }
-            }
+            writeSamples(context, xi, xq, numOutput, true);
         }
 
-        context->rxIdx = bufIdx;
-
         // clear to indicate to A that B has been handled
         context->numSamplesA = 0;
     }
@@ -262,6 +1021,8 @@ static void callbackEvent(
         break;
     case sdrplay_api_DeviceRemoved:
         doMessage(context, "sdrplay_api_EventCb: %s", "sdrplay_api_DeviceRemoved");
+        // picked up by recoverDevice()
+        atomic_store_explicit(&context->deviceRemoved, true, memory_order_release);
         break;
     default:
         doMessage(context, "sdrplay_api_EventCb: %d, unhandled event", eventId);
@@ -332,7 +1093,7 @@ static int getDevice(struct Context* context, bool maxFs) {
     // Fetch list of available devices
     if ((err = sdrplay_api_GetDevices(devs, &numDevs, MAX_DEVS)) != sdrplay_api_Success) {
         doMessage(context, "sdrplay_api_GetDevices failed %s", sdrplay_api_GetErrorString(err));
-        return 0;
+        return 1;
     }
     doMessage(context, "MaxDevs=%d NumDevs=%d", MAX_DEVS, numDevs);
     if (numDevs > 0) {
@@ -387,19 +1148,15 @@ static int getDevice(struct Context* context, bool maxFs) {
 
 
 /**
-* Configure one channel/tuner.
-* This has been wrapped into a single function because DuoEngine
-* configures the tuner identically.
+* Configure the IF, analog bandwidth, and decimation of one
+* channel/tuner, which together set the hardware sample rate.
 *
 * @param context pointer to DuoEngine Context passed to sdrplay_api
 * @param chanParams channel/tuner to configure
 * @param engine pointer to DuoEngine configuration
 */
-static void configureChannel(
-        struct Context* context, sdrplay_api_RxChannelParamsT *chanParams, struct DuoEngine* engine) {
-    // Set center frequency
-    chanParams->tunerParams.rfFreq.rfHz = engine->tuneFreq;
-
+static void configureRate(
+        struct Context* context, sdrplay_api_RxChannelParamsT *chanParams, const struct DuoEngine* engine) {
     // Set low IF frequency and analog bandwidth
     chanParams->tunerParams.bwType = sdrplay_api_BW_1_536;
     if (engine->maxSampleRate) {
@@ -424,10 +1181,45 @@ static void configureChannel(
         }
     }
 
-    // Configure notch filters
-    chanParams->rspDuoTunerParams.rfNotchEnable = 0;
-    chanParams->rspDuoTunerParams.rfDabNotchEnable = 0;
-    if (engine->notchMwfm) {
+    // Set decimation
+    chanParams->ctrlParams.decimation.enable = 0;
+    chanParams->ctrlParams.decimation.decimationFactor = 1;
+    if (engine->decimFactor == 2 || engine->decimFactor == 4 ||
+        engine->decimFactor == 8 || engine->decimFactor == 16 ||
+        engine->decimFactor == 32) {
+        chanParams->ctrlParams.decimation.enable = 1;
+        chanParams->ctrlParams.decimation.decimationFactor = engine->decimFactor;
+    }
+    else if (engine->decimFactor != 1) {
+        doMessage(
+            context,
+            "invalid decimation factor got=%u, decimation disabled",
+            engine->decimFactor);
+    }
+}
+
+
+/**
+* Configure one channel/tuner.
+* This has been wrapped into a single function because DuoEngine
+* configures the tuner identically.
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+* @param chanParams channel/tuner to configure
+* @param engine pointer to DuoEngine configuration
+*/
+static void configureChannel(
+        struct Context* context, sdrplay_api_RxChannelParamsT *chanParams, struct DuoEngine* engine) {
+    // Set center frequency
+    chanParams->tunerParams.rfFreq.rfHz = engine->tuneFreq;
+
+    // Set IF, analog bandwidth, and decimation
+    configureRate(context, chanParams, engine);
+
+    // Configure notch filters
+    chanParams->rspDuoTunerParams.rfNotchEnable = 0;
+    chanParams->rspDuoTunerParams.rfDabNotchEnable = 0;
+    if (engine->notchMwfm) {
         chanParams->rspDuoTunerParams.rfNotchEnable = 1;
     }
     if (engine->notchDab) {
@@ -456,22 +1248,6 @@ static void configureChannel(
     if (chanParams->ctrlParams.agc.enable != sdrplay_api_AGC_DISABLE) {
         chanParams->ctrlParams.agc.setPoint_dBfs = min(engine->agcSetPoint, 0);
     }
-
-    // Set decimation
-    chanParams->ctrlParams.decimation.enable = 0;
-    chanParams->ctrlParams.decimation.decimationFactor = 1;
-    if (engine->decimFactor == 2 || engine->decimFactor == 4 ||
-        engine->decimFactor == 8 || engine->decimFactor == 16 ||
-        engine->decimFactor == 32) {
-        chanParams->ctrlParams.decimation.enable = 1;
-        chanParams->ctrlParams.decimation.decimationFactor = engine->decimFactor;
-    }
-    else if (engine->decimFactor != 1) {
-        doMessage(
-            context,
-            "invalid decimation factor got=%u, decimation disabled",
-            engine->decimFactor);
-    }
 }
 
 
@@ -574,12 +1350,15 @@ static sdrplay_api_DeviceParamsT* configureDevice(
 
 
 /**
-* Get device params and fill in the provided DuoEngineControl
+* Get device params and fill in the device settings of the provided
+* DuoEngineControl
 *
 * @param context pointer to DuoEngine Context passed to sdrplay_api
 * @param control pointer to DuoEngineControl runtime configuration
+*
+* @return zero on success, non-zero otherwise
 */
-static void populateControl(struct Context* context, struct DuoEngineControl* control) {
+static int populateDevice(struct Context* context, struct DuoEngineControl* control) {
     sdrplay_api_ErrT err;
     sdrplay_api_DeviceParamsT* params = NULL;
     sdrplay_api_RxChannelParamsT *chanParams = NULL;
@@ -588,7 +1367,7 @@ static void populateControl(struct Context* context, struct DuoEngineControl* co
     if ((err = sdrplay_api_GetDeviceParams(context->device.dev, &params)) != sdrplay_api_Success) {
         doMessage(context, "sdrplay_api_GetDeviceParams failed %s",
                sdrplay_api_GetErrorString(err));
-        return;
+        return 1;
     }
     chanParams = params->rxChannelA;
     control->tuneFreq = (float)chanParams->tunerParams.rfFreq.rfHz;
@@ -607,11 +1386,41 @@ static void populateControl(struct Context* context, struct DuoEngineControl* co
     } else if (control->agcBandwidth == sdrplay_api_AGC_100HZ) {
         control->agcBandwidth = 100;
     }
+    return 0;
+}
+
+
+/**
+* Fill in the provided DuoEngineControl, with the device settings kept
+* in lastControl while the device is being recovered
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+* @param control pointer to DuoEngineControl runtime configuration
+*/
+static void populateControl(struct Context* context, struct DuoEngineControl* control) {
+    if (context->recovering) {
+        *control = context->lastControl;
+    }
+    else if (populateDevice(context, control) != 0) {
+        return;
+    }
+    memset(&control->iqA, 0, sizeof(control->iqA));
+    memset(&control->iqB, 0, sizeof(control->iqB));
+    if (context->correct) {
+        // Updated by the stream callbacks, a snapshot may straddle a block
+        duoIQEstimate(&context->correctorA, &control->iqA);
+        duoIQEstimate(&context->correctorB, &control->iqB);
+    }
+    memcpy(control->beams, context->beamTarget, sizeof(control->beams));
+    control->shiftFreq = context->shiftTarget;
+    control->decimFactor = context->decimTarget;
+    control->maxSampleRate = context->maxFsTarget;
+    control->outputRate = context->outputRateTarget;
 }
 
 
 /**
-* Apply runtime configuration changes in the supplied DuoEngineControl.
+* Apply the device settings of the supplied DuoEngineControl.
 * Compares orig and control parameters to detect which settings to
 * update with sdrplay_api.
 * The expected workflow is to use populateControl() to get the current
@@ -621,8 +1430,10 @@ static void populateControl(struct Context* context, struct DuoEngineControl* co
 * @param context pointer to DuoEngine Context passed to sdrplay_api
 * @param orig pointer to DuoEngineControl with state before desired changes
 * @param control pointer to DuoEngineControl runtime configuration
+*
+* @return zero on success, non-zero otherwise
 */
-static void applyControl(struct Context* context, struct DuoEngineControl* orig, struct DuoEngineControl* control) {
+static int applyDevice(struct Context* context, struct DuoEngineControl* orig, struct DuoEngineControl* control) {
     sdrplay_api_ErrT err;
     sdrplay_api_DeviceParamsT* params = NULL;
     sdrplay_api_RxChannelParamsT *chanParams = NULL;
@@ -631,7 +1442,7 @@ static void applyControl(struct Context* context, struct DuoEngineControl* orig,
     if ((err = sdrplay_api_GetDeviceParams(context->device.dev, &params)) != sdrplay_api_Success) {
         doMessage(context, "sdrplay_api_GetDeviceParams failed %s",
                sdrplay_api_GetErrorString(err));
-        return;
+        return 1;
     }
     // Configure both channels identically
     reconfigureChannel(context, params->rxChannelA, control);
@@ -666,22 +1477,113 @@ static void applyControl(struct Context* context, struct DuoEngineControl* orig,
                 sdrplay_api_Update_RspDuo_RfDabNotchControl,
                 sdrplay_api_Update_Ext1_None);
     }
+    return 0;
 }
 
+
 /**
-* Blocking function that loops for as long as DuoEngine is running.
-* Calls user-specified controlCallback() on a regular interval.
+* Apply runtime configuration changes in the supplied DuoEngineControl.
+* Device settings are updated with applyDevice(), or kept in
+* lastControl while the device is being recovered.
 *
 * @param context pointer to DuoEngine Context passed to sdrplay_api
+* @param orig pointer to DuoEngineControl with state before desired changes
+* @param control pointer to DuoEngineControl runtime configuration
+*/
+static void applyControl(struct Context* context, struct DuoEngineControl* orig, struct DuoEngineControl* control) {
+    if (context->recovering) {
+        // restored by recoverDevice()
+        context->lastControl = *control;
+    }
+    else if (applyDevice(context, orig, control) != 0) {
+        return;
+    }
+    if (orig->tuneFreq != control->tuneFreq) {
+        // picked up by updateCalibration()
+        context->calTarget = control->tuneFreq;
+    }
+    if (memcmp(orig->beams, control->beams, sizeof(control->beams))) {
+        // picked up by updateBeams()
+        memcpy(context->beamTarget, control->beams, sizeof(context->beamTarget));
+        context->beamPending = true;
+    }
+    if (orig->shiftFreq != control->shiftFreq) {
+        // picked up by updateShift()
+        context->shiftTarget = control->shiftFreq;
+        context->shiftPending = true;
+    }
+    if (orig->decimFactor != control->decimFactor || orig->maxSampleRate != control->maxSampleRate ||
+        orig->outputRate != control->outputRate) {
+        // picked up by updateRate()
+        context->decimTarget = control->decimFactor;
+        context->maxFsTarget = control->maxSampleRate;
+        context->outputRateTarget = control->outputRate;
+        context->ratePending = true;
+    }
+}
+
+/**
+* Hand the calibration for the latest tuning frequency to the stream
+* callbacks once they have picked up any previous update.
 *
-* @return zero on a clean exit, non-zero otherwise
+* @param context pointer to DuoEngine Context passed to sdrplay_api
 */
-static int controlLoop(struct Context* context) {
+static void updateCalibration(struct Context* context) {
+    // Taps designed now would be for the old rate once a rate change is picked up
+    if (!context->calibrate || context->calFreq == context->calTarget ||
+        atomic_load_explicit(&context->rateUpdate, memory_order_acquire)) {
+        return;
+    }
+    struct DuoCalPoint point;
+    duoCalTableLookup(context->calTable, context->calTarget, &point);
+    if (duoCalStage(&context->calibrator, &point, context->calRate) == 0) {
+        context->calFreq = context->calTarget;
+    }
+}
+
+
+/**
+* Hand the latest beam weights to the stream callbacks once they have
+* picked up any previous update.
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+*/
+static void updateBeams(struct Context* context) {
+    if (!context->beamPending || atomic_load_explicit(&context->beamUpdate, memory_order_acquire)) {
+        return;
+    }
+    memcpy(context->beamStaged, context->beamTarget, sizeof(context->beamStaged));
+    context->beamPending = false;
+    atomic_store_explicit(&context->beamUpdate, true, memory_order_release);
+}
+
+
+/**
+* Hand the latest frequency shift to the stream callbacks once they
+* have picked up any previous update.
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+*/
+static void updateShift(struct Context* context) {
+    if (!context->shiftPending || atomic_load_explicit(&context->shiftUpdate, memory_order_acquire)) {
+        return;
+    }
+    context->shiftStaged = context->shiftTarget;
+    context->shiftPending = false;
+    atomic_store_explicit(&context->shiftUpdate, true, memory_order_release);
+}
+
+
+/**
+* Start streaming from the configured device
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+*
+* @return zero on success, non-zero otherwise
+*/
+static int startStreaming(struct Context* context) {
     sdrplay_api_ErrT err;
     sdrplay_api_CallbackFnsT callbacks;
-    int rcode = 0;
-    struct DuoEngineControl origControl;
-    struct DuoEngineControl userControl;
 
     // Assign callback functions to be passed to sdrplay_api_Init()
     callbacks.StreamACbFn = callbackStreamA;
@@ -694,26 +1596,19 @@ static int controlLoop(struct Context* context) {
         doMessage(context, "sdrplay_api_Init failed %s", sdrplay_api_GetErrorString(err));
         return 1;
     }
+    return 0;
+}
 
-    // Loop allowing user control in main thread
-    while (true) {
-        if (context->controlCallback != NULL) {
-            populateControl(context, &origControl);
-            userControl = origControl;
-            rcode = context->controlCallback(&userControl, context->userContext);
-            if (rcode != 0) {
-                break;
-            }
-            if (memcmp(&origControl, &userControl, sizeof(origControl))) {
-                applyControl(context, &origControl, &userControl);
-            }
-        }
-#if defined(_WIN32) || (_WIN64)
-        Sleep(100);
-#else
-	usleep(100000);
-#endif
-    }
+
+/**
+* Stop streaming and give the API time to wind down
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+*
+* @return zero on success, non-zero otherwise
+*/
+static int stopStreaming(struct Context* context) {
+    sdrplay_api_ErrT err;
 
     // Finished with device so uninitialise it
     if ((err = sdrplay_api_Uninit(context->device.dev)) != sdrplay_api_Success) {
@@ -732,79 +1627,1015 @@ static int controlLoop(struct Context* context) {
 
 
 /**
-* Main function for user to call to pass control to DuoEngine.
-* This is a blocking function and will run until either:
-*   1. An error is encountered
-*   2. The user requests an exit via controlCallback()
+* Configure a resampler for each tuner if the output rate differs from
+* the hardware rate.
 *
+* @param context pointer to DuoEngine Context passed to sdrplay_api
 * @param engine DuoEngine configuration passed by user
+* @param resamplerA resampler to initialize for tuner A
+* @param resamplerB resampler to initialize for tuner B
+* @param resample set to true if the resamplers were initialized
 *
-* @return zero on clean exit, non-zero otherwise
+* @return zero on success, non-zero otherwise
 */
-int duoEngineRun(struct DuoEngine* engine) {
-    struct Context context;
-    int rcode = 0;
-    
-    context.transfer.floatingPoint = engine->floatingPoint;
-    if (engine->floatingPoint) {
-        context.transfer.scalarSize = sizeof(float);
+static int configureResampler(
+        struct Context* context, const struct DuoEngine* engine,
+        struct DuoResampler* resamplerA, struct DuoResampler* resamplerB, bool* resample) {
+    unsigned int inRate = duoEngineHardwareRate(engine);
+    unsigned int outRate = duoEngineSampleRate(engine);
+    *resample = false;
+    if (inRate == outRate) {
+        return 0;
     }
-    else {
-        context.transfer.scalarSize = sizeof(short);
+    if (duoResamplerInit(resamplerA, inRate, outRate, engine->resampleQuality) ||
+        duoResamplerInit(resamplerB, inRate, outRate, engine->resampleQuality)) {
+        doMessage(
+            context, "unsupported resampling from %u Hz to %u Hz", inRate, outRate);
+        duoResamplerFree(resamplerA);
+        duoResamplerFree(resamplerB);
+        return 1;
+    }
+    doMessage(
+        context, "resampling %u/%u with %u taps per output",
+        resamplerA->interp, resamplerA->decim, resamplerA->numTaps);
+    *resample = true;
+    return 0;
+}
+
+
+/**
+* Configure the signal detector if a detector size is set.
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+* @param engine DuoEngine configuration passed by user
+* @param detector detector to initialize
+* @param detect set to true if the detector was initialized
+*
+* @return zero on success, non-zero otherwise
+*/
+static int configureDetector(
+        struct Context* context, const struct DuoEngine* engine,
+        struct DuoDetector* detector, bool* detect) {
+    *detect = false;
+    if (engine->detectSize == 0) {
+        return 0;
+    }
+    if (engine->detectionCallback == NULL) {
+        doMessage(context, "detectionCallback is required when detectSize is set");
+        return 1;
+    }
+    if (duoDetectorInit(
+            detector, engine->detectSize, engine->detectAverages,
+            engine->detectThreshold, engine->detectTimeConstant, duoEngineSampleRate(engine))) {
+        doMessage(
+            context, "unsupported detector size %u with %u averages",
+            engine->detectSize, engine->detectAverages);
+        return 1;
+    }
+    doMessage(
+        context, "detecting with %u bins of %.1f Hz every %.1f ms",
+        engine->detectSize, duoEngineSampleRate(engine) / (double)engine->detectSize,
+        1000.0 * engine->detectSize * engine->detectAverages / duoEngineSampleRate(engine));
+    *detect = true;
+    return 0;
+}
+
+
+/**
+* Release the resamplers and detector in the staged slots, either
+* retired by the stream callbacks or never picked up
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+*/
+static void releaseStaged(struct Context* context) {
+    if (context->resampleStaged) {
+        duoResamplerFree(&context->resamplerStagedA);
+        duoResamplerFree(&context->resamplerStagedB);
+        context->resampleStaged = false;
+    }
+    if (context->detectStaged) {
+        duoDetectorFree(&context->detectorStaged);
+        context->detectStaged = false;
+    }
+}
+
+
+/**
+* Update the IF, analog bandwidth, decimation, and ADC sample rate of
+* both tuners while streaming. The device parameters are restored if
+* the update fails.
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+* @param config configuration with the new sample rate settings
+*
+* @return zero on success, non-zero otherwise
+*/
+static int updateHardwareRate(struct Context* context, const struct DuoEngine* config) {
+    sdrplay_api_ErrT err;
+    sdrplay_api_DeviceParamsT* params = NULL;
+    int reason = sdrplay_api_Update_Ctrl_Decimation | sdrplay_api_Update_Tuner_BwType |
+                 sdrplay_api_Update_Tuner_IfType;
+
+    if ((err = sdrplay_api_GetDeviceParams(context->device.dev, &params)) != sdrplay_api_Success) {
+        doMessage(context, "sdrplay_api_GetDeviceParams failed %s",
+               sdrplay_api_GetErrorString(err));
+        return 1;
+    }
+    configureRate(context, params->rxChannelA, config);
+    configureRate(context, params->rxChannelB, config);
+    if (config->maxSampleRate != context->config.maxSampleRate) {
+        params->devParams->fsFreq.fsHz = config->maxSampleRate ? SAMPLE_FREQ_MAXFS : SAMPLE_FREQ_DEFAULT;
+        reason |= sdrplay_api_Update_Dev_Fs;
+    }
+    if ((err = sdrplay_api_Update(
+            context->device.dev, sdrplay_api_Tuner_Both,
+            (sdrplay_api_ReasonForUpdateT)reason,
+            sdrplay_api_Update_Ext1_None)) != sdrplay_api_Success) {
+        doMessage(context, "sdrplay_api_Update failed %s, sample rate unchanged",
+               sdrplay_api_GetErrorString(err));
+        configureRate(context, params->rxChannelA, &context->config);
+        configureRate(context, params->rxChannelB, &context->config);
+        params->devParams->fsFreq.fsHz = context->config.maxSampleRate ? SAMPLE_FREQ_MAXFS : SAMPLE_FREQ_DEFAULT;
+        return 1;
+    }
+    return 0;
+}
+
+
+/**
+* Apply the latest sample rate settings once the stream callbacks have
+* picked up any previous change. The resamplers and detector for the
+* new rate are built here, then the hardware is updated, and the
+* stream callbacks switch to them at the start of their next callback.
+* Settings that cannot be applied are reverted to the current ones.
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+*/
+static void updateRate(struct Context* context) {
+    const struct DuoEngine* current = &context->config;
+    struct DuoEngine* config = &context->rateStaged;
+    // Calibration taps staged at the old rate have to be picked up first, and the device has to be there
+    if (!context->ratePending || atomic_load_explicit(&context->rateUpdate, memory_order_acquire) ||
+        context->recovering ||
+        (context->calibrate && atomic_load_explicit(&context->calibrator.staged, memory_order_acquire))) {
+        return;
+    }
+    context->ratePending = false;
+    // The state retired by the previous change is no longer used by the stream callbacks
+    releaseStaged(context);
+
+    *config = *current;
+    config->decimFactor = context->decimTarget;
+    config->maxSampleRate = context->maxFsTarget;
+    config->outputRate = context->outputRateTarget;
+    bool hardware = config->decimFactor != current->decimFactor ||
+                    config->maxSampleRate != current->maxSampleRate;
+    if (!hardware && config->outputRate == current->outputRate) {
+        return;
+    }
+    if (config->decimFactor != 1 && config->decimFactor != 2 && config->decimFactor != 4 &&
+        config->decimFactor != 8 && config->decimFactor != 16 && config->decimFactor != 32) {
+        doMessage(context, "invalid decimation factor got=%u, sample rate unchanged", config->decimFactor);
+    }
+    else if (configureResampler(
+                context, config, &context->resamplerStagedA, &context->resamplerStagedB,
+                &context->resampleStaged) == 0 &&
+             configureDetector(context, config, &context->detectorStaged, &context->detectStaged) == 0 &&
+             (!hardware || updateHardwareRate(context, config) == 0)) {
+        doMessage(context, "sample rate changing to %u Hz", duoEngineSampleRate(config));
+        atomic_store_explicit(&context->rateUpdate, true, memory_order_release);
+        return;
+    }
+    releaseStaged(context);
+    context->decimTarget = current->decimFactor;
+    context->maxFsTarget = current->maxSampleRate;
+    context->outputRateTarget = current->outputRate;
+}
+
+
+/**
+* Copy the settings that differ between orig and user into control,
+* leaving the others as they are. The read only estimates are ignored.
+*
+* @param orig settings passed to controlCallback
+* @param user settings returned by controlCallback
+* @param control current settings to update
+*/
+static void mergeControl(
+        const struct DuoEngineControl* orig, const struct DuoEngineControl* user, struct DuoEngineControl* control) {
+    if (orig->tuneFreq != user->tuneFreq) {
+        control->tuneFreq = user->tuneFreq;
+    }
+    if (orig->agcBandwidth != user->agcBandwidth) {
+        control->agcBandwidth = user->agcBandwidth;
+    }
+    if (orig->agcSetPoint != user->agcSetPoint) {
+        control->agcSetPoint = user->agcSetPoint;
+    }
+    if (orig->lnaState != user->lnaState) {
+        control->lnaState = user->lnaState;
+    }
+    if (orig->notchMwfm != user->notchMwfm) {
+        control->notchMwfm = user->notchMwfm;
+    }
+    if (orig->notchDab != user->notchDab) {
+        control->notchDab = user->notchDab;
+    }
+    if (memcmp(orig->beams, user->beams, sizeof(user->beams))) {
+        memcpy(control->beams, user->beams, sizeof(control->beams));
+    }
+    if (orig->shiftFreq != user->shiftFreq) {
+        control->shiftFreq = user->shiftFreq;
     }
-    context.transfer.sampleSize = context.transfer.scalarSize * 2;
-    context.transfer.frameSize = context.transfer.sampleSize * 2;
+    if (orig->decimFactor != user->decimFactor) {
+        control->decimFactor = user->decimFactor;
+    }
+    if (orig->maxSampleRate != user->maxSampleRate) {
+        control->maxSampleRate = user->maxSampleRate;
+    }
+    if (orig->outputRate != user->outputRate) {
+        control->outputRate = user->outputRate;
+    }
+}
+
+
+/**
+* One pass of the control loop. Calls user-specified controlCallback()
+* and hands any staged changes to the stream callbacks.
+*
+* @param context pointer to DuoEngine Context passed to sdrplay_api
+* @param lock engine lock held by the caller, released around
+*             controlCallback so it can call the other duoEngine functions
+*
+* @return zero to continue, non-zero once controlCallback asked to stop
+*/
+static int controlStep(struct Context* context, DuoMutex* lock) {
+    struct DuoEngineControl origControl;
+    struct DuoEngineControl userControl;
+    struct DuoEngineControl currControl;
+    struct DuoEngineControl newControl;
+
+    if (context->controlCallback != NULL) {
+        populateControl(context, &origControl);
+        userControl = origControl;
+        duoMutexUnlock(lock);
+        int stop = context->controlCallback(&userControl, context->userContext);
+        duoMutexLock(lock);
+        if (stop != 0) {
+            return 1;
+        }
+        if (memcmp(&origControl, &userControl, sizeof(origControl))) {
+            // Settings changed by duoEngineSetControl() during the callback are kept
+            populateControl(context, &currControl);
+            newControl = currControl;
+            mergeControl(&origControl, &userControl, &newControl);
+            applyControl(context, &currControl, &newControl);
+        }
+    }
+    updateCalibration(context);
+    updateBeams(context);
+    updateShift(context);
+    updateRate(context);
+    return 0;
+}
 
-    context.transfer.numFrames = engine->maxTransferSize / context.transfer.frameSize;
-    context.transfer.numSamples = context.transfer.numFrames * 2;
-    context.transfer.numScalars = context.transfer.numSamples * 2;
-    context.transfer.numBytes = context.transfer.numScalars * context.transfer.scalarSize;
+
+/**
+* Fill in a zeroed context from the engine configuration and allocate
+* its buffers and signal processing state.
+*
+* @param context pointer to zeroed DuoEngine Context
+* @param engine DuoEngine configuration passed by user
+*
+* @return zero on success, non-zero otherwise
+*/
+static int initContext(struct Context* context, struct DuoEngine* engine) {
+    int rcode = 0;
+    unsigned int sampleBits = 0;
+    unsigned int frameBits = 0;
+    unsigned int stream = 0;
+
+    context->config = *engine;
+    context->decimTarget = engine->decimFactor;
+    context->maxFsTarget = engine->maxSampleRate;
+    context->outputRateTarget = engine->outputRate;
+    context->ratePending = false;
+    atomic_store_explicit(&context->rateUpdate, false, memory_order_relaxed);
+    context->resampleStaged = false;
+    context->detectStaged = false;
+
+    context->transfer.format = duoEngineFormat(engine);
+    context->transfer.floatingPoint = context->transfer.format == DUO_FORMAT_FLOAT32 ||
+                                      context->transfer.format == DUO_FORMAT_FLOAT16;
+    context->transfer.outputMask = duoEngineOutputMask(engine);
+    context->transfer.numStreams = duoEngineNumStreams(context->transfer.outputMask);
+    context->transfer.bitsPerScalar = duoEngineFormatBits(context->transfer.format);
+    sampleBits = context->transfer.bitsPerScalar * 2;
+    frameBits = sampleBits * context->transfer.numStreams;
+    // Sizes that are not a whole number of bytes are reported as zero
+    context->transfer.scalarSize = (context->transfer.bitsPerScalar % 8) ? 0 : context->transfer.bitsPerScalar / 8;
+    context->transfer.sampleSize = (sampleBits % 8) ? 0 : sampleBits / 8;
+    context->transfer.frameSize = (frameBits % 8) ? 0 : frameBits / 8;
+
+    context->transfer.layout = engine->layout;
+    context->transfer.numFrames = duoEngineTransferFrames(engine);
+    context->transfer.numSamples = context->transfer.numFrames * context->transfer.numStreams;
+    context->transfer.numScalars = context->transfer.numSamples * 2;
+    context->transfer.numBytes = context->transfer.numFrames * frameBits / 8;
+    context->transfer.sampleRate = (float)duoEngineSampleRate(engine);
+    context->transfer.epoch = 0;
+
+    // The buffer holds floats or 16-bit scalars that are packed on transfer
+    context->scalarSize = context->transfer.floatingPoint ? sizeof(float) : sizeof(short);
+    context->packBuffer = NULL;
 
     // Make sure the buffer size is a multiple of the transfer size
-    context.bufferSize = 100 * context.transfer.numBytes;
-    context.bufferLen = context.bufferSize / context.transfer.scalarSize;
-    context.buffer = malloc(context.bufferSize);
+    context->bufferSize = 100 * context->transfer.numScalars * context->scalarSize;
+    context->bufferLen = context->bufferSize / context->scalarSize;
+    context->buffer = malloc(context->bufferSize);
  
-    if (context.buffer == NULL) {
+    if (context->buffer == NULL) {
         perror("malloc failed");
         return 1;
     }
 
-    context.numSamplesA = 0;
-    context.numSamplesB = 0;
-    context.rxIdx = 0;
-    context.txIdx = 0;
-    context.transferCallback = engine->transferCallback;
-    context.controlCallback = engine->controlCallback;
-    context.messageCallback = engine->messageCallback;
-    context.userContext = engine->userContext;
+    if (context->transfer.format != DUO_FORMAT_INT16 && context->transfer.format != DUO_FORMAT_FLOAT32) {
+        context->packBuffer = malloc(context->transfer.numBytes);
+        if (context->packBuffer == NULL) {
+            perror("malloc failed");
+            return 1;
+        }
+    }
+
+    // Selected streams are placed in order A, B, sum, diff, beams
+    for (unsigned int idx = 0; idx < DUO_MAX_STREAMS; idx++) {
+        context->streamIdx[idx] = -1;
+        if (context->transfer.outputMask & (1u << idx)) {
+            context->streamIdx[idx] = (int)stream;
+            switch (context->transfer.layout) {
+            case DUO_LAYOUT_PLANAR:
+            case DUO_LAYOUT_SPLIT:
+                context->chanOffset[stream] = stream * context->transfer.numFrames * 2;
+                break;
+            default:
+                context->chanOffset[stream] = stream * 2;
+                break;
+            }
+            stream++;
+        }
+    }
+    switch (context->transfer.layout) {
+    case DUO_LAYOUT_PLANAR:
+        context->chanStride = 2;
+        context->quadOffset = 1;
+        break;
+    case DUO_LAYOUT_SPLIT:
+        context->chanStride = 1;
+        context->quadOffset = context->transfer.numFrames;
+        break;
+    default:
+        context->chanStride = context->transfer.numStreams * 2;
+        context->quadOffset = 1;
+        break;
+    }
+    context->needStash = (context->transfer.outputMask & (DUO_OUTPUT_SUM | DUO_OUTPUT_DIFF | DUO_OUTPUT_BEAMS)) != 0 ||
+                         engine->detectSize != 0 || engine->measurePower;
+    context->stashI = NULL;
+    context->stashQ = NULL;
+    context->stashLen = 0;
+    context->deliver = engine->transferCallback != NULL || engine->readBufferSize != 0;
+    context->beamform = (context->transfer.outputMask & DUO_OUTPUT_BEAMS) != 0 && context->deliver;
+    memcpy(context->beams, engine->beams, sizeof(context->beams));
+    memcpy(context->beamTarget, engine->beams, sizeof(context->beamTarget));
+    context->beamPending = false;
+    atomic_store_explicit(&context->beamUpdate, false, memory_order_relaxed);
+    for (unsigned int idx = 0; idx < DUO_MAX_BEAMS; idx++) {
+        context->beamI[idx] = NULL;
+        context->beamQ[idx] = NULL;
+        context->beamLen[idx] = 0;
+    }
+    context->correct = engine->iqCorrection;
+    context->correctedI = NULL;
+    context->correctedQ = NULL;
+    context->correctedLen = 0;
+    if (context->correct) {
+        // Estimates persist across stream resets since the impairments belong to the hardware
+        duoIQInit(&context->correctorA, duoEngineHardwareRate(engine), engine->iqTimeConstant);
+        duoIQInit(&context->correctorB, duoEngineHardwareRate(engine), engine->iqTimeConstant);
+    }
+    context->calibrate = engine->calibration != NULL;
+    context->calTable = engine->calibration;
+    context->calibratedI = NULL;
+    context->calibratedQ = NULL;
+    context->calibratedLen = 0;
+    if (context->calibrate) {
+        struct DuoCalPoint point;
+        context->calRate = duoEngineHardwareRate(engine);
+        context->calFreq = engine->tuneFreq;
+        context->calTarget = engine->tuneFreq;
+        duoCalTableLookup(context->calTable, engine->tuneFreq, &point);
+        duoCalInit(&context->calibrator, &point, context->calRate);
+    }
+    context->ncoRate = duoEngineHardwareRate(engine);
+    duoNCOInit(&context->nco, engine->shiftFreq, context->ncoRate);
+    context->mixing = false;
+    context->shiftTarget = engine->shiftFreq;
+    context->shiftStaged = engine->shiftFreq;
+    context->shiftPending = false;
+    atomic_store_explicit(&context->shiftUpdate, false, memory_order_relaxed);
+    context->mixedI = NULL;
+    context->mixedQ = NULL;
+    context->mixedLen = 0;
+    context->resample = false;
+    context->resampledI = NULL;
+    context->resampledQ = NULL;
+    context->resampledLen = 0;
+    configureFlush(context);
+    context->schedPolicy = engine->schedPolicy;
+    context->schedPriority = engine->schedPriority;
+    context->streamCpus = engine->streamCpus;
+    context->threadReadyA = false;
+    context->threadReadyB = false;
+    context->measurePower = engine->measurePower;
+    context->powerSumA = 0;
+    context->powerSumB = 0;
+    context->transfer.powerA = DUO_POWER_FLOOR_DB;
+    context->transfer.powerB = DUO_POWER_FLOOR_DB;
+
+    context->numSamplesA = 0;
+    context->numSamplesB = 0;
+    context->rxIdx = 0;
+    context->rxFrame = 0;
+    context->txIdx = 0;
+    context->transferCallback = engine->transferCallback;
+    context->detectionCallback = engine->detectionCallback;
+    context->controlCallback = engine->controlCallback;
+    context->messageCallback = engine->messageCallback;
+    context->userContext = engine->userContext;
+
+    context->detect = false;
+    if (!context->deliver && engine->detectionCallback == NULL) {
+        doMessage(context, "transferCallback is required unless detectionCallback or readBufferSize is set");
+        rcode = 1;
+    }
+    context->read = false;
+    if (rcode == 0 && engine->readBufferSize != 0) {
+        if (context->transfer.layout != DUO_LAYOUT_INTERLEAVED || context->transfer.frameSize == 0) {
+            doMessage(context, "readBufferSize requires the interleaved layout and whole byte frames");
+            rcode = 1;
+        }
+        else if (engine->readBufferSize / context->transfer.numBytes < 2) {
+            doMessage(context, "readBufferSize must hold at least two transfers of %u bytes",
+                      context->transfer.numBytes);
+            rcode = 1;
+        }
+        else if (duoRingInit(&context->ring, context->transfer.frameSize, engine->readBufferSize) != 0) {
+            doMessage(context, "failed to allocate %u byte read buffer", engine->readBufferSize);
+            rcode = 1;
+        }
+        else {
+            context->ring.rate = context->transfer.sampleRate;
+            context->read = true;
+        }
+    }
+    if (rcode == 0) {
+        rcode = configureResampler(context, engine, &context->resamplerA, &context->resamplerB, &context->resample);
+    }
+    if (rcode == 0) {
+        rcode = configureDetector(context, engine, &context->detector, &context->detect);
+    }
+    return rcode;
+}
+
+
+/**
+* Write every buffer allocated by initContext() once so that streaming
+* does not take page faults on them
+*
+* @param context pointer to DuoEngine Context
+*/
+static void prefaultContext(struct Context* context) {
+    duoRtPrefault(context->buffer, context->bufferSize);
+    duoRtPrefault(context->packBuffer, context->transfer.numBytes);
+    if (context->read) {
+        duoRtPrefault(context->ring.data, (size_t)(context->ring.capacity + context->ring.mirror) * context->ring.frameSize);
+    }
+}
+
+
+/**
+* Release everything allocated by initContext()
+*
+* @param context pointer to DuoEngine Context
+*/
+static void freeContext(struct Context* context) {
+    if (context->buffer) {
+        free(context->buffer);
+        context->buffer = NULL;
+    }
+    if (context->packBuffer) {
+        free(context->packBuffer);
+        context->packBuffer = NULL;
+    }
+    free(context->stashI);
+    free(context->stashQ);
+    if (context->resample) {
+        duoResamplerFree(&context->resamplerA);
+        duoResamplerFree(&context->resamplerB);
+    }
+    free(context->resampledI);
+    free(context->resampledQ);
+    free(context->mixedI);
+    free(context->mixedQ);
+    if (context->detect) {
+        duoDetectorFree(&context->detector);
+    }
+    free(context->correctedI);
+    free(context->correctedQ);
+    if (context->calibrate) {
+        duoCalFree(&context->calibrator);
+    }
+    free(context->calibratedI);
+    free(context->calibratedQ);
+    for (unsigned int idx = 0; idx < DUO_MAX_BEAMS; idx++) {
+        free(context->beamI[idx]);
+        free(context->beamQ[idx]);
+    }
+    releaseStaged(context);
+    if (context->read) {
+        duoRingFree(&context->ring);
+        context->read = false;
+    }
+}
+
+
+/**
+* Running engine: the context shared with the stream callbacks plus the
+* control thread that calls controlCallback and stages updates.
+* The lock serializes the control thread with duoEngineSetControl()
+* and duoEngineGetControl(), and guards stopRequested and stopped.
+* It is released around controlCallback and the slow device calls.
+*/
+struct DuoEngineHandle {
+    struct Context context;
+    DuoThread thread;
+    DuoMutex lock;
+    DuoCond cond;
+    // how far duoEngineStart() got, so duoEngineStop() can undo it
+    bool apiOpen;
+    bool deviceSelected;
+    bool streaming;
+    bool threadStarted;
+    bool stopRequested;
+    bool stopped;
+    // true if lockMemory was applied, undone by duoEngineStop()
+    bool memoryLocked;
+    unsigned long long controlCpus;
+    // automatic recovery state of the control thread, see recoverDevice()
+    unsigned int lastCallbackCount;
+    unsigned long long lastCallbackMs;
+    unsigned long long lostMs;
+    unsigned long long retryMs;
+    struct DuoEngineStats stats;
+#if !defined(_WIN32) && !defined(_WIN64)
+    // pipe written once when the engine stops, the read end is returned by duoEngineGetFd()
+    int notifyFd[2];
+#endif
+};
+
+
+/**
+* Stop streaming on a lost device and bring it back: release it, select
+* it again, configure it for the current sample rate with the device
+* settings of control, and restart streaming. The frames received
+* before the loss are delivered first.
+*
+* @param handle engine being recovered
+* @param control device settings to restore
+*
+* @return zero once streaming again, non-zero otherwise
+*/
+static int reopenDevice(struct DuoEngineHandle* handle, struct DuoEngineControl* control) {
+    struct Context* context = &handle->context;
+    // A rate already handed to the stream callbacks is switched to at their first callback
+    const struct DuoEngine* config = atomic_load_explicit(&context->rateUpdate, memory_order_acquire) ?
+        &context->rateStaged : &context->config;
+    int rcode = 0;
+
+    if (handle->streaming) {
+        // A removed device may fail to uninitialise, it is released regardless
+        stopStreaming(context);
+        handle->streaming = false;
+        flushTransfer(context, false);
+    }
+    if (handle->deviceSelected) {
+        sdrplay_api_ReleaseDevice(&context->device);
+        handle->deviceSelected = false;
+    }
+
+    sdrplay_api_LockDeviceApi();
+    rcode = getDevice(context, config->maxSampleRate);
+    handle->deviceSelected = rcode == 0;
+    sdrplay_api_UnlockDeviceApi();
 
-    rcode = openApi(&context, engine->apiDebug);
+    if (rcode == 0) {
+        context->params = configureDevice(context, (struct DuoEngine*)config);
+        if (context->params == NULL) {
+            rcode = 1;
+        }
+    }
+    if (rcode == 0) {
+        reconfigureChannel(context, context->params->rxChannelA, control);
+        reconfigureChannel(context, context->params->rxChannelB, control);
+        // No callbacks run until streaming starts
+        resetStream(context);
+        atomic_store_explicit(&context->deviceRemoved, false, memory_order_release);
+        context->threadReadyA = false;
+        context->threadReadyB = false;
+        rcode = startStreaming(context);
+        handle->streaming = rcode == 0;
+    }
+    return rcode;
+}
+
+
+/**
+* Watch for a removed device or a stream without tuner callbacks for
+* recoverTimeout seconds, and recover the device with reopenDevice()
+* every RECOVER_RETRY_MS until it succeeds. A stream thread held up in
+* a user callback is back-pressure rather than a stall, and streaming
+* is never stopped under it, so recovery waits for it to return.
+* Called by the control thread with the lock held, which is released
+* while the device is reopened. Control changes in the meantime are
+* kept in lastControl and applied once streaming again.
+*
+* @param handle running engine
+*/
+static void recoverDevice(struct DuoEngineHandle* handle) {
+    struct Context* context = &handle->context;
+    unsigned long long now = duoClockMs();
+    struct DuoEngineControl restored;
+    struct DuoEngineControl current;
+
+    if (context->config.recoverTimeout <= 0.0f) {
+        return;
+    }
+    if (!context->recovering) {
+        unsigned int callbackCount = atomic_load_explicit(&context->callbackCount, memory_order_relaxed);
+        const char* reason = NULL;
+        if (atomic_load_explicit(&context->inUserCallback, memory_order_acquire)) {
+            handle->lastCallbackMs = now;
+            return;
+        }
+        if (atomic_load_explicit(&context->deviceRemoved, memory_order_acquire)) {
+            reason = "device removed";
+        }
+        else if (callbackCount != handle->lastCallbackCount) {
+            handle->lastCallbackCount = callbackCount;
+            handle->lastCallbackMs = now;
+        }
+        else if (now - handle->lastCallbackMs >= (unsigned long long)(context->config.recoverTimeout * 1000.0f)) {
+            reason = "stream stalled";
+        }
+        if (reason == NULL) {
+            return;
+        }
+        // Settings from startup or the last snapshot are kept if the device no longer answers
+        populateDevice(context, &context->lastControl);
+        context->recovering = true;
+        handle->stats.deviceLosses++;
+        handle->lostMs = now;
+        handle->retryMs = now;
+        doMessage(context, "%s, recovering device", reason);
+    }
+    if (now < handle->retryMs) {
+        return;
+    }
+
+    restored = context->lastControl;
+    duoMutexUnlock(&handle->lock);
+    int rcode = reopenDevice(handle, &restored);
+    duoMutexLock(&handle->lock);
+    now = duoClockMs();
+    if (rcode != 0) {
+        handle->stats.failedAttempts++;
+        handle->retryMs = now + RECOVER_RETRY_MS;
+        return;
+    }
+
+    context->recovering = false;
+    handle->lastCallbackCount = atomic_load_explicit(&context->callbackCount, memory_order_relaxed);
+    handle->lastCallbackMs = now;
+    handle->stats.recoveries++;
+    handle->stats.lastRecoveryTime = (float)(now - handle->lostMs) / 1000.0f;
+    handle->stats.totalRecoveryTime += handle->stats.lastRecoveryTime;
+    doMessage(context, "device recovered after %.1f s", handle->stats.lastRecoveryTime);
+    // Changes made while the device was being reopened
+    current = context->lastControl;
+    if (memcmp(&restored, &current, sizeof(current))) {
+        applyDevice(context, &restored, &current);
+    }
+}
+
+
+static void controlThread(void* arg) {
+    struct DuoEngineHandle* handle = (struct DuoEngineHandle*)arg;
+    configureThread(&handle->context, "control", handle->controlCpus);
+    handle->lastCallbackMs = duoClockMs();
+    duoMutexLock(&handle->lock);
+    while (!handle->stopRequested) {
+        if (controlStep(&handle->context, &handle->lock) != 0) {
+            break;
+        }
+        recoverDevice(handle);
+        duoCondTimedWait(&handle->cond, &handle->lock, CONTROL_INTERVAL_MS);
+    }
+    handle->stopped = true;
+    duoCondBroadcast(&handle->cond);
+    duoMutexUnlock(&handle->lock);
+    if (handle->context.read) {
+        // Readers drain what is left and then see the end of the stream
+        duoRingClose(&handle->context.ring);
+    }
+#if !defined(_WIN32) && !defined(_WIN64)
+    char signal = 1;
+    if (write(handle->notifyFd[1], &signal, 1) != 1) {
+        doMessage(&handle->context, "failed to signal engine stop");
+    }
+#endif
+}
+
+
+int duoEngineStart(struct DuoEngine* engine, struct DuoEngineHandle** handle) {
+    int rcode = 0;
+    *handle = NULL;
+    // Zeroed so a partial start can be released by duoEngineStop()
+    struct DuoEngineHandle* engineHandle = (struct DuoEngineHandle*)calloc(1, sizeof(struct DuoEngineHandle));
+    if (engineHandle == NULL) {
+        perror("calloc failed");
+        return 1;
+    }
+    struct Context* context = &engineHandle->context;
+    duoMutexInit(&engineHandle->lock);
+    duoCondInit(&engineHandle->cond);
+#if !defined(_WIN32) && !defined(_WIN64)
+    engineHandle->notifyFd[0] = -1;
+    engineHandle->notifyFd[1] = -1;
+    if (pipe(engineHandle->notifyFd) != 0) {
+        perror("pipe failed");
+        engineHandle->notifyFd[0] = -1;
+        engineHandle->notifyFd[1] = -1;
+        rcode = 1;
+    }
+#endif
+
+    if (rcode == 0) {
+        rcode = initContext(context, engine);
+        engineHandle->controlCpus = engine->controlCpus;
+    }
+    if (rcode == 0 && engine->lockMemory) {
+        int error = duoRtLockMemory();
+        if (error) {
+            doMessage(context, "failed to lock memory: %s", duoRtReason(error));
+        }
+        else {
+            engineHandle->memoryLocked = true;
+            doMessage(context, "memory locked");
+        }
+    }
+    if (rcode == 0 && engine->prefault) {
+        prefaultContext(context);
+    }
+    if (rcode == 0) {
+        rcode = openApi(context, engine->apiDebug);
+        engineHandle->apiOpen = rcode == 0;
+    }
     if (rcode == 0) {
         // Lock API while device selection is performed
         sdrplay_api_LockDeviceApi();
 
-        rcode = getDevice(&context, engine->maxSampleRate);
+        rcode = getDevice(context, engine->maxSampleRate);
+        engineHandle->deviceSelected = rcode == 0;
 
         // Unlock API now that device is selected
         sdrplay_api_UnlockDeviceApi();
+    }
+    if (rcode == 0) {
+        context->params = configureDevice(context, engine);
+        if (context->params == NULL) {
+            rcode = 1;
+        }
+    }
+    if (rcode == 0) {
+        // Device settings restored if the device is lost before a later snapshot
+        populateDevice(context, &context->lastControl);
+        rcode = startStreaming(context);
+        engineHandle->streaming = rcode == 0;
+    }
+    if (rcode == 0) {
+        rcode = duoThreadCreate(&engineHandle->thread, controlThread, engineHandle);
+        engineHandle->threadStarted = rcode == 0;
+        if (rcode != 0) {
+            doMessage(context, "failed to start control thread");
+        }
+    }
 
-        if (rcode == 0) {
-            context.params = configureDevice(&context, engine);
-            if (context.params != NULL) {
-                rcode = controlLoop(&context);
-            }
-            // Release device (make it available to other applications)
-            sdrplay_api_ReleaseDevice(&context.device);
+    if (rcode != 0) {
+        duoEngineStop(engineHandle);
+        return rcode;
+    }
+    *handle = engineHandle;
+    return 0;
+}
+
+
+int duoEnginePoll(struct DuoEngineHandle* handle, unsigned int timeoutMs) {
+    duoMutexLock(&handle->lock);
+    if (!handle->stopped && timeoutMs > 0) {
+        duoCondTimedWait(&handle->cond, &handle->lock, timeoutMs);
+    }
+    bool stopped = handle->stopped;
+    duoMutexUnlock(&handle->lock);
+    return stopped ? 1 : 0;
+}
+
+
+int duoEngineGetFd(struct DuoEngineHandle* handle) {
+#if defined(_WIN32) || defined(_WIN64)
+    return -1;
+#else
+    return handle->notifyFd[0];
+#endif
+}
+
+
+int duoEngineGetControl(struct DuoEngineHandle* handle, struct DuoEngineControl* control) {
+    duoMutexLock(&handle->lock);
+    bool stopped = handle->stopped;
+    if (!stopped) {
+        populateControl(&handle->context, control);
+    }
+    duoMutexUnlock(&handle->lock);
+    return stopped ? 1 : 0;
+}
+
+
+int duoEngineSetControl(struct DuoEngineHandle* handle, const struct DuoEngineControl* control) {
+    struct DuoEngineControl origControl;
+    struct DuoEngineControl userControl = *control;
+    duoMutexLock(&handle->lock);
+    bool stopped = handle->stopped;
+    if (!stopped) {
+        populateControl(&handle->context, &origControl);
+        if (memcmp(&origControl, &userControl, sizeof(origControl))) {
+            applyControl(&handle->context, &origControl, &userControl);
         }
+        // Stage the changes now rather than at the next control interval
+        updateCalibration(&handle->context);
+        updateBeams(&handle->context);
+        updateShift(&handle->context);
+    }
+    duoMutexUnlock(&handle->lock);
+    return stopped ? 1 : 0;
+}
 
-        sdrplay_api_Close();
+
+int duoEngineRead(struct DuoEngineHandle* handle, void* buffer, unsigned int numFrames, unsigned int timeoutMs) {
+    struct DuoRing* ring = &handle->context.ring;
+    if (!handle->context.read) {
+        return -1;
+    }
+    if (numFrames > ring->capacity) {
+        numFrames = ring->capacity;
+    }
+    duoRingWait(ring, numFrames, timeoutMs);
+    unsigned int count = duoRingRead(ring, buffer, numFrames);
+    if (count == 0 && duoRingDrained(ring)) {
+        return -1;
+    }
+    return (int)count;
+}
+
+
+int duoEnginePeek(struct DuoEngineHandle* handle, const void** data, unsigned int numFrames, unsigned int timeoutMs) {
+    struct DuoRing* ring = &handle->context.ring;
+    *data = NULL;
+    if (!handle->context.read) {
+        return -1;
+    }
+    // Only the mirrored run past the tail is guaranteed to be contiguous
+    if (numFrames > ring->mirror) {
+        numFrames = ring->mirror;
+    }
+    unsigned int available = duoRingWait(ring, numFrames, timeoutMs);
+    if (available == 0 && duoRingDrained(ring)) {
+        return -1;
+    }
+    *data = duoRingTail(ring);
+    return (int)(available < numFrames ? available : numFrames);
+}
+
+
+int duoEngineConsume(struct DuoEngineHandle* handle, unsigned int numFrames) {
+    if (!handle->context.read) {
+        return 1;
+    }
+    return duoRingConsume(&handle->context.ring, numFrames) == numFrames ? 0 : 1;
+}
+
+
+int duoEngineGetOverruns(struct DuoEngineHandle* handle, unsigned long long* overruns, unsigned long long* droppedFrames) {
+    struct DuoRing* ring = &handle->context.ring;
+    if (!handle->context.read) {
+        return 1;
+    }
+    duoMutexLock(&ring->lock);
+    *overruns = ring->overruns;
+    *droppedFrames = ring->dropped;
+    duoMutexUnlock(&ring->lock);
+    return 0;
+}
+
+
+int duoEngineGetStats(struct DuoEngineHandle* handle, struct DuoEngineStats* stats) {
+    duoMutexLock(&handle->lock);
+    *stats = handle->stats;
+    stats->discontinuities = atomic_load_explicit(&handle->context.discontinuities, memory_order_relaxed);
+    stats->recovering = handle->context.recovering;
+    duoMutexUnlock(&handle->lock);
+    return 0;
+}
+
+
+int duoEngineGetReadRate(
+        struct DuoEngineHandle* handle, float* sampleRate, unsigned int* epoch, unsigned int* untilChange) {
+    if (!handle->context.read) {
+        return 1;
     }
+    *sampleRate = duoRingRate(&handle->context.ring, epoch, untilChange);
+    return 0;
+}
+
 
-    if (context.buffer) {
-        free(context.buffer);
-        context.buffer = NULL;
+int duoEngineHalt(struct DuoEngineHandle* handle) {
+    int rcode = 0;
+    if (handle == NULL) {
+        return 1;
+    }
+    duoMutexLock(&handle->lock);
+    handle->stopRequested = true;
+    duoCondBroadcast(&handle->cond);
+    duoMutexUnlock(&handle->lock);
+    if (handle->threadStarted) {
+        duoThreadJoin(handle->thread);
+        handle->threadStarted = false;
+    }
+    if (handle->streaming && stopStreaming(&handle->context) != 0) {
+        rcode = 1;
+    }
+    handle->streaming = false;
+    if (handle->deviceSelected) {
+        // Release device (make it available to other applications)
+        sdrplay_api_ReleaseDevice(&handle->context.device);
+        handle->deviceSelected = false;
+    }
+    if (handle->apiOpen) {
+        sdrplay_api_Close();
+        handle->apiOpen = false;
     }
+    return rcode;
+}
 
+
+int duoEngineStop(struct DuoEngineHandle* handle) {
+    if (handle == NULL) {
+        return 1;
+    }
+    int rcode = duoEngineHalt(handle);
+    freeContext(&handle->context);
+    if (handle->memoryLocked) {
+        duoRtUnlockMemory();
+    }
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (handle->notifyFd[0] >= 0) {
+        close(handle->notifyFd[0]);
+        close(handle->notifyFd[1]);
+    }
+#endif
+    duoCondDestroy(&handle->cond);
+    duoMutexDestroy(&handle->lock);
+    free(handle);
     return rcode;
 }
+
+
+int duoEngineRun(struct DuoEngine* engine) {
+    struct DuoEngineHandle* handle = NULL;
+    int rcode = duoEngineStart(engine, &handle);
+    if (rcode != 0) {
+        return rcode;
+    }
+    while (!duoEnginePoll(handle, 1000)) {
+    }
+    return duoEngineStop(handle);
+}
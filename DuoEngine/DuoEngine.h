@@ -31,14 +31,113 @@ extern "C" {
 #endif
 
 
+/**
+* Sample scalar formats DuoEngine can deliver.
+* The packed integer formats keep the most significant bits of the
+* 16-bit scalars from sdrplay_api. They are bit-packed little-endian
+* with no padding between scalars (see DuoPack.h for pack and unpack
+* routines).
+*/
+enum DuoEngineFormat {
+    // 16-bit signed integer scalars as delivered by sdrplay_api
+    DUO_FORMAT_INT16 = 0,
+    // 32-bit IEEE floating point scalars scaled to [-1.0, 1.0]
+    DUO_FORMAT_FLOAT32 = 1,
+    // 12-bit signed integer scalars, two scalars in three bytes
+    DUO_FORMAT_INT12 = 2,
+    // 14-bit signed integer scalars, four scalars in seven bytes
+    DUO_FORMAT_INT14 = 3,
+    // 8-bit signed integer scalars for bandwidth-constrained links
+    DUO_FORMAT_INT8 = 4,
+    // 16-bit IEEE half-precision floating point scaled to [-1.0, 1.0]
+    DUO_FORMAT_FLOAT16 = 5
+};
+
+
+/**
+* Arrangement of the scalars within each transfer.
+* N is the number of frames in the transfer.
+*/
+enum DuoEngineLayout {
+    // frames of Ia, Qa, Ib, Qb
+    DUO_LAYOUT_INTERLEAVED = 0,
+    // N samples (Ia, Qa) from tuner A followed by N samples from tuner B
+    DUO_LAYOUT_PLANAR = 1,
+    // split-complex blocks of N scalars each: Ia, Qa, Ib, Qb
+    DUO_LAYOUT_SPLIT = 2
+};
+
+
+/**
+* Output streams DuoEngine can deliver, combined as a bitmask.
+* Selected streams appear in each frame in the order listed here.
+* The sum and difference streams are scaled by 1/2 to stay in range.
+* The beam streams are weighted sums of A and B, see struct DuoEngineBeam.
+*/
+enum DuoEngineOutput {
+    // tuner A samples
+    DUO_OUTPUT_A = 0x1,
+    // tuner B samples
+    DUO_OUTPUT_B = 0x2,
+    // (A + B) / 2
+    DUO_OUTPUT_SUM = 0x4,
+    // (A - B) / 2
+    DUO_OUTPUT_DIFF = 0x8,
+    // first steered beam, beams[0]
+    DUO_OUTPUT_BEAM0 = 0x10,
+    // second steered beam, beams[1]
+    DUO_OUTPUT_BEAM1 = 0x20
+};
+
+/**
+* Filter quality of the DuoEngine resampler.
+* Higher quality widens the passband and deepens the stopband at the
+* cost of more taps per output sample.
+*/
+enum DuoEngineResampleQuality {
+    // 80% of the output bandwidth passed, 60 dB stopband
+    DUO_RESAMPLE_LOW = 0,
+    // 90% of the output bandwidth passed, 80 dB stopband
+    DUO_RESAMPLE_MEDIUM = 1,
+    // 95% of the output bandwidth passed, 100 dB stopband
+    DUO_RESAMPLE_HIGH = 2
+};
+
+/**
+* Scheduling policy of the threads that run DuoEngine processing
+*/
+enum DuoEngineSched {
+    // leave the threads with the default time-sharing scheduler
+    DUO_SCHED_DEFAULT = 0,
+    // SCHED_FIFO real-time scheduling
+    DUO_SCHED_FIFO = 1,
+    // SCHED_RR real-time scheduling
+    DUO_SCHED_RR = 2
+};
+
+#define DUO_OUTPUT_BOTH (DUO_OUTPUT_A | DUO_OUTPUT_B)
+#define DUO_OUTPUT_BEAMS (DUO_OUTPUT_BEAM0 | DUO_OUTPUT_BEAM1)
+#define DUO_OUTPUT_ALL (DUO_OUTPUT_A | DUO_OUTPUT_B | DUO_OUTPUT_SUM | DUO_OUTPUT_DIFF | DUO_OUTPUT_BEAMS)
+#define DUO_MAX_STREAMS (6)
+#define DUO_MAX_BEAMS (2)
+
+
 /**
 * Representation of a transfer of data from engine to user.
 * Includes redundant metadata to make it easy for users to interpret
 * the data in multiple ways (e.g. scalar, sample, or frame).
 * In context of DuoEngine, the following definitions apply:
 *     scalar: single value I or Q
-*     sample: complex sample from a single source (I, Q)
-*     frame: pair of samples from two sources (Ia, Qa, Ib, Qb)
+*     sample: complex sample from a single stream (I, Q)
+*     frame: one sample from each selected output stream, by default
+*            a pair of samples from two tuners (Ia, Qa, Ib, Qb)
+* NOTE: for bit-packed formats, scalarSize, sampleSize, and frameSize
+* are zero when the value is not a whole number of bytes. Use
+* bitsPerScalar instead.
+* NOTE: floatingPoint is true for both float32 and float16, check
+* format before casting data.
+* NOTE: for the planar and split layouts the sizes still describe
+* whole frames, but the scalars of each frame are not contiguous.
 */
 struct DuoEngineTransfer {
     bool floatingPoint;
@@ -50,6 +149,64 @@ struct DuoEngineTransfer {
     unsigned int numSamples;
     unsigned int numFrames;
     void* data;
+    // added fields follow data so the original layout is unchanged
+    enum DuoEngineFormat format;
+    enum DuoEngineLayout layout;
+    // selected output streams, see enum DuoEngineOutput
+    unsigned int outputMask;
+    // number of samples in each frame
+    unsigned int numStreams;
+    unsigned int bitsPerScalar;
+    // frames per second per stream, after any resampling
+    float sampleRate;
+    /**
+    * number of runtime sample rate changes before this transfer
+    * NOTE: a transfer never holds frames of two rates, the first
+    * transfer of each epoch starts at the new sampleRate
+    */
+    unsigned int epoch;
+    /**
+    * true if the first frame does not follow on from the last frame of
+    * the previous transfer, after a stream reset or a device recovery
+    */
+    bool discontinuity;
+    /**
+    * mean power of tuner A and tuner B over the frames of this transfer
+    * in dBFS, only measured when DuoEngine.measurePower is set
+    */
+    float powerA;
+    float powerB;
+};
+
+
+/**
+* Current DC offset and I/Q imbalance estimates for one tuner
+*/
+struct DuoEngineIQEstimate {
+    // DC offset of I and Q as a fraction of full scale
+    float dcI;
+    float dcQ;
+    // amplitude of Q relative to I
+    float gain;
+    // phase error of Q from quadrature in degrees
+    float phase;
+    // image rejection of the uncorrected tuner in dB
+    float imageRejection;
+};
+
+
+/**
+* Complex weights of one beam, formed per sample as
+*     beam = (weightAI + j weightAQ) * A + (weightBI + j weightBQ) * B
+* Weights of 1/2 on each tuner give the sum stream. The beam is
+* saturated to the sample range. See duoBeamSteer() in DuoBeam.h to
+* steer by phase.
+*/
+struct DuoEngineBeam {
+    float weightAI;
+    float weightAQ;
+    float weightBI;
+    float weightBQ;
 };
 
 
@@ -71,6 +228,72 @@ struct DuoEngineControl {
     bool notchMwfm;
     // true to enable the frontend DAB notch filter
     bool notchDab;
+    /**
+    * current correction estimates for each tuner
+    * NOTE: read only, only updated when iqCorrection is enabled
+    */
+    struct DuoEngineIQEstimate iqA;
+    struct DuoEngineIQEstimate iqB;
+    /**
+    * weights of the beam output streams
+    * NOTE: changes take effect at the start of the next callback
+    */
+    struct DuoEngineBeam beams[DUO_MAX_BEAMS];
+    // offset from tuneFreq in Hz shifted to 0 Hz without a hardware retune
+    float shiftFreq;
+    /**
+    * settings that set the delivered sample rate, see DuoEngine
+    * NOTE: a change is applied in the stream without restarting it.
+    * The analog bandwidth and IF follow decimFactor and maxSampleRate
+    * as at startup. The frames received so far at the old rate are
+    * delivered first and the next transfer starts a new epoch.
+    */
+    unsigned int decimFactor;
+    bool maxSampleRate;
+    unsigned int outputRate;
+};
+
+
+/**
+* Health of the stream and the automatic device recovery, see
+* DuoEngine.recoverTimeout
+*/
+struct DuoEngineStats {
+    // transfers delivered with discontinuity set
+    unsigned int discontinuities;
+    // times the device was removed or the stream stalled
+    unsigned int deviceLosses;
+    // times streaming resumed after a loss
+    unsigned int recoveries;
+    // attempts to resume streaming that failed and were retried
+    unsigned int failedAttempts;
+    // true from a loss until streaming resumes
+    bool recovering;
+    // seconds from detecting a loss to streaming again, of the last and of all recoveries
+    float lastRecoveryTime;
+    float totalRecoveryTime;
+};
+
+
+/**
+* Detection reported by the DuoEngine signal detector, see DuoDetect.h
+*/
+struct DuoEngineDetection {
+    // delivered frame number of the first sample of the detecting average
+    unsigned long long sampleNumber;
+    // seconds of delivered samples since streaming started
+    double time;
+    // FFT bin in centered order, bin detectSize / 2 is 0 Hz
+    unsigned int bin;
+    // frequency of the bin relative to the center of the delivered band in Hz
+    float freq;
+    // average power of the two tuners in the bin in dBFS
+    float power;
+    // signal to noise floor ratio of each tuner in the bin in dB
+    float snrA;
+    float snrB;
+    // phase of tuner B relative to tuner A in the bin in degrees
+    float phase;
 };
 
 
@@ -87,9 +310,23 @@ struct DuoEngineControl {
 typedef void (*DuoEngineTransferCallback)(struct DuoEngineTransfer* transfer, void *userContext);
 
 
+/**
+* Function type to implement for user to receive signal detections
+*
+* @param detection pointer to the detection, only valid during the call
+* @param userContext pointer to context memory specified in the
+*                    userContext DuoEngine field
+*/
+typedef void (*DuoEngineDetectionCallback)(const struct DuoEngineDetection* detection, void *userContext);
+
+
 /**
 * Function type to implement for user to get periodic callbacks
-* to allow user control in the main thread.
+* to allow user control. Called every 100 ms from the DuoEngine
+* control thread without the engine lock, so it may call the other
+* duoEngine functions for its handle except duoEngineStop().
+* NOTE: only the fields changed in the control argument are applied,
+* over any changes made meanwhile with duoEngineSetControl()
 *
 * @param userContext pointer to context memory specified in the
 *                    userContext DuoEngine field
@@ -112,6 +349,10 @@ typedef int (*DuoEngineControlCallback)(struct DuoEngineControl* control, void *
 typedef void (*DuoEngineMessageCallback)(const char* msg, void *userContext);
 
 
+// Inter-tuner calibration table, see DuoCal.h
+struct DuoCalTable;
+
+
 /**
 * Main configuration for DuoEngine
 * User first calls duoEngineInit() to initialize with
@@ -149,8 +390,87 @@ struct DuoEngine {
     bool usbBulkMode;
     // true to enable sdrplay_api debugging output
     bool apiDebug;
-    // true to convert all sample scalars from short to float
+    /**
+    * true to convert all sample scalars from short to float
+    * NOTE: this is equivalent to setting format to DUO_FORMAT_FLOAT32
+    * and takes precedence if format is left at DUO_FORMAT_INT16
+    */
     bool floatingPoint;
+    // sample scalar format delivered via transferCallback
+    enum DuoEngineFormat format;
+    /**
+    * arrangement of scalars within each transfer
+    * NOTE: for planar and split layouts the number of frames in a
+    * transfer is a multiple of 4 so that each block of a bit-packed
+    * format starts on a byte boundary
+    */
+    enum DuoEngineLayout layout;
+    /**
+    * bitmask of output streams to deliver, see enum DuoEngineOutput
+    * NOTE: zero is treated as DUO_OUTPUT_BOTH
+    */
+    unsigned int outputMask;
+    /**
+    * output sample rate in Hz, zero to deliver the hardware rate of
+    * 2 MHz / decimFactor
+    * NOTE: any other rate is produced by a polyphase resampler applied
+    * identically to both tuners. The ratio to the hardware rate,
+    * reduced to lowest terms L/M, must have L <= 1024. Use hardware
+    * decimation to get close to the output rate first since the
+    * resampler cost grows with M.
+    */
+    unsigned int outputRate;
+    // filter quality of the resampler used when outputRate is set
+    enum DuoEngineResampleQuality resampleQuality;
+    /**
+    * offset from tuneFreq in Hz that is shifted to 0 Hz, e.g. to keep a
+    * signal away from the DC offset of the tuners
+    * NOTE: a phase continuous NCO mixes both tuners with the same phase
+    * at the hardware rate, in the same pass as the resampler when
+    * outputRate is set so the shifted band can be decimated. The shift
+    * can be changed at runtime through DuoEngineControl.
+    */
+    float shiftFreq;
+    /**
+    * true to remove the DC offset and I/Q gain and phase imbalance
+    * of each tuner with slowly adapting estimators
+    * NOTE: correction is applied at the hardware rate before any
+    * resampling and the estimates are reported in DuoEngineControl
+    */
+    bool iqCorrection;
+    // averaging time of the correction estimates in seconds
+    float iqTimeConstant;
+    /**
+    * optional table of the phase, delay, and gain of tuner B relative
+    * to tuner A, NULL to disable
+    * NOTE: the table is interpolated at the tuning frequency, and again
+    * whenever tuneFreq is changed, and removed from tuner B. Tuner A is
+    * delayed by DUO_CAL_HALF_TAPS samples to stay aligned. The table
+    * must remain valid until the engine is stopped.
+    */
+    const struct DuoCalTable* calibration;
+    // initial weights of the beam output streams, default is the sum
+    struct DuoEngineBeam beams[DUO_MAX_BEAMS];
+    /**
+    * FFT size of the signal detector, a power of two >= 16, or zero to
+    * disable detection
+    * NOTE: the detector runs on the delivered samples of both tuners
+    * and reports each new signal once through detectionCallback
+    */
+    unsigned int detectSize;
+    // FFT frames averaged for each detection decision
+    unsigned int detectAverages;
+    // detection threshold in dB above the noise floor of each bin
+    float detectThreshold;
+    // averaging time of the noise floor of each bin in seconds
+    float detectTimeConstant;
+    /**
+    * true to report the mean power of each tuner with every transfer,
+    * e.g. to trigger a capture
+    * NOTE: the power is that of the delivered tuner samples, after any
+    * correction, shift, and resampling, whichever streams are selected
+    */
+    bool measurePower;
     /** 
     * maximum number of bytes DuoEngine can transfer to user
     * via transferCallback
@@ -159,6 +479,60 @@ struct DuoEngine {
     */
     unsigned int maxTransferSize;
     /**
+    * maximum time in seconds a frame waits for its transfer to fill,
+    * zero to only deliver full transfers
+    * NOTE: at low sample rates a full transfer can take a long time to
+    * fill. Once it holds this many seconds of frames at the end of a
+    * tuner callback, the frames so far are delivered as a shorter
+    * transfer with its own numFrames and numBytes. Latency is still
+    * bounded below by the interval between tuner callbacks.
+    */
+    float maxLatency;
+    /**
+    * size in bytes of the ring of delivered frames pulled with
+    * duoEngineRead() or duoEnginePeek(), zero to disable
+    * NOTE: requires the interleaved layout and a whole number of bytes
+    * per frame, and must hold at least two transfers. Transfers that
+    * do not fit are dropped and counted, see duoEngineGetOverruns().
+    */
+    unsigned int readBufferSize;
+    /**
+    * real-time scheduling policy of the threads that run the stream
+    * callbacks, which do all sample processing, and of the engine
+    * control thread
+    * NOTE: usually needs CAP_SYS_NICE or an rtprio limit on Linux.
+    * Each thread is configured when it first runs, and settings that
+    * cannot be applied are reported through messageCallback while
+    * streaming carries on without them. The same applies to
+    * streamCpus, controlCpus, and lockMemory.
+    */
+    enum DuoEngineSched schedPolicy;
+    // real-time priority used with schedPolicy, 1-99 on Linux
+    int schedPriority;
+    // bitmask of CPUs for the stream callback threads, zero to leave unpinned
+    unsigned long long streamCpus;
+    // bitmask of CPUs for the control thread, zero to leave unpinned
+    unsigned long long controlCpus;
+    /**
+    * true to lock all current and future memory of the process into
+    * RAM until the engine is stopped
+    */
+    bool lockMemory;
+    // true to write every engine buffer once before streaming starts
+    bool prefault;
+    /**
+    * seconds without samples from the tuners after which the stream is
+    * considered stalled, zero to disable automatic recovery
+    * NOTE: on a stall or a removed device the control thread releases
+    * the device, selects it again, restores the last DuoEngineControl
+    * settings, and resumes streaming, retrying every second until the
+    * device is back. Control changes made meanwhile are applied then.
+    * Time spent in transferCallback or detectionCallback never counts
+    * towards a stall, so a consumer applying back-pressure is waited
+    * for. See duoEngineGetStats().
+    */
+    float recoverTimeout;
+    /**
     * pointer to user context struct that is passed back to user
     * as a parameter in each callback
     * NOTE: NULL is allowed
@@ -166,10 +540,18 @@ struct DuoEngine {
     void* userContext;
     /**
     * pointer to user transfer callback function
-    * NOTE: NULL is NOT allowed
+    * NOTE: NULL is only allowed when readBufferSize or
+    * detectionCallback is set. With neither transferCallback nor
+    * readBufferSize no samples are delivered.
     */
     DuoEngineTransferCallback transferCallback;
     /**
+    * pointer to user detection function, called from the streaming
+    * thread like transferCallback
+    * NOTE: NULL is allowed, required when detectSize is set
+    */
+    DuoEngineDetectionCallback detectionCallback;
+    /**
     * pointer to user control function
     * NOTE: NULL is allowed
     */
@@ -198,10 +580,30 @@ struct DuoEngine {
 #define DEFAULT_DECIM_FACTOR (1)
 #endif
 
+#ifndef DEFAULT_IQ_TIME_CONSTANT
+#define DEFAULT_IQ_TIME_CONSTANT (1.0f)
+#endif
+
+#ifndef DEFAULT_DETECT_AVERAGES
+#define DEFAULT_DETECT_AVERAGES (8)
+#endif
+
+#ifndef DEFAULT_DETECT_THRESHOLD
+#define DEFAULT_DETECT_THRESHOLD (10.0f)
+#endif
+
+#ifndef DEFAULT_DETECT_TIME_CONSTANT
+#define DEFAULT_DETECT_TIME_CONSTANT (1.0f)
+#endif
+
 #ifndef DEFAULT_MAX_TRANSFER_SIZE
 #define DEFAULT_MAX_TRANSFER_SIZE (10 * 1024)
 #endif
 
+#ifndef DEFAULT_RECOVER_TIMEOUT
+#define DEFAULT_RECOVER_TIMEOUT (0.0f)
+#endif
+
 
 /**
 * Initialize engine struct with default values
@@ -215,12 +617,203 @@ static void duoEngineInit(struct DuoEngine* engine) {
     engine->lnaState = DEFAULT_LNA_STATE;
     engine->decimFactor = DEFAULT_DECIM_FACTOR;
     engine->floatingPoint = false;
+    engine->format = DUO_FORMAT_INT16;
+    engine->layout = DUO_LAYOUT_INTERLEAVED;
+    engine->outputMask = DUO_OUTPUT_BOTH;
+    engine->outputRate = 0;
+    engine->resampleQuality = DUO_RESAMPLE_MEDIUM;
+    engine->shiftFreq = 0.0f;
+    engine->iqCorrection = false;
+    engine->iqTimeConstant = DEFAULT_IQ_TIME_CONSTANT;
+    engine->calibration = NULL;
+    for (unsigned int idx = 0; idx < DUO_MAX_BEAMS; idx++) {
+        engine->beams[idx].weightAI = 0.5f;
+        engine->beams[idx].weightAQ = 0.0f;
+        engine->beams[idx].weightBI = 0.5f;
+        engine->beams[idx].weightBQ = 0.0f;
+    }
+    engine->detectSize = 0;
+    engine->detectAverages = DEFAULT_DETECT_AVERAGES;
+    engine->detectThreshold = DEFAULT_DETECT_THRESHOLD;
+    engine->detectTimeConstant = DEFAULT_DETECT_TIME_CONSTANT;
+    engine->measurePower = false;
     engine->maxTransferSize = DEFAULT_MAX_TRANSFER_SIZE;
+    engine->maxLatency = 0.0f;
+    engine->readBufferSize = 0;
+    engine->schedPolicy = DUO_SCHED_DEFAULT;
+    engine->schedPriority = 0;
+    engine->streamCpus = 0;
+    engine->controlCpus = 0;
+    engine->lockMemory = false;
+    engine->prefault = false;
+    engine->recoverTimeout = DEFAULT_RECOVER_TIMEOUT;
+}
+
+
+/**
+* Resolve the sample format from the format and floatingPoint fields
+*
+* @param engine pointer to engine configuration
+*
+* @return format that will be delivered via transferCallback
+*/
+static enum DuoEngineFormat duoEngineFormat(const struct DuoEngine* engine) {
+    if (engine->floatingPoint && engine->format == DUO_FORMAT_INT16) {
+        return DUO_FORMAT_FLOAT32;
+    }
+    return engine->format;
+}
+
+
+/**
+* Number of bits used to store each scalar in the specified format
+*/
+static unsigned int duoEngineFormatBits(enum DuoEngineFormat format) {
+    switch (format) {
+    case DUO_FORMAT_FLOAT32:
+        return 32;
+    case DUO_FORMAT_INT12:
+        return 12;
+    case DUO_FORMAT_INT14:
+        return 14;
+    case DUO_FORMAT_INT8:
+        return 8;
+    default:
+        // int16 and float16
+        return 16;
+    }
+}
+
+
+/**
+* Short human-readable name for the specified format
+*/
+static const char* duoEngineFormatName(enum DuoEngineFormat format) {
+    switch (format) {
+    case DUO_FORMAT_FLOAT32:
+        return "float32";
+    case DUO_FORMAT_INT12:
+        return "int12";
+    case DUO_FORMAT_INT14:
+        return "int14";
+    case DUO_FORMAT_INT8:
+        return "int8";
+    case DUO_FORMAT_FLOAT16:
+        return "float16";
+    default:
+        return "int16";
+    }
 }
 
 
 /**
-* Blocking function to start and run the engine.
+* Resolve the selected output streams
+*
+* @param engine pointer to engine configuration
+*
+* @return bitmask of streams that will be delivered via transferCallback
+*/
+static unsigned int duoEngineOutputMask(const struct DuoEngine* engine) {
+    unsigned int mask = engine->outputMask & DUO_OUTPUT_ALL;
+    return mask ? mask : DUO_OUTPUT_BOTH;
+}
+
+
+/**
+* Sample rate in Hz delivered by the hardware after decimation
+*/
+static unsigned int duoEngineHardwareRate(const struct DuoEngine* engine) {
+    return 2000000 / (engine->decimFactor ? engine->decimFactor : 1);
+}
+
+
+/**
+* Sample rate in Hz delivered via transferCallback.
+* Matches the transfer sampleRate reported by DuoEngine.
+*/
+static unsigned int duoEngineSampleRate(const struct DuoEngine* engine) {
+    return engine->outputRate ? engine->outputRate : duoEngineHardwareRate(engine);
+}
+
+
+/**
+* Short human-readable name for the specified resampler quality
+*/
+static const char* duoEngineResampleQualityName(enum DuoEngineResampleQuality quality) {
+    switch (quality) {
+    case DUO_RESAMPLE_LOW:
+        return "low";
+    case DUO_RESAMPLE_HIGH:
+        return "high";
+    default:
+        return "medium";
+    }
+}
+
+
+/**
+* Number of output streams (samples per frame) selected by a mask
+*/
+static unsigned int duoEngineNumStreams(unsigned int outputMask) {
+    unsigned int count = 0;
+    for (unsigned int bit = DUO_OUTPUT_A; bit <= DUO_OUTPUT_BEAM1; bit <<= 1) {
+        if (outputMask & bit) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+/**
+* Number of frames in each transfer for the specified configuration.
+* Matches the transfer numFrames reported by DuoEngine.
+*
+* @param engine pointer to engine configuration
+*
+* @return number of frames per transfer
+*/
+static unsigned int duoEngineTransferFrames(const struct DuoEngine* engine) {
+    unsigned int frameBits = duoEngineFormatBits(duoEngineFormat(engine)) * 2 *
+                             duoEngineNumStreams(duoEngineOutputMask(engine));
+    unsigned int numFrames = (unsigned int)(((unsigned long long)engine->maxTransferSize * 8) / frameBits);
+    if (engine->layout != DUO_LAYOUT_INTERLEAVED) {
+        // Keep every block of a bit-packed format byte aligned
+        numFrames -= numFrames % 4;
+    }
+    else if (frameBits % 8) {
+        // Keep the transfer a whole number of bytes
+        numFrames -= numFrames % 2;
+    }
+    return numFrames;
+}
+
+
+/**
+* Short human-readable name for the specified layout
+*/
+static const char* duoEngineLayoutName(enum DuoEngineLayout layout) {
+    switch (layout) {
+    case DUO_LAYOUT_PLANAR:
+        return "planar";
+    case DUO_LAYOUT_SPLIT:
+        return "split";
+    default:
+        return "interleaved";
+    }
+}
+
+
+/**
+* Opaque handle of a running engine, see duoEngineStart()
+*/
+struct DuoEngineHandle;
+
+
+/**
+* Blocking function to start and run the engine until controlCallback
+* returns non-zero. Equivalent to duoEngineStart(), duoEnginePoll()
+* until it returns non-zero, then duoEngineStop().
 *
 * @param engine configuration
 *
@@ -229,6 +822,188 @@ static void duoEngineInit(struct DuoEngine* engine) {
 int duoEngineRun(struct DuoEngine* engine);
 
 
+/**
+* Start the engine and return without blocking. Samples are delivered
+* from the API stream threads and controlCallback, if set, is called
+* from a control thread owned by the engine, so the calling thread is
+* free to run its own event loop.
+*
+* @param engine configuration, only read during the call
+* @param handle set to the handle of the running engine on success,
+*               NULL otherwise
+*
+* @return zero on success, non-zero otherwise
+*/
+int duoEngineStart(struct DuoEngine* engine, struct DuoEngineHandle** handle);
+
+
+/**
+* Stop streaming and release the device and all engine memory.
+* The handle is invalid afterwards. Must be called once for every
+* successful duoEngineStart(), whether or not the engine has stopped
+* on its own.
+*
+* @param handle running engine
+*
+* @return zero on clean exit, non-zero otherwise
+*/
+int duoEngineStop(struct DuoEngineHandle* handle);
+
+
+/**
+* Stop streaming and release the device like duoEngineStop(), but keep
+* the handle and its memory. Frames left in the read buffer, including
+* those returned by duoEnginePeek(), stay valid, and duoEngineRead(),
+* duoEnginePeek(), duoEngineConsume(), duoEngineGetOverruns(), and
+* duoEngineGetStats() can still be used. duoEngineStop() must still be
+* called to free the handle. Calling it more than once has no effect.
+*
+* @param handle running engine
+*
+* @return zero on clean exit, non-zero otherwise
+*/
+int duoEngineHalt(struct DuoEngineHandle* handle);
+
+
+/**
+* Wait until the engine stops on its own, i.e. controlCallback returned
+* non-zero, or the timeout expires. Samples are still delivered after
+* it stops until duoEngineStop() is called.
+*
+* @param handle running engine
+* @param timeoutMs maximum wait in milliseconds, zero to check only
+*
+* @return zero while running, non-zero once stopped
+*/
+int duoEnginePoll(struct DuoEngineHandle* handle, unsigned int timeoutMs);
+
+
+/**
+* File descriptor for select(), poll(), or epoll that becomes readable
+* once the engine stops on its own. Call duoEngineStop() when it does.
+* NOTE: not available on Windows, use duoEnginePoll() instead
+*
+* @param handle running engine
+*
+* @return file descriptor, -1 if not available
+*/
+int duoEngineGetFd(struct DuoEngineHandle* handle);
+
+
+/**
+* Read the current runtime configuration, e.g. as the starting point
+* for duoEngineSetControl()
+*
+* @param handle running engine
+* @param control filled in with the current configuration
+*
+* @return zero on success, non-zero if the engine has stopped
+*/
+int duoEngineGetControl(struct DuoEngineHandle* handle, struct DuoEngineControl* control);
+
+
+/**
+* Apply runtime configuration changes from any thread, as if returned
+* by controlCallback. Fields equal to the current configuration are
+* left untouched.
+*
+* @param handle running engine
+* @param control desired runtime configuration
+*
+* @return zero on success, non-zero if the engine has stopped
+*/
+int duoEngineSetControl(struct DuoEngineHandle* handle, const struct DuoEngineControl* control);
+
+
+/**
+* Pull delivered frames from the ring enabled by readBufferSize. Waits
+* until numFrames are available, the timeout expires, or the engine
+* stops, then copies as many as are available up to numFrames, e.g.
+* exactly one FFT worth of frames. Stops short at a runtime change of
+* the sample rate, see duoEngineGetReadRate().
+* NOTE: only one thread may pull frames at a time
+*
+* @param handle running engine
+* @param buffer destination of at least numFrames frames
+* @param numFrames number of frames wanted, limited to the ring size
+* @param timeoutMs maximum wait in milliseconds, zero to check only
+*
+* @return number of frames copied, -1 once the engine has stopped and
+*         the ring is empty or if readBufferSize is not set
+*/
+int duoEngineRead(struct DuoEngineHandle* handle, void* buffer, unsigned int numFrames, unsigned int timeoutMs);
+
+
+/**
+* Zero-copy alternative to duoEngineRead(). Waits like duoEngineRead()
+* and points data at the oldest frames in the ring, which stay valid
+* until they are released with duoEngineConsume().
+*
+* @param handle running engine
+* @param data set to the oldest frame, NULL on error
+* @param numFrames number of contiguous frames wanted, limited to a
+*                  quarter of the ring size
+* @param timeoutMs maximum wait in milliseconds, zero to check only
+*
+* @return number of contiguous frames at data, -1 once the engine has
+*         stopped and the ring is empty or if readBufferSize is not set
+*/
+int duoEnginePeek(struct DuoEngineHandle* handle, const void** data, unsigned int numFrames, unsigned int timeoutMs);
+
+
+/**
+* Release the oldest frames of the ring after duoEnginePeek()
+*
+* @param handle running engine
+* @param numFrames number of frames to release
+*
+* @return zero on success, non-zero if fewer frames were in the ring
+*/
+int duoEngineConsume(struct DuoEngineHandle* handle, unsigned int numFrames);
+
+
+/**
+* Count the transfers dropped because the ring was full
+*
+* @param handle running engine
+* @param overruns set to the number of dropped transfers
+* @param droppedFrames set to the number of dropped frames
+*
+* @return zero on success, non-zero if readBufferSize is not set
+*/
+int duoEngineGetOverruns(struct DuoEngineHandle* handle, unsigned long long* overruns, unsigned long long* droppedFrames);
+
+
+/**
+* Get the stream health and recovery counters
+*
+* @param handle running or stopped engine
+* @param stats set to the counters so far
+*
+* @return zero on success, non-zero otherwise
+*/
+int duoEngineGetStats(struct DuoEngineHandle* handle, struct DuoEngineStats* stats);
+
+
+/**
+* Sample rate of the frames returned by the next duoEngineRead() or
+* duoEnginePeek()
+* NOTE: reads stop short at a runtime change of the sample rate, so a
+* block of frames never mixes two rates
+*
+* @param handle running engine
+* @param sampleRate set to the rate of the oldest frame in the ring
+* @param epoch set to the epoch of the oldest frame, see
+*              DuoEngineTransfer
+* @param untilChange set to the frames left at this rate before the
+*                    next change, zero if no change is in the ring
+*
+* @return zero on success, non-zero if readBufferSize is not set
+*/
+int duoEngineGetReadRate(
+    struct DuoEngineHandle* handle, float* sampleRate, unsigned int* epoch, unsigned int* untilChange);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,402 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOENGINE_HPP
+#define DUOENGINE_HPP
+
+/**
+* Header-only C++17 wrapper around DuoEngine.
+*
+* The transfer callback is a lambda or functor that takes a
+* duo::Transfer<T>. The scalar type T is picked once, when the engine
+* starts, from the configured format. The functor is then called
+* through a trampoline specialized for that type, so its inner loops
+* see plain int16_t, int8_t, or float data with no format branches
+* and the compiler is free to vectorize them. A generic lambda
+* (auto parameter) accepts every format. A functor that only takes
+* some of the types makes start() fail for the others.
+*
+* Only the interleaved layout and the byte-sized formats int16, int8,
+* and float32 have a frame type, the packed formats are left to the C
+* API.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "DuoEngine.h"
+
+
+namespace duo {
+
+
+/**
+* Format delivered for each scalar type of a frame
+*/
+template <typename T>
+struct FormatOf;
+
+template <>
+struct FormatOf<int16_t> {
+    static constexpr DuoEngineFormat value = DUO_FORMAT_INT16;
+};
+
+template <>
+struct FormatOf<int8_t> {
+    static constexpr DuoEngineFormat value = DUO_FORMAT_INT8;
+};
+
+template <>
+struct FormatOf<float> {
+    static constexpr DuoEngineFormat value = DUO_FORMAT_FLOAT32;
+};
+
+
+/**
+* View of one frame: an I, Q pair for each selected output stream,
+* in the order of enum DuoEngineOutput
+*/
+template <typename T>
+class Frame {
+public:
+    Frame(const T* scalars, unsigned int numStreams) : scalars_(scalars), numStreams_(numStreams) {}
+
+    // number of output streams in the frame
+    unsigned int size() const { return numStreams_; }
+    T i(unsigned int stream) const { return scalars_[2 * stream]; }
+    T q(unsigned int stream) const { return scalars_[2 * stream + 1]; }
+    const T* data() const { return scalars_; }
+
+private:
+    const T* scalars_;
+    unsigned int numStreams_;
+};
+
+
+/**
+* Span-like range of consecutive frames, valid only as long as the
+* memory it views, i.e. for the duration of the transfer callback or
+* until the frames are consumed
+*/
+template <typename T>
+class Transfer {
+public:
+    class iterator {
+    public:
+        iterator(const T* scalars, unsigned int numStreams) : scalars_(scalars), numStreams_(numStreams) {}
+        Frame<T> operator*() const { return Frame<T>(scalars_, numStreams_); }
+        iterator& operator++() {
+            scalars_ += 2 * numStreams_;
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return scalars_ == other.scalars_; }
+        bool operator!=(const iterator& other) const { return scalars_ != other.scalars_; }
+
+    private:
+        const T* scalars_;
+        unsigned int numStreams_;
+    };
+
+    Transfer(const T* scalars, size_t numFrames, unsigned int numStreams, const DuoEngineTransfer* info = nullptr)
+        : scalars_(scalars), numFrames_(numFrames), numStreams_(numStreams), info_(info) {}
+
+    // number of frames
+    size_t size() const { return numFrames_; }
+    bool empty() const { return numFrames_ == 0; }
+    unsigned int numStreams() const { return numStreams_; }
+    Frame<T> operator[](size_t idx) const { return Frame<T>(scalars_ + idx * 2 * numStreams_, numStreams_); }
+    iterator begin() const { return iterator(scalars_, numStreams_); }
+    iterator end() const { return iterator(scalars_ + numFrames_ * 2 * numStreams_, numStreams_); }
+
+    // all scalars in order, e.g. for a flat loop over a single stream
+    const T* data() const { return scalars_; }
+    size_t numScalars() const { return numFrames_ * 2 * numStreams_; }
+
+    // frames starting at offset, clipped to the end of this range
+    Transfer subspan(size_t offset, size_t count) const {
+        offset = offset < numFrames_ ? offset : numFrames_;
+        count = count < numFrames_ - offset ? count : numFrames_ - offset;
+        return Transfer(scalars_ + offset * 2 * numStreams_, count, numStreams_, info_);
+    }
+
+    // details of the callback transfer such as sampleRate and power, nullptr for pulled frames
+    const DuoEngineTransfer* info() const { return info_; }
+
+private:
+    const T* scalars_;
+    size_t numFrames_;
+    unsigned int numStreams_;
+    const DuoEngineTransfer* info_;
+};
+
+
+/**
+* RAII owner of a DuoEngine configuration and, once started, the
+* running engine. Stopped on destruction. Not copyable or movable
+* since the C callbacks hold its address.
+*/
+class Engine {
+public:
+    Engine() { duoEngineInit(&config_); }
+    ~Engine() { stop(); }
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    /**
+    * Configuration applied by start(), e.g. tuneFreq and format.
+    * The callback and userContext fields are set by the wrapper.
+    */
+    DuoEngine& config() { return config_; }
+    const DuoEngine& config() const { return config_; }
+
+    /**
+    * Set the transfer callback, called with a Transfer<T> whose T
+    * matches the configured format
+    */
+    template <typename F>
+    void onTransfer(F&& fn) {
+        using Fn = std::decay_t<F>;
+        transferFn_ = std::make_shared<Fn>(std::forward<F>(fn));
+        bindTransfer_ = &bindTransfer<Fn>;
+    }
+
+    // Set the detection callback, see DuoEngineDetectionCallback
+    void onDetection(std::function<void(const DuoEngineDetection&)> fn) { detectionFn_ = std::move(fn); }
+
+    /**
+    * Set the periodic control callback, see DuoEngineControlCallback
+    * NOTE: return true to keep running, false to stop
+    */
+    void onControl(std::function<bool(DuoEngineControl&)> fn) { controlFn_ = std::move(fn); }
+
+    // Set the message callback, see DuoEngineMessageCallback
+    void onMessage(std::function<void(const char*)> fn) { messageFn_ = std::move(fn); }
+
+    /**
+    * Start streaming without blocking, see duoEngineStart()
+    * Throws std::logic_error for a configuration the wrapper cannot
+    * deliver and std::runtime_error if the engine fails to start.
+    */
+    void start() {
+        if (handle_ != nullptr) {
+            throw std::logic_error("DuoEngine is already running");
+        }
+        DuoEngine engine = config_;
+        engine.userContext = this;
+        engine.transferCallback = nullptr;
+        if (transferFn_) {
+            if (engine.layout != DUO_LAYOUT_INTERLEAVED) {
+                throw std::logic_error("DuoEngine C++ frames require the interleaved layout");
+            }
+            engine.transferCallback = bindTransfer_(duoEngineFormat(&engine));
+            if (engine.transferCallback == nullptr) {
+                throw std::logic_error(
+                    std::string("transfer callback does not accept the ") +
+                    duoEngineFormatName(duoEngineFormat(&engine)) + " format");
+            }
+        }
+        engine.detectionCallback = detectionFn_ ? &detectionTrampoline : nullptr;
+        engine.controlCallback = controlFn_ ? &controlTrampoline : nullptr;
+        engine.messageCallback = messageFn_ ? &messageTrampoline : nullptr;
+        numStreams_ = duoEngineNumStreams(duoEngineOutputMask(&engine));
+        format_ = duoEngineFormat(&engine);
+        if (duoEngineStart(&engine, &handle_) != 0) {
+            handle_ = nullptr;
+            throw std::runtime_error("DuoEngine failed to start");
+        }
+    }
+
+    /**
+    * Stop streaming and release the device, see duoEngineStop()
+    *
+    * @return true on clean exit or if not running
+    */
+    bool stop() {
+        if (handle_ == nullptr) {
+            return true;
+        }
+        int rcode = duoEngineStop(handle_);
+        handle_ = nullptr;
+        return rcode == 0;
+    }
+
+    /**
+    * Blocking start, wait until the control callback returns false,
+    * and stop, see duoEngineRun()
+    */
+    bool run() {
+        start();
+        while (!poll(1000)) {
+        }
+        return stop();
+    }
+
+    bool running() const { return handle_ != nullptr; }
+
+    // true once the engine stopped on its own, see duoEnginePoll()
+    bool poll(unsigned int timeoutMs) { return duoEnginePoll(checked(), timeoutMs) != 0; }
+
+    // descriptor readable once the engine stops, see duoEngineGetFd()
+    int fd() { return duoEngineGetFd(checked()); }
+
+    DuoEngineControl control() {
+        DuoEngineControl control;
+        if (duoEngineGetControl(checked(), &control) != 0) {
+            throw std::runtime_error("DuoEngine has stopped");
+        }
+        return control;
+    }
+
+    void setControl(const DuoEngineControl& control) {
+        if (duoEngineSetControl(checked(), &control) != 0) {
+            throw std::runtime_error("DuoEngine has stopped");
+        }
+    }
+
+    /**
+    * Copy up to numFrames frames from the ring enabled by
+    * readBufferSize, see duoEngineRead()
+    *
+    * @return number of frames copied, -1 at the end of the stream
+    */
+    template <typename T>
+    int read(T* buffer, unsigned int numFrames, unsigned int timeoutMs) {
+        checkFormat<T>();
+        return duoEngineRead(checked(), buffer, numFrames, timeoutMs);
+    }
+
+    /**
+    * View the oldest frames of the ring enabled by readBufferSize
+    * without copying, see duoEnginePeek(). Release them with
+    * consume(). An empty view marks the end of the stream once
+    * finished() is true.
+    */
+    template <typename T>
+    Transfer<T> peek(unsigned int numFrames, unsigned int timeoutMs) {
+        checkFormat<T>();
+        const void* data = nullptr;
+        int count = duoEnginePeek(checked(), &data, numFrames, timeoutMs);
+        finished_ = count < 0;
+        return Transfer<T>(static_cast<const T*>(data), count < 0 ? 0 : count, numStreams_);
+    }
+
+    void consume(size_t numFrames) { duoEngineConsume(checked(), (unsigned int)numFrames); }
+
+    // stream health and device recovery counters, see duoEngineGetStats()
+    DuoEngineStats stats() {
+        DuoEngineStats stats;
+        duoEngineGetStats(checked(), &stats);
+        return stats;
+    }
+
+    // sample rate of the frames at the read position, see duoEngineGetReadRate()
+    float readRate() {
+        float sampleRate = 0.0f;
+        unsigned int epoch = 0;
+        unsigned int untilChange = 0;
+        duoEngineGetReadRate(checked(), &sampleRate, &epoch, &untilChange);
+        return sampleRate;
+    }
+
+    // true once peek() found the ring empty after the engine stopped
+    bool finished() const { return finished_; }
+
+    DuoEngineHandle* handle() { return handle_; }
+
+private:
+    template <typename Fn>
+    static DuoEngineTransferCallback bindTransfer(DuoEngineFormat format) {
+        switch (format) {
+        case DUO_FORMAT_INT16:
+            return transferTrampoline<Fn, int16_t>();
+        case DUO_FORMAT_INT8:
+            return transferTrampoline<Fn, int8_t>();
+        case DUO_FORMAT_FLOAT32:
+            return transferTrampoline<Fn, float>();
+        default:
+            return nullptr;
+        }
+    }
+
+    template <typename Fn, typename T>
+    static DuoEngineTransferCallback transferTrampoline() {
+        if constexpr (std::is_invocable_v<Fn&, Transfer<T>>) {
+            return [](DuoEngineTransfer* transfer, void* userContext) {
+                Engine* engine = static_cast<Engine*>(userContext);
+                Fn& fn = *static_cast<Fn*>(engine->transferFn_.get());
+                fn(Transfer<T>(static_cast<const T*>(transfer->data), transfer->numFrames,
+                               transfer->numStreams, transfer));
+            };
+        }
+        else {
+            return nullptr;
+        }
+    }
+
+    static void detectionTrampoline(const DuoEngineDetection* detection, void* userContext) {
+        static_cast<Engine*>(userContext)->detectionFn_(*detection);
+    }
+
+    static int controlTrampoline(DuoEngineControl* control, void* userContext) {
+        return static_cast<Engine*>(userContext)->controlFn_(*control) ? 0 : 1;
+    }
+
+    static void messageTrampoline(const char* msg, void* userContext) {
+        static_cast<Engine*>(userContext)->messageFn_(msg);
+    }
+
+    DuoEngineHandle* checked() {
+        if (handle_ == nullptr) {
+            throw std::logic_error("DuoEngine is not running");
+        }
+        return handle_;
+    }
+
+    template <typename T>
+    void checkFormat() const {
+        if (format_ != FormatOf<T>::value) {
+            throw std::logic_error("frame type does not match the DuoEngine format");
+        }
+    }
+
+    DuoEngine config_;
+    DuoEngineHandle* handle_ = nullptr;
+    DuoEngineFormat format_ = DUO_FORMAT_INT16;
+    unsigned int numStreams_ = 0;
+    bool finished_ = false;
+    // type-erased transfer functor and the function that picks its trampoline for a format
+    std::shared_ptr<void> transferFn_;
+    DuoEngineTransferCallback (*bindTransfer_)(DuoEngineFormat) = nullptr;
+    std::function<void(const DuoEngineDetection&)> detectionFn_;
+    std::function<bool(DuoEngineControl&)> controlFn_;
+    std::function<void(const char*)> messageFn_;
+};
+
+
+}
+
+#endif
@@ -0,0 +1,312 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOFFT_H
+#define DUOFFT_H
+
+/**
+* In-place complex FFT for power of two sizes.
+* Data is split-complex (separate real and imaginary arrays), which
+* lets each butterfly stage run four butterflies per SIMD operation
+* with SSE or NEON. Stages narrower than the vector width and other
+* architectures use scalar code.
+*
+* The forward transform is X[k] = sum(x[n] * exp(-2*pi*i*n*k/N)).
+* The inverse transform is unnormalized, i.e. inverse(forward(x)) = N*x.
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DUOFFT_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DUOFFT_NEON
+#endif
+
+#ifndef DUOFFT_PI
+#define DUOFFT_PI (3.14159265358979323846)
+#endif
+
+
+/**
+* Window functions for spectral analysis
+*/
+enum DuoWindow {
+    DUO_WINDOW_RECT = 0,
+    DUO_WINDOW_HANN = 1,
+    DUO_WINDOW_HAMMING = 2,
+    DUO_WINDOW_BLACKMAN = 3
+};
+
+
+struct DuoFFT {
+    // number of points, a power of two
+    unsigned int size;
+    unsigned int log2Size;
+    // bit-reversed index for each index
+    unsigned int* bitrev;
+    /**
+    * twiddle factors for every stage, concatenated.
+    * The stage with butterfly span h uses the h entries starting
+    * at offset h - 1.
+    */
+    float* twiddleRe;
+    float* twiddleIm;
+};
+
+
+/**
+* Check if a size is supported by duoFFTInit()
+*/
+static bool duoFFTValidSize(unsigned int size) {
+    return size >= 2 && (size & (size - 1)) == 0;
+}
+
+
+/**
+* Allocate tables for an FFT of the specified size
+*
+* @param fft pointer to struct to initialize
+* @param size number of points, must be a power of two >= 2
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoFFTInit(struct DuoFFT* fft, unsigned int size) {
+    fft->size = size;
+    fft->log2Size = 0;
+    fft->bitrev = NULL;
+    fft->twiddleRe = NULL;
+    fft->twiddleIm = NULL;
+    if (!duoFFTValidSize(size)) {
+        return 1;
+    }
+    while ((1u << fft->log2Size) < size) {
+        fft->log2Size++;
+    }
+
+    fft->bitrev = (unsigned int*)malloc(size * sizeof(unsigned int));
+    fft->twiddleRe = (float*)malloc(size * sizeof(float));
+    fft->twiddleIm = (float*)malloc(size * sizeof(float));
+    if (fft->bitrev == NULL || fft->twiddleRe == NULL || fft->twiddleIm == NULL) {
+        free(fft->bitrev);
+        free(fft->twiddleRe);
+        free(fft->twiddleIm);
+        fft->bitrev = NULL;
+        fft->twiddleRe = NULL;
+        fft->twiddleIm = NULL;
+        return 1;
+    }
+
+    for (unsigned int idx = 0; idx < size; idx++) {
+        unsigned int rev = 0;
+        for (unsigned int bit = 0; bit < fft->log2Size; bit++) {
+            rev |= ((idx >> bit) & 1) << (fft->log2Size - 1 - bit);
+        }
+        fft->bitrev[idx] = rev;
+    }
+
+    for (unsigned int span = 1; span < size; span <<= 1) {
+        float* twRe = fft->twiddleRe + span - 1;
+        float* twIm = fft->twiddleIm + span - 1;
+        for (unsigned int idx = 0; idx < span; idx++) {
+            // Computed in double so large sizes stay accurate
+            double angle = -DUOFFT_PI * idx / span;
+            twRe[idx] = (float)cos(angle);
+            twIm[idx] = (float)sin(angle);
+        }
+    }
+    return 0;
+}
+
+
+/**
+* Release the tables allocated by duoFFTInit()
+*/
+static void duoFFTFree(struct DuoFFT* fft) {
+    free(fft->bitrev);
+    free(fft->twiddleRe);
+    free(fft->twiddleIm);
+    fft->bitrev = NULL;
+    fft->twiddleRe = NULL;
+    fft->twiddleIm = NULL;
+}
+
+
+/**
+* In-place forward FFT
+*
+* @param fft tables from duoFFTInit()
+* @param re real parts, fft->size values
+* @param im imaginary parts, fft->size values
+*/
+static void duoFFTForward(const struct DuoFFT* fft, float* re, float* im) {
+    unsigned int size = fft->size;
+
+    for (unsigned int idx = 0; idx < size; idx++) {
+        unsigned int rev = fft->bitrev[idx];
+        if (idx < rev) {
+            float tmp = re[idx];
+            re[idx] = re[rev];
+            re[rev] = tmp;
+            tmp = im[idx];
+            im[idx] = im[rev];
+            im[rev] = tmp;
+        }
+    }
+
+    for (unsigned int span = 1; span < size; span <<= 1) {
+        const float* twRe = fft->twiddleRe + span - 1;
+        const float* twIm = fft->twiddleIm + span - 1;
+        for (unsigned int start = 0; start < size; start += 2 * span) {
+            float* aRe = re + start;
+            float* aIm = im + start;
+            float* bRe = aRe + span;
+            float* bIm = aIm + span;
+            unsigned int idx = 0;
+#if defined(DUOFFT_SSE)
+            for (; idx + 4 <= span; idx += 4) {
+                __m128 wr = _mm_loadu_ps(twRe + idx);
+                __m128 wi = _mm_loadu_ps(twIm + idx);
+                __m128 br = _mm_loadu_ps(bRe + idx);
+                __m128 bi = _mm_loadu_ps(bIm + idx);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(br, wr), _mm_mul_ps(bi, wi));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(br, wi), _mm_mul_ps(bi, wr));
+                __m128 ar = _mm_loadu_ps(aRe + idx);
+                __m128 ai = _mm_loadu_ps(aIm + idx);
+                _mm_storeu_ps(aRe + idx, _mm_add_ps(ar, tr));
+                _mm_storeu_ps(aIm + idx, _mm_add_ps(ai, ti));
+                _mm_storeu_ps(bRe + idx, _mm_sub_ps(ar, tr));
+                _mm_storeu_ps(bIm + idx, _mm_sub_ps(ai, ti));
+            }
+#elif defined(DUOFFT_NEON)
+            for (; idx + 4 <= span; idx += 4) {
+                float32x4_t wr = vld1q_f32(twRe + idx);
+                float32x4_t wi = vld1q_f32(twIm + idx);
+                float32x4_t br = vld1q_f32(bRe + idx);
+                float32x4_t bi = vld1q_f32(bIm + idx);
+                float32x4_t tr = vmlsq_f32(vmulq_f32(br, wr), bi, wi);
+                float32x4_t ti = vmlaq_f32(vmulq_f32(br, wi), bi, wr);
+                float32x4_t ar = vld1q_f32(aRe + idx);
+                float32x4_t ai = vld1q_f32(aIm + idx);
+                vst1q_f32(aRe + idx, vaddq_f32(ar, tr));
+                vst1q_f32(aIm + idx, vaddq_f32(ai, ti));
+                vst1q_f32(bRe + idx, vsubq_f32(ar, tr));
+                vst1q_f32(bIm + idx, vsubq_f32(ai, ti));
+            }
+#endif
+            for (; idx < span; idx++) {
+                float tr = bRe[idx] * twRe[idx] - bIm[idx] * twIm[idx];
+                float ti = bRe[idx] * twIm[idx] + bIm[idx] * twRe[idx];
+                bRe[idx] = aRe[idx] - tr;
+                bIm[idx] = aIm[idx] - ti;
+                aRe[idx] += tr;
+                aIm[idx] += ti;
+            }
+        }
+    }
+}
+
+
+/**
+* In-place unnormalized inverse FFT
+*
+* @param fft tables from duoFFTInit()
+* @param re real parts, fft->size values
+* @param im imaginary parts, fft->size values
+*/
+static void duoFFTInverse(const struct DuoFFT* fft, float* re, float* im) {
+    // Swapping real and imaginary parts conjugates the twiddles
+    duoFFTForward(fft, im, re);
+}
+
+
+/**
+* Fill a window of the specified type.
+* Windows are periodic (DFT-even), the usual form for spectral analysis.
+*
+* @param window window type
+* @param out pointer to size values
+* @param size window length
+*/
+static void duoFFTWindow(enum DuoWindow window, float* out, unsigned int size) {
+    for (unsigned int idx = 0; idx < size; idx++) {
+        double phase = 2.0 * DUOFFT_PI * idx / size;
+        switch (window) {
+        case DUO_WINDOW_HANN:
+            out[idx] = (float)(0.5 - 0.5 * cos(phase));
+            break;
+        case DUO_WINDOW_HAMMING:
+            out[idx] = (float)(0.54 - 0.46 * cos(phase));
+            break;
+        case DUO_WINDOW_BLACKMAN:
+            out[idx] = (float)(0.42 - 0.5 * cos(phase) + 0.08 * cos(2.0 * phase));
+            break;
+        default:
+            out[idx] = 1.0f;
+            break;
+        }
+    }
+}
+
+
+/**
+* Short human-readable name for the specified window
+*/
+static const char* duoFFTWindowName(enum DuoWindow window) {
+    switch (window) {
+    case DUO_WINDOW_HANN:
+        return "hann";
+    case DUO_WINDOW_HAMMING:
+        return "hamming";
+    case DUO_WINDOW_BLACKMAN:
+        return "blackman";
+    default:
+        return "rect";
+    }
+}
+
+
+/**
+* Look up a window by the name returned from duoFFTWindowName()
+*
+* @param name window name
+* @param window pointer to store the window type
+*
+* @return zero on success, non-zero if the name is not recognized
+*/
+static int duoFFTWindowFromName(const char* name, enum DuoWindow* window) {
+    for (int idx = DUO_WINDOW_RECT; idx <= DUO_WINDOW_BLACKMAN; idx++) {
+        if (strcmp(name, duoFFTWindowName((enum DuoWindow)idx)) == 0) {
+            *window = (enum DuoWindow)idx;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+#endif
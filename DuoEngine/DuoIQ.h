@@ -0,0 +1,304 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOIQ_H
+#define DUOIQ_H
+
+/**
+* Streaming DC offset and I/Q imbalance correction for one tuner.
+*
+* The DC offset is tracked as the slowly averaged mean of I and Q.
+* The imbalance is estimated blindly from the averaged second moments
+* of the DC free signal: a balanced receiver gives I and Q with equal
+* power and no correlation, so the power ratio gives the gain error of
+* Q and the normalized correlation gives its phase error. Q is then
+* rescaled and orthogonalized against I:
+*
+*     I' = I - dcI
+*     Q' = coefQ * (Q - dcQ) + coefI * I'
+*
+* The statistics of each block are gathered in the same pass that
+* applies the correction from the previous blocks, so the cost is a
+* handful of vector operations per sample.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "DuoEngine.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DUOIQ_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DUOIQ_NEON
+#endif
+
+// Largest phase error that will be corrected, sin(30 degrees)
+#define DUO_IQ_MAX_SIN_PHASE (0.5f)
+
+
+struct DuoIQCorrector {
+    // fraction of the estimate replaced per input sample
+    float rate;
+    // false until the first block has seeded the estimates
+    bool primed;
+    // DC offsets in ADC counts
+    float dcI;
+    float dcQ;
+    // second moments of the DC free signal
+    float powerI;
+    float powerQ;
+    float cross;
+    // correction applied to Q
+    float coefQ;
+    float coefI;
+};
+
+
+/**
+* Keep the averaging time of the estimates after a change of the input
+* sample rate, the estimates themselves are unchanged
+*
+* @param corr pointer to corrector
+* @param sampleRate input sample rate in Hz
+* @param timeConstant averaging time of the estimates in seconds
+*/
+static void duoIQSetRate(struct DuoIQCorrector* corr, double sampleRate, double timeConstant) {
+    corr->rate = (float)(1.0 / (sampleRate * (timeConstant > 0.0 ? timeConstant : 1e-3)));
+}
+
+
+/**
+* Initialize a corrector with no correction applied
+*
+* @param corr pointer to struct to initialize
+* @param sampleRate input sample rate in Hz
+* @param timeConstant averaging time of the estimates in seconds
+*/
+static void duoIQInit(struct DuoIQCorrector* corr, double sampleRate, double timeConstant) {
+    memset(corr, 0, sizeof(struct DuoIQCorrector));
+    duoIQSetRate(corr, sampleRate, timeConstant);
+    corr->coefQ = 1.0f;
+    corr->coefI = 0.0f;
+}
+
+
+/**
+* Recompute the Q correction from the current moments
+*/
+static void duoIQUpdateCoefs(struct DuoIQCorrector* corr) {
+    if (corr->powerI <= 0.0f || corr->powerQ <= 0.0f) {
+        corr->coefQ = 1.0f;
+        corr->coefI = 0.0f;
+        return;
+    }
+    float gain = sqrtf(corr->powerQ / corr->powerI);
+    float sinPhase = corr->cross / sqrtf(corr->powerI * corr->powerQ);
+    if (sinPhase > DUO_IQ_MAX_SIN_PHASE) {
+        sinPhase = DUO_IQ_MAX_SIN_PHASE;
+    }
+    else if (sinPhase < -DUO_IQ_MAX_SIN_PHASE) {
+        sinPhase = -DUO_IQ_MAX_SIN_PHASE;
+    }
+    float cosPhase = sqrtf(1.0f - sinPhase * sinPhase);
+    corr->coefQ = 1.0f / (gain * cosPhase);
+    corr->coefI = -sinPhase / cosPhase;
+}
+
+
+static short duoIQSaturate(float value) {
+    value = value < 0.0f ? value - 0.5f : value + 0.5f;
+    if (value >= 32767.0f) {
+        return 32767;
+    }
+    if (value <= -32768.0f) {
+        return -32768;
+    }
+    return (short)value;
+}
+
+
+/**
+* Correct a block of samples and update the estimates
+*
+* @param corr corrector from duoIQInit()
+* @param xi real input samples
+* @param xq imaginary input samples
+* @param numSamples number of samples in xi and xq
+* @param yi real output samples, may not alias xi
+* @param yq imaginary output samples, may not alias xq
+*/
+static void duoIQProcess(
+        struct DuoIQCorrector* corr, const short* xi, const short* xq,
+        unsigned int numSamples, short* yi, short* yq) {
+    float dcI = corr->dcI;
+    float dcQ = corr->dcQ;
+    float coefQ = corr->coefQ;
+    float coefI = corr->coefI;
+    float sumI = 0.0f;
+    float sumQ = 0.0f;
+    float sumII = 0.0f;
+    float sumQQ = 0.0f;
+    float sumIQ = 0.0f;
+    unsigned int idx = 0;
+
+#if defined(DUOIQ_SSE)
+    __m128 vDcI = _mm_set1_ps(dcI);
+    __m128 vDcQ = _mm_set1_ps(dcQ);
+    __m128 vCoefQ = _mm_set1_ps(coefQ);
+    __m128 vCoefI = _mm_set1_ps(coefI);
+    __m128 vSumI = _mm_setzero_ps();
+    __m128 vSumQ = _mm_setzero_ps();
+    __m128 vSumII = _mm_setzero_ps();
+    __m128 vSumQQ = _mm_setzero_ps();
+    __m128 vSumIQ = _mm_setzero_ps();
+    for (; idx + 8 <= numSamples; idx += 8) {
+        __m128i rawI = _mm_loadu_si128((const __m128i*)(xi + idx));
+        __m128i rawQ = _mm_loadu_si128((const __m128i*)(xq + idx));
+        // Sign extend by unpacking into the high half and shifting down
+        __m128 i0 = _mm_sub_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(rawI, rawI), 16)), vDcI);
+        __m128 i1 = _mm_sub_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(rawI, rawI), 16)), vDcI);
+        __m128 q0 = _mm_sub_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(rawQ, rawQ), 16)), vDcQ);
+        __m128 q1 = _mm_sub_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(rawQ, rawQ), 16)), vDcQ);
+        vSumI = _mm_add_ps(vSumI, _mm_add_ps(i0, i1));
+        vSumQ = _mm_add_ps(vSumQ, _mm_add_ps(q0, q1));
+        vSumII = _mm_add_ps(vSumII, _mm_add_ps(_mm_mul_ps(i0, i0), _mm_mul_ps(i1, i1)));
+        vSumQQ = _mm_add_ps(vSumQQ, _mm_add_ps(_mm_mul_ps(q0, q0), _mm_mul_ps(q1, q1)));
+        vSumIQ = _mm_add_ps(vSumIQ, _mm_add_ps(_mm_mul_ps(i0, q0), _mm_mul_ps(i1, q1)));
+        q0 = _mm_add_ps(_mm_mul_ps(vCoefQ, q0), _mm_mul_ps(vCoefI, i0));
+        q1 = _mm_add_ps(_mm_mul_ps(vCoefQ, q1), _mm_mul_ps(vCoefI, i1));
+        // Round to nearest and saturate back to 16 bits
+        _mm_storeu_si128((__m128i*)(yi + idx), _mm_packs_epi32(_mm_cvtps_epi32(i0), _mm_cvtps_epi32(i1)));
+        _mm_storeu_si128((__m128i*)(yq + idx), _mm_packs_epi32(_mm_cvtps_epi32(q0), _mm_cvtps_epi32(q1)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, vSumI);
+    sumI = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_ps(lanes, vSumQ);
+    sumQ = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_ps(lanes, vSumII);
+    sumII = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_ps(lanes, vSumQQ);
+    sumQQ = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_ps(lanes, vSumIQ);
+    sumIQ = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(DUOIQ_NEON)
+    float32x4_t vDcI = vdupq_n_f32(dcI);
+    float32x4_t vDcQ = vdupq_n_f32(dcQ);
+    float32x4_t vSumI = vdupq_n_f32(0.0f);
+    float32x4_t vSumQ = vdupq_n_f32(0.0f);
+    float32x4_t vSumII = vdupq_n_f32(0.0f);
+    float32x4_t vSumQQ = vdupq_n_f32(0.0f);
+    float32x4_t vSumIQ = vdupq_n_f32(0.0f);
+    float32x4_t vHalf = vdupq_n_f32(0.5f);
+    uint32x4_t vSign = vdupq_n_u32(0x80000000u);
+    for (; idx + 4 <= numSamples; idx += 4) {
+        float32x4_t i0 = vsubq_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(xi + idx))), vDcI);
+        float32x4_t q0 = vsubq_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(xq + idx))), vDcQ);
+        vSumI = vaddq_f32(vSumI, i0);
+        vSumQ = vaddq_f32(vSumQ, q0);
+        vSumII = vmlaq_f32(vSumII, i0, i0);
+        vSumQQ = vmlaq_f32(vSumQQ, q0, q0);
+        vSumIQ = vmlaq_f32(vSumIQ, i0, q0);
+        q0 = vmlaq_n_f32(vmulq_n_f32(q0, coefQ), i0, coefI);
+        // Round half away from zero, then truncate and saturate to 16 bits
+        float32x4_t halfI = vreinterpretq_f32_u32(vorrq_u32(
+            vandq_u32(vreinterpretq_u32_f32(i0), vSign), vreinterpretq_u32_f32(vHalf)));
+        float32x4_t halfQ = vreinterpretq_f32_u32(vorrq_u32(
+            vandq_u32(vreinterpretq_u32_f32(q0), vSign), vreinterpretq_u32_f32(vHalf)));
+        vst1_s16(yi + idx, vqmovn_s32(vcvtq_s32_f32(vaddq_f32(i0, halfI))));
+        vst1_s16(yq + idx, vqmovn_s32(vcvtq_s32_f32(vaddq_f32(q0, halfQ))));
+    }
+    float lanes[4];
+    vst1q_f32(lanes, vSumI);
+    sumI = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    vst1q_f32(lanes, vSumQ);
+    sumQ = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    vst1q_f32(lanes, vSumII);
+    sumII = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    vst1q_f32(lanes, vSumQQ);
+    sumQQ = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    vst1q_f32(lanes, vSumIQ);
+    sumIQ = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; idx < numSamples; idx++) {
+        float i0 = xi[idx] - dcI;
+        float q0 = xq[idx] - dcQ;
+        sumI += i0;
+        sumQ += q0;
+        sumII += i0 * i0;
+        sumQQ += q0 * q0;
+        sumIQ += i0 * q0;
+        yi[idx] = duoIQSaturate(i0);
+        yq[idx] = duoIQSaturate(coefQ * q0 + coefI * i0);
+    }
+
+    if (numSamples == 0) {
+        return;
+    }
+
+    // Fold the block statistics into the estimates
+    float count = (float)numSamples;
+    float meanI = sumI / count;
+    float meanQ = sumQ / count;
+    float weight = corr->primed ? 1.0f - expf(-corr->rate * count) : 1.0f;
+    corr->dcI += weight * meanI;
+    corr->dcQ += weight * meanQ;
+    corr->powerI += weight * (sumII / count - meanI * meanI - corr->powerI);
+    corr->powerQ += weight * (sumQQ / count - meanQ * meanQ - corr->powerQ);
+    corr->cross += weight * (sumIQ / count - meanI * meanQ - corr->cross);
+    corr->primed = true;
+    duoIQUpdateCoefs(corr);
+}
+
+
+/**
+* Report the current estimates
+*
+* @param corr corrector from duoIQInit()
+* @param estimate receives the estimates
+*/
+static void duoIQEstimate(const struct DuoIQCorrector* corr, struct DuoEngineIQEstimate* estimate) {
+    estimate->dcI = corr->dcI / 32768.0f;
+    estimate->dcQ = corr->dcQ / 32768.0f;
+    estimate->gain = 1.0f;
+    estimate->phase = 0.0f;
+    estimate->imageRejection = 0.0f;
+    if (corr->powerI <= 0.0f || corr->powerQ <= 0.0f) {
+        return;
+    }
+    double gain = sqrt(corr->powerQ / corr->powerI);
+    double sinPhase = corr->cross / sqrt((double)corr->powerI * corr->powerQ);
+    double cosPhase = sqrt(fmax(0.0, 1.0 - sinPhase * sinPhase));
+    double wanted = 1.0 + 2.0 * gain * cosPhase + gain * gain;
+    double image = 1.0 - 2.0 * gain * cosPhase + gain * gain;
+    estimate->gain = (float)gain;
+    estimate->phase = (float)(asin(sinPhase) * 180.0 / 3.14159265358979323846);
+    estimate->imageRejection = (float)(10.0 * log10(wanted / (image + 1e-12)));
+}
+
+
+#endif
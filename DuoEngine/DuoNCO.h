@@ -0,0 +1,255 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUONCO_H
+#define DUONCO_H
+
+/**
+* Numerically controlled oscillator mixer for complex 16-bit samples.
+*
+* Each sample is multiplied by e^{-j 2 pi f n / fs}, which moves a
+* signal at offset f from the tuning frequency to 0 Hz. The phase is
+* kept in cycles as a double so it never drifts, and carries over
+* between blocks and frequency changes so the output is phase
+* continuous.
+*
+* Mixing reads the phase without advancing it, so the same block
+* length can be mixed for both tuners with an identical phase before
+* duoNCOAdvance() moves on. Within each run of DUO_NCO_BLOCK samples
+* four phasors are rotated together with SSE or NEON, and the run
+* starts again from the exact phase to bound the rounding error.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DUONCO_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DUONCO_NEON
+#endif
+
+// Samples mixed from each exactly computed starting phase
+#define DUO_NCO_BLOCK (256)
+
+#ifndef DUONCO_PI
+#define DUONCO_PI (3.14159265358979323846)
+#endif
+
+
+struct DuoNCO {
+    // phase of the next sample in cycles, in [0, 1)
+    double phase;
+    // phase increment per sample in cycles
+    double step;
+};
+
+
+/**
+* Set the frequency shifted to 0 Hz without disturbing the phase
+*
+* @param nco oscillator to update
+* @param freq offset from the tuning frequency in Hz
+* @param sampleRate sample rate of the mixed samples in Hz
+*/
+static void duoNCOSetFrequency(struct DuoNCO* nco, double freq, double sampleRate) {
+    nco->step = -freq / sampleRate;
+    nco->step -= floor(nco->step);
+}
+
+
+/**
+* Initialize the oscillator with zero phase
+*
+* @param nco oscillator to initialize
+* @param freq offset from the tuning frequency in Hz
+* @param sampleRate sample rate of the mixed samples in Hz
+*/
+static void duoNCOInit(struct DuoNCO* nco, double freq, double sampleRate) {
+    nco->phase = 0.0;
+    duoNCOSetFrequency(nco, freq, sampleRate);
+}
+
+
+/**
+* True when mixing would leave the samples unchanged
+*/
+static bool duoNCOIdle(const struct DuoNCO* nco) {
+    return nco->step == 0.0 && nco->phase == 0.0;
+}
+
+
+/**
+* Advance the phase past numSamples mixed samples
+*/
+static void duoNCOAdvance(struct DuoNCO* nco, unsigned int numSamples) {
+    nco->phase += nco->step * numSamples;
+    nco->phase -= floor(nco->phase);
+}
+
+
+/**
+* Mix a block of samples into floating point, e.g. the history of a
+* filter. The first sample is mixed with the phase offset samples
+* after the current phase.
+*
+* @param nco oscillator, not advanced
+* @param offset samples between the current phase and xi[0]
+* @param xi real input samples
+* @param xq imaginary input samples
+* @param numSamples number of samples
+* @param yi real output
+* @param yq imaginary output
+*/
+static void duoNCOMixFloat(
+        const struct DuoNCO* nco, unsigned int offset,
+        const short* xi, const short* xq, unsigned int numSamples,
+        float* yi, float* yq) {
+    double stepAngle = 2.0 * DUONCO_PI * nco->step;
+    for (unsigned int base = 0; base < numSamples; base += DUO_NCO_BLOCK) {
+        unsigned int count = numSamples - base;
+        if (count > DUO_NCO_BLOCK) {
+            count = DUO_NCO_BLOCK;
+        }
+        double start = nco->phase + nco->step * (offset + base);
+        start = 2.0 * DUONCO_PI * (start - floor(start));
+        float lanesRe[4];
+        float lanesIm[4];
+        for (unsigned int lane = 0; lane < 4; lane++) {
+            lanesRe[lane] = (float)cos(start + lane * stepAngle);
+            lanesIm[lane] = (float)sin(start + lane * stepAngle);
+        }
+        float rotRe = (float)cos(4.0 * stepAngle);
+        float rotIm = (float)sin(4.0 * stepAngle);
+        const short* bi = xi + base;
+        const short* bq = xq + base;
+        float* oi = yi + base;
+        float* oq = yq + base;
+        unsigned int idx = 0;
+#if defined(DUONCO_SSE)
+        __m128 pr = _mm_loadu_ps(lanesRe);
+        __m128 pi = _mm_loadu_ps(lanesIm);
+        __m128 sr = _mm_set1_ps(rotRe);
+        __m128 si = _mm_set1_ps(rotIm);
+        for (; idx + 4 <= count; idx += 4) {
+            // Sign extend by unpacking into the high half and shifting down
+            __m128i rawI = _mm_loadl_epi64((const __m128i*)(bi + idx));
+            __m128i rawQ = _mm_loadl_epi64((const __m128i*)(bq + idx));
+            __m128 vi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(rawI, rawI), 16));
+            __m128 vq = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(rawQ, rawQ), 16));
+            _mm_storeu_ps(oi + idx, _mm_sub_ps(_mm_mul_ps(vi, pr), _mm_mul_ps(vq, pi)));
+            _mm_storeu_ps(oq + idx, _mm_add_ps(_mm_mul_ps(vi, pi), _mm_mul_ps(vq, pr)));
+            __m128 nr = _mm_sub_ps(_mm_mul_ps(pr, sr), _mm_mul_ps(pi, si));
+            pi = _mm_add_ps(_mm_mul_ps(pr, si), _mm_mul_ps(pi, sr));
+            pr = nr;
+        }
+        _mm_storeu_ps(lanesRe, pr);
+        _mm_storeu_ps(lanesIm, pi);
+#elif defined(DUONCO_NEON)
+        float32x4_t pr = vld1q_f32(lanesRe);
+        float32x4_t pi = vld1q_f32(lanesIm);
+        for (; idx + 4 <= count; idx += 4) {
+            float32x4_t vi = vcvtq_f32_s32(vmovl_s16(vld1_s16(bi + idx)));
+            float32x4_t vq = vcvtq_f32_s32(vmovl_s16(vld1_s16(bq + idx)));
+            vst1q_f32(oi + idx, vmlsq_f32(vmulq_f32(vi, pr), vq, pi));
+            vst1q_f32(oq + idx, vmlaq_f32(vmulq_f32(vi, pi), vq, pr));
+            float32x4_t nr = vmlsq_n_f32(vmulq_n_f32(pr, rotRe), pi, rotIm);
+            pi = vmlaq_n_f32(vmulq_n_f32(pr, rotIm), pi, rotRe);
+            pr = nr;
+        }
+        vst1q_f32(lanesRe, pr);
+        vst1q_f32(lanesIm, pi);
+#else
+        for (; idx + 4 <= count; idx += 4) {
+            for (unsigned int lane = 0; lane < 4; lane++) {
+                float vi = bi[idx + lane];
+                float vq = bq[idx + lane];
+                oi[idx + lane] = vi * lanesRe[lane] - vq * lanesIm[lane];
+                oq[idx + lane] = vi * lanesIm[lane] + vq * lanesRe[lane];
+                float nr = lanesRe[lane] * rotRe - lanesIm[lane] * rotIm;
+                lanesIm[lane] = lanesRe[lane] * rotIm + lanesIm[lane] * rotRe;
+                lanesRe[lane] = nr;
+            }
+        }
+#endif
+        // The remaining samples continue from the next phasor of each lane
+        for (unsigned int lane = 0; idx < count; idx++, lane++) {
+            float vi = bi[idx];
+            float vq = bq[idx];
+            oi[idx] = vi * lanesRe[lane] - vq * lanesIm[lane];
+            oq[idx] = vi * lanesIm[lane] + vq * lanesRe[lane];
+        }
+    }
+}
+
+
+/**
+* Mix a block of samples into 16-bit samples
+*
+* @param nco oscillator, not advanced
+* @param xi real input samples
+* @param xq imaginary input samples
+* @param numSamples number of samples
+* @param yi real output, may alias xi
+* @param yq imaginary output, may alias xq
+*/
+static void duoNCOMix(
+        const struct DuoNCO* nco, const short* xi, const short* xq,
+        unsigned int numSamples, short* yi, short* yq) {
+    float mixI[DUO_NCO_BLOCK];
+    float mixQ[DUO_NCO_BLOCK];
+    for (unsigned int base = 0; base < numSamples; base += DUO_NCO_BLOCK) {
+        unsigned int count = numSamples - base;
+        if (count > DUO_NCO_BLOCK) {
+            count = DUO_NCO_BLOCK;
+        }
+        duoNCOMixFloat(nco, base, xi + base, xq + base, count, mixI, mixQ);
+        short* oi = yi + base;
+        short* oq = yq + base;
+        unsigned int idx = 0;
+#if defined(DUONCO_SSE)
+        for (; idx + 8 <= count; idx += 8) {
+            // Rounds to nearest and saturates to 16 bits
+            __m128i i0 = _mm_cvtps_epi32(_mm_loadu_ps(mixI + idx));
+            __m128i i1 = _mm_cvtps_epi32(_mm_loadu_ps(mixI + idx + 4));
+            __m128i q0 = _mm_cvtps_epi32(_mm_loadu_ps(mixQ + idx));
+            __m128i q1 = _mm_cvtps_epi32(_mm_loadu_ps(mixQ + idx + 4));
+            _mm_storeu_si128((__m128i*)(oi + idx), _mm_packs_epi32(i0, i1));
+            _mm_storeu_si128((__m128i*)(oq + idx), _mm_packs_epi32(q0, q1));
+        }
+#endif
+        for (; idx < count; idx++) {
+            float vi = mixI[idx];
+            float vq = mixQ[idx];
+            vi = vi < 0.0f ? vi - 0.5f : vi + 0.5f;
+            vq = vq < 0.0f ? vq - 0.5f : vq + 0.5f;
+            oi[idx] = (short)(vi >= 32767.0f ? 32767 : (vi <= -32768.0f ? -32768 : vi));
+            oq[idx] = (short)(vq >= 32767.0f ? 32767 : (vq <= -32768.0f ? -32768 : vq));
+        }
+    }
+}
+
+
+#endif
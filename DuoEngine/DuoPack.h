@@ -0,0 +1,483 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOPACK_H
+#define DUOPACK_H
+
+/**
+* Pack and unpack routines for the reduced-size DuoEngine formats.
+* Integer formats are packed from 16-bit scalars and float16 is
+* converted from 32-bit floating point scalars.
+* DuoEngine uses the pack routines to produce transfers and receivers
+* can include this header on its own to restore 16-bit scalars.
+*
+* Packing keeps the most significant bits of each 16-bit scalar and
+* unpacking restores the original 16-bit scale with the discarded low
+* bits set to zero.
+* Bit-packed scalars are stored little-endian, lowest scalar in the
+* lowest bits, e.g. for 12-bit scalars a and b:
+*     byte0 = a[7:0], byte1 = b[3:0] a[11:8], byte2 = b[11:4]
+* A trailing partial group is zero-padded to a whole byte.
+*
+* SIMD kernels are used when the compiler targets SSE2/SSSE3/F16C or
+* NEON with scalar code for the remainder and other architectures.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "DuoEngine.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DUOPACK_SSE2
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define DUOPACK_SSSE3
+#endif
+#if defined(__F16C__)
+#include <immintrin.h>
+#define DUOPACK_F16C
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DUOPACK_NEON
+#if defined(__aarch64__) || (defined(__ARM_FP) && (__ARM_FP & 2))
+#define DUOPACK_NEON_FP16
+#endif
+#endif
+
+
+/**
+* Number of bytes needed to hold packed scalars
+*
+* @param format packed format
+* @param numScalars number of scalars
+*
+* @return size in bytes, rounded up to a whole byte
+*/
+static size_t duoPackedSize(enum DuoEngineFormat format, size_t numScalars) {
+    return (numScalars * duoEngineFormatBits(format) + 7) / 8;
+}
+
+
+/**
+* Pack 16-bit scalars to 8-bit scalars
+*/
+static void duoPackInt8(const int16_t* in, int8_t* out, size_t numScalars) {
+    size_t idx = 0;
+#if defined(DUOPACK_SSE2)
+    for (; idx + 16 <= numScalars; idx += 16) {
+        __m128i lo = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(in + idx)), 8);
+        __m128i hi = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(in + idx + 8)), 8);
+        _mm_storeu_si128((__m128i*)(out + idx), _mm_packs_epi16(lo, hi));
+    }
+#elif defined(DUOPACK_NEON)
+    for (; idx + 8 <= numScalars; idx += 8) {
+        vst1_s8(out + idx, vshrn_n_s16(vld1q_s16(in + idx), 8));
+    }
+#endif
+    for (; idx < numScalars; idx++) {
+        out[idx] = (int8_t)(in[idx] >> 8);
+    }
+}
+
+
+/**
+* Unpack 8-bit scalars to 16-bit scalars
+*/
+static void duoUnpackInt8(const int8_t* in, int16_t* out, size_t numScalars) {
+    size_t idx = 0;
+#if defined(DUOPACK_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    for (; idx + 16 <= numScalars; idx += 16) {
+        // Interleaving with zero bytes shifts each value into the high byte
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + idx));
+        _mm_storeu_si128((__m128i*)(out + idx), _mm_unpacklo_epi8(zero, v));
+        _mm_storeu_si128((__m128i*)(out + idx + 8), _mm_unpackhi_epi8(zero, v));
+    }
+#elif defined(DUOPACK_NEON)
+    for (; idx + 8 <= numScalars; idx += 8) {
+        vst1q_s16(out + idx, vshll_n_s8(vld1_s8(in + idx), 8));
+    }
+#endif
+    for (; idx < numScalars; idx++) {
+        out[idx] = (int16_t)(in[idx] * 256);
+    }
+}
+
+
+/**
+* Pack 16-bit scalars to bit-packed 12-bit scalars
+*/
+static void duoPackInt12(const int16_t* in, uint8_t* out, size_t numScalars) {
+    size_t idx = 0;
+#if defined(DUOPACK_SSSE3)
+    const __m128i mask12 = _mm_set1_epi32(0x0FFF);
+    const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for (; idx + 8 <= numScalars; idx += 8) {
+        __m128i v = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(in + idx)), 4);
+        // Each 32-bit lane holds a pair, combine to a | b << 12
+        __m128i lo = _mm_and_si128(v, mask12);
+        __m128i hi = _mm_slli_epi32(_mm_srli_epi32(v, 16), 12);
+        __m128i packed = _mm_shuffle_epi8(_mm_or_si128(lo, hi), compact);
+        _mm_storel_epi64((__m128i*)out, packed);
+        uint32_t tail = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+        memcpy(out + 8, &tail, 4);
+        out += 12;
+    }
+#elif defined(DUOPACK_NEON)
+    for (; idx + 16 <= numScalars; idx += 16) {
+        int16x8x2_t v = vld2q_s16(in + idx);
+        uint16x8_t a = vreinterpretq_u16_s16(vshrq_n_s16(v.val[0], 4));
+        uint16x8_t b = vreinterpretq_u16_s16(vshrq_n_s16(v.val[1], 4));
+        uint8x8x3_t bytes;
+        bytes.val[0] = vmovn_u16(a);
+        bytes.val[1] = vmovn_u16(vorrq_u16(
+            vandq_u16(vshrq_n_u16(a, 8), vdupq_n_u16(0x0F)), vshlq_n_u16(b, 4)));
+        bytes.val[2] = vmovn_u16(vshrq_n_u16(b, 4));
+        vst3_u8(out, bytes);
+        out += 24;
+    }
+#endif
+    for (; idx + 2 <= numScalars; idx += 2) {
+        uint32_t a = (uint16_t)(in[idx] >> 4) & 0x0FFF;
+        uint32_t b = (uint16_t)(in[idx + 1] >> 4) & 0x0FFF;
+        out[0] = (uint8_t)a;
+        out[1] = (uint8_t)((a >> 8) | (b << 4));
+        out[2] = (uint8_t)(b >> 4);
+        out += 3;
+    }
+    if (idx < numScalars) {
+        uint32_t a = (uint16_t)(in[idx] >> 4) & 0x0FFF;
+        out[0] = (uint8_t)a;
+        out[1] = (uint8_t)(a >> 8);
+    }
+}
+
+
+/**
+* Unpack bit-packed 12-bit scalars to 16-bit scalars
+*/
+static void duoUnpackInt12(const uint8_t* in, int16_t* out, size_t numScalars) {
+    size_t idx = 0;
+#if defined(DUOPACK_SSSE3)
+    const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i mask12 = _mm_set1_epi32(0x0FFF);
+    // 16 bytes are loaded for each 12 consumed so stop early enough
+    for (; idx + 8 <= numScalars && (numScalars - idx) * 3 / 2 >= 16; idx += 8) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), expand);
+        __m128i lo = _mm_slli_epi32(_mm_and_si128(v, mask12), 4);
+        __m128i hi = _mm_slli_epi32(_mm_srli_epi32(v, 12), 20);
+        _mm_storeu_si128((__m128i*)(out + idx), _mm_or_si128(lo, hi));
+        in += 12;
+    }
+#elif defined(DUOPACK_NEON)
+    for (; idx + 16 <= numScalars; idx += 16) {
+        uint8x8x3_t bytes = vld3_u8(in);
+        uint16x8_t b0 = vmovl_u8(bytes.val[0]);
+        uint16x8_t b1 = vmovl_u8(bytes.val[1]);
+        uint16x8_t b2 = vmovl_u8(bytes.val[2]);
+        int16x8x2_t v;
+        v.val[0] = vreinterpretq_s16_u16(vshlq_n_u16(
+            vorrq_u16(b0, vshlq_n_u16(vandq_u16(b1, vdupq_n_u16(0x0F)), 8)), 4));
+        v.val[1] = vreinterpretq_s16_u16(vshlq_n_u16(
+            vorrq_u16(vshrq_n_u16(b1, 4), vshlq_n_u16(b2, 4)), 4));
+        vst2q_s16(out + idx, v);
+        in += 24;
+    }
+#endif
+    for (; idx + 2 <= numScalars; idx += 2) {
+        uint32_t word = in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16);
+        out[idx] = (int16_t)(uint16_t)((word & 0x0FFF) << 4);
+        out[idx + 1] = (int16_t)(uint16_t)(((word >> 12) & 0x0FFF) << 4);
+        in += 3;
+    }
+    if (idx < numScalars) {
+        uint32_t word = in[0] | ((uint32_t)in[1] << 8);
+        out[idx] = (int16_t)(uint16_t)((word & 0x0FFF) << 4);
+    }
+}
+
+
+/**
+* Pack 16-bit scalars to bit-packed 14-bit scalars
+*/
+static void duoPackInt14(const int16_t* in, uint8_t* out, size_t numScalars) {
+    size_t idx = 0;
+#if defined(DUOPACK_SSSE3)
+    const __m128i mask14 = _mm_set1_epi32(0x3FFF);
+    const __m128i mask28 = _mm_set_epi32(0, 0x0FFFFFFF, 0, 0x0FFFFFFF);
+    const __m128i compact = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 8, 9, 10, 11, 12, 13, 14, -1, -1);
+    for (; idx + 8 <= numScalars; idx += 8) {
+        __m128i v = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(in + idx)), 2);
+        // Combine pairs in 32-bit lanes, then pairs of pairs in 64-bit lanes
+        __m128i pairs = _mm_or_si128(
+            _mm_and_si128(v, mask14), _mm_slli_epi32(_mm_srli_epi32(v, 16), 14));
+        __m128i quads = _mm_or_si128(
+            _mm_and_si128(pairs, mask28), _mm_slli_epi64(_mm_srli_epi64(pairs, 32), 28));
+        __m128i packed = _mm_shuffle_epi8(quads, compact);
+        _mm_storel_epi64((__m128i*)out, packed);
+        uint64_t tail = 0;
+        _mm_storel_epi64((__m128i*)&tail, _mm_srli_si128(packed, 8));
+        memcpy(out + 8, &tail, 6);
+        out += 14;
+    }
+#endif
+    for (; idx + 4 <= numScalars; idx += 4) {
+        uint64_t word = ((uint64_t)((uint16_t)(in[idx] >> 2) & 0x3FFF)) |
+                        ((uint64_t)((uint16_t)(in[idx + 1] >> 2) & 0x3FFF) << 14) |
+                        ((uint64_t)((uint16_t)(in[idx + 2] >> 2) & 0x3FFF) << 28) |
+                        ((uint64_t)((uint16_t)(in[idx + 3] >> 2) & 0x3FFF) << 42);
+        for (unsigned int byte = 0; byte < 7; byte++) {
+            out[byte] = (uint8_t)(word >> (8 * byte));
+        }
+        out += 7;
+    }
+    if (idx < numScalars) {
+        uint64_t word = 0;
+        size_t remain = numScalars - idx;
+        for (size_t pos = 0; pos < remain; pos++) {
+            word |= (uint64_t)((uint16_t)(in[idx + pos] >> 2) & 0x3FFF) << (14 * pos);
+        }
+        for (size_t byte = 0; byte < (remain * 14 + 7) / 8; byte++) {
+            out[byte] = (uint8_t)(word >> (8 * byte));
+        }
+    }
+}
+
+
+/**
+* Unpack bit-packed 14-bit scalars to 16-bit scalars
+*/
+static void duoUnpackInt14(const uint8_t* in, int16_t* out, size_t numScalars) {
+    size_t idx = 0;
+#if defined(DUOPACK_SSSE3)
+    const __m128i expand = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, -1, 7, 8, 9, 10, 11, 12, 13, -1);
+    const __m128i mask14 = _mm_set1_epi32(0x3FFF);
+    const __m128i mask28 = _mm_set_epi32(0, 0x0FFFFFFF, 0, 0x0FFFFFFF);
+    // 16 bytes are loaded for each 14 consumed so stop early enough
+    for (; idx + 8 <= numScalars && (numScalars - idx) * 7 / 4 >= 16; idx += 8) {
+        __m128i quads = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), expand);
+        __m128i pairs = _mm_or_si128(
+            _mm_and_si128(quads, mask28), _mm_slli_epi64(_mm_srli_epi64(quads, 28), 32));
+        __m128i lo = _mm_slli_epi32(_mm_and_si128(pairs, mask14), 2);
+        __m128i hi = _mm_slli_epi32(_mm_srli_epi32(pairs, 14), 18);
+        _mm_storeu_si128((__m128i*)(out + idx), _mm_or_si128(lo, hi));
+        in += 14;
+    }
+#endif
+    for (; idx + 4 <= numScalars; idx += 4) {
+        uint64_t word = 0;
+        for (unsigned int byte = 0; byte < 7; byte++) {
+            word |= (uint64_t)in[byte] << (8 * byte);
+        }
+        for (unsigned int pos = 0; pos < 4; pos++) {
+            out[idx + pos] = (int16_t)(uint16_t)(((word >> (14 * pos)) & 0x3FFF) << 2);
+        }
+        in += 7;
+    }
+    if (idx < numScalars) {
+        uint64_t word = 0;
+        size_t remain = numScalars - idx;
+        for (size_t byte = 0; byte < (remain * 14 + 7) / 8; byte++) {
+            word |= (uint64_t)in[byte] << (8 * byte);
+        }
+        for (size_t pos = 0; pos < remain; pos++) {
+            out[idx + pos] = (int16_t)(uint16_t)(((word >> (14 * pos)) & 0x3FFF) << 2);
+        }
+    }
+}
+
+
+/**
+* Convert one float to IEEE half precision, rounding to nearest even
+*/
+static uint16_t duoFloatToHalf(float value) {
+    uint32_t bits = 0;
+    uint32_t sign = 0;
+    uint16_t half = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    sign = bits & 0x80000000u;
+    bits ^= sign;
+    if (bits >= 0x47800000u) {
+        // Too large for half precision, Inf or NaN
+        half = (bits > 0x7F800000u) ? 0x7E00 : 0x7C00;
+    }
+    else if (bits < 0x38800000u) {
+        // Subnormal or zero, let float addition do the rounding
+        const uint32_t magicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+        float magic = 0;
+        float tmp = 0;
+        memcpy(&magic, &magicBits, sizeof(magic));
+        memcpy(&tmp, &bits, sizeof(tmp));
+        tmp += magic;
+        memcpy(&bits, &tmp, sizeof(bits));
+        half = (uint16_t)(bits - magicBits);
+    }
+    else {
+        uint32_t mantOdd = (bits >> 13) & 1;
+        // Rebias the exponent and round the mantissa
+        bits += ((uint32_t)(15 - 127) << 23) + 0x0FFF;
+        bits += mantOdd;
+        half = (uint16_t)(bits >> 13);
+    }
+    return half | (uint16_t)(sign >> 16);
+}
+
+
+/**
+* Convert one IEEE half precision value to float
+*/
+static float duoHalfToFloat(uint16_t half) {
+    const uint32_t shiftedExp = 0x7C00u << 13;
+    uint32_t bits = ((uint32_t)half & 0x7FFF) << 13;
+    uint32_t exp = shiftedExp & bits;
+    float value = 0;
+    bits += (uint32_t)(127 - 15) << 23;
+    if (exp == shiftedExp) {
+        // Inf or NaN
+        bits += (uint32_t)(128 - 16) << 23;
+        memcpy(&value, &bits, sizeof(value));
+    }
+    else if (exp == 0) {
+        // Zero or subnormal, renormalize with float subtraction
+        const uint32_t magicBits = 113u << 23;
+        float magic = 0;
+        memcpy(&magic, &magicBits, sizeof(magic));
+        bits += 1u << 23;
+        memcpy(&value, &bits, sizeof(value));
+        value -= magic;
+    }
+    else {
+        memcpy(&value, &bits, sizeof(value));
+    }
+    uint32_t sign = ((uint32_t)half & 0x8000) << 16;
+    memcpy(&bits, &value, sizeof(bits));
+    bits |= sign;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+/**
+* Convert floating point scalars to IEEE half precision
+*/
+static void duoPackFloat16(const float* in, uint16_t* out, size_t numScalars) {
+    size_t idx = 0;
+#if defined(DUOPACK_F16C)
+    for (; idx + 8 <= numScalars; idx += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(in + idx), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(out + idx), half);
+    }
+#elif defined(DUOPACK_NEON_FP16)
+    for (; idx + 4 <= numScalars; idx += 4) {
+        vst1_u16(out + idx, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(in + idx))));
+    }
+#endif
+    for (; idx < numScalars; idx++) {
+        out[idx] = duoFloatToHalf(in[idx]);
+    }
+}
+
+
+/**
+* Convert IEEE half precision scalars to floating point
+*/
+static void duoUnpackFloat16(const uint16_t* in, float* out, size_t numScalars) {
+    size_t idx = 0;
+#if defined(DUOPACK_F16C)
+    for (; idx + 8 <= numScalars; idx += 8) {
+        __m128i half = _mm_loadu_si128((const __m128i*)(in + idx));
+        _mm256_storeu_ps(out + idx, _mm256_cvtph_ps(half));
+    }
+#elif defined(DUOPACK_NEON_FP16)
+    for (; idx + 4 <= numScalars; idx += 4) {
+        vst1q_f32(out + idx, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(in + idx))));
+    }
+#endif
+    for (; idx < numScalars; idx++) {
+        out[idx] = duoHalfToFloat(in[idx]);
+    }
+}
+
+
+/**
+* Pack 16-bit scalars to the specified format
+*
+* @param format destination format, must be a packed integer format
+*               (use duoPackFloat16() for float16)
+* @param in pointer to 16-bit scalars
+* @param out pointer to at least duoPackedSize() bytes
+* @param numScalars number of scalars to pack
+*
+* @return number of bytes written to out
+*/
+static size_t duoPack(enum DuoEngineFormat format, const int16_t* in, void* out, size_t numScalars) {
+    switch (format) {
+    case DUO_FORMAT_INT12:
+        duoPackInt12(in, (uint8_t*)out, numScalars);
+        break;
+    case DUO_FORMAT_INT14:
+        duoPackInt14(in, (uint8_t*)out, numScalars);
+        break;
+    case DUO_FORMAT_INT8:
+        duoPackInt8(in, (int8_t*)out, numScalars);
+        break;
+    default:
+        memcpy(out, in, numScalars * sizeof(int16_t));
+        break;
+    }
+    return duoPackedSize(format, numScalars);
+}
+
+
+/**
+* Unpack scalars in the specified format to 16-bit scalars
+*
+* @param format source format, must be a packed integer format
+*               (use duoUnpackFloat16() for float16)
+* @param in pointer to packed data
+* @param out pointer to room for numScalars 16-bit scalars
+* @param numScalars number of scalars to unpack
+*/
+static void duoUnpack(enum DuoEngineFormat format, const void* in, int16_t* out, size_t numScalars) {
+    switch (format) {
+    case DUO_FORMAT_INT12:
+        duoUnpackInt12((const uint8_t*)in, out, numScalars);
+        break;
+    case DUO_FORMAT_INT14:
+        duoUnpackInt14((const uint8_t*)in, out, numScalars);
+        break;
+    case DUO_FORMAT_INT8:
+        duoUnpackInt8((const int8_t*)in, out, numScalars);
+        break;
+    default:
+        memcpy(out, in, numScalars * sizeof(int16_t));
+        break;
+    }
+}
+
+
+#endif
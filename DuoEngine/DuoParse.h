@@ -25,6 +25,9 @@ SOFTWARE.
 
 #if defined(_WIN32) || (_WIN64)
 #include <winsock.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #endif
 
 #include <stdlib.h>
@@ -34,6 +37,9 @@ SOFTWARE.
 #include <errno.h>
 
 #include "DuoEngine.h"
+#include "DuoCal.h"
+#include "DuoBeam.h"
+#include "DuoRealtime.h"
 
 
 static int parseUintArg(char* arg, unsigned int* result, int base) {
@@ -62,6 +68,19 @@ static int parseIntArg(char* arg, int* result, int base) {
 }
 
 
+static int parseFloatArg(char* arg, float* result) {
+    char* endPtr = NULL;
+    errno = 0;
+    float tmp = strtof(arg, &endPtr);
+    if (errno || endPtr == arg || *endPtr != '\0') {
+        perror("failed to parse float");
+        return 1;
+    }
+    *result = tmp;
+    return 0;
+}
+
+
 static int parseFrequency(char* arg, float* result) {
     char* endPtr = NULL;
     float freq = 0;
@@ -181,6 +200,135 @@ static int parseDecimFactor(char* arg, unsigned int* result) {
 }
 
 
+static int parseSampleFormat(char* arg, enum DuoEngineFormat* result) {
+    if (strcmp(arg, "int16") == 0) {
+        *result = DUO_FORMAT_INT16;
+    }
+    else if (strcmp(arg, "float32") == 0) {
+        *result = DUO_FORMAT_FLOAT32;
+    }
+    else if (strcmp(arg, "int14") == 0) {
+        *result = DUO_FORMAT_INT14;
+    }
+    else if (strcmp(arg, "int12") == 0) {
+        *result = DUO_FORMAT_INT12;
+    }
+    else if (strcmp(arg, "int8") == 0) {
+        *result = DUO_FORMAT_INT8;
+    }
+    else if (strcmp(arg, "float16") == 0) {
+        *result = DUO_FORMAT_FLOAT16;
+    }
+    else {
+        printf("invalid sample format [%s], must be int16, float32, float16, int14, int12, or int8\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
+
+static int parseLayout(char* arg, enum DuoEngineLayout* result) {
+    if (strcmp(arg, "interleaved") == 0) {
+        *result = DUO_LAYOUT_INTERLEAVED;
+    }
+    else if (strcmp(arg, "planar") == 0) {
+        *result = DUO_LAYOUT_PLANAR;
+    }
+    else if (strcmp(arg, "split") == 0) {
+        *result = DUO_LAYOUT_SPLIT;
+    }
+    else {
+        printf("invalid layout [%s], must be interleaved, planar, or split\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
+
+/**
+* Parsing function for output sample rates.
+* Accepts the same k, M, and G suffixes as frequencies (e.g. 48k or 2.4M)
+* and rounds to a whole number of Hz.
+*/
+static int parseSampleRate(char* arg, unsigned int* result) {
+    float rate = 0;
+    if (parseFrequency(arg, &rate) || rate < 1.0f || rate > 10000000.0f) {
+        printf("invalid sample rate [%s], must be in [1-10M] Hz\n", arg);
+        return 1;
+    }
+    *result = (unsigned int)(rate + 0.5f);
+    return 0;
+}
+
+
+static int parseResampleQuality(char* arg, enum DuoEngineResampleQuality* result) {
+    if (strcmp(arg, "low") == 0) {
+        *result = DUO_RESAMPLE_LOW;
+    }
+    else if (strcmp(arg, "medium") == 0) {
+        *result = DUO_RESAMPLE_MEDIUM;
+    }
+    else if (strcmp(arg, "high") == 0) {
+        *result = DUO_RESAMPLE_HIGH;
+    }
+    else {
+        printf("invalid resampler quality [%s], must be low, medium, or high\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
+
+static int parseOutputMask(char* arg, unsigned int* result) {
+    static const char* names[] = {"a", "b", "sum", "diff", "beam0", "beam1"};
+    unsigned int mask = 0;
+    const char* token = arg;
+    while (true) {
+        size_t len = strcspn(token, ",");
+        unsigned int idx = 0;
+        for (idx = 0; idx < DUO_MAX_STREAMS; idx++) {
+            if (len == strlen(names[idx]) && strncmp(token, names[idx], len) == 0) {
+                mask |= 1u << idx;
+                break;
+            }
+        }
+        if (idx == DUO_MAX_STREAMS) {
+            printf("invalid output streams [%s], must be a comma separated list of a, b, sum, diff, beam0, or beam1\n", arg);
+            return 1;
+        }
+        if (token[len] == '\0') {
+            break;
+        }
+        token += len + 1;
+    }
+    *result = mask;
+    return 0;
+}
+
+
+static int parseBeamSteering(char* arg, struct DuoEngineBeam* beams) {
+    char* token = arg;
+    for (unsigned int beam = 0; beam < DUO_MAX_BEAMS; beam++) {
+        char* endPtr = NULL;
+        errno = 0;
+        float phase = strtof(token, &endPtr);
+        if (errno || endPtr == token || (*endPtr != ',' && *endPtr != '\0')) {
+            printf("invalid beam steering [%s], must be up to %u comma separated phases in degrees\n",
+                   arg, DUO_MAX_BEAMS);
+            return 1;
+        }
+        duoBeamSteer(&beams[beam], phase, 1.0f);
+        if (*endPtr == '\0') {
+            return 0;
+        }
+        token = endPtr + 1;
+    }
+    printf("invalid beam steering [%s], must be up to %u comma separated phases in degrees\n",
+           arg, DUO_MAX_BEAMS);
+    return 1;
+}
+
+
 static int parseNotchFilter(char* arg, bool* mwfm, bool* dab) {
     if (strncmp(arg, "mwfm", 4) == 0) {
         *mwfm = true;
@@ -196,4 +344,132 @@ static int parseNotchFilter(char* arg, bool* mwfm, bool* dab) {
 }
 
 
+/**
+* Parsing function for comma separated CPU numbers or ranges of CPU
+* numbers (e.g. "2,3" or "0,4-7") into a bitmask with bit n for CPU n
+*/
+static int parseCpuList(char* arg, unsigned long long* result) {
+    unsigned long long mask = 0;
+    char* token = arg;
+    while (true) {
+        char* end = NULL;
+        errno = 0;
+        unsigned long first = strtoul(token, &end, 10);
+        unsigned long last = first;
+        if (end != token && *end == '-') {
+            token = end + 1;
+            last = strtoul(token, &end, 10);
+        }
+        if (errno || end == token || (*end != ',' && *end != '\0') ||
+            first > last || last >= DUO_RT_MAX_CPUS) {
+            printf("invalid CPU list [%s], must be comma separated CPUs or ranges in [0-%d]\n",
+                   arg, DUO_RT_MAX_CPUS - 1);
+            return 1;
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            mask |= 1ull << cpu;
+        }
+        if (*end == '\0') {
+            break;
+        }
+        token = end + 1;
+    }
+    *result = mask;
+    return 0;
+}
+
+
+static int parseRealtimePriority(char* arg, int* result) {
+    int tmp;
+    if (parseIntArg(arg, &tmp, 10) || tmp < 1 || tmp > 99) {
+        printf("invalid real-time priority, must be in [1-99]\n");
+        return 1;
+    }
+    *result = tmp;
+    return 0;
+}
+
+
+/**
+* Parsing function for [addr][:port] arguments.
+* Can accept
+*   1. IP address only with no semicolon (e.g. "192.168.1.1")
+*   2. IP address and port separated by semicolon (e.g. "192.168.1.1:8080")
+*   3. Port only with leading semicolon (e.g. ":8080")
+*
+* @param arg pointer to null-terminated string
+* @param ipStr pointer location to store pointer to IP address string
+*/
+static int parseAddrPort(
+        char* arg, char** ipStr, unsigned long* ipAddr, unsigned int* port) {
+    int sepIdx = -1;
+    unsigned long tmpAddr;
+    unsigned int tmpPort;
+    size_t argLen = strlen(arg);
+    for (unsigned int charIdx = 0; charIdx < argLen; charIdx++) {
+        if (arg[charIdx] == ':') {
+            sepIdx = charIdx;
+            break;
+        }
+    }
+    if (sepIdx == 0 && argLen > 1) {
+        // Starts with separator, must be just a port
+        if (parseUintArg(&arg[1], &tmpPort, 10)) {
+            return 1;
+        }
+        if (tmpPort > 65535) {
+            printf("invalid UDP port [%u], must be in [0-65535]\n", tmpPort);
+            return 1;
+        }
+        *port = tmpPort;
+        return 0;
+    }
+    else if (sepIdx == -1) {
+        // No separator, must be just an address
+        tmpAddr = inet_addr(arg);
+        if (tmpAddr == INADDR_NONE) {
+            printf("invalid IPv4 address value [%s]\n", arg);
+            return 1;
+        }
+        *ipAddr = tmpAddr;
+        *ipStr = arg;
+        return 0;
+    }
+    else if (argLen > 3 && sepIdx != (argLen - 1)) {
+        // We found the separator somewhere in the middle
+        // Insert a null-termination where the ':' used to be
+        // This effectively separates arg into two C strings
+        arg[sepIdx] = 0;
+        tmpAddr = inet_addr(arg);
+        if (tmpAddr == INADDR_NONE) {
+            printf("invalid IPv4 address value [%s]\n", arg);
+            return 1;
+        }
+        if (parseUintArg(&arg[sepIdx + 1], &tmpPort, 10)) {
+            return 1;
+        }
+        if (tmpPort > 65535) {
+            printf("invalid UDP port [%u], must be in [0-65535]\n", tmpPort);
+            return 1;
+        }
+        *port = tmpPort;
+        *ipAddr = tmpAddr;
+        *ipStr = arg;
+        return 0;
+    }
+    printf("invalid address and port specification [%s] "
+           "(expect [addr][:port])\n", arg);
+    return 1;
+}
+
+
+static int parseCalibrationTable(char* arg, struct DuoCalTable* table) {
+    if (duoCalTableLoad(table, arg)) {
+        printf("invalid calibration table [%s], expect lines of freq_hz,phase_deg,delay_ns,gain\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
+
 #endif
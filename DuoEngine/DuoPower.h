@@ -0,0 +1,113 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOPOWER_H
+#define DUOPOWER_H
+
+/**
+* Mean power of blocks of complex 16-bit samples.
+*
+* Squares are summed exactly in 64-bit integers, so a block of any
+* length gives the same result however it is split into runs. Power
+* is reported relative to a full scale complex sample of magnitude
+* 32768, so a full scale tone reads 0 dBFS.
+*/
+
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DUOPOWER_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DUOPOWER_NEON
+#endif
+
+// Lowest power reported in dBFS, e.g. for a block of zeros
+#define DUO_POWER_FLOOR_DB (-200.0f)
+
+
+/**
+* Sum of I^2 + Q^2 over a run of samples
+*
+* @param xi real samples
+* @param xq imaginary samples
+* @param numSamples number of samples
+*
+* @return sum of squares
+*/
+static uint64_t duoPowerSum(const short* xi, const short* xq, unsigned int numSamples) {
+    uint64_t sum = 0;
+    unsigned int idx = 0;
+#if defined(DUOPOWER_SSE)
+    // Each pair of squares fits in 32 bits when treated as unsigned
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; idx + 8 <= numSamples; idx += 8) {
+        __m128i vi = _mm_loadu_si128((const __m128i*)(xi + idx));
+        __m128i vq = _mm_loadu_si128((const __m128i*)(xq + idx));
+        __m128i si = _mm_madd_epi16(vi, vi);
+        __m128i sq = _mm_madd_epi16(vq, vq);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(si, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(si, zero));
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sum = lanes[0] + lanes[1];
+#elif defined(DUOPOWER_NEON)
+    int64x2_t acc = vdupq_n_s64(0);
+    for (; idx + 4 <= numSamples; idx += 4) {
+        int16x4_t vi = vld1_s16(xi + idx);
+        int16x4_t vq = vld1_s16(xq + idx);
+        acc = vpadalq_s32(acc, vmull_s16(vi, vi));
+        acc = vpadalq_s32(acc, vmull_s16(vq, vq));
+    }
+    sum = (uint64_t)(vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1));
+#endif
+    for (; idx < numSamples; idx++) {
+        sum += (uint64_t)((int32_t)xi[idx] * xi[idx]) + (uint64_t)((int32_t)xq[idx] * xq[idx]);
+    }
+    return sum;
+}
+
+
+/**
+* Convert a sum of squares to mean power in dBFS
+*
+* @param sum sum of squares from duoPowerSum()
+* @param numSamples number of samples summed
+*
+* @return mean power in dBFS
+*/
+static float duoPowerDb(uint64_t sum, unsigned int numSamples) {
+    if (sum == 0 || numSamples == 0) {
+        return DUO_POWER_FLOOR_DB;
+    }
+    double mean = (double)sum / ((double)numSamples * 32768.0 * 32768.0);
+    return (float)(10.0 * log10(mean));
+}
+
+
+#endif
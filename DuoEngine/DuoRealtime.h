@@ -0,0 +1,159 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOREALTIME_H
+#define DUOREALTIME_H
+
+/**
+* Real-time scheduling, CPU affinity, and memory locking of the
+* calling thread or process.
+*
+* Each function returns zero on success or an error code and sets a
+* short reason, so the caller can report what could not be applied and
+* carry on without it. On Linux, CPU affinity needs _GNU_SOURCE defined
+* before the first system header and is reported as unsupported
+* otherwise, as it is on macOS. Windows maps both real-time policies to
+* THREAD_PRIORITY_TIME_CRITICAL and has no process-wide memory lock.
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(_GNU_SOURCE) && defined(CPU_SET)
+#define DUOREALTIME_AFFINITY
+#endif
+
+// Highest CPU number that can appear in an affinity mask
+#define DUO_RT_MAX_CPUS (64)
+
+
+static const char* duoRtReason(int error) {
+#if defined(_WIN32) || defined(_WIN64)
+    return error == ENOSYS ? "not supported on this platform" : "Windows API error";
+#else
+    if (error == ENOSYS) {
+        return "not supported on this platform";
+    }
+    if (error == EPERM) {
+        return "permission denied (needs CAP_SYS_NICE/CAP_IPC_LOCK or rtprio/memlock limits)";
+    }
+    return strerror(error);
+#endif
+}
+
+
+/**
+* Set the scheduling policy and priority of the calling thread
+*
+* @param fifo true for SCHED_FIFO, false for SCHED_RR
+* @param priority real-time priority, 1-99 on Linux
+*
+* @return zero on success, error code otherwise
+*/
+static int duoRtSetScheduling(bool fifo, int priority) {
+#if defined(_WIN32) || defined(_WIN64)
+    (void)fifo;
+    (void)priority;
+    return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) ? 0 : EINVAL;
+#else
+    struct sched_param param;
+    int policy = fifo ? SCHED_FIFO : SCHED_RR;
+    if (priority < sched_get_priority_min(policy) || priority > sched_get_priority_max(policy)) {
+        return EINVAL;
+    }
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    return pthread_setschedparam(pthread_self(), policy, &param);
+#endif
+}
+
+
+/**
+* Pin the calling thread to a set of CPUs
+*
+* @param cpus bitmask of CPUs, bit n for CPU n
+*
+* @return zero on success, error code otherwise
+*/
+static int duoRtSetAffinity(unsigned long long cpus) {
+#if defined(_WIN32) || defined(_WIN64)
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)cpus) != 0 ? 0 : EINVAL;
+#elif defined(DUOREALTIME_AFFINITY)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned int cpu = 0; cpu < DUO_RT_MAX_CPUS; cpu++) {
+        if (cpus & (1ull << cpu)) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpus;
+    return ENOSYS;
+#endif
+}
+
+
+/**
+* Lock all current and future memory of the process into RAM
+*
+* @return zero on success, error code otherwise
+*/
+static int duoRtLockMemory(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    return ENOSYS;
+#else
+    return mlockall(MCL_CURRENT | MCL_FUTURE) == 0 ? 0 : errno;
+#endif
+}
+
+
+static void duoRtUnlockMemory(void) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    munlockall();
+#endif
+}
+
+
+/**
+* Touch every page of a buffer so that no page fault is taken when it
+* is first written while streaming
+*/
+static void duoRtPrefault(void* buffer, size_t size) {
+    if (buffer) {
+        memset(buffer, 0, size);
+    }
+}
+
+
+#endif
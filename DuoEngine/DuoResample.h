@@ -0,0 +1,391 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUORESAMPLE_H
+#define DUORESAMPLE_H
+
+/**
+* Rational L/M polyphase FIR resampler for complex 16-bit samples.
+*
+* The input is conceptually upsampled by L, low-pass filtered with a
+* Kaiser-windowed sinc, and decimated by M. Only the taps that touch
+* real input samples are evaluated, so each output costs one dot
+* product of numTaps taps per scalar. The dot products use SSE or
+* NEON when available.
+*
+* The filter passes the band below a fraction of the lower of the two
+* Nyquist rates (see enum DuoEngineResampleQuality) and reaches full
+* attenuation at that Nyquist rate.
+*
+* DuoEngine runs one resampler per tuner with identical configuration,
+* so both tuners see the same delay and phase response.
+*
+* An optional NCO (see DuoNCO.h) mixes the inputs as they are loaded
+* into the filter history, so a frequency shift followed by decimation
+* costs no extra pass over the full rate samples.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "DuoEngine.h"
+#include "DuoNCO.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DUORESAMPLE_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DUORESAMPLE_NEON
+#endif
+
+// Largest supported interpolation factor L
+#define DUO_RESAMPLE_MAX_INTERP (1024)
+// Largest supported prototype filter length L * numTaps
+#define DUO_RESAMPLE_MAX_TAPS (1 << 21)
+// Input samples converted per pass, bounds the history buffer size
+#define DUO_RESAMPLE_CHUNK (1024)
+
+#ifndef DUORESAMPLE_PI
+#define DUORESAMPLE_PI (3.14159265358979323846)
+#endif
+
+
+struct DuoResampler {
+    // interpolation factor L
+    unsigned int interp;
+    // decimation factor M
+    unsigned int decim;
+    // taps per polyphase branch, a multiple of 4
+    unsigned int numTaps;
+    // interp branches of numTaps taps, each stored in reverse order
+    float* taps;
+    // numTaps - 1 previous inputs followed by the current chunk
+    float* histI;
+    float* histQ;
+    // history index of the newest input used by the next output
+    unsigned int pos;
+    // polyphase branch of the next output
+    unsigned int phase;
+};
+
+
+/**
+* Reduce the ratio between two sample rates to L/M
+*
+* @param inRate input sample rate in Hz
+* @param outRate output sample rate in Hz
+* @param interp pointer to store L
+* @param decim pointer to store M
+*
+* @return zero on success, non-zero if L exceeds DUO_RESAMPLE_MAX_INTERP
+*/
+static int duoResampleRatio(
+        unsigned int inRate, unsigned int outRate,
+        unsigned int* interp, unsigned int* decim) {
+    unsigned int a = inRate;
+    unsigned int b = outRate;
+    if (a == 0 || b == 0) {
+        return 1;
+    }
+    while (b) {
+        unsigned int tmp = a % b;
+        a = b;
+        b = tmp;
+    }
+    *interp = outRate / a;
+    *decim = inRate / a;
+    return *interp > DUO_RESAMPLE_MAX_INTERP;
+}
+
+
+/**
+* Zeroth order modified Bessel function of the first kind for the
+* Kaiser window
+*/
+static double duoResampleBessel0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+
+/**
+* Design the filter and allocate the resampler state
+*
+* @param resampler pointer to struct to initialize
+* @param inRate input sample rate in Hz
+* @param outRate output sample rate in Hz
+* @param quality filter quality, trades passband width and stopband
+*                attenuation against taps per output
+*
+* @return zero on success, non-zero if the ratio is unsupported or
+*         allocation fails
+*/
+static int duoResamplerInit(
+        struct DuoResampler* resampler, unsigned int inRate, unsigned int outRate,
+        enum DuoEngineResampleQuality quality) {
+    // Fraction of the lower Nyquist rate passed and stopband attenuation in dB
+    double passband = 0.9;
+    double attenuation = 80.0;
+    if (quality == DUO_RESAMPLE_LOW) {
+        passband = 0.8;
+        attenuation = 60.0;
+    }
+    else if (quality == DUO_RESAMPLE_HIGH) {
+        passband = 0.95;
+        attenuation = 100.0;
+    }
+
+    memset(resampler, 0, sizeof(struct DuoResampler));
+    if (duoResampleRatio(inRate, outRate, &resampler->interp, &resampler->decim)) {
+        return 1;
+    }
+    unsigned int interp = resampler->interp;
+    double upRate = (double)inRate * interp;
+    double nyquist = (inRate < outRate ? inRate : outRate) / 2.0;
+
+    // Kaiser design formulas for the prototype at the upsampled rate
+    double transition = 2.0 * DUORESAMPLE_PI * (1.0 - passband) * nyquist / upRate;
+    double cutoff = (1.0 + passband) / 2.0 * nyquist / upRate;
+    double beta = 0.1102 * (attenuation - 8.7);
+    double length = (attenuation - 8.0) / (2.285 * transition) + 1.0;
+    unsigned int numTaps = (unsigned int)ceil(length / interp);
+    numTaps = (numTaps + 3) & ~3u;
+    if ((unsigned long long)numTaps * interp > DUO_RESAMPLE_MAX_TAPS) {
+        return 1;
+    }
+    resampler->numTaps = numTaps;
+
+    size_t total = (size_t)numTaps * interp;
+    size_t histLen = numTaps - 1 + DUO_RESAMPLE_CHUNK;
+    resampler->taps = (float*)malloc(total * sizeof(float));
+    resampler->histI = (float*)calloc(histLen, sizeof(float));
+    resampler->histQ = (float*)calloc(histLen, sizeof(float));
+    if (resampler->taps == NULL || resampler->histI == NULL || resampler->histQ == NULL) {
+        free(resampler->taps);
+        free(resampler->histI);
+        free(resampler->histQ);
+        memset(resampler, 0, sizeof(struct DuoResampler));
+        return 1;
+    }
+
+    // Prototype tap n belongs to branch n % L at position n / L
+    double center = (total - 1) / 2.0;
+    double norm = duoResampleBessel0(beta);
+    double sum = 0.0;
+    for (size_t n = 0; n < total; n++) {
+        double t = n - center;
+        double x = 2.0 * cutoff * t;
+        double sinc = (t == 0.0) ? 1.0 : sin(DUORESAMPLE_PI * x) / (DUORESAMPLE_PI * x);
+        double r = t / (center > 0 ? center : 1.0);
+        double window = duoResampleBessel0(beta * sqrt(r * r < 1.0 ? 1.0 - r * r : 0.0)) / norm;
+        double tap = 2.0 * cutoff * sinc * window;
+        size_t branch = n % interp;
+        size_t idx = n / interp;
+        resampler->taps[branch * numTaps + (numTaps - 1 - idx)] = (float)tap;
+        sum += tap;
+    }
+    // Each branch has a DC gain of one
+    float scale = (float)(interp / sum);
+    for (size_t n = 0; n < total; n++) {
+        resampler->taps[n] *= scale;
+    }
+
+    resampler->pos = numTaps - 1;
+    resampler->phase = 0;
+    return 0;
+}
+
+
+/**
+* Release the memory allocated by duoResamplerInit()
+*/
+static void duoResamplerFree(struct DuoResampler* resampler) {
+    free(resampler->taps);
+    free(resampler->histI);
+    free(resampler->histQ);
+    memset(resampler, 0, sizeof(struct DuoResampler));
+}
+
+
+/**
+* Clear the filter history, e.g. after a stream reset
+*/
+static void duoResamplerReset(struct DuoResampler* resampler) {
+    size_t histLen = resampler->numTaps - 1 + DUO_RESAMPLE_CHUNK;
+    memset(resampler->histI, 0, histLen * sizeof(float));
+    memset(resampler->histQ, 0, histLen * sizeof(float));
+    resampler->pos = resampler->numTaps - 1;
+    resampler->phase = 0;
+}
+
+
+/**
+* Upper bound on the number of outputs produced from numSamples inputs
+*/
+static unsigned int duoResamplerMaxOutput(const struct DuoResampler* resampler, unsigned int numSamples) {
+    return (unsigned int)((unsigned long long)numSamples * resampler->interp / resampler->decim) + 2;
+}
+
+
+/**
+* Dot product of one branch with the I and Q histories
+*/
+static void duoResampleDot(
+        const float* taps, const float* xi, const float* xq, unsigned int numTaps,
+        float* outI, float* outQ) {
+    unsigned int idx = 0;
+    float sumI = 0.0f;
+    float sumQ = 0.0f;
+#if defined(DUORESAMPLE_SSE)
+    __m128 accI = _mm_setzero_ps();
+    __m128 accQ = _mm_setzero_ps();
+    for (; idx + 4 <= numTaps; idx += 4) {
+        __m128 tap = _mm_loadu_ps(taps + idx);
+        accI = _mm_add_ps(accI, _mm_mul_ps(tap, _mm_loadu_ps(xi + idx)));
+        accQ = _mm_add_ps(accQ, _mm_mul_ps(tap, _mm_loadu_ps(xq + idx)));
+    }
+    // Horizontal sums
+    accI = _mm_add_ps(accI, _mm_movehl_ps(accI, accI));
+    accQ = _mm_add_ps(accQ, _mm_movehl_ps(accQ, accQ));
+    accI = _mm_add_ss(accI, _mm_shuffle_ps(accI, accI, 1));
+    accQ = _mm_add_ss(accQ, _mm_shuffle_ps(accQ, accQ, 1));
+    sumI = _mm_cvtss_f32(accI);
+    sumQ = _mm_cvtss_f32(accQ);
+#elif defined(DUORESAMPLE_NEON)
+    float32x4_t accI = vdupq_n_f32(0.0f);
+    float32x4_t accQ = vdupq_n_f32(0.0f);
+    for (; idx + 4 <= numTaps; idx += 4) {
+        float32x4_t tap = vld1q_f32(taps + idx);
+        accI = vmlaq_f32(accI, tap, vld1q_f32(xi + idx));
+        accQ = vmlaq_f32(accQ, tap, vld1q_f32(xq + idx));
+    }
+    float32x2_t pairI = vadd_f32(vget_low_f32(accI), vget_high_f32(accI));
+    float32x2_t pairQ = vadd_f32(vget_low_f32(accQ), vget_high_f32(accQ));
+    sumI = vget_lane_f32(vpadd_f32(pairI, pairI), 0);
+    sumQ = vget_lane_f32(vpadd_f32(pairQ, pairQ), 0);
+#endif
+    for (; idx < numTaps; idx++) {
+        sumI += taps[idx] * xi[idx];
+        sumQ += taps[idx] * xq[idx];
+    }
+    *outI = sumI;
+    *outQ = sumQ;
+}
+
+
+/**
+* Round and saturate a filter output to a 16-bit scalar
+*/
+static short duoResampleToShort(float value) {
+    if (value >= 32767.0f) {
+        return 32767;
+    }
+    if (value <= -32768.0f) {
+        return -32768;
+    }
+    return (short)(value >= 0.0f ? value + 0.5f : value - 0.5f);
+}
+
+
+/**
+* Resample a block of complex samples. State carries over between
+* calls so consecutive blocks form a continuous stream.
+*
+* @param resampler resampler from duoResamplerInit()
+* @param nco oscillator to mix the inputs with, NULL for none. The
+*            first input is mixed with the current phase, which is
+*            not advanced.
+* @param xi real input scalars
+* @param xq imaginary input scalars
+* @param numSamples number of input samples
+* @param yi real output scalars, at least duoResamplerMaxOutput() long
+* @param yq imaginary output scalars, at least duoResamplerMaxOutput() long
+*
+* @return number of output samples written
+*/
+static unsigned int duoResamplerProcess(
+        struct DuoResampler* resampler, const struct DuoNCO* nco,
+        const short* xi, const short* xq, unsigned int numSamples,
+        short* yi, short* yq) {
+    unsigned int numTaps = resampler->numTaps;
+    unsigned int interp = resampler->interp;
+    unsigned int decim = resampler->decim;
+    float* histI = resampler->histI;
+    float* histQ = resampler->histQ;
+    unsigned int numOut = 0;
+    unsigned int inIdx = 0;
+
+    while (inIdx < numSamples) {
+        unsigned int count = numSamples - inIdx;
+        if (count > DUO_RESAMPLE_CHUNK) {
+            count = DUO_RESAMPLE_CHUNK;
+        }
+        if (nco != NULL) {
+            duoNCOMixFloat(nco, inIdx, xi + inIdx, xq + inIdx, count,
+                           histI + numTaps - 1, histQ + numTaps - 1);
+        }
+        else {
+            for (unsigned int idx = 0; idx < count; idx++) {
+                histI[numTaps - 1 + idx] = xi[inIdx + idx];
+                histQ[numTaps - 1 + idx] = xq[inIdx + idx];
+            }
+        }
+
+        unsigned int end = numTaps - 1 + count;
+        while (resampler->pos < end) {
+            unsigned int start = resampler->pos - (numTaps - 1);
+            float outI;
+            float outQ;
+            duoResampleDot(
+                resampler->taps + resampler->phase * numTaps,
+                histI + start, histQ + start, numTaps, &outI, &outQ);
+            yi[numOut] = duoResampleToShort(outI);
+            yq[numOut] = duoResampleToShort(outQ);
+            numOut++;
+
+            resampler->phase += decim;
+            resampler->pos += resampler->phase / interp;
+            resampler->phase %= interp;
+        }
+
+        // Keep the newest numTaps - 1 inputs for the next chunk
+        memmove(histI, histI + count, (numTaps - 1) * sizeof(float));
+        memmove(histQ, histQ + count, (numTaps - 1) * sizeof(float));
+        resampler->pos -= count;
+        inIdx += count;
+    }
+    return numOut;
+}
+
+
+#endif
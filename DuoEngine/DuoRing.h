@@ -0,0 +1,372 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUORING_H
+#define DUORING_H
+
+/**
+* Single producer, single consumer ring of whole frames that lets a
+* consumer pull samples at its own pace instead of receiving them in a
+* callback.
+*
+* The producer never blocks. A transfer that does not fit in the free
+* space is dropped as a whole and counted as an overrun, so the frames
+* already in the ring are never overwritten while a consumer holds a
+* pointer to them. Frames are copied outside the lock, which only
+* guards the positions.
+*
+* The first quarter of the ring is mirrored past its end so that any
+* run of up to a quarter of the ring can be peeked as one contiguous
+* block, whatever the read position, without an intermediate copy.
+*
+* The producer can mark the position where the sample rate changes.
+* Reads stop short at a mark so that no block spans two rates, and
+* the rate of the oldest frame is tracked as the marks are passed.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "DuoThread.h"
+
+// Rate changes that can be waiting in the ring, older ones are merged
+#define DUO_RING_MARKS (8)
+
+
+struct DuoRing {
+    DuoMutex lock;
+    DuoCond cond;
+    // capacity plus mirror frames
+    char* data;
+    unsigned int frameSize;
+    unsigned int capacity;
+    // frames at the start of the ring also written past its end
+    unsigned int mirror;
+    // total frames written and consumed, the positions are these modulo capacity
+    unsigned long long head;
+    unsigned long long tail;
+    // frames and transfers dropped because the ring was full
+    unsigned long long dropped;
+    unsigned long long overruns;
+    // true once no more frames will be written
+    bool closed;
+    // number of consumers waiting on cond
+    unsigned int waiters;
+    // positions where the sample rate changes, marks from markTail to markHead are pending
+    unsigned long long markPos[DUO_RING_MARKS];
+    float markRate[DUO_RING_MARKS];
+    unsigned int markHead;
+    unsigned int markTail;
+    // sample rate of the frame at tail and the number of marks it has passed
+    float rate;
+    unsigned int epoch;
+};
+
+
+/**
+* Allocate the ring
+*
+* @param ring ring to initialize
+* @param frameSize bytes in each frame
+* @param numBytes size of the ring in bytes, rounded down to whole frames
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoRingInit(struct DuoRing* ring, unsigned int frameSize, unsigned int numBytes) {
+    memset(ring, 0, sizeof(struct DuoRing));
+    if (frameSize == 0 || numBytes / frameSize < 4) {
+        return 1;
+    }
+    ring->frameSize = frameSize;
+    ring->capacity = numBytes / frameSize;
+    ring->mirror = ring->capacity / 4;
+    ring->data = (char*)malloc((size_t)(ring->capacity + ring->mirror) * frameSize);
+    if (ring->data == NULL) {
+        return 1;
+    }
+    duoMutexInit(&ring->lock);
+    duoCondInit(&ring->cond);
+    return 0;
+}
+
+
+static void duoRingFree(struct DuoRing* ring) {
+    if (ring->data) {
+        duoCondDestroy(&ring->cond);
+        duoMutexDestroy(&ring->lock);
+        free(ring->data);
+        ring->data = NULL;
+    }
+}
+
+
+/**
+* Copy frames into the ring at a position, including the mirror
+*/
+static void duoRingCopyIn(struct DuoRing* ring, unsigned int pos, const char* frames, unsigned int numFrames) {
+    size_t frameSize = ring->frameSize;
+    memcpy(ring->data + pos * frameSize, frames, numFrames * frameSize);
+    if (pos < ring->mirror) {
+        unsigned int count = ring->mirror - pos;
+        if (count > numFrames) {
+            count = numFrames;
+        }
+        memcpy(ring->data + (ring->capacity + pos) * frameSize, frames, count * frameSize);
+    }
+}
+
+
+/**
+* Add frames to the ring, or drop them all if they do not fit.
+* Only called from the producer thread.
+*
+* @param ring ring to write
+* @param frames frames to copy
+* @param numFrames number of frames
+*/
+static void duoRingWrite(struct DuoRing* ring, const void* frames, unsigned int numFrames) {
+    duoMutexLock(&ring->lock);
+    bool fits = !ring->closed && ring->capacity - (ring->head - ring->tail) >= numFrames;
+    if (!fits && !ring->closed) {
+        ring->dropped += numFrames;
+        ring->overruns++;
+    }
+    unsigned int pos = (unsigned int)(ring->head % ring->capacity);
+    duoMutexUnlock(&ring->lock);
+    if (!fits) {
+        return;
+    }
+
+    // The consumer never reads past head, so the free space can be filled unlocked
+    unsigned int first = ring->capacity - pos;
+    if (first > numFrames) {
+        first = numFrames;
+    }
+    duoRingCopyIn(ring, pos, (const char*)frames, first);
+    if (first < numFrames) {
+        duoRingCopyIn(ring, 0, (const char*)frames + (size_t)first * ring->frameSize, numFrames - first);
+    }
+
+    duoMutexLock(&ring->lock);
+    ring->head += numFrames;
+    if (ring->waiters) {
+        duoCondBroadcast(&ring->cond);
+    }
+    duoMutexUnlock(&ring->lock);
+}
+
+
+/**
+* Record that the frames written from now on have a new sample rate.
+* Only called from the producer thread.
+*/
+static void duoRingMark(struct DuoRing* ring, float rate) {
+    duoMutexLock(&ring->lock);
+    if (ring->markHead - ring->markTail == DUO_RING_MARKS) {
+        // The consumer is far behind, the oldest change is taken as already passed
+        ring->rate = ring->markRate[ring->markTail % DUO_RING_MARKS];
+        ring->markTail++;
+        ring->epoch++;
+    }
+    ring->markPos[ring->markHead % DUO_RING_MARKS] = ring->head;
+    ring->markRate[ring->markHead % DUO_RING_MARKS] = rate;
+    ring->markHead++;
+    duoMutexUnlock(&ring->lock);
+}
+
+
+/**
+* Frames that can be read before the next mark. Called with the lock
+* held.
+*
+* @param ring ring to read
+* @param bounded set to true if a mark stops the frames short of head
+* @param pass true to retire the marks the tail has reached, false to
+*             treat a mark at the tail as a barrier so that a read in
+*             progress never returns frames of the next rate
+*
+* @return number of frames that can be read at the current rate
+*/
+static unsigned int duoRingReadable(struct DuoRing* ring, bool* bounded, bool pass) {
+    while (pass && ring->markTail != ring->markHead && ring->markPos[ring->markTail % DUO_RING_MARKS] <= ring->tail) {
+        ring->rate = ring->markRate[ring->markTail % DUO_RING_MARKS];
+        ring->markTail++;
+        ring->epoch++;
+    }
+    *bounded = ring->markTail != ring->markHead && ring->markPos[ring->markTail % DUO_RING_MARKS] <= ring->head;
+    if (*bounded) {
+        return (unsigned int)(ring->markPos[ring->markTail % DUO_RING_MARKS] - ring->tail);
+    }
+    return (unsigned int)(ring->head - ring->tail);
+}
+
+
+/**
+* Sample rate and epoch of the oldest frame, and the frames left at
+* that rate before the next mark, zero if none is in the ring
+*/
+static float duoRingRate(struct DuoRing* ring, unsigned int* epoch, unsigned int* untilChange) {
+    bool bounded = false;
+    duoMutexLock(&ring->lock);
+    unsigned int readable = duoRingReadable(ring, &bounded, true);
+    float rate = ring->rate;
+    *epoch = ring->epoch;
+    duoMutexUnlock(&ring->lock);
+    *untilChange = bounded ? readable : 0;
+    return rate;
+}
+
+
+/**
+* Stop accepting frames and wake all waiting consumers. The frames
+* already in the ring can still be read.
+*/
+static void duoRingClose(struct DuoRing* ring) {
+    duoMutexLock(&ring->lock);
+    ring->closed = true;
+    duoCondBroadcast(&ring->cond);
+    duoMutexUnlock(&ring->lock);
+}
+
+
+static unsigned long long duoRingNowMs(void) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/**
+* Wait until the ring holds numFrames, the timeout expires, the ring
+* is closed, or a mark is reached. Only called from the consumer
+* thread.
+*
+* @param ring ring to wait on
+* @param numFrames number of frames wanted
+* @param timeoutMs maximum wait in milliseconds, zero to check only
+*
+* @return number of frames before head or the next mark, which may be
+*         more or less than numFrames
+*/
+static unsigned int duoRingWait(struct DuoRing* ring, unsigned int numFrames, unsigned int timeoutMs) {
+    unsigned long long deadline = duoRingNowMs() + timeoutMs;
+    bool bounded = false;
+    duoMutexLock(&ring->lock);
+    ring->waiters++;
+    // Marks reached before the wait are passed, a mark reached during it ends the wait
+    unsigned int available = duoRingReadable(ring, &bounded, true);
+    while (available < numFrames && !bounded && !ring->closed) {
+        unsigned long long now = duoRingNowMs();
+        if (now >= deadline) {
+            break;
+        }
+        duoCondTimedWait(&ring->cond, &ring->lock, (unsigned int)(deadline - now));
+        available = duoRingReadable(ring, &bounded, false);
+    }
+    ring->waiters--;
+    duoMutexUnlock(&ring->lock);
+    return available;
+}
+
+
+/**
+* Pointer to the oldest frame in the ring. Only called from the
+* consumer thread.
+*
+* @param ring ring to read
+*
+* @return pointer to the oldest frame, followed contiguously by at
+*         least mirror frames of the ring
+*/
+static const void* duoRingTail(struct DuoRing* ring) {
+    duoMutexLock(&ring->lock);
+    unsigned int pos = (unsigned int)(ring->tail % ring->capacity);
+    duoMutexUnlock(&ring->lock);
+    return ring->data + (size_t)pos * ring->frameSize;
+}
+
+
+/**
+* Release the oldest frames of the ring. Only called from the consumer
+* thread.
+*
+* @param ring ring to release frames from
+* @param numFrames number of frames, limited to the frames in the ring
+*
+* @return number of frames released
+*/
+static unsigned int duoRingConsume(struct DuoRing* ring, unsigned int numFrames) {
+    duoMutexLock(&ring->lock);
+    unsigned int available = (unsigned int)(ring->head - ring->tail);
+    if (numFrames > available) {
+        numFrames = available;
+    }
+    ring->tail += numFrames;
+    duoMutexUnlock(&ring->lock);
+    return numFrames;
+}
+
+
+/**
+* True once the ring is closed and every frame has been consumed
+*/
+static bool duoRingDrained(struct DuoRing* ring) {
+    duoMutexLock(&ring->lock);
+    bool drained = ring->closed && ring->head == ring->tail;
+    duoMutexUnlock(&ring->lock);
+    return drained;
+}
+
+
+/**
+* Copy and release the oldest frames of the ring, stopping at the next
+* mark. Only called from the consumer thread.
+*
+* @param ring ring to read
+* @param buffer destination of the frames
+* @param numFrames maximum number of frames to copy
+*
+* @return number of frames copied
+*/
+static unsigned int duoRingRead(struct DuoRing* ring, void* buffer, unsigned int numFrames) {
+    size_t frameSize = ring->frameSize;
+    bool bounded = false;
+    duoMutexLock(&ring->lock);
+    unsigned int available = duoRingReadable(ring, &bounded, false);
+    unsigned int pos = (unsigned int)(ring->tail % ring->capacity);
+    duoMutexUnlock(&ring->lock);
+    if (numFrames > available) {
+        numFrames = available;
+    }
+    unsigned int first = ring->capacity - pos;
+    if (first > numFrames) {
+        first = numFrames;
+    }
+    memcpy(buffer, ring->data + pos * frameSize, first * frameSize);
+    memcpy((char*)buffer + first * frameSize, ring->data, (numFrames - first) * frameSize);
+    return duoRingConsume(ring, numFrames);
+}
+
+
+#endif
@@ -0,0 +1,246 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOTHREAD_H
+#define DUOTHREAD_H
+
+/**
+* Minimal portable wrappers for threads, mutexes, condition variables,
+* and a monotonic clock so the same code can run with the Windows API
+* or pthreads.
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+
+typedef void (*DuoThreadFunc)(void* arg);
+
+#if defined(_WIN32) || defined(_WIN64)
+typedef HANDLE DuoThread;
+typedef CRITICAL_SECTION DuoMutex;
+typedef CONDITION_VARIABLE DuoCond;
+#else
+typedef pthread_t DuoThread;
+typedef pthread_mutex_t DuoMutex;
+typedef pthread_cond_t DuoCond;
+#endif
+
+
+// Trampoline state so both APIs can call a void function
+struct DuoThreadStart {
+    DuoThreadFunc func;
+    void* arg;
+};
+
+
+#if defined(_WIN32) || defined(_WIN64)
+static DWORD WINAPI duoThreadTrampoline(LPVOID param) {
+#else
+static void* duoThreadTrampoline(void* param) {
+#endif
+    struct DuoThreadStart start = *(struct DuoThreadStart*)param;
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+
+/**
+* Start a new thread running func(arg)
+*
+* @param thread pointer to thread handle to fill in
+* @param func function to run in the new thread
+* @param arg argument passed to func
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoThreadCreate(DuoThread* thread, DuoThreadFunc func, void* arg) {
+    struct DuoThreadStart* start = (struct DuoThreadStart*)malloc(sizeof(struct DuoThreadStart));
+    if (start == NULL) {
+        return 1;
+    }
+    start->func = func;
+    start->arg = arg;
+#if defined(_WIN32) || defined(_WIN64)
+    *thread = CreateThread(NULL, 0, duoThreadTrampoline, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return 1;
+    }
+#else
+    if (pthread_create(thread, NULL, duoThreadTrampoline, start) != 0) {
+        free(start);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+
+/**
+* Block until the specified thread exits
+*
+* @param thread thread handle from duoThreadCreate()
+*/
+static void duoThreadJoin(DuoThread thread) {
+#if defined(_WIN32) || defined(_WIN64)
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+
+static void duoMutexInit(DuoMutex* mutex) {
+#if defined(_WIN32) || defined(_WIN64)
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+
+static void duoMutexDestroy(DuoMutex* mutex) {
+#if defined(_WIN32) || defined(_WIN64)
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+
+static void duoMutexLock(DuoMutex* mutex) {
+#if defined(_WIN32) || defined(_WIN64)
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+
+static void duoMutexUnlock(DuoMutex* mutex) {
+#if defined(_WIN32) || defined(_WIN64)
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+
+static void duoCondInit(DuoCond* cond) {
+#if defined(_WIN32) || defined(_WIN64)
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+}
+
+
+static void duoCondDestroy(DuoCond* cond) {
+#if defined(_WIN32) || defined(_WIN64)
+    // Windows condition variables do not need to be destroyed
+    (void)cond;
+#else
+    pthread_cond_destroy(cond);
+#endif
+}
+
+
+static void duoCondWait(DuoCond* cond, DuoMutex* mutex) {
+#if defined(_WIN32) || defined(_WIN64)
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+
+/**
+* Wait on a condition variable for at most the specified time
+*
+* @param cond condition variable to wait on
+* @param mutex locked mutex associated with cond
+* @param timeoutMs maximum wait in milliseconds
+*
+* @return true if signaled, false if the wait timed out
+*/
+static bool duoCondTimedWait(DuoCond* cond, DuoMutex* mutex, unsigned int timeoutMs) {
+#if defined(_WIN32) || defined(_WIN64)
+    return SleepConditionVariableCS(cond, mutex, timeoutMs) != 0;
+#else
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(cond, mutex, &deadline) != ETIMEDOUT;
+#endif
+}
+
+
+static void duoCondSignal(DuoCond* cond) {
+#if defined(_WIN32) || defined(_WIN64)
+    WakeConditionVariable(cond);
+#else
+    pthread_cond_signal(cond);
+#endif
+}
+
+
+static void duoCondBroadcast(DuoCond* cond) {
+#if defined(_WIN32) || defined(_WIN64)
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+
+/**
+* Milliseconds from an arbitrary start that never jump with changes
+* to the wall clock, for measuring intervals
+*/
+static unsigned long long duoClockMs(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    return GetTickCount64();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+
+#endif
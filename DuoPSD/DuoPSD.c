@@ -0,0 +1,515 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#include <winsock.h>
+#include <wsipv6ok.h>
+#include <conio.h>
+#include "windows_getopt.h"
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "posix_conio.h"
+
+#define INVALID_SOCKET (-1)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define DEFAULT_AGC_BANDWIDTH (5)
+
+#include "DuoEngine.h"
+#include "DuoParse.h"
+#include "psd.h"
+
+
+static const char* USAGE = "\
+Usage: DuoPSD.exe [-h] [-a agchz] [-t agcdb] [-l lna] [-d decim] [-n notch]\n\
+                  [-w warmup] [-N fftsize] [-W window] [-v overlap]\n\
+                  [-A averages] [-C] [-c count] [-u [ipaddr][:port]]\n\
+                  [-o path] [-k] [-x] freq\n\
+\n\
+Averaged (Welch) power spectral density of both tuners. One record is\n\
+produced per average, so the output rate is a small fraction of the\n\
+sample rate.\n\
+\n\
+Options:\n\
+  -h: print this help message\n\
+  -a 0|5|50|100: AGC loop bandwidth in Hz (default=5)\n\
+  -t [-72-0]: AGC set point in dBFS (default=-30)\n\
+  -l 0-9: LNA state where 0 provides the least RF gain reduction.\n\
+      Default value is 4 (20-37 dB reduction depending on frequency).\n\
+  -d 1|2|4|8|16|32: Decimation factor (default=1)\n\
+      For factors 4, 8, 16, and 32, the analog bandwidth will \n\
+      be reduced to 600, 300, 200, and 200 kHz respectively unless \n\
+      the -x option is also specified. In which case the analog \n\
+      bandwidth remains 1.536 MHz.\n\
+  -n mwfm|dab: Enable MW/FM or DAB notch filter\n\
+      Both filters can be enabled by providing the -n option twice\n\
+      (once for each filter). By default, both filters are disabled.\n\
+  -w seconds: Run the radio for the specified number of seconds to\n\
+      warm up and stabilize performance before averaging (default=2).\n\
+      During the warmup period, samples are discarded.\n\
+  -N fftsize: FFT size, a power of two >= 8 (default=1024)\n\
+  -W rect|hann|hamming|blackman: Window function (default=hann)\n\
+  -v 0-95: Segment overlap in percent (default=50)\n\
+  -A averages: Number of segments in each average (default=1000)\n\
+  -C: Also average the cross spectrum B * conj(A)\n\
+  -c count: Exit after the specified number of averages\n\
+      (default=0, run until q is pressed)\n\
+  -u [ipaddr][:port]: Send each record as a UDP packet to the\n\
+      specified IPv4 address (default=127.0.0.1) and port\n\
+      (default=1234). Use \":port\" to change only the port.\n\
+  -o path: Append each record to the specified file\n\
+  -k: Use USB bulk transfer mode instead of isochronous\n\
+  -x: Use the maximum 8 MHz master sample rate.\n\
+      This will deliver 12 bit ADC resolution, but with slightly \n\
+      better anti-aliaising performance at the widest bandwidth.\n\
+      This mode is only available at 1.536 MHz analog bandwidth.\n\
+      The default mode is to use a 6 MHz master sample clock.\n\
+      That mode delivers 14 bit ADC resolution, but with slightly\n\
+      inferior anti-aliaising performance at the widest bandwidth.\n\
+      The default mode is also compatible with analog bandwidths of\n\
+      1.536 MHz, 600 kHz, 300 kHz, and 200 kHz. 6 MHz operation\n\
+      should result in a slightly lower CPU load.\n\
+\n\
+Arguments:\n\
+  freq: Tuner RF frequency in Hz is mandatory.\n\
+      Can be specified with k, K, m, M, g, or G suffix to indicate\n\
+      the value is in kHz, MHz, or GHz respectively (e.g. 1.42G)\n\
+\n";
+
+
+// Largest payload of a single UDP datagram over IPv4
+#define MAX_UDP_PAYLOAD (65507)
+
+
+struct Context {
+    struct DuoPSD psd;
+    float sampleRate;
+    float centerFreq;
+    enum DuoWindow window;
+    // number of averages to run, zero to run until stopped
+    unsigned int maxAverages;
+    // DuoPSDRecord followed by the spectra
+    char* record;
+    size_t recordSize;
+    FILE* out;
+    bool udp;
+#if defined(_WIN32) || (_WIN64)
+    SOCKET sock;
+#else
+    int sock;
+#endif
+    struct sockaddr_in dest;
+    time_t startTime;
+    bool started;
+    bool done;
+};
+
+
+/**
+* Find the strongest bin of a centered spectrum
+*
+* @return bin index in [0, size)
+*/
+static unsigned int peakBin(const float* psd, unsigned int size) {
+    unsigned int peak = 0;
+    for (unsigned int idx = 1; idx < size; idx++) {
+        if (psd[idx] > psd[peak]) {
+            peak = idx;
+        }
+    }
+    return peak;
+}
+
+
+static void resultCallback(const struct DuoPSDResult* result, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    unsigned int size = context->psd.fftSize;
+    float binWidth = context->sampleRate / size;
+    unsigned int peakA = peakBin(result->psdA, size);
+    unsigned int peakB = peakBin(result->psdB, size);
+    printf("sequence=%u peakA=%.1f dBFS/Hz at %.0f Hz peakB=%.1f dBFS/Hz at %.0f Hz\n",
+           result->sequence,
+           10.0 * log10(result->psdA[peakA] + 1e-30),
+           context->centerFreq + ((int)peakA - (int)size / 2) * binWidth,
+           10.0 * log10(result->psdB[peakB] + 1e-30),
+           context->centerFreq + ((int)peakB - (int)size / 2) * binWidth);
+
+    struct DuoPSDRecord* record = (struct DuoPSDRecord*)context->record;
+    record->sequence = result->sequence;
+    record->numAverages = result->numAverages;
+    float* values = (float*)(context->record + sizeof(struct DuoPSDRecord));
+    memcpy(values, result->psdA, size * sizeof(float));
+    memcpy(values + size, result->psdB, size * sizeof(float));
+    if (result->crossRe) {
+        float* cross = values + 2 * size;
+        for (unsigned int idx = 0; idx < size; idx++) {
+            cross[2 * idx] = result->crossRe[idx];
+            cross[2 * idx + 1] = result->crossIm[idx];
+        }
+    }
+
+    if (context->out) {
+        if (fwrite(context->record, context->recordSize, 1, context->out) != 1) {
+            printf("failed to write record %u\n", result->sequence);
+            context->done = true;
+        }
+    }
+    if (context->udp) {
+        int rcode = sendto(
+            context->sock, context->record, (int)context->recordSize, 0,
+            (struct sockaddr*)&context->dest, sizeof(context->dest));
+#if defined(_WIN32) || defined(_WIN64)
+        if (rcode == SOCKET_ERROR) {
+            printf("sendto failed with error=%d\n", WSAGetLastError());
+        }
+#else
+        if (rcode == -1) {
+            perror("sendto failed");
+        }
+#endif
+    }
+
+    if (context->maxAverages && result->sequence + 1 >= context->maxAverages) {
+        context->done = true;
+    }
+}
+
+
+static void transferCallback(struct DuoEngineTransfer* transfer, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    if (context->started && !context->done) {
+        duoPSDPush(&context->psd, (const float*)transfer->data, transfer->numFrames);
+    }
+    else if (!context->started) {
+        if (time(NULL) >= context->startTime) {
+            context->started = true;
+        }
+    }
+}
+
+
+static int controlCallback(struct DuoEngineControl* control, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    if (_kbhit()) {
+        char ctrl = _getch();
+        if (ctrl == 'q') {
+            context->done = true;
+            return 1;
+        }
+    }
+    if (context->done) {
+        return 1;
+    }
+    return 0;
+}
+
+
+static void messageCallback(const char* msg, void* userContext) {
+    printf("%s\n", msg);
+}
+
+
+static void usage(void) {
+    printf(USAGE);
+}
+
+
+int main(int argc, char** argv) {
+    char opt = 0;
+    unsigned int fftSize = 1024;
+    unsigned int overlapPercent = 50;
+    unsigned int numAverages = 1000;
+    unsigned int warmup = 2;
+    bool cross = false;
+    unsigned int port = 1234;
+    char defaultAddr[] = "127.0.0.1";
+    char* ipStr = defaultAddr;
+    unsigned long ipAddr = inet_addr(defaultAddr);
+    char* outputPath = NULL;
+    int rcode = 0;
+
+    struct DuoEngine engine;
+    duoEngineInit(&engine);
+
+    struct Context context;
+    memset(&context, 0, sizeof(context));
+    context.window = DUO_WINDOW_HANN;
+    context.sock = INVALID_SOCKET;
+
+    while ((opt = getopt(argc, argv, "ha:t:l:d:n:w:N:W:v:A:Cc:u:o:kx")) != -1) {
+        switch (opt) {
+        case 'a':
+            if (parseAgcBandwidth(optarg, &engine.agcBandwidth)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            if (parseAgcSetPoint(optarg, &engine.agcSetPoint)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'l':
+            if (parseLnaState(optarg, &engine.lnaState)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'd':
+            if (parseDecimFactor(optarg, &engine.decimFactor)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            if (parseNotchFilter(optarg, &engine.notchMwfm, &engine.notchDab)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'w':
+            if (parseUintArg(optarg, &warmup, 10)) {
+                printf("invalid warmup time, must be an unsigned int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            if (parseUintArg(optarg, &fftSize, 10) || fftSize < 8 || !duoFFTValidSize(fftSize)) {
+                printf("invalid FFT size, must be a power of two >= 8\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'W':
+            if (duoFFTWindowFromName(optarg, &context.window)) {
+                printf("invalid window [%s]\n", optarg);
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'v':
+            if (parseUintArg(optarg, &overlapPercent, 10) || overlapPercent > 95) {
+                printf("invalid overlap, must be in [0-95] percent\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'A':
+            if (parseUintArg(optarg, &numAverages, 10) || numAverages == 0) {
+                printf("invalid number of averages, must be a positive int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'C':
+            cross = true;
+            break;
+        case 'c':
+            if (parseUintArg(optarg, &context.maxAverages, 10)) {
+                printf("invalid average count, must be an unsigned int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'u':
+            if (parseAddrPort(optarg, &ipStr, &ipAddr, &port)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            context.udp = true;
+            break;
+        case 'o':
+            outputPath = optarg;
+            break;
+        case 'k':
+            engine.usbBulkMode = true;
+            break;
+        case 'x':
+            engine.maxSampleRate = true;
+            break;
+        case 'h':
+            usage();
+            return EXIT_SUCCESS;
+        default:
+            printf("unrecognized option\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Handle remaining positional arguments
+    if (optind == (argc - 1)) {
+        if (parseFrequency(argv[optind], &engine.tuneFreq)) {
+            printf("invalid frequency argument\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        printf("invalid number of arguments\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    context.sampleRate = (float)duoEngineSampleRate(&engine);
+    context.centerFreq = (float)engine.tuneFreq;
+    unsigned int overlap = fftSize * overlapPercent / 100;
+
+    context.recordSize = sizeof(struct DuoPSDRecord) + (cross ? 4 : 2) * fftSize * sizeof(float);
+    if (context.udp && context.recordSize > MAX_UDP_PAYLOAD) {
+        printf("records of %zu bytes are too large for UDP, reduce the FFT size\n",
+               context.recordSize);
+        return EXIT_FAILURE;
+    }
+
+    printf("RF Tune Frequency: %f Hz\n", engine.tuneFreq);
+    printf("AGC Loop Bandwidth: %u Hz\n", engine.agcBandwidth);
+    if (engine.agcBandwidth > 0) {
+        printf("AGC Set Point: %d dBFS\n", engine.agcSetPoint);
+    }
+    printf("Warmup: %u seconds\n", warmup);
+    printf("LNA State: %u\n", engine.lnaState);
+    printf("Decimation Factor: %u\n", engine.decimFactor);
+    printf("USB Bulk Mode: %s\n", engine.usbBulkMode ? "true" : "false");
+    printf("Max Fs Mode: %s\n", engine.maxSampleRate ? "true" : "false");
+    printf("Sample Rate: %.0f Hz\n", context.sampleRate);
+    printf("FFT Size: %u\n", fftSize);
+    printf("Resolution Bandwidth: %.1f Hz\n", context.sampleRate / fftSize);
+    printf("Window: %s\n", duoFFTWindowName(context.window));
+    printf("Overlap: %u samples\n", overlap);
+    printf("Averages: %u\n", numAverages);
+    printf("Average Interval: %.1f ms\n",
+           ((double)numAverages * (fftSize - overlap) + overlap) / context.sampleRate * 1000.0);
+    printf("Cross Spectrum: %s\n", cross ? "true" : "false");
+    printf("Record Size: %zu bytes\n", context.recordSize);
+    if (context.udp) {
+        printf("Destination IP Address: %s\n", ipStr);
+        printf("Destination UDP Port: %u\n", port);
+    }
+    if (outputPath) {
+        printf("Output File: %s\n", outputPath);
+    }
+
+    if (duoPSDInit(&context.psd, fftSize, overlap, numAverages, context.window,
+                   cross, context.sampleRate, resultCallback, &context)) {
+        printf("failed to initialize PSD estimator\n");
+        return EXIT_FAILURE;
+    }
+
+    context.record = (char*)calloc(1, context.recordSize);
+    if (context.record == NULL) {
+        printf("failed to allocate record buffer\n");
+        duoPSDFree(&context.psd);
+        return EXIT_FAILURE;
+    }
+    struct DuoPSDRecord* record = (struct DuoPSDRecord*)context.record;
+    record->magic[0] = 'D';
+    record->magic[1] = 'P';
+    record->magic[2] = 'S';
+    record->magic[3] = 'D';
+    record->fftSize = fftSize;
+    record->flags = cross ? DUO_PSD_CROSS : 0;
+    record->sampleRate = context.sampleRate;
+    record->centerFreq = context.centerFreq;
+    record->window = (uint32_t)context.window;
+
+    if (outputPath) {
+        context.out = fopen(outputPath, "ab");
+        if (context.out == NULL) {
+            perror(outputPath);
+            rcode = 1;
+        }
+    }
+
+    if (rcode == 0 && context.udp) {
+#if defined(_WIN32) || (_WIN64)
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 0), &wsaData) != 0) {
+            printf("WSAStartup() failed");
+            rcode = 1;
+        }
+#endif
+        if (rcode == 0 && (context.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
+#if defined(_WIN32) || (_WIN64)
+            printf("socket creation failed error=%u", WSAGetLastError());
+#else
+            perror("socket creation failed:");
+#endif
+            rcode = 1;
+        }
+        memset(&context.dest, 0, sizeof(context.dest));
+        context.dest.sin_family = AF_INET;
+        context.dest.sin_addr.s_addr = ipAddr;
+        context.dest.sin_port = htons((unsigned short)port);
+    }
+
+    if (rcode == 0) {
+        // The estimator works on interleaved floating point frames
+        engine.format = DUO_FORMAT_FLOAT32;
+        engine.userContext = &context;
+        engine.transferCallback = transferCallback;
+        engine.controlCallback = controlCallback;
+        engine.messageCallback = messageCallback;
+
+        // Configure warmup start time if needed
+        context.started = warmup == 0;
+        context.startTime = time(NULL) + warmup;
+
+        printf("PRESS q to QUIT\n");
+        rcode = duoEngineRun(&engine);
+    }
+
+    if (context.sock != INVALID_SOCKET) {
+#if defined(_WIN32) || defined(_WIN64)
+        closesocket(context.sock);
+#else
+        close(context.sock);
+#endif
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    if (context.udp) {
+        WSACleanup();
+    }
+#endif
+    if (context.out) {
+        fclose(context.out);
+    }
+    free(context.record);
+    duoPSDFree(&context.psd);
+
+    return rcode == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,326 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef PSD_H
+#define PSD_H
+
+/**
+* Streaming Welch power spectral density estimator for the two tuners.
+*
+* Each tuner is split into windowed segments of N frames that overlap
+* by a configurable number of frames. The squared magnitude of each
+* segment's FFT is averaged over a configurable number of segments and
+* reported once per average. The cross spectrum B * conj(A) can
+* optionally be averaged in the same way.
+*
+* Spectra are reported as densities in full scale squared per Hz,
+* centered so that bin N/2 is the tuning frequency (i.e. bins run from
+* -fs/2 to fs/2 - fs/N).
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "DuoFFT.h"
+
+
+// DuoPSDRecord flag set when the cross spectrum follows the PSDs
+#define DUO_PSD_CROSS (0x1)
+
+
+/**
+* Record emitted by DuoPSD for each average.
+* Followed by fftSize floats of the tuner A PSD, fftSize floats of the
+* tuner B PSD, and, if DUO_PSD_CROSS is set in flags, fftSize complex
+* bins of the cross spectrum as interleaved floats (re, im).
+* All values are in the byte order of the sending machine, as with
+* DuoUDP samples.
+*/
+struct DuoPSDRecord {
+    // "DPSD"
+    int8_t magic[4];
+    // record counter, incremented by one for each record
+    uint32_t sequence;
+    uint32_t fftSize;
+    // number of segments averaged
+    uint32_t numAverages;
+    uint32_t flags;
+    // sample rate in samples per second
+    float sampleRate;
+    // tuning frequency in Hz, the frequency of bin fftSize/2
+    float centerFreq;
+    // window type, see enum DuoWindow
+    uint32_t window;
+};
+
+
+/**
+* Results for one average, arrays are fftSize values in centered order
+* and only valid until the next push
+*/
+struct DuoPSDResult {
+    uint32_t sequence;
+    uint32_t numAverages;
+    const float* psdA;
+    const float* psdB;
+    // NULL unless the cross spectrum is enabled
+    const float* crossRe;
+    const float* crossIm;
+};
+
+
+typedef void (*DuoPSDResultCallback)(const struct DuoPSDResult* result, void* userContext);
+
+
+struct DuoPSD {
+    struct DuoFFT fft;
+    unsigned int fftSize;
+    unsigned int hopSize;
+    unsigned int numAverages;
+    bool cross;
+    DuoPSDResultCallback callback;
+    void* userContext;
+    float* window;
+    // converts summed |X|^2 to a density
+    double densityScale;
+    // last fftSize frames of each tuner
+    float* histARe;
+    float* histAIm;
+    float* histBRe;
+    float* histBIm;
+    unsigned int fill;
+    // FFT work buffers
+    float* workARe;
+    float* workAIm;
+    float* workBRe;
+    float* workBIm;
+    // accumulators in FFT order
+    float* accA;
+    float* accB;
+    float* accCrossRe;
+    float* accCrossIm;
+    unsigned int count;
+    uint32_t sequence;
+    // scaled and centered results
+    float* outA;
+    float* outB;
+    float* outCrossRe;
+    float* outCrossIm;
+    // single allocation backing all of the arrays above
+    float* memory;
+};
+
+
+/**
+* Initialize a PSD estimator
+*
+* @param psd pointer to struct to initialize
+* @param fftSize FFT size N, a power of two >= 8
+* @param overlap number of frames shared by consecutive segments, < N
+* @param numAverages number of segments in each average
+* @param window window type applied to each segment
+* @param cross true to also average the cross spectrum
+* @param sampleRate sample rate in samples per second
+* @param callback function called with the results of each average
+* @param userContext pointer passed back to callback
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoPSDInit(
+        struct DuoPSD* psd, unsigned int fftSize, unsigned int overlap,
+        unsigned int numAverages, enum DuoWindow window, bool cross,
+        float sampleRate, DuoPSDResultCallback callback, void* userContext) {
+    memset(psd, 0, sizeof(struct DuoPSD));
+    if (fftSize < 8 || !duoFFTValidSize(fftSize) || overlap >= fftSize || numAverages == 0) {
+        return 1;
+    }
+    if (duoFFTInit(&psd->fft, fftSize)) {
+        return 1;
+    }
+    float** arrays[] = {
+        &psd->window, &psd->histARe, &psd->histAIm, &psd->histBRe, &psd->histBIm,
+        &psd->workARe, &psd->workAIm, &psd->workBRe, &psd->workBIm,
+        &psd->accA, &psd->accB, &psd->accCrossRe, &psd->accCrossIm,
+        &psd->outA, &psd->outB, &psd->outCrossRe, &psd->outCrossIm};
+    size_t numArrays = sizeof(arrays) / sizeof(arrays[0]);
+    psd->memory = (float*)calloc((size_t)fftSize * numArrays, sizeof(float));
+    if (psd->memory == NULL) {
+        duoFFTFree(&psd->fft);
+        return 1;
+    }
+    psd->fftSize = fftSize;
+    psd->hopSize = fftSize - overlap;
+    psd->numAverages = numAverages;
+    psd->cross = cross;
+    psd->callback = callback;
+    psd->userContext = userContext;
+
+    float* next = psd->memory;
+    for (size_t idx = 0; idx < numArrays; idx++) {
+        *arrays[idx] = next;
+        next += fftSize;
+    }
+
+    duoFFTWindow(window, psd->window, fftSize);
+    double windowPower = 0.0;
+    for (unsigned int idx = 0; idx < fftSize; idx++) {
+        windowPower += (double)psd->window[idx] * psd->window[idx];
+    }
+    psd->densityScale = 1.0 / (sampleRate * windowPower);
+    return 0;
+}
+
+
+/**
+* Release the memory allocated by duoPSDInit()
+*/
+static void duoPSDFree(struct DuoPSD* psd) {
+    duoFFTFree(&psd->fft);
+    free(psd->memory);
+    psd->memory = NULL;
+}
+
+
+/**
+* Scale, center, and report the accumulated spectra
+*/
+static void duoPSDFinish(struct DuoPSD* psd) {
+    unsigned int size = psd->fftSize;
+    unsigned int half = size / 2;
+    float scale = (float)(psd->densityScale / psd->count);
+    struct DuoPSDResult result;
+
+    for (unsigned int idx = 0; idx < size; idx++) {
+        // Swap halves so negative frequencies come first
+        unsigned int src = (idx + half) % size;
+        psd->outA[idx] = psd->accA[src] * scale;
+        psd->outB[idx] = psd->accB[src] * scale;
+        if (psd->cross) {
+            psd->outCrossRe[idx] = psd->accCrossRe[src] * scale;
+            psd->outCrossIm[idx] = psd->accCrossIm[src] * scale;
+        }
+    }
+
+    result.sequence = psd->sequence;
+    result.numAverages = psd->count;
+    result.psdA = psd->outA;
+    result.psdB = psd->outB;
+    result.crossRe = psd->cross ? psd->outCrossRe : NULL;
+    result.crossIm = psd->cross ? psd->outCrossIm : NULL;
+    if (psd->callback) {
+        psd->callback(&result, psd->userContext);
+    }
+
+    memset(psd->accA, 0, size * sizeof(float));
+    memset(psd->accB, 0, size * sizeof(float));
+    memset(psd->accCrossRe, 0, size * sizeof(float));
+    memset(psd->accCrossIm, 0, size * sizeof(float));
+    psd->count = 0;
+    psd->sequence++;
+}
+
+
+/**
+* Transform and accumulate one full segment
+*/
+static void duoPSDProcessSegment(struct DuoPSD* psd) {
+    unsigned int size = psd->fftSize;
+    const float* window = psd->window;
+
+    for (unsigned int idx = 0; idx < size; idx++) {
+        psd->workARe[idx] = psd->histARe[idx] * window[idx];
+        psd->workAIm[idx] = psd->histAIm[idx] * window[idx];
+        psd->workBRe[idx] = psd->histBRe[idx] * window[idx];
+        psd->workBIm[idx] = psd->histBIm[idx] * window[idx];
+    }
+    duoFFTForward(&psd->fft, psd->workARe, psd->workAIm);
+    duoFFTForward(&psd->fft, psd->workBRe, psd->workBIm);
+
+    const float* aRe = psd->workARe;
+    const float* aIm = psd->workAIm;
+    const float* bRe = psd->workBRe;
+    const float* bIm = psd->workBIm;
+    for (unsigned int idx = 0; idx < size; idx++) {
+        psd->accA[idx] += aRe[idx] * aRe[idx] + aIm[idx] * aIm[idx];
+        psd->accB[idx] += bRe[idx] * bRe[idx] + bIm[idx] * bIm[idx];
+    }
+    if (psd->cross) {
+        for (unsigned int idx = 0; idx < size; idx++) {
+            // B * conj(A), same convention as DuoCorr
+            psd->accCrossRe[idx] += bRe[idx] * aRe[idx] + bIm[idx] * aIm[idx];
+            psd->accCrossIm[idx] += bIm[idx] * aRe[idx] - bRe[idx] * aIm[idx];
+        }
+    }
+
+    psd->count++;
+    if (psd->count == psd->numAverages) {
+        duoPSDFinish(psd);
+    }
+}
+
+
+/**
+* Push interleaved floating point frames (Ia, Qa, Ib, Qb) through the
+* estimator. Results are reported via the callback as each average
+* completes.
+*
+* @param psd estimator from duoPSDInit()
+* @param frames pointer to frames
+* @param numFrames number of frames
+*/
+static void duoPSDPush(struct DuoPSD* psd, const float* frames, size_t numFrames) {
+    unsigned int size = psd->fftSize;
+    unsigned int keep = size - psd->hopSize;
+    size_t frameIdx = 0;
+    while (frameIdx < numFrames) {
+        size_t count = size - psd->fill;
+        if (count > numFrames - frameIdx) {
+            count = numFrames - frameIdx;
+        }
+        unsigned int dst = psd->fill;
+        const float* in = frames + frameIdx * 4;
+        for (size_t idx = 0; idx < count; idx++) {
+            psd->histARe[dst + idx] = in[0];
+            psd->histAIm[dst + idx] = in[1];
+            psd->histBRe[dst + idx] = in[2];
+            psd->histBIm[dst + idx] = in[3];
+            in += 4;
+        }
+        psd->fill += (unsigned int)count;
+        frameIdx += count;
+
+        if (psd->fill == size) {
+            duoPSDProcessSegment(psd);
+            // Keep the overlap for the next segment
+            memmove(psd->histARe, psd->histARe + psd->hopSize, keep * sizeof(float));
+            memmove(psd->histAIm, psd->histAIm + psd->hopSize, keep * sizeof(float));
+            memmove(psd->histBRe, psd->histBRe + psd->hopSize, keep * sizeof(float));
+            memmove(psd->histBIm, psd->histBIm + psd->hopSize, keep * sizeof(float));
+            psd->fill = keep;
+        }
+    }
+}
+
+
+#endif
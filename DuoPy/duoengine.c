@@ -0,0 +1,904 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/**
+* Python extension module exposing DuoEngine.
+*
+* Engine.read() pulls frames from the engine ring (see readBufferSize)
+* and returns them as NumPy arrays that view the ring through the
+* buffer protocol, so no samples are copied on their way to Python.
+* float32 frames are complex64 arrays of shape (frames, streams), int16
+* and int8 frames are arrays of shape (frames, streams, 2).
+*
+* The frames of a zero-copy read are released at the next read() once
+* the array is gone. While it is alive they stay pinned in the ring and
+* later reads are copied from behind them, until the pinned frames and
+* those copied behind them fill a quarter of the ring. stop() does not
+* wait for the arrays; the ring is freed with the last of them.
+*
+* The GIL is released while waiting for frames and while starting and
+* stopping the engine. No Python code runs on engine threads, so the
+* control callback is not exposed; call set_control() or retune() from
+* Python instead.
+*
+* Built with DUO_EMULATE, the module also exposes the fault injection
+* of DuoEmulate.h for tests.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <time.h>
+
+#include "DuoEngine.h"
+#include "DuoParse.h"
+
+#ifdef DUO_EMULATE
+#include "DuoEmulate.h"
+#endif
+
+// Longest wait between checks for KeyboardInterrupt
+#define WAIT_SLICE_MS (100)
+
+#ifndef DEFAULT_READ_BUFFER_SIZE
+#define DEFAULT_READ_BUFFER_SIZE (64 * 1024 * 1024)
+#endif
+
+
+/**
+* Handle of one engine run. Zero-copy reads reference it, so the ring
+* they view is freed only once the last of them is gone, after stop()
+* has already halted streaming and released the device.
+*/
+typedef struct {
+    PyObject_HEAD
+    struct DuoEngineHandle* handle;
+    // buffer exports of zero-copy reads that are still alive
+    Py_ssize_t exports;
+} RingObject;
+
+
+typedef struct {
+    PyObject_HEAD
+    struct DuoEngine config;
+    struct DuoEngineHandle* handle;
+    enum DuoEngineFormat format;
+    unsigned int numStreams;
+    unsigned int frameSize;
+    // longest zero-copy read in frames, a quarter of the ring
+    unsigned int maxPeek;
+    // frames viewed by the last zero-copy read, released at the next read
+    unsigned int pending;
+    // frames copied from behind pending while it was still viewed
+    unsigned int behind;
+    // sample rate of the frames returned by the last read, zero before the first
+    float readRate;
+    // ring of the current run, NULL when stopped
+    RingObject* ring;
+    char lastMsg[256];
+} EngineObject;
+
+
+typedef struct {
+    PyObject_HEAD
+    // ring that holds data, NULL if data is owned
+    RingObject* ring;
+    void* data;
+    bool owned;
+    const char* format;
+    Py_ssize_t itemSize;
+    int ndim;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+} BlockObject;
+
+
+static PyTypeObject RingType;
+static PyTypeObject BlockType;
+static PyObject* numpyAsArray = NULL;
+
+
+/**
+* Messages are printed like the tools do, and the latest is kept for
+* the exception raised when start fails
+*/
+static void messageCallback(const char* msg, void* userContext) {
+    EngineObject* self = (EngineObject*)userContext;
+    snprintf(self->lastMsg, sizeof(self->lastMsg), "%s", msg);
+    fprintf(stderr, "%s\n", msg);
+}
+
+
+static int blockGetBuffer(PyObject* obj, Py_buffer* view, int flags) {
+    BlockObject* self = (BlockObject*)obj;
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "DuoEngine frames are read-only");
+        view->obj = NULL;
+        return -1;
+    }
+    view->buf = self->data;
+    view->obj = obj;
+    Py_INCREF(obj);
+    view->len = self->shape[0] * self->strides[0];
+    view->readonly = 1;
+    view->itemsize = self->itemSize;
+    view->format = (flags & PyBUF_FORMAT) ? (char*)self->format : NULL;
+    view->ndim = self->ndim;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    if (self->ring) {
+        self->ring->exports++;
+    }
+    return 0;
+}
+
+
+static void blockReleaseBuffer(PyObject* obj, Py_buffer* view) {
+    BlockObject* self = (BlockObject*)obj;
+    if (self->ring) {
+        self->ring->exports--;
+    }
+}
+
+
+static void blockDealloc(PyObject* obj) {
+    BlockObject* self = (BlockObject*)obj;
+    if (self->owned) {
+        PyMem_Free(self->data);
+    }
+    Py_XDECREF(self->ring);
+    Py_TYPE(obj)->tp_free(obj);
+}
+
+
+static void ringDealloc(PyObject* obj) {
+    RingObject* self = (RingObject*)obj;
+    // Streaming was halted by stop(), this only frees the ring
+    if (self->handle) {
+        Py_BEGIN_ALLOW_THREADS
+        duoEngineStop(self->handle);
+        Py_END_ALLOW_THREADS
+    }
+    Py_TYPE(obj)->tp_free(obj);
+}
+
+
+static PyBufferProcs blockBufferProcs = {
+    blockGetBuffer,
+    blockReleaseBuffer
+};
+
+
+/**
+* Wrap frames in a block and convert it to a NumPy array when NumPy is
+* available, otherwise return a memoryview
+*
+* @param self engine that delivered the frames
+* @param data first frame
+* @param numFrames number of frames
+* @param owned true if data was allocated with PyMem_Malloc for the block
+*
+* @return new reference, NULL with an exception set on failure
+*/
+static PyObject* wrapFrames(EngineObject* self, void* data, unsigned int numFrames, bool owned) {
+    BlockObject* block = PyObject_New(BlockObject, &BlockType);
+    if (block == NULL) {
+        if (owned) {
+            PyMem_Free(data);
+        }
+        return NULL;
+    }
+    block->ring = NULL;
+    if (!owned) {
+        block->ring = self->ring;
+        Py_INCREF(self->ring);
+    }
+    block->data = data;
+    block->owned = owned;
+    block->shape[0] = numFrames;
+    block->shape[1] = self->numStreams;
+    block->strides[0] = self->frameSize;
+    if (self->format == DUO_FORMAT_FLOAT32) {
+        // Each I, Q pair of floats is one complex64
+        block->format = "Zf";
+        block->itemSize = 2 * sizeof(float);
+        block->ndim = 2;
+        block->strides[1] = block->itemSize;
+    }
+    else {
+        block->format = self->format == DUO_FORMAT_INT16 ? "h" : "b";
+        block->itemSize = self->format == DUO_FORMAT_INT16 ? sizeof(int16_t) : sizeof(int8_t);
+        block->ndim = 3;
+        block->shape[2] = 2;
+        block->strides[1] = 2 * block->itemSize;
+        block->strides[2] = block->itemSize;
+    }
+
+    PyObject* result = numpyAsArray ?
+        PyObject_CallFunctionObjArgs(numpyAsArray, (PyObject*)block, NULL) :
+        PyMemoryView_FromObject((PyObject*)block);
+    Py_DECREF(block);
+    return result;
+}
+
+
+static int engineInit(PyObject* obj, PyObject* args, PyObject* kwargs) {
+    static char* keywords[] = {
+        "freq", "lna_state", "agc_bandwidth", "agc_set_point", "decimation",
+        "format", "outputs", "output_rate", "shift_freq", "iq_correction",
+        "notch_mwfm", "notch_dab", "max_sample_rate", "usb_bulk",
+        "buffer_size", "max_transfer_size", "recover_timeout", NULL};
+    EngineObject* self = (EngineObject*)obj;
+    struct DuoEngine* config = &self->config;
+    double freq = 0.0;
+    double shiftFreq = 0.0;
+    const char* format = "float32";
+    const char* outputs = "a,b";
+    int iqCorrection = 0;
+    int notchMwfm = 0;
+    int notchDab = 0;
+    int maxSampleRate = 0;
+    int usbBulk = 0;
+    char arg[64];
+
+    if (self->handle) {
+        PyErr_SetString(PyExc_RuntimeError, "DuoEngine is running");
+        return -1;
+    }
+    duoEngineInit(config);
+    config->readBufferSize = DEFAULT_READ_BUFFER_SIZE;
+    if (!PyArg_ParseTupleAndKeywords(
+            args, kwargs, "d|IIiIssIdpppppIIf", keywords,
+            &freq, &config->lnaState, &config->agcBandwidth, &config->agcSetPoint,
+            &config->decimFactor, &format, &outputs, &config->outputRate, &shiftFreq,
+            &iqCorrection, &notchMwfm, &notchDab, &maxSampleRate, &usbBulk,
+            &config->readBufferSize, &config->maxTransferSize, &config->recoverTimeout)) {
+        return -1;
+    }
+    config->tuneFreq = (float)freq;
+    config->shiftFreq = (float)shiftFreq;
+    config->iqCorrection = iqCorrection != 0;
+    config->notchMwfm = notchMwfm != 0;
+    config->notchDab = notchDab != 0;
+    config->maxSampleRate = maxSampleRate != 0;
+    config->usbBulkMode = usbBulk != 0;
+
+    if (config->lnaState > 9) {
+        PyErr_SetString(PyExc_ValueError, "lna_state must be in [0-9]");
+        return -1;
+    }
+    if (config->agcBandwidth != 0 && config->agcBandwidth != 5 &&
+        config->agcBandwidth != 50 && config->agcBandwidth != 100) {
+        PyErr_SetString(PyExc_ValueError, "agc_bandwidth must be 0, 5, 50, or 100");
+        return -1;
+    }
+    if (config->agcSetPoint > 0 || config->agcSetPoint < -72) {
+        PyErr_SetString(PyExc_ValueError, "agc_set_point must be in [-72-0] dBFS");
+        return -1;
+    }
+    if (config->decimFactor == 0 || config->decimFactor > 32 ||
+        (config->decimFactor & (config->decimFactor - 1)) != 0) {
+        PyErr_SetString(PyExc_ValueError, "decimation must be in [1,2,4,8,16,32]");
+        return -1;
+    }
+    snprintf(arg, sizeof(arg), "%s", format);
+    if (parseSampleFormat(arg, &config->format) ||
+        (config->format != DUO_FORMAT_FLOAT32 && config->format != DUO_FORMAT_INT16 &&
+         config->format != DUO_FORMAT_INT8)) {
+        PyErr_SetString(PyExc_ValueError, "format must be float32, int16, or int8");
+        return -1;
+    }
+    snprintf(arg, sizeof(arg), "%s", outputs);
+    if (parseOutputMask(arg, &config->outputMask)) {
+        PyErr_SetString(PyExc_ValueError, "outputs must be a comma separated list of a, b, sum, diff, beam0, or beam1");
+        return -1;
+    }
+
+    self->format = config->format;
+    self->numStreams = duoEngineNumStreams(duoEngineOutputMask(config));
+    self->frameSize = duoEngineFormatBits(self->format) * 2 * self->numStreams / 8;
+    self->maxPeek = config->readBufferSize / self->frameSize / 4;
+    config->userContext = self;
+    config->messageCallback = messageCallback;
+    return 0;
+}
+
+
+static void engineDealloc(PyObject* obj) {
+    EngineObject* self = (EngineObject*)obj;
+    if (self->handle) {
+        Py_BEGIN_ALLOW_THREADS
+        duoEngineHalt(self->handle);
+        Py_END_ALLOW_THREADS
+        self->handle = NULL;
+    }
+    // Blocks still viewing the ring keep it alive
+    Py_CLEAR(self->ring);
+    Py_TYPE(obj)->tp_free(obj);
+}
+
+
+static int checkRunning(EngineObject* self) {
+    if (self->handle == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "DuoEngine is not running");
+        return 1;
+    }
+    return 0;
+}
+
+
+static PyObject* engineStart(PyObject* obj, PyObject* unused) {
+    EngineObject* self = (EngineObject*)obj;
+    int rcode = 0;
+    if (self->handle) {
+        PyErr_SetString(PyExc_RuntimeError, "DuoEngine is already running");
+        return NULL;
+    }
+    RingObject* ring = PyObject_New(RingObject, &RingType);
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->handle = NULL;
+    ring->exports = 0;
+    self->lastMsg[0] = '\0';
+    self->pending = 0;
+    self->behind = 0;
+    self->readRate = 0.0f;
+    Py_BEGIN_ALLOW_THREADS
+    rcode = duoEngineStart(&self->config, &self->handle);
+    Py_END_ALLOW_THREADS
+    if (rcode != 0) {
+        self->handle = NULL;
+        Py_DECREF(ring);
+        PyErr_Format(PyExc_RuntimeError, "DuoEngine failed to start: %s", self->lastMsg);
+        return NULL;
+    }
+    ring->handle = self->handle;
+    self->ring = ring;
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* engineStop(PyObject* obj, PyObject* unused) {
+    EngineObject* self = (EngineObject*)obj;
+    int rcode = 0;
+    if (self->handle == NULL) {
+        Py_RETURN_NONE;
+    }
+    // Streaming stops and the device is released now, even while arrays
+    // from zero-copy reads still view the ring
+    Py_BEGIN_ALLOW_THREADS
+    rcode = duoEngineHalt(self->handle);
+    Py_END_ALLOW_THREADS
+    self->handle = NULL;
+    self->pending = 0;
+    self->behind = 0;
+    Py_CLEAR(self->ring);
+    if (rcode != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "DuoEngine did not stop cleanly");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static double nowSeconds(void) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+
+/**
+* Time left until the deadline in milliseconds for at most one slice.
+* Must be called with the GIL held.
+*
+* @return false once the deadline has passed or a signal raised
+*/
+static bool nextSlice(double deadline, unsigned int* sliceMs) {
+    if (PyErr_CheckSignals() != 0) {
+        return false;
+    }
+    double left = deadline - nowSeconds();
+    if (left <= 0.0) {
+        return false;
+    }
+    *sliceMs = left * 1000.0 < WAIT_SLICE_MS ? (unsigned int)(left * 1000.0) + 1 : WAIT_SLICE_MS;
+    return true;
+}
+
+
+/**
+* True if count frames from the read position already reach the next
+* sample rate change, so waiting for more would not return them
+*/
+static bool reachesChange(EngineObject* self, int count) {
+    unsigned int epoch = 0;
+    unsigned int untilChange = 0;
+    duoEngineGetReadRate(self->handle, &self->readRate, &epoch, &untilChange);
+    return untilChange != 0 && count >= 0 && (unsigned int)count >= untilChange;
+}
+
+
+/**
+* Read while the frames of the last zero-copy read are still viewed.
+* They cannot be released, so up to numFrames frames after them and
+* after any frames already copied behind them are copied instead.
+*
+* @return new reference, NULL with an exception set on failure
+*/
+static PyObject* readBehind(EngineObject* self, unsigned int numFrames, double deadline) {
+    unsigned int offset = self->pending + self->behind;
+    unsigned int sliceMs = 0;
+    const void* data = NULL;
+    if (offset >= self->maxPeek || reachesChange(self, offset)) {
+        PyErr_SetString(PyExc_BufferError, "arrays from zero-copy reads hold back the engine buffer, release them to read on");
+        return NULL;
+    }
+    if (numFrames > self->maxPeek - offset) {
+        numFrames = self->maxPeek - offset;
+    }
+    int count = duoEnginePeek(self->handle, &data, offset + numFrames, 0);
+    while (count >= 0 && (unsigned int)count < offset + numFrames && !reachesChange(self, count) &&
+           nextSlice(deadline, &sliceMs)) {
+        Py_BEGIN_ALLOW_THREADS
+        count = duoEnginePeek(self->handle, &data, offset + numFrames, sliceMs);
+        Py_END_ALLOW_THREADS
+    }
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    reachesChange(self, count);
+    unsigned int total = count > (int)offset ? (unsigned int)count - offset : 0;
+    char* copy = (char*)PyMem_Malloc((size_t)total * self->frameSize + 1);
+    if (copy == NULL) {
+        return PyErr_NoMemory();
+    }
+    if (total > 0) {
+        memcpy(copy, (const char*)data + (size_t)offset * self->frameSize, (size_t)total * self->frameSize);
+    }
+    self->behind += total;
+    return wrapFrames(self, copy, total, true);
+}
+
+
+static PyObject* engineRead(PyObject* obj, PyObject* args, PyObject* kwargs) {
+    static char* keywords[] = {"num_frames", "timeout", "copy", NULL};
+    EngineObject* self = (EngineObject*)obj;
+    unsigned int numFrames = 0;
+    double timeout = 1.0;
+    int copy = 0;
+    int count = 0;
+    unsigned int sliceMs = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "I|dp", keywords, &numFrames, &timeout, &copy)) {
+        return NULL;
+    }
+    if (checkRunning(self)) {
+        return NULL;
+    }
+    double deadline = nowSeconds() + timeout;
+
+    if (self->ring->exports > 0) {
+        return readBehind(self, numFrames, deadline);
+    }
+    // Nothing views the frames of earlier reads, so they are released now
+    duoEngineConsume(self->handle, self->pending + self->behind);
+    self->pending = 0;
+    self->behind = 0;
+
+    if (!copy && numFrames <= self->maxPeek) {
+        const void* data = NULL;
+        count = duoEnginePeek(self->handle, &data, numFrames, 0);
+        while (count >= 0 && (unsigned int)count < numFrames && !reachesChange(self, count) &&
+               nextSlice(deadline, &sliceMs)) {
+            Py_BEGIN_ALLOW_THREADS
+            count = duoEnginePeek(self->handle, &data, numFrames, sliceMs);
+            Py_END_ALLOW_THREADS
+        }
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        if (count < 0) {
+            Py_RETURN_NONE;
+        }
+        // The peeked frames are still at the read position, so this is their rate
+        reachesChange(self, count);
+        self->pending = count;
+        return wrapFrames(self, (void*)data, count, false);
+    }
+
+    char* data = (char*)PyMem_Malloc((size_t)numFrames * self->frameSize + 1);
+    if (data == NULL) {
+        return PyErr_NoMemory();
+    }
+    unsigned int total = 0;
+    float rate = 0.0f;
+    unsigned int startEpoch = 0;
+    unsigned int epoch = 0;
+    unsigned int untilChange = 0;
+    count = 0;
+    while (total < numFrames && count >= 0) {
+        // A block never spans a change of sample rate
+        duoEngineGetReadRate(self->handle, &rate, &epoch, &untilChange);
+        if (epoch != startEpoch && total > 0) {
+            break;
+        }
+        startEpoch = epoch;
+        self->readRate = rate;
+        bool wait = nextSlice(deadline, &sliceMs);
+        if (PyErr_Occurred()) {
+            PyMem_Free(data);
+            return NULL;
+        }
+        Py_BEGIN_ALLOW_THREADS
+        count = duoEngineRead(
+            self->handle, data + (size_t)total * self->frameSize,
+            numFrames - total, wait ? sliceMs : 0);
+        Py_END_ALLOW_THREADS
+        if (count > 0) {
+            total += count;
+        }
+        if (!wait) {
+            break;
+        }
+    }
+    // A partial read is returned and the end of the stream reported at the next read
+    if (count < 0 && total == 0) {
+        PyMem_Free(data);
+        Py_RETURN_NONE;
+    }
+    return wrapFrames(self, data, total, true);
+}
+
+
+static PyObject* controlToDict(const struct DuoEngineControl* control) {
+    return Py_BuildValue(
+        "{s:d,s:I,s:i,s:I,s:O,s:O,s:d,s:I,s:O,s:I}",
+        "tune_freq", (double)control->tuneFreq,
+        "agc_bandwidth", control->agcBandwidth,
+        "agc_set_point", control->agcSetPoint,
+        "lna_state", control->lnaState,
+        "notch_mwfm", control->notchMwfm ? Py_True : Py_False,
+        "notch_dab", control->notchDab ? Py_True : Py_False,
+        "shift_freq", (double)control->shiftFreq,
+        "decimation", control->decimFactor,
+        "max_sample_rate", control->maxSampleRate ? Py_True : Py_False,
+        "output_rate", control->outputRate);
+}
+
+
+static PyObject* engineGetControl(PyObject* obj, PyObject* unused) {
+    EngineObject* self = (EngineObject*)obj;
+    struct DuoEngineControl control;
+    if (checkRunning(self)) {
+        return NULL;
+    }
+    if (duoEngineGetControl(self->handle, &control) != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "DuoEngine has stopped");
+        return NULL;
+    }
+    return controlToDict(&control);
+}
+
+
+static PyObject* engineSetControl(PyObject* obj, PyObject* args, PyObject* kwargs) {
+    static char* keywords[] = {
+        "tune_freq", "agc_bandwidth", "agc_set_point", "lna_state",
+        "notch_mwfm", "notch_dab", "shift_freq", "decimation", "max_sample_rate",
+        "output_rate", NULL};
+    EngineObject* self = (EngineObject*)obj;
+    struct DuoEngineControl control;
+    if (checkRunning(self)) {
+        return NULL;
+    }
+    if (duoEngineGetControl(self->handle, &control) != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "DuoEngine has stopped");
+        return NULL;
+    }
+    double tuneFreq = control.tuneFreq;
+    double shiftFreq = control.shiftFreq;
+    int notchMwfm = control.notchMwfm;
+    int notchDab = control.notchDab;
+    int maxSampleRate = control.maxSampleRate;
+    if (!PyArg_ParseTupleAndKeywords(
+            args, kwargs, "|dIiIppdIpI", keywords,
+            &tuneFreq, &control.agcBandwidth, &control.agcSetPoint, &control.lnaState,
+            &notchMwfm, &notchDab, &shiftFreq, &control.decimFactor, &maxSampleRate,
+            &control.outputRate)) {
+        return NULL;
+    }
+    if (control.lnaState > 9 || control.agcSetPoint > 0 || control.agcSetPoint < -72 ||
+        (control.agcBandwidth != 0 && control.agcBandwidth != 5 &&
+         control.agcBandwidth != 50 && control.agcBandwidth != 100)) {
+        PyErr_SetString(PyExc_ValueError, "invalid lna_state, agc_bandwidth, or agc_set_point");
+        return NULL;
+    }
+    if (control.decimFactor == 0 || control.decimFactor > 32 ||
+        (control.decimFactor & (control.decimFactor - 1)) != 0) {
+        PyErr_SetString(PyExc_ValueError, "decimation must be in [1,2,4,8,16,32]");
+        return NULL;
+    }
+    control.tuneFreq = (float)tuneFreq;
+    control.shiftFreq = (float)shiftFreq;
+    control.notchMwfm = notchMwfm != 0;
+    control.notchDab = notchDab != 0;
+    control.maxSampleRate = maxSampleRate != 0;
+    if (duoEngineSetControl(self->handle, &control) != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "DuoEngine has stopped");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* engineRetune(PyObject* obj, PyObject* args) {
+    double freq = 0.0;
+    if (!PyArg_ParseTuple(args, "d", &freq)) {
+        return NULL;
+    }
+    PyObject* kwargs = Py_BuildValue("{s:d}", "tune_freq", freq);
+    PyObject* empty = PyTuple_New(0);
+    PyObject* result = NULL;
+    if (kwargs && empty) {
+        result = engineSetControl(obj, empty, kwargs);
+    }
+    Py_XDECREF(kwargs);
+    Py_XDECREF(empty);
+    return result;
+}
+
+
+static PyObject* engineOverruns(PyObject* obj, PyObject* unused) {
+    EngineObject* self = (EngineObject*)obj;
+    unsigned long long overruns = 0;
+    unsigned long long droppedFrames = 0;
+    if (checkRunning(self)) {
+        return NULL;
+    }
+    duoEngineGetOverruns(self->handle, &overruns, &droppedFrames);
+    return Py_BuildValue("(KK)", overruns, droppedFrames);
+}
+
+
+static PyObject* engineStats(PyObject* obj, PyObject* unused) {
+    EngineObject* self = (EngineObject*)obj;
+    struct DuoEngineStats stats;
+    if (checkRunning(self)) {
+        return NULL;
+    }
+    duoEngineGetStats(self->handle, &stats);
+    return Py_BuildValue(
+        "{s:I,s:I,s:I,s:I,s:O,s:d,s:d}",
+        "discontinuities", stats.discontinuities,
+        "device_losses", stats.deviceLosses,
+        "recoveries", stats.recoveries,
+        "failed_attempts", stats.failedAttempts,
+        "recovering", stats.recovering ? Py_True : Py_False,
+        "last_recovery_time", (double)stats.lastRecoveryTime,
+        "total_recovery_time", (double)stats.totalRecoveryTime);
+}
+
+
+static PyObject* engineEnter(PyObject* obj, PyObject* unused) {
+    EngineObject* self = (EngineObject*)obj;
+    if (self->handle == NULL) {
+        PyObject* result = engineStart(obj, NULL);
+        if (result == NULL) {
+            return NULL;
+        }
+        Py_DECREF(result);
+    }
+    Py_INCREF(obj);
+    return obj;
+}
+
+
+static PyObject* engineExit(PyObject* obj, PyObject* args) {
+    PyObject* result = engineStop(obj, NULL);
+    if (result == NULL) {
+        // An exception leaving the with body is not replaced by one from stop
+        if (PyTuple_Size(args) > 0 && PyTuple_GetItem(args, 0) != Py_None) {
+            PyErr_Clear();
+            Py_RETURN_FALSE;
+        }
+        return NULL;
+    }
+    Py_DECREF(result);
+    Py_RETURN_FALSE;
+}
+
+
+static PyObject* engineGetSampleRate(PyObject* obj, void* unused) {
+    EngineObject* self = (EngineObject*)obj;
+    if (self->readRate > 0.0f) {
+        return PyFloat_FromDouble(self->readRate);
+    }
+    return PyFloat_FromDouble(duoEngineSampleRate(&self->config));
+}
+
+
+static PyObject* engineGetNumStreams(PyObject* obj, void* unused) {
+    return PyLong_FromUnsignedLong(((EngineObject*)obj)->numStreams);
+}
+
+
+static PyObject* engineGetRunning(PyObject* obj, void* unused) {
+    return PyBool_FromLong(((EngineObject*)obj)->handle != NULL);
+}
+
+
+static PyMethodDef engineMethods[] = {
+    {"start", engineStart, METH_NOARGS,
+     "start() -> None\n\nStart streaming into the read buffer."},
+    {"stop", engineStop, METH_NOARGS,
+     "stop() -> None\n\nStop streaming and release the device. Arrays from zero-copy\n"
+     "reads stay valid, the buffer is freed once they are all gone."},
+    {"read", (PyCFunction)(void(*)(void))engineRead, METH_VARARGS | METH_KEYWORDS,
+     "read(num_frames, timeout=1.0, copy=False) -> array or None\n\n"
+     "Wait up to timeout seconds for num_frames frames. Returns fewer on\n"
+     "timeout, before a change of sample_rate, and None at the end of\n"
+     "the stream. Unless copy is set or num_frames exceeds a quarter of\n"
+     "buffer_size, the array views the engine buffer. While it is alive\n"
+     "its frames stay in the buffer and later reads return copies of the\n"
+     "frames after them, raising BufferError once those fill a quarter of\n"
+     "buffer_size."},
+    {"get_control", engineGetControl, METH_NOARGS,
+     "get_control() -> dict\n\nCurrent runtime configuration."},
+    {"set_control", (PyCFunction)(void(*)(void))engineSetControl, METH_VARARGS | METH_KEYWORDS,
+     "set_control(tune_freq=, agc_bandwidth=, agc_set_point=, lna_state=,\n"
+     "            notch_mwfm=, notch_dab=, shift_freq=, decimation=,\n"
+     "            max_sample_rate=, output_rate=) -> None\n\n"
+     "Change any of the runtime settings while streaming."},
+    {"retune", engineRetune, METH_VARARGS,
+     "retune(freq) -> None\n\nChange the tuning frequency of both tuners."},
+    {"overruns", engineOverruns, METH_NOARGS,
+     "overruns() -> (transfers, frames)\n\nTransfers and frames dropped because the buffer was full."},
+    {"stats", engineStats, METH_NOARGS,
+     "stats() -> dict\n\nStream discontinuities and automatic device recovery counters."},
+    {"__enter__", engineEnter, METH_NOARGS, NULL},
+    {"__exit__", engineExit, METH_VARARGS, NULL},
+    {NULL, NULL, 0, NULL}
+};
+
+
+static PyGetSetDef engineGetSet[] = {
+    {"sample_rate", engineGetSampleRate, NULL, "frames per second of the last read()", NULL},
+    {"num_streams", engineGetNumStreams, NULL, "output streams in each frame", NULL},
+    {"running", engineGetRunning, NULL, "true between start() and stop()", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+
+static PyTypeObject EngineType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "duoengine.Engine",
+};
+
+
+static PyTypeObject RingType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "duoengine.Ring",
+};
+
+
+static PyTypeObject BlockType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "duoengine.Block",
+};
+
+
+#ifdef DUO_EMULATE
+static PyObject* moduleEmulateRemove(PyObject* module, PyObject* args) {
+    double absent = 1.0;
+    if (!PyArg_ParseTuple(args, "|d", &absent)) {
+        return NULL;
+    }
+    if (absent < 0.0) {
+        PyErr_SetString(PyExc_ValueError, "absent must not be negative");
+        return NULL;
+    }
+    duoEmulateRemove((unsigned int)(absent * 1000.0));
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* moduleEmulateStall(PyObject* module, PyObject* unused) {
+    duoEmulateStall();
+    Py_RETURN_NONE;
+}
+#endif
+
+
+static PyMethodDef moduleMethods[] = {
+#ifdef DUO_EMULATE
+    {"emulate_remove", moduleEmulateRemove, METH_VARARGS,
+     "emulate_remove(absent=1.0) -> None\n\n"
+     "Unplug the emulated RSPduo, which can be opened again after absent\n"
+     "seconds."},
+    {"emulate_stall", moduleEmulateStall, METH_NOARGS,
+     "emulate_stall() -> None\n\nStop the stream of the emulated RSPduo without any event."},
+#endif
+    {NULL, NULL, 0, NULL}
+};
+
+
+static struct PyModuleDef duoengineModule = {
+    PyModuleDef_HEAD_INIT,
+    "duoengine",
+    "Dual-tuner RSPduo streaming through DuoEngine",
+    -1,
+    moduleMethods
+};
+
+
+PyMODINIT_FUNC PyInit_duoengine(void) {
+    EngineType.tp_basicsize = sizeof(EngineObject);
+    EngineType.tp_flags = Py_TPFLAGS_DEFAULT;
+    EngineType.tp_doc =
+        "Engine(freq, lna_state=4, agc_bandwidth=0, agc_set_point=-30, decimation=1,\n"
+        "       format='float32', outputs='a,b', output_rate=0, shift_freq=0.0,\n"
+        "       iq_correction=False, notch_mwfm=False, notch_dab=False,\n"
+        "       max_sample_rate=False, usb_bulk=False, buffer_size=64 MiB,\n"
+        "       max_transfer_size=10240, recover_timeout=0.0)\n\n"
+        "RSPduo dual-tuner stream. Use as a context manager or call start()\n"
+        "and stop(), and pull frames with read().";
+    EngineType.tp_new = PyType_GenericNew;
+    EngineType.tp_init = engineInit;
+    EngineType.tp_dealloc = engineDealloc;
+    EngineType.tp_methods = engineMethods;
+    EngineType.tp_getset = engineGetSet;
+    RingType.tp_basicsize = sizeof(RingObject);
+    RingType.tp_flags = Py_TPFLAGS_DEFAULT;
+    RingType.tp_doc = "Read buffer of one Engine run, kept while zero-copy reads view it";
+    RingType.tp_dealloc = ringDealloc;
+    BlockType.tp_basicsize = sizeof(BlockObject);
+    BlockType.tp_flags = Py_TPFLAGS_DEFAULT;
+    BlockType.tp_doc = "Frames delivered by Engine.read()";
+    BlockType.tp_dealloc = blockDealloc;
+    BlockType.tp_as_buffer = &blockBufferProcs;
+    if (PyType_Ready(&EngineType) < 0 || PyType_Ready(&RingType) < 0 ||
+        PyType_Ready(&BlockType) < 0) {
+        return NULL;
+    }
+
+    PyObject* module = PyModule_Create(&duoengineModule);
+    if (module == NULL) {
+        return NULL;
+    }
+    Py_INCREF(&EngineType);
+    if (PyModule_AddObject(module, "Engine", (PyObject*)&EngineType) < 0) {
+        Py_DECREF(&EngineType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    // NumPy is optional, without it reads return memoryviews
+    PyObject* numpy = PyImport_ImportModule("numpy");
+    if (numpy) {
+        numpyAsArray = PyObject_GetAttrString(numpy, "asarray");
+        Py_DECREF(numpy);
+    }
+    PyErr_Clear();
+    return module;
+}
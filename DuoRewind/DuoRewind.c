@@ -0,0 +1,764 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#include <winsock.h>
+#include <wsipv6ok.h>
+#include <conio.h>
+#include "windows_getopt.h"
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "posix_conio.h"
+
+#define INVALID_SOCKET (-1)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_AGC_BANDWIDTH (5)
+
+#include "DuoEngine.h"
+#include "DuoParse.h"
+#include "DuoThread.h"
+#include "wav.h"
+
+
+static const char* USAGE = "\
+Usage: DuoRewind.exe [-h] [-a agchz] [-t agcdb] [-l lna] [-d decim]\n\
+                     [-n notch] [-s format] [-c streams] [-r rate]\n\
+                     [-F freq] [-I] [-b bytes] [-u port] [-S]\n\
+                     [-R priority] [-C cpus] [-L] [-k] [-x]\n\
+                     freq [prefix]\n\
+\n\
+Keeps the most recent samples of the selected streams in memory and\n\
+writes them to a file on request, so a signal can be saved after it\n\
+has passed. Capture continues while the file is written.\n\
+\n\
+A dump is requested by pressing d, by sending SIGUSR1 to the process\n\
+(not on Windows), or by sending a UDP datagram containing \"dump\" to\n\
+the command port on 127.0.0.1. Press q to quit.\n\
+\n\
+Options:\n\
+  -h: print this help message\n\
+  -a 0|5|50|100: AGC loop bandwidth in Hz (default=5)\n\
+  -t [-72-0]: AGC set point in dBFS (default=-30)\n\
+  -l 0-9: LNA state where 0 provides the least RF gain reduction.\n\
+      Default value is 4 (20-37 dB reduction depending on frequency).\n\
+  -d 1|2|4|8|16|32: Decimation factor (default=1)\n\
+      For factors 4, 8, 16, and 32, the analog bandwidth will \n\
+      be reduced to 600, 300, 200, and 200 kHz respectively unless \n\
+      the -x option is also specified. In which case the analog \n\
+      bandwidth remains 1.536 MHz.\n\
+  -n mwfm|dab: Enable MW/FM or DAB notch filter\n\
+      Both filters can be enabled by providing the -n option twice\n\
+      (once for each filter). By default, both filters are disabled.\n\
+  -s int16|float32|int8: Sample scalar format (default=int16)\n\
+  -c streams: Comma separated output streams from a, b, sum, diff,\n\
+      beam0, and beam1 (default=a,b). Selected streams appear in each\n\
+      frame in that order as I, Q pairs.\n\
+  -r rate: Resample both tuners to the specified output rate in Hz\n\
+      (e.g. 250k), which lengthens the window for the same memory.\n\
+      By default no resampling is done.\n\
+  -F freq: Shift the signal at freq Hz from the tuning frequency\n\
+      to 0 Hz with a phase continuous NCO\n\
+  -I: Remove the DC offset and I/Q gain and phase imbalance of each\n\
+      tuner with slowly adapting estimators (default=off)\n\
+  -b bytes: Memory for the window of samples (default=256M).\n\
+      Can be specified with k, K, m, M, g, or G suffix to indicate\n\
+      the value is in KiB, MiB, or GiB respectively. A small part\n\
+      is kept as headroom for the stream while a dump is written.\n\
+  -u port: Listen for dump commands on this UDP port of 127.0.0.1\n\
+      (default=disabled)\n\
+  -S: Write a SigMF recording (prefix_time.sigmf-data and\n\
+      .sigmf-meta) instead of a WAV file\n\
+  -R priority: Run the threads that process samples with SCHED_FIFO\n\
+      real-time scheduling at priority 1-99. Usually requires root,\n\
+      CAP_SYS_NICE, or an rtprio limit. Settings that cannot be\n\
+      applied are reported and capture continues without them.\n\
+  -C cpus: Pin the threads that process samples to the comma\n\
+      separated CPUs or ranges of CPUs (e.g. 2,3 or 2-3)\n\
+  -L: Lock the process memory into RAM and write every sample\n\
+      buffer once before streaming starts\n\
+  -k: Use USB bulk transfer mode instead of isochronous\n\
+  -x: Use the maximum 8 MHz master sample rate.\n\
+      This will deliver 12 bit ADC resolution, but with slightly \n\
+      better anti-aliaising performance at the widest bandwidth.\n\
+      This mode is only available at 1.536 MHz analog bandwidth.\n\
+      The default mode is to use a 6 MHz master sample clock.\n\
+      That mode delivers 14 bit ADC resolution, but with slightly\n\
+      inferior anti-aliaising performance at the widest bandwidth.\n\
+      The default mode is also compatible with analog bandwidths of\n\
+      1.536 MHz, 600 kHz, 300 kHz, and 200 kHz. 6 MHz operation\n\
+      should result in a slightly lower CPU load.\n\
+\n\
+Arguments:\n\
+  freq: Tuner RF frequency in Hz is mandatory.\n\
+      Can be specified with k, K, m, M, g, or G suffix to indicate\n\
+      the value is in kHz, MHz, or GHz respectively (e.g. 1.42G)\n\
+  [prefix]: Start of each dump file name, followed by the UTC time\n\
+      of the request (default=rewind)\n\
+\n";
+
+
+// Approximate size of each chunk of the window
+#define CHUNK_BYTES (1024 * 1024)
+
+#define MAX_PATH_LEN (1024)
+
+
+/**
+* Rolling window of transfers in fixed size chunks.
+* The stream thread copies each transfer into the chunk being filled
+* without locking, and only takes the lock to publish the new fill
+* level. The writer thread copies one chunk at a time out under the
+* lock and writes it to disk without it, so the stream never waits on
+* the disk. Chunks are numbered from the start of the capture and
+* chunk c is held in slot c % numChunks until chunk c + numChunks
+* replaces it.
+*/
+struct Rewind {
+    uint8_t* data;
+    size_t chunkBytes;
+    unsigned int numChunks;
+    // chunks dumped, the remaining chunks are headroom for the stream
+    unsigned int windowChunks;
+    // chunk being filled and bytes filled, both only change under the lock
+    uint64_t head;
+    size_t fill;
+    DuoMutex lock;
+    DuoCond cond;
+    DuoThread writer;
+    // requested dump from chunk dumpStart to the first dumpFill bytes of chunk dumpEnd
+    bool dumpRequested;
+    bool dumping;
+    uint64_t dumpStart;
+    uint64_t dumpEnd;
+    size_t dumpFill;
+    time_t dumpTime;
+    bool stop;
+    // private copy of the chunk being written
+    uint8_t* chunk;
+};
+
+
+struct Context {
+    struct Rewind rewind;
+    // output description
+    const char* prefix;
+    bool sigmf;
+    enum DuoEngineFormat format;
+    struct WavHeader wav;
+    size_t frameBytes;
+    double sampleRate;
+    double centerFreq;
+    unsigned int numStreams;
+    const char* streams;
+    unsigned int numDumps;
+#if defined(_WIN32) || (_WIN64)
+    SOCKET sock;
+#else
+    int sock;
+#endif
+    bool done;
+};
+
+
+#if !defined(_WIN32) && !defined(_WIN64)
+static volatile sig_atomic_t dumpSignal = 0;
+
+
+static void signalHandler(int sig) {
+    dumpSignal = 1;
+}
+#endif
+
+
+static void transferCallback(struct DuoEngineTransfer* transfer, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    struct Rewind* rewind = &context->rewind;
+    uint8_t* slot = rewind->data + (rewind->head % rewind->numChunks) * rewind->chunkBytes;
+    // Chunks hold a whole number of transfers
+    memcpy(slot + rewind->fill, transfer->data, transfer->numBytes);
+    duoMutexLock(&rewind->lock);
+    rewind->fill += transfer->numBytes;
+    if (rewind->fill + transfer->numBytes > rewind->chunkBytes) {
+        rewind->head++;
+        rewind->fill = 0;
+    }
+    duoMutexUnlock(&rewind->lock);
+}
+
+
+/**
+* Mark a dump of the current window for the writer thread
+*/
+static void requestDump(struct Context* context) {
+    struct Rewind* rewind = &context->rewind;
+    duoMutexLock(&rewind->lock);
+    if (rewind->dumpRequested || rewind->dumping) {
+        printf("dump already in progress\n");
+    }
+    else {
+        rewind->dumpEnd = rewind->head;
+        rewind->dumpFill = rewind->fill;
+        rewind->dumpStart = 0;
+        if (rewind->head >= rewind->windowChunks) {
+            rewind->dumpStart = rewind->head - rewind->windowChunks + 1;
+        }
+        rewind->dumpTime = time(NULL);
+        rewind->dumpRequested = true;
+        duoCondBroadcast(&rewind->cond);
+    }
+    duoMutexUnlock(&rewind->lock);
+}
+
+
+/**
+* Write the SigMF metadata of a dump
+*
+* @return zero on success, non-zero otherwise
+*/
+static int writeMeta(struct Context* context, const char* path, time_t start) {
+    const char* datatype = "ci16_le";
+    if (context->format == DUO_FORMAT_FLOAT32) {
+        datatype = "cf32_le";
+    }
+    else if (context->format == DUO_FORMAT_INT8) {
+        datatype = "ci8";
+    }
+    char datetime[32];
+    strftime(datetime, sizeof(datetime), "%Y-%m-%dT%H:%M:%SZ", gmtime(&start));
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        perror(path);
+        return 1;
+    }
+    fprintf(out,
+            "{\n"
+            "    \"global\": {\n"
+            "        \"core:datatype\": \"%s\",\n"
+            "        \"core:sample_rate\": %.1f,\n"
+            "        \"core:num_channels\": %u,\n"
+            "        \"core:version\": \"1.0.0\",\n"
+            "        \"core:recorder\": \"DuoRewind\",\n"
+            "        \"core:description\": \"RSPduo streams %s interleaved\"\n"
+            "    },\n"
+            "    \"captures\": [\n"
+            "        {\n"
+            "            \"core:sample_start\": 0,\n"
+            "            \"core:frequency\": %.1f,\n"
+            "            \"core:datetime\": \"%s\"\n"
+            "        }\n"
+            "    ],\n"
+            "    \"annotations\": []\n"
+            "}\n",
+            datatype, context->sampleRate, context->numStreams, context->streams,
+            context->centerFreq, datetime);
+    if (fclose(out) != 0) {
+        perror(path);
+        return 1;
+    }
+    return 0;
+}
+
+
+/**
+* Write the requested window to a new file. Chunks are copied under the
+* lock one at a time and checked against the stream, which may have
+* replaced the oldest chunks if the disk is slower than the stream.
+*/
+static void writeDump(struct Context* context) {
+    struct Rewind* rewind = &context->rewind;
+    char stamp[32];
+    char path[MAX_PATH_LEN];
+    char metaPath[MAX_PATH_LEN];
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", gmtime(&rewind->dumpTime));
+    snprintf(path, sizeof(path), "%s_%s.%s",
+             context->prefix, stamp, context->sigmf ? "sigmf-data" : "wav");
+    context->numDumps++;
+
+    FILE* out = fopen(path, "wb");
+    if (out == NULL) {
+        perror(path);
+        return;
+    }
+    size_t bytesWritten = 0;
+    bool failed = !context->sigmf && fwrite(&context->wav, sizeof(context->wav), 1, out) != 1;
+    bool truncated = false;
+    for (uint64_t idx = rewind->dumpStart; idx <= rewind->dumpEnd && !failed; idx++) {
+        size_t numBytes = idx == rewind->dumpEnd ? rewind->dumpFill : rewind->chunkBytes;
+        duoMutexLock(&rewind->lock);
+        if (idx + rewind->numChunks <= rewind->head) {
+            truncated = true;
+        }
+        else {
+            memcpy(rewind->chunk, rewind->data + (idx % rewind->numChunks) * rewind->chunkBytes, numBytes);
+        }
+        duoMutexUnlock(&rewind->lock);
+        if (truncated) {
+            break;
+        }
+        if (!context->sigmf && context->format == DUO_FORMAT_INT8) {
+            // WAV 8-bit samples are unsigned with 128 as zero
+            for (size_t byteIdx = 0; byteIdx < numBytes; byteIdx++) {
+                rewind->chunk[byteIdx] ^= 0x80;
+            }
+        }
+        if (fwrite(rewind->chunk, 1, numBytes, out) != numBytes) {
+            failed = true;
+        }
+        bytesWritten += numBytes;
+    }
+    if (!context->sigmf && !failed) {
+        struct WavHeader wav = context->wav;
+        wavHeaderUpdate(&wav, (uint32_t)bytesWritten);
+        if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&wav, sizeof(wav), 1, out) != 1) {
+            failed = true;
+        }
+    }
+    if (fclose(out) != 0) {
+        failed = true;
+    }
+
+    double seconds = bytesWritten / context->frameBytes / context->sampleRate;
+    if (context->sigmf && !failed) {
+        snprintf(metaPath, sizeof(metaPath), "%s_%s.sigmf-meta", context->prefix, stamp);
+        failed = writeMeta(context, metaPath, rewind->dumpTime - (time_t)(seconds + 0.5)) != 0;
+    }
+    if (failed) {
+        printf("Dump %u: failed to write %s\n", context->numDumps, path);
+    }
+    else {
+        printf("Dump %u: wrote %.1f seconds (%zu bytes) to %s\n",
+               context->numDumps, seconds, bytesWritten, path);
+    }
+    if (truncated) {
+        printf("Dump %u: the disk fell behind the stream, newer samples were dropped\n",
+               context->numDumps);
+    }
+}
+
+
+static void writerThread(void* arg) {
+    struct Context* context = (struct Context*)arg;
+    struct Rewind* rewind = &context->rewind;
+    duoMutexLock(&rewind->lock);
+    while (true) {
+        if (rewind->dumpRequested) {
+            rewind->dumpRequested = false;
+            rewind->dumping = true;
+            duoMutexUnlock(&rewind->lock);
+            writeDump(context);
+            duoMutexLock(&rewind->lock);
+            rewind->dumping = false;
+            continue;
+        }
+        if (rewind->stop) {
+            break;
+        }
+        duoCondWait(&rewind->cond, &rewind->lock);
+    }
+    duoMutexUnlock(&rewind->lock);
+}
+
+
+/**
+* True if a dump command arrived on the command socket
+*/
+static bool pollCommand(struct Context* context) {
+    if (context->sock == INVALID_SOCKET) {
+        return false;
+    }
+    bool dump = false;
+    while (true) {
+        fd_set readSet;
+        struct timeval timeout = {0, 0};
+        FD_ZERO(&readSet);
+        FD_SET(context->sock, &readSet);
+        if (select((int)context->sock + 1, &readSet, NULL, NULL, &timeout) <= 0) {
+            break;
+        }
+        char msg[64];
+        int len = recv(context->sock, msg, sizeof(msg) - 1, 0);
+        if (len <= 0) {
+            break;
+        }
+        msg[len] = 0;
+        if (strncmp(msg, "dump", 4) == 0) {
+            dump = true;
+        }
+        else {
+            printf("unknown command [%s]\n", msg);
+        }
+    }
+    return dump;
+}
+
+
+static int controlCallback(struct DuoEngineControl* control, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    bool dump = pollCommand(context);
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (dumpSignal) {
+        dumpSignal = 0;
+        dump = true;
+    }
+#endif
+    if (_kbhit()) {
+        char ctrl = _getch();
+        if (ctrl == 'q') {
+            context->done = true;
+            return 1;
+        }
+        if (ctrl == 'd') {
+            dump = true;
+        }
+    }
+    if (dump) {
+        requestDump(context);
+    }
+    if (context->done) {
+        return 1;
+    }
+    return 0;
+}
+
+
+static void messageCallback(const char* msg, void* userContext) {
+    printf("%s\n", msg);
+}
+
+
+static void usage(void) {
+    printf(USAGE);
+}
+
+
+int main(int argc, char** argv) {
+    char opt = 0;
+    char defaultPrefix[] = "rewind";
+    char defaultOutput[] = "a,b";
+    size_t budget = 256 * 1024 * 1024;
+    unsigned int port = 0;
+
+    struct DuoEngine engine;
+    duoEngineInit(&engine);
+
+    struct Context context;
+    memset(&context, 0, sizeof(context));
+    context.prefix = defaultPrefix;
+    context.streams = defaultOutput;
+    context.sock = INVALID_SOCKET;
+    struct Rewind* rewind = &context.rewind;
+
+    while ((opt = getopt(argc, argv, "ha:t:l:d:n:s:c:r:F:Ib:u:SR:C:Lkx")) != -1) {
+        switch (opt) {
+        case 'a':
+            if (parseAgcBandwidth(optarg, &engine.agcBandwidth)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            if (parseAgcSetPoint(optarg, &engine.agcSetPoint)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'l':
+            if (parseLnaState(optarg, &engine.lnaState)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'd':
+            if (parseDecimFactor(optarg, &engine.decimFactor)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            if (parseNotchFilter(optarg, &engine.notchMwfm, &engine.notchDab)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            if (parseSampleFormat(optarg, &engine.format)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            if (engine.format != DUO_FORMAT_INT16 && engine.format != DUO_FORMAT_FLOAT32 &&
+                engine.format != DUO_FORMAT_INT8) {
+                printf("sample format must be int16, float32, or int8\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            if (parseOutputMask(optarg, &engine.outputMask)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            context.streams = optarg;
+            break;
+        case 'r':
+            if (parseSampleRate(optarg, &engine.outputRate)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'F':
+            if (parseFrequency(optarg, &engine.shiftFreq)) {
+                printf("invalid frequency shift argument\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'I':
+            engine.iqCorrection = true;
+            break;
+        case 'b':
+            if (parseSize(optarg, &budget)) {
+                printf("invalid memory size argument\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'u':
+            if (parseUintArg(optarg, &port, 10) || port == 0 || port > 65535) {
+                printf("invalid UDP port, must be in [1-65535]\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S':
+            context.sigmf = true;
+            break;
+        case 'R':
+            if (parseRealtimePriority(optarg, &engine.schedPriority)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            engine.schedPolicy = DUO_SCHED_FIFO;
+            break;
+        case 'C':
+            if (parseCpuList(optarg, &engine.streamCpus)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'L':
+            engine.lockMemory = true;
+            engine.prefault = true;
+            break;
+        case 'k':
+            engine.usbBulkMode = true;
+            break;
+        case 'x':
+            engine.maxSampleRate = true;
+            break;
+        case 'h':
+            usage();
+            return EXIT_SUCCESS;
+        default:
+            printf("unrecognized option\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Handle remaining positional arguments
+    if (optind == (argc - 1) || optind == (argc - 2)) {
+        if (parseFrequency(argv[optind], &engine.tuneFreq)) {
+            printf("invalid frequency argument\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+        if (optind == (argc - 2)) {
+            context.prefix = argv[optind + 1];
+        }
+    }
+    else {
+        printf("invalid number of arguments\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    context.format = duoEngineFormat(&engine);
+    context.numStreams = duoEngineNumStreams(duoEngineOutputMask(&engine));
+    context.frameBytes = (size_t)duoEngineFormatBits(context.format) * 2 * context.numStreams / 8;
+    context.sampleRate = duoEngineSampleRate(&engine);
+    context.centerFreq = (double)engine.tuneFreq + engine.shiftFreq;
+    size_t transferBytes = duoEngineTransferFrames(&engine) * context.frameBytes;
+
+    // Whole transfers in each chunk, with at least two chunks of headroom
+    rewind->chunkBytes = CHUNK_BYTES - CHUNK_BYTES % transferBytes;
+    if (rewind->chunkBytes == 0) {
+        rewind->chunkBytes = transferBytes;
+    }
+    rewind->numChunks = (unsigned int)(budget / rewind->chunkBytes);
+    unsigned int headroom = rewind->numChunks / 16;
+    if (headroom < 2) {
+        headroom = 2;
+    }
+    if (rewind->numChunks < headroom + 1) {
+        printf("memory size too small, must be at least %zu bytes\n",
+               (headroom + 1) * rewind->chunkBytes);
+        usage();
+        return EXIT_FAILURE;
+    }
+    rewind->windowChunks = rewind->numChunks - headroom;
+    double windowSeconds = (double)rewind->windowChunks * rewind->chunkBytes /
+                           context.frameBytes / context.sampleRate;
+    if (!context.sigmf && (double)rewind->windowChunks * rewind->chunkBytes > UINT32_MAX) {
+        printf("WAV file only supports file sizes <= 4 GiB, use -S or reduce -b\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    printf("RF Tune Frequency: %f Hz\n", engine.tuneFreq);
+    printf("AGC Loop Bandwidth: %u Hz\n", engine.agcBandwidth);
+    if (engine.agcBandwidth > 0) {
+        printf("AGC Set Point: %d dBFS\n", engine.agcSetPoint);
+    }
+    printf("LNA State: %u\n", engine.lnaState);
+    printf("Decimation Factor: %u\n", engine.decimFactor);
+    printf("Sample Rate: %.0f Hz\n", context.sampleRate);
+    if (engine.shiftFreq != 0.0f) {
+        printf("Frequency Shift: %.0f Hz\n", engine.shiftFreq);
+    }
+    printf("IQ Correction: %s\n", engine.iqCorrection ? "true" : "false");
+    printf("Sample Format: %s\n", duoEngineFormatName(context.format));
+    printf("Output Streams: %s\n", context.streams);
+    printf("USB Bulk Mode: %s\n", engine.usbBulkMode ? "true" : "false");
+    printf("Real-time Priority: %d\n", engine.schedPolicy == DUO_SCHED_FIFO ? engine.schedPriority : 0);
+    printf("CPU Mask: 0x%llx\n", engine.streamCpus);
+    printf("Lock Memory: %s\n", engine.lockMemory ? "true" : "false");
+    printf("Max Fs Mode: %s\n", engine.maxSampleRate ? "true" : "false");
+    printf("Memory: %zu bytes\n", (size_t)rewind->numChunks * rewind->chunkBytes);
+    printf("Window: %.1f seconds\n", windowSeconds);
+    printf("Output Format: %s\n", context.sigmf ? "SigMF" : "WAV");
+    printf("Output Prefix: %s\n", context.prefix);
+    if (port) {
+        printf("Command Port: %u\n", port);
+    }
+
+    wavHeaderInit(
+        &context.wav, (uint32_t)context.sampleRate, (uint16_t)(2 * context.numStreams),
+        (uint8_t)(duoEngineFormatBits(context.format) / 8),
+        context.format == DUO_FORMAT_FLOAT32);
+
+    // Touch every page now so the stream never waits on the first use of one
+    rewind->data = (uint8_t*)malloc((size_t)rewind->numChunks * rewind->chunkBytes);
+    rewind->chunk = (uint8_t*)malloc(rewind->chunkBytes);
+    if (rewind->data == NULL || rewind->chunk == NULL) {
+        printf("failed to allocate %zu bytes for the window\n",
+               (size_t)rewind->numChunks * rewind->chunkBytes);
+        return EXIT_FAILURE;
+    }
+    memset(rewind->data, 0, (size_t)rewind->numChunks * rewind->chunkBytes);
+
+    int rcode = 0;
+    if (port) {
+#if defined(_WIN32) || (_WIN64)
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 0), &wsaData) != 0) {
+            printf("WSAStartup() failed");
+            rcode = 1;
+        }
+#endif
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        addr.sin_port = htons((unsigned short)port);
+        if (rcode == 0 && (context.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
+            printf("socket creation failed\n");
+            rcode = 1;
+        }
+        else if (rcode == 0 && bind(context.sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            printf("failed to bind command port %u\n", port);
+            rcode = 1;
+        }
+    }
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    signal(SIGUSR1, signalHandler);
+#endif
+
+    duoMutexInit(&rewind->lock);
+    duoCondInit(&rewind->cond);
+    if (rcode == 0 && duoThreadCreate(&rewind->writer, writerThread, &context)) {
+        printf("failed to start writer thread\n");
+        rcode = 1;
+    }
+
+    if (rcode == 0) {
+        engine.userContext = &context;
+        engine.transferCallback = transferCallback;
+        engine.controlCallback = controlCallback;
+        engine.messageCallback = messageCallback;
+
+        printf("PRESS d to DUMP, q to QUIT\n");
+        rcode = duoEngineRun(&engine);
+
+        // Let a dump in progress finish
+        duoMutexLock(&rewind->lock);
+        rewind->stop = true;
+        duoCondBroadcast(&rewind->cond);
+        duoMutexUnlock(&rewind->lock);
+        duoThreadJoin(rewind->writer);
+        printf("Dumps: %u\n", context.numDumps);
+    }
+
+    if (context.sock != INVALID_SOCKET) {
+#if defined(_WIN32) || defined(_WIN64)
+        closesocket(context.sock);
+#else
+        close(context.sock);
+#endif
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    if (port) {
+        WSACleanup();
+    }
+#endif
+    duoCondDestroy(&rewind->cond);
+    duoMutexDestroy(&rewind->lock);
+    free(rewind->data);
+    free(rewind->chunk);
+
+    return rcode == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
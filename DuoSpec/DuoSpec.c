@@ -0,0 +1,472 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#include <conio.h>
+#include "windows_getopt.h"
+#else
+#include <unistd.h>
+#include <getopt.h>
+#include "posix_conio.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_AGC_BANDWIDTH (5)
+
+#include "DuoEngine.h"
+#include "DuoParse.h"
+#include "spec.h"
+
+
+static const char* USAGE = "\
+Usage: DuoSpec.exe [-h] [-a agchz] [-t agcdb] [-l lna] [-d decim] [-n notch]\n\
+                   [-w warmup] [-N fftsize] [-W window] [-C] [-T seconds]\n\
+                   [-o path] [-p seconds] [-R] [-f offfreq] [-s seconds]\n\
+                   [-b ms] [-k] [-x] freq\n\
+\n\
+Long-integration spectrometer. Accumulates the power spectrum of both\n\
+tuners (and optionally their cross spectrum) in double precision and\n\
+periodically checkpoints the accumulators to a file.\n\
+\n\
+Options:\n\
+  -h: print this help message\n\
+  -a 0|5|50|100: AGC loop bandwidth in Hz (default=5)\n\
+      Consider disabling the AGC (-a 0) for calibrated integrations.\n\
+  -t [-72-0]: AGC set point in dBFS (default=-30)\n\
+  -l 0-9: LNA state where 0 provides the least RF gain reduction.\n\
+      Default value is 4 (20-37 dB reduction depending on frequency).\n\
+  -d 1|2|4|8|16|32: Decimation factor (default=1)\n\
+      For factors 4, 8, 16, and 32, the analog bandwidth will \n\
+      be reduced to 600, 300, 200, and 200 kHz respectively unless \n\
+      the -x option is also specified. In which case the analog \n\
+      bandwidth remains 1.536 MHz.\n\
+  -n mwfm|dab: Enable MW/FM or DAB notch filter\n\
+      Both filters can be enabled by providing the -n option twice\n\
+      (once for each filter). By default, both filters are disabled.\n\
+  -w seconds: Run the radio for the specified number of seconds to\n\
+      warm up and stabilize performance before integrating (default=2).\n\
+      During the warmup period, samples are discarded.\n\
+  -N fftsize: FFT size, a power of two >= 8 (default=1024)\n\
+  -W rect|hann|hamming|blackman: Window function (default=hann)\n\
+  -C: Also accumulate the cross spectrum B * conj(A)\n\
+  -T seconds: Stop after integrating the specified number of seconds\n\
+      of samples, on and off combined (default=0, run until q is pressed)\n\
+  -o path: Checkpoint file (default=spectrum.dspc)\n\
+  -p seconds: Checkpoint interval (default=60)\n\
+  -R: Resume the integration from an existing checkpoint file\n\
+  -f offfreq: Enable frequency switching. The tuners alternate between\n\
+      freq (on) and offfreq (off), accumulating each separately.\n\
+      Accepts the same suffixes as freq.\n\
+  -s seconds: Integration time at each frequency before switching\n\
+      (default=10)\n\
+  -b ms: Samples discarded after each retune while the tuners\n\
+      settle (default=250)\n\
+  -k: Use USB bulk transfer mode instead of isochronous\n\
+  -x: Use the maximum 8 MHz master sample rate.\n\
+      This will deliver 12 bit ADC resolution, but with slightly \n\
+      better anti-aliaising performance at the widest bandwidth.\n\
+      This mode is only available at 1.536 MHz analog bandwidth.\n\
+      The default mode is to use a 6 MHz master sample clock.\n\
+      That mode delivers 14 bit ADC resolution, but with slightly\n\
+      inferior anti-aliaising performance at the widest bandwidth.\n\
+      The default mode is also compatible with analog bandwidths of\n\
+      1.536 MHz, 600 kHz, 300 kHz, and 200 kHz. 6 MHz operation\n\
+      should result in a slightly lower CPU load.\n\
+\n\
+Arguments:\n\
+  freq: Tuner RF frequency in Hz is mandatory.\n\
+      Can be specified with k, K, m, M, g, or G suffix to indicate\n\
+      the value is in kHz, MHz, or GHz respectively (e.g. 1.42G)\n\
+\n";
+
+
+struct Context {
+    struct DuoSpec spec;
+    struct DuoSpecFileHeader head;
+    char* path;
+    float sampleRate;
+    // on and off tuning frequencies
+    float freq[2];
+    bool switched;
+    // accumulators receiving samples, DUO_SPEC_ON or DUO_SPEC_OFF
+    volatile int which;
+    // set by the transfer callback to request a retune to the other frequency
+    volatile bool retunePending;
+    // set by the control callback once the retune has been requested
+    volatile bool retuned;
+    uint64_t dwellFrames;
+    uint64_t dwellLeft;
+    uint64_t blankFrames;
+    uint64_t blankLeft;
+    // total segments to integrate, zero to run until stopped
+    uint64_t maxSpectra;
+    unsigned int checkpointSec;
+    time_t nextCheckpoint;
+    time_t startTime;
+    bool started;
+    volatile bool done;
+};
+
+
+/**
+* Save the accumulators and report progress
+*/
+static void checkpoint(struct Context* context) {
+    struct DuoSpec* spec = &context->spec;
+    double segmentSec = spec->fftSize / context->sampleRate;
+    if (duoSpecSave(spec, context->path, &context->head)) {
+        printf("failed to write checkpoint %s\n", context->path);
+        return;
+    }
+    if (context->switched) {
+        printf("checkpoint on=%.1f s off=%.1f s\n",
+               spec->accum[DUO_SPEC_ON].numSpectra * segmentSec,
+               spec->accum[DUO_SPEC_OFF].numSpectra * segmentSec);
+    }
+    else {
+        printf("checkpoint integrated=%.1f s\n",
+               spec->accum[DUO_SPEC_ON].numSpectra * segmentSec);
+    }
+}
+
+
+static void transferCallback(struct DuoEngineTransfer* transfer, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    struct DuoSpec* spec = &context->spec;
+    if (!context->started) {
+        if (time(NULL) >= context->startTime) {
+            context->started = true;
+            context->nextCheckpoint = time(NULL) + context->checkpointSec;
+        }
+        return;
+    }
+    if (context->done) {
+        return;
+    }
+
+    if (context->retunePending) {
+        // Discard samples until the retune has been issued and settled
+        if (!context->retuned) {
+            return;
+        }
+        if (context->blankLeft > transfer->numFrames) {
+            context->blankLeft -= transfer->numFrames;
+            return;
+        }
+        context->which ^= 1;
+        context->dwellLeft = context->dwellFrames;
+        context->retuned = false;
+        context->retunePending = false;
+        return;
+    }
+
+    duoSpecPush(spec, (const float*)transfer->data, transfer->numFrames, context->which);
+
+    if (context->switched) {
+        if (context->dwellLeft > transfer->numFrames) {
+            context->dwellLeft -= transfer->numFrames;
+        }
+        else {
+            duoSpecDiscard(spec);
+            context->blankLeft = context->blankFrames;
+            context->retunePending = true;
+        }
+    }
+
+    if (context->maxSpectra &&
+        spec->accum[0].numSpectra + spec->accum[1].numSpectra >= context->maxSpectra) {
+        context->done = true;
+    }
+    else if (time(NULL) >= context->nextCheckpoint) {
+        // Written from the streaming thread so the accumulators are consistent
+        checkpoint(context);
+        context->nextCheckpoint = time(NULL) + context->checkpointSec;
+    }
+}
+
+
+static int controlCallback(struct DuoEngineControl* control, void* userContext) {
+    struct Context* context = (struct Context*)userContext;
+    if (_kbhit()) {
+        char ctrl = _getch();
+        if (ctrl == 'q') {
+            context->done = true;
+            return 1;
+        }
+    }
+    if (context->done) {
+        return 1;
+    }
+    if (context->retunePending && !context->retuned) {
+        // DuoEngine applies the change after this returns, the blank
+        // period covers the time until the tuners have moved
+        control->tuneFreq = context->freq[context->which ^ 1];
+        context->retuned = true;
+    }
+    return 0;
+}
+
+
+static void messageCallback(const char* msg, void* userContext) {
+    printf("%s\n", msg);
+}
+
+
+static void usage(void) {
+    printf(USAGE);
+}
+
+
+int main(int argc, char** argv) {
+    char opt = 0;
+    unsigned int fftSize = 1024;
+    enum DuoWindow window = DUO_WINDOW_HANN;
+    bool cross = false;
+    unsigned int warmup = 2;
+    unsigned int totalSec = 0;
+    unsigned int dwellSec = 10;
+    unsigned int blankMs = 250;
+    bool resume = false;
+    char defaultPath[] = "spectrum.dspc";
+    int rcode = 0;
+
+    struct DuoEngine engine;
+    duoEngineInit(&engine);
+
+    struct Context context;
+    memset(&context, 0, sizeof(context));
+    context.path = defaultPath;
+    context.checkpointSec = 60;
+
+    while ((opt = getopt(argc, argv, "ha:t:l:d:n:w:N:W:CT:o:p:Rf:s:b:kx")) != -1) {
+        switch (opt) {
+        case 'a':
+            if (parseAgcBandwidth(optarg, &engine.agcBandwidth)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            if (parseAgcSetPoint(optarg, &engine.agcSetPoint)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'l':
+            if (parseLnaState(optarg, &engine.lnaState)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'd':
+            if (parseDecimFactor(optarg, &engine.decimFactor)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            if (parseNotchFilter(optarg, &engine.notchMwfm, &engine.notchDab)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'w':
+            if (parseUintArg(optarg, &warmup, 10)) {
+                printf("invalid warmup time, must be an unsigned int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            if (parseUintArg(optarg, &fftSize, 10) || fftSize < 8 || !duoFFTValidSize(fftSize)) {
+                printf("invalid FFT size, must be a power of two >= 8\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'W':
+            if (duoFFTWindowFromName(optarg, &window)) {
+                printf("invalid window [%s]\n", optarg);
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'C':
+            cross = true;
+            break;
+        case 'T':
+            if (parseUintArg(optarg, &totalSec, 10)) {
+                printf("invalid integration time, must be an unsigned int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'o':
+            context.path = optarg;
+            break;
+        case 'p':
+            if (parseUintArg(optarg, &context.checkpointSec, 10) || context.checkpointSec == 0) {
+                printf("invalid checkpoint interval, must be a positive int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'R':
+            resume = true;
+            break;
+        case 'f':
+            if (parseFrequency(optarg, &context.freq[DUO_SPEC_OFF])) {
+                printf("invalid off frequency\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            context.switched = true;
+            break;
+        case 's':
+            if (parseUintArg(optarg, &dwellSec, 10) || dwellSec == 0) {
+                printf("invalid switching time, must be a positive int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b':
+            if (parseUintArg(optarg, &blankMs, 10)) {
+                printf("invalid blanking time, must be an unsigned int\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'k':
+            engine.usbBulkMode = true;
+            break;
+        case 'x':
+            engine.maxSampleRate = true;
+            break;
+        case 'h':
+            usage();
+            return EXIT_SUCCESS;
+        default:
+            printf("unrecognized option\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Handle remaining positional arguments
+    if (optind == (argc - 1)) {
+        if (parseFrequency(argv[optind], &engine.tuneFreq)) {
+            printf("invalid frequency argument\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        printf("invalid number of arguments\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    context.sampleRate = (float)duoEngineSampleRate(&engine);
+    context.freq[DUO_SPEC_ON] = engine.tuneFreq;
+    context.dwellFrames = (uint64_t)dwellSec * (uint64_t)context.sampleRate;
+    context.dwellLeft = context.dwellFrames;
+    context.blankFrames = (uint64_t)blankMs * (uint64_t)context.sampleRate / 1000;
+    context.maxSpectra = (uint64_t)((double)totalSec * context.sampleRate / fftSize);
+
+    context.head.flags = context.switched ? DUO_SPEC_SWITCHED : 0;
+    context.head.sampleRate = context.sampleRate;
+    context.head.freq[DUO_SPEC_ON] = context.freq[DUO_SPEC_ON];
+    context.head.freq[DUO_SPEC_OFF] = context.freq[DUO_SPEC_OFF];
+
+    printf("RF Tune Frequency: %f Hz\n", engine.tuneFreq);
+    if (context.switched) {
+        printf("Off Frequency: %f Hz\n", context.freq[DUO_SPEC_OFF]);
+        printf("Switching Time: %u seconds\n", dwellSec);
+        printf("Settling Time: %u ms\n", blankMs);
+    }
+    printf("AGC Loop Bandwidth: %u Hz\n", engine.agcBandwidth);
+    if (engine.agcBandwidth > 0) {
+        printf("AGC Set Point: %d dBFS\n", engine.agcSetPoint);
+    }
+    printf("Warmup: %u seconds\n", warmup);
+    printf("LNA State: %u\n", engine.lnaState);
+    printf("Decimation Factor: %u\n", engine.decimFactor);
+    printf("USB Bulk Mode: %s\n", engine.usbBulkMode ? "true" : "false");
+    printf("Max Fs Mode: %s\n", engine.maxSampleRate ? "true" : "false");
+    printf("Sample Rate: %.0f Hz\n", context.sampleRate);
+    printf("FFT Size: %u\n", fftSize);
+    printf("Resolution Bandwidth: %.1f Hz\n", context.sampleRate / fftSize);
+    printf("Window: %s\n", duoFFTWindowName(window));
+    printf("Cross Spectrum: %s\n", cross ? "true" : "false");
+    if (totalSec > 0) {
+        printf("Integration Time: %u seconds\n", totalSec);
+    }
+    printf("Checkpoint File: %s\n", context.path);
+    printf("Checkpoint Interval: %u seconds\n", context.checkpointSec);
+
+    if (duoSpecInit(&context.spec, fftSize, window, cross, context.sampleRate)) {
+        printf("failed to initialize spectrometer\n");
+        return EXIT_FAILURE;
+    }
+
+    if (resume) {
+        struct DuoSpecFileHeader saved;
+        if (duoSpecLoad(&context.spec, context.path, &saved) ||
+            saved.flags != (context.head.flags | (cross ? DUO_SPEC_CROSS : 0)) ||
+            saved.freq[DUO_SPEC_ON] != context.head.freq[DUO_SPEC_ON] ||
+            saved.freq[DUO_SPEC_OFF] != context.head.freq[DUO_SPEC_OFF]) {
+            printf("cannot resume from %s, the file is missing or its settings differ\n",
+                   context.path);
+            duoSpecFree(&context.spec);
+            return EXIT_FAILURE;
+        }
+        printf("Resumed Spectra: %llu on, %llu off\n",
+               (unsigned long long)saved.numSpectra[DUO_SPEC_ON],
+               (unsigned long long)saved.numSpectra[DUO_SPEC_OFF]);
+    }
+
+    // The spectrometer works on interleaved floating point frames
+    engine.format = DUO_FORMAT_FLOAT32;
+    engine.userContext = &context;
+    engine.transferCallback = transferCallback;
+    engine.controlCallback = controlCallback;
+    engine.messageCallback = messageCallback;
+
+    // Configure warmup start time if needed
+    context.started = false;
+    context.startTime = time(NULL) + warmup;
+
+    printf("PRESS q to QUIT\n");
+    rcode = duoEngineRun(&engine);
+
+    // Streaming has stopped so the final checkpoint is consistent
+    checkpoint(&context);
+    duoSpecFree(&context.spec);
+
+    return rcode == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,418 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef SPEC_H
+#define SPEC_H
+
+/**
+* Long-integration spectrometer accumulators for the two tuners.
+*
+* Each tuner is split into consecutive, non-overlapping windowed
+* segments of N frames. The power spectrum of every segment (and
+* optionally the cross spectrum B * conj(A)) is added to double
+* precision accumulators, so integrations of hours do not lose
+* precision the way float sums would.
+*
+* Two sets of accumulators are kept so frequency-switched observations
+* can integrate the "on" and "off" frequencies separately.
+*
+* Accumulators are held in centered order (bin N/2 is the tuning
+* frequency) and are saved verbatim in checkpoint files, see
+* struct DuoSpecFileHeader.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#endif
+
+#include "DuoFFT.h"
+
+
+#define DUO_SPEC_VERSION (1)
+
+// DuoSpecFileHeader flag set when the cross spectrum is accumulated
+#define DUO_SPEC_CROSS (0x1)
+// DuoSpecFileHeader flag set when the off accumulators are present
+#define DUO_SPEC_SWITCHED (0x2)
+
+// Index of the accumulators for the tuning and reference frequencies
+#define DUO_SPEC_ON (0)
+#define DUO_SPEC_OFF (1)
+
+
+/**
+* Header of a DuoSpec checkpoint file.
+* Followed by the on accumulators and then, if DUO_SPEC_SWITCHED is
+* set, the off accumulators. Each set is fftSize doubles of tuner A
+* power, fftSize doubles of tuner B power and, if DUO_SPEC_CROSS is
+* set, fftSize doubles each of the cross spectrum real and imaginary
+* parts. Bins are centered so bin fftSize/2 is the tuning frequency.
+* All values are in the byte order of the writing machine.
+*
+* The mean power spectral density in full scale squared per Hz is
+* sum * densityScale / numSpectra.
+*/
+struct DuoSpecFileHeader {
+    // "DSPC"
+    int8_t magic[4];
+    uint32_t version;
+    uint32_t fftSize;
+    uint32_t flags;
+    // window type, see enum DuoWindow
+    uint32_t window;
+    uint32_t reserved;
+    // sample rate in samples per second
+    double sampleRate;
+    // tuning frequencies in Hz of the on and off accumulators
+    double freq[2];
+    // 1 / (sampleRate * sum(window^2))
+    double densityScale;
+    // number of segments in the on and off accumulators
+    uint64_t numSpectra[2];
+};
+
+
+struct DuoSpecAccum {
+    double* powerA;
+    double* powerB;
+    // NULL unless the cross spectrum is enabled
+    double* crossRe;
+    double* crossIm;
+    uint64_t numSpectra;
+};
+
+
+struct DuoSpec {
+    struct DuoFFT fft;
+    unsigned int fftSize;
+    bool cross;
+    enum DuoWindow windowType;
+    float* window;
+    double densityScale;
+    // current segment of each tuner, transformed in place
+    float* segARe;
+    float* segAIm;
+    float* segBRe;
+    float* segBIm;
+    unsigned int fill;
+    struct DuoSpecAccum accum[2];
+    float* floatMemory;
+    double* doubleMemory;
+};
+
+
+/**
+* Initialize a spectrometer with zeroed accumulators
+*
+* @param spec pointer to struct to initialize
+* @param fftSize FFT size N, a power of two >= 8
+* @param window window type applied to each segment
+* @param cross true to also accumulate the cross spectrum
+* @param sampleRate sample rate in samples per second
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoSpecInit(
+        struct DuoSpec* spec, unsigned int fftSize, enum DuoWindow window,
+        bool cross, float sampleRate) {
+    memset(spec, 0, sizeof(struct DuoSpec));
+    if (fftSize < 8 || !duoFFTValidSize(fftSize)) {
+        return 1;
+    }
+    if (duoFFTInit(&spec->fft, fftSize)) {
+        return 1;
+    }
+    size_t numSets = cross ? 4 : 2;
+    spec->floatMemory = (float*)calloc((size_t)fftSize * 5, sizeof(float));
+    spec->doubleMemory = (double*)calloc((size_t)fftSize * numSets * 2, sizeof(double));
+    if (spec->floatMemory == NULL || spec->doubleMemory == NULL) {
+        free(spec->floatMemory);
+        free(spec->doubleMemory);
+        duoFFTFree(&spec->fft);
+        return 1;
+    }
+    spec->fftSize = fftSize;
+    spec->cross = cross;
+    spec->windowType = window;
+    spec->window = spec->floatMemory;
+    spec->segARe = spec->window + fftSize;
+    spec->segAIm = spec->segARe + fftSize;
+    spec->segBRe = spec->segAIm + fftSize;
+    spec->segBIm = spec->segBRe + fftSize;
+
+    double* next = spec->doubleMemory;
+    for (int idx = 0; idx < 2; idx++) {
+        struct DuoSpecAccum* accum = &spec->accum[idx];
+        accum->powerA = next;
+        accum->powerB = next + fftSize;
+        next += 2 * fftSize;
+        if (cross) {
+            accum->crossRe = next;
+            accum->crossIm = next + fftSize;
+            next += 2 * fftSize;
+        }
+    }
+
+    duoFFTWindow(window, spec->window, fftSize);
+    double windowPower = 0.0;
+    for (unsigned int idx = 0; idx < fftSize; idx++) {
+        windowPower += (double)spec->window[idx] * spec->window[idx];
+    }
+    spec->densityScale = 1.0 / (sampleRate * windowPower);
+    return 0;
+}
+
+
+/**
+* Release the memory allocated by duoSpecInit()
+*/
+static void duoSpecFree(struct DuoSpec* spec) {
+    duoFFTFree(&spec->fft);
+    free(spec->floatMemory);
+    free(spec->doubleMemory);
+    spec->floatMemory = NULL;
+    spec->doubleMemory = NULL;
+}
+
+
+/**
+* Drop any partially filled segment, e.g. after a retune
+*/
+static void duoSpecDiscard(struct DuoSpec* spec) {
+    spec->fill = 0;
+}
+
+
+/**
+* Add the power of each FFT bin to a centered accumulator.
+* Written as two loops without a modulo so they vectorize.
+*/
+static void duoSpecAddPower(double* acc, const float* re, const float* im, unsigned int size) {
+    unsigned int half = size / 2;
+    for (unsigned int idx = 0; idx < half; idx++) {
+        acc[idx + half] += re[idx] * re[idx] + im[idx] * im[idx];
+    }
+    for (unsigned int idx = half; idx < size; idx++) {
+        acc[idx - half] += re[idx] * re[idx] + im[idx] * im[idx];
+    }
+}
+
+
+/**
+* Window, transform and accumulate the current segment
+*/
+static void duoSpecProcessSegment(struct DuoSpec* spec, struct DuoSpecAccum* accum) {
+    unsigned int size = spec->fftSize;
+    unsigned int half = size / 2;
+    const float* window = spec->window;
+    float* aRe = spec->segARe;
+    float* aIm = spec->segAIm;
+    float* bRe = spec->segBRe;
+    float* bIm = spec->segBIm;
+
+    for (unsigned int idx = 0; idx < size; idx++) {
+        aRe[idx] *= window[idx];
+        aIm[idx] *= window[idx];
+        bRe[idx] *= window[idx];
+        bIm[idx] *= window[idx];
+    }
+    duoFFTForward(&spec->fft, aRe, aIm);
+    duoFFTForward(&spec->fft, bRe, bIm);
+
+    duoSpecAddPower(accum->powerA, aRe, aIm, size);
+    duoSpecAddPower(accum->powerB, bRe, bIm, size);
+    if (spec->cross) {
+        for (unsigned int idx = 0; idx < size; idx++) {
+            // B * conj(A), same convention as DuoCorr and DuoPSD
+            unsigned int dst = idx < half ? idx + half : idx - half;
+            accum->crossRe[dst] += bRe[idx] * aRe[idx] + bIm[idx] * aIm[idx];
+            accum->crossIm[dst] += bIm[idx] * aRe[idx] - bRe[idx] * aIm[idx];
+        }
+    }
+    accum->numSpectra++;
+}
+
+
+/**
+* Push interleaved floating point frames (Ia, Qa, Ib, Qb) into the
+* spectrometer, accumulating each completed segment
+*
+* @param spec spectrometer from duoSpecInit()
+* @param frames pointer to frames
+* @param numFrames number of frames
+* @param which DUO_SPEC_ON or DUO_SPEC_OFF accumulators
+*
+* @return number of segments completed
+*/
+static unsigned int duoSpecPush(
+        struct DuoSpec* spec, const float* frames, size_t numFrames, int which) {
+    unsigned int size = spec->fftSize;
+    unsigned int numSegments = 0;
+    size_t frameIdx = 0;
+    while (frameIdx < numFrames) {
+        size_t count = size - spec->fill;
+        if (count > numFrames - frameIdx) {
+            count = numFrames - frameIdx;
+        }
+        unsigned int dst = spec->fill;
+        const float* in = frames + frameIdx * 4;
+        for (size_t idx = 0; idx < count; idx++) {
+            spec->segARe[dst + idx] = in[0];
+            spec->segAIm[dst + idx] = in[1];
+            spec->segBRe[dst + idx] = in[2];
+            spec->segBIm[dst + idx] = in[3];
+            in += 4;
+        }
+        spec->fill += (unsigned int)count;
+        frameIdx += count;
+
+        if (spec->fill == size) {
+            duoSpecProcessSegment(spec, &spec->accum[which]);
+            spec->fill = 0;
+            numSegments++;
+        }
+    }
+    return numSegments;
+}
+
+
+/**
+* Write the accumulators to a checkpoint file.
+* The file is written under a temporary name and then renamed over
+* path, so an interruption never leaves a truncated checkpoint.
+*
+* @param spec spectrometer from duoSpecInit()
+* @param path checkpoint file path
+* @param head header with the frequencies and sample rate filled in,
+*             the remaining fields are set here
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoSpecSave(struct DuoSpec* spec, const char* path, struct DuoSpecFileHeader* head) {
+    size_t size = spec->fftSize;
+    int numAccum = (head->flags & DUO_SPEC_SWITCHED) ? 2 : 1;
+    head->magic[0] = 'D';
+    head->magic[1] = 'S';
+    head->magic[2] = 'P';
+    head->magic[3] = 'C';
+    head->version = DUO_SPEC_VERSION;
+    head->fftSize = spec->fftSize;
+    head->flags = (head->flags & ~DUO_SPEC_CROSS) | (spec->cross ? DUO_SPEC_CROSS : 0);
+    head->window = (uint32_t)spec->windowType;
+    head->reserved = 0;
+    head->densityScale = spec->densityScale;
+    head->numSpectra[0] = spec->accum[0].numSpectra;
+    head->numSpectra[1] = spec->accum[1].numSpectra;
+
+    size_t pathLen = strlen(path);
+    char* tmpPath = (char*)malloc(pathLen + 5);
+    if (tmpPath == NULL) {
+        return 1;
+    }
+    memcpy(tmpPath, path, pathLen);
+    memcpy(tmpPath + pathLen, ".tmp", 5);
+
+    FILE* out = fopen(tmpPath, "wb");
+    if (out == NULL) {
+        free(tmpPath);
+        return 1;
+    }
+    bool ok = fwrite(head, sizeof(struct DuoSpecFileHeader), 1, out) == 1;
+    for (int idx = 0; ok && idx < numAccum; idx++) {
+        struct DuoSpecAccum* accum = &spec->accum[idx];
+        ok = fwrite(accum->powerA, sizeof(double), size, out) == size &&
+             fwrite(accum->powerB, sizeof(double), size, out) == size;
+        if (ok && spec->cross) {
+            ok = fwrite(accum->crossRe, sizeof(double), size, out) == size &&
+                 fwrite(accum->crossIm, sizeof(double), size, out) == size;
+        }
+    }
+    ok = (fclose(out) == 0) && ok;
+
+#if defined(_WIN32) || defined(_WIN64)
+    ok = ok && MoveFileExA(tmpPath, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmpPath, path) == 0;
+#endif
+    if (!ok) {
+        remove(tmpPath);
+    }
+    free(tmpPath);
+    return ok ? 0 : 1;
+}
+
+
+/**
+* Resume the accumulators from a checkpoint file written by
+* duoSpecSave(). The file must match the FFT size, window, cross
+* spectrum setting, and sample rate of the spectrometer. On failure
+* the accumulators are zeroed.
+*
+* @param spec spectrometer from duoSpecInit()
+* @param path checkpoint file path
+* @param head pointer to store the checkpoint header
+*
+* @return zero on success, non-zero otherwise
+*/
+static int duoSpecLoad(struct DuoSpec* spec, const char* path, struct DuoSpecFileHeader* head) {
+    size_t size = spec->fftSize;
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) {
+        return 1;
+    }
+    bool ok = fread(head, sizeof(struct DuoSpecFileHeader), 1, in) == 1 &&
+              memcmp(head->magic, "DSPC", 4) == 0 &&
+              head->version == DUO_SPEC_VERSION &&
+              head->fftSize == spec->fftSize &&
+              head->window == (uint32_t)spec->windowType &&
+              ((head->flags & DUO_SPEC_CROSS) != 0) == spec->cross &&
+              head->densityScale == spec->densityScale;
+    int numAccum = (head->flags & DUO_SPEC_SWITCHED) ? 2 : 1;
+    for (int idx = 0; ok && idx < numAccum; idx++) {
+        struct DuoSpecAccum* accum = &spec->accum[idx];
+        ok = fread(accum->powerA, sizeof(double), size, in) == size &&
+             fread(accum->powerB, sizeof(double), size, in) == size;
+        if (ok && spec->cross) {
+            ok = fread(accum->crossRe, sizeof(double), size, in) == size &&
+                 fread(accum->crossIm, sizeof(double), size, in) == size;
+        }
+        accum->numSpectra = head->numSpectra[idx];
+    }
+    fclose(in);
+    if (!ok) {
+        // A partial read must not leave a mix of checkpoint and old sums
+        size_t numSets = spec->cross ? 4 : 2;
+        memset(spec->doubleMemory, 0, size * numSets * 2 * sizeof(double));
+        spec->accum[0].numSpectra = 0;
+        spec->accum[1].numSpectra = 0;
+    }
+    return ok ? 0 : 1;
+}
+
+
+#endif
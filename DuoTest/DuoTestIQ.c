@@ -0,0 +1,169 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/**
+* Feeds DuoIQ.h a tone with a known DC offset and I/Q imbalance and
+* checks that the estimates converge to it and that the correction
+* suppresses the image.
+*/
+
+#include <stdio.h>
+#include <math.h>
+
+#include "DuoIQ.h"
+
+
+#define SAMPLE_RATE (2e6)
+#define TIME_CONSTANT (0.05)
+#define BLOCK_SAMPLES (1008)
+#define SETTLE_SAMPLES (1000000)
+// Image rejection is measured over a window holding a whole number of tone cycles
+#define WINDOW_SAMPLES (65536)
+#define TONE_BIN (1000)
+#define TONE_AMPLITUDE (8000.0)
+#define NOISE_AMPLITUDE (20)
+
+// Impairment of the source, Q relative to I
+#define DC_I (900.0)
+#define DC_Q (-400.0)
+#define GAIN (1.12)
+#define PHASE_DEG (6.0)
+
+#define MIN_REJECTION_DB (40.0)
+#define PI (3.14159265358979323846)
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+
+static unsigned int failures;
+
+
+struct Source {
+    unsigned long long sampleNum;
+    unsigned int seed;
+};
+
+
+static double noise(struct Source* source) {
+    source->seed = source->seed * 1103515245u + 12345u;
+    return (double)((int)((source->seed >> 16) % (2 * NOISE_AMPLITUDE + 1)) - NOISE_AMPLITUDE);
+}
+
+
+static void generate(struct Source* source, short* xi, short* xq, unsigned int numSamples) {
+    const double step = 2.0 * PI * TONE_BIN / WINDOW_SAMPLES;
+    const double phaseError = PHASE_DEG * PI / 180.0;
+    for (unsigned int idx = 0; idx < numSamples; idx++) {
+        double phase = step * (double)(source->sampleNum++ % WINDOW_SAMPLES);
+        xi[idx] = (short)lrint(TONE_AMPLITUDE * cos(phase) + DC_I + noise(source));
+        xq[idx] = (short)lrint(GAIN * TONE_AMPLITUDE * sin(phase + phaseError) + DC_Q + noise(source));
+    }
+}
+
+
+/**
+* Ratio in dB of the tone to its image over one window that starts at
+* a whole number of tone cycles, with the mean removed
+*/
+static double imageRejection(const short* xi, const short* xq) {
+    const double step = 2.0 * PI * TONE_BIN / WINDOW_SAMPLES;
+    double meanI = 0.0;
+    double meanQ = 0.0;
+    double toneI = 0.0;
+    double toneQ = 0.0;
+    double imageI = 0.0;
+    double imageQ = 0.0;
+    for (unsigned int idx = 0; idx < WINDOW_SAMPLES; idx++) {
+        meanI += xi[idx];
+        meanQ += xq[idx];
+    }
+    meanI /= WINDOW_SAMPLES;
+    meanQ /= WINDOW_SAMPLES;
+    for (unsigned int idx = 0; idx < WINDOW_SAMPLES; idx++) {
+        double i = xi[idx] - meanI;
+        double q = xq[idx] - meanQ;
+        double c = cos(step * idx);
+        double s = sin(step * idx);
+        // (i + jq) * exp(-j phase) and (i + jq) * exp(+j phase)
+        toneI += i * c + q * s;
+        toneQ += q * c - i * s;
+        imageI += i * c - q * s;
+        imageQ += q * c + i * s;
+    }
+    return 10.0 * log10((toneI * toneI + toneQ * toneQ) / (imageI * imageI + imageQ * imageQ + 1e-12));
+}
+
+
+int main(void) {
+    static short xi[WINDOW_SAMPLES];
+    static short xq[WINDOW_SAMPLES];
+    static short yi[WINDOW_SAMPLES];
+    static short yq[WINDOW_SAMPLES];
+    struct Source source = {0, 1};
+    struct DuoIQCorrector corr;
+    struct DuoEngineIQEstimate estimate;
+
+    duoIQInit(&corr, SAMPLE_RATE, TIME_CONSTANT);
+
+    // Blocks the size of a stream callback until the estimates settle
+    for (unsigned int done = 0; done < SETTLE_SAMPLES; done += BLOCK_SAMPLES) {
+        generate(&source, xi, xq, BLOCK_SAMPLES);
+        duoIQProcess(&corr, xi, xq, BLOCK_SAMPLES, yi, yq);
+    }
+    duoIQEstimate(&corr, &estimate);
+    printf("dcI=%.1f dcQ=%.1f gain=%.4f phase=%.3f imageRejection=%.2f dB\n",
+        estimate.dcI * 32768.0, estimate.dcQ * 32768.0, estimate.gain, estimate.phase,
+        estimate.imageRejection);
+    CHECK(fabs(estimate.dcI * 32768.0 - DC_I) < 2.0);
+    CHECK(fabs(estimate.dcQ * 32768.0 - DC_Q) < 2.0);
+    CHECK(fabs(estimate.gain - GAIN) < 0.005);
+    CHECK(fabs(estimate.phase - PHASE_DEG) < 0.2);
+
+    // Expected rejection of the uncorrected source from the injected gain and phase
+    double cosPhase = cos(PHASE_DEG * PI / 180.0);
+    double expected = 10.0 * log10((1.0 + 2.0 * GAIN * cosPhase + GAIN * GAIN) /
+        (1.0 - 2.0 * GAIN * cosPhase + GAIN * GAIN));
+    CHECK(fabs(estimate.imageRejection - expected) < 0.5);
+
+    // Align the window to the tone so it holds whole cycles
+    unsigned int align = (unsigned int)((WINDOW_SAMPLES - source.sampleNum % WINDOW_SAMPLES) % WINDOW_SAMPLES);
+    generate(&source, xi, xq, align);
+    duoIQProcess(&corr, xi, xq, align, yi, yq);
+    for (unsigned int done = 0; done < WINDOW_SAMPLES; done += BLOCK_SAMPLES) {
+        unsigned int count = WINDOW_SAMPLES - done < BLOCK_SAMPLES ? WINDOW_SAMPLES - done : BLOCK_SAMPLES;
+        generate(&source, xi + done, xq + done, count);
+        duoIQProcess(&corr, xi + done, xq + done, count, yi + done, yq + done);
+    }
+    double before = imageRejection(xi, xq);
+    double after = imageRejection(yi, yq);
+    printf("image rejection %.1f dB uncorrected, %.1f dB corrected\n", before, after);
+    CHECK(fabs(before - expected) < 1.0);
+    CHECK(after > MIN_REJECTION_DB);
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
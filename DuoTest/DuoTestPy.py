@@ -0,0 +1,130 @@
+# Smoke test of the duoengine module against the emulated RSPduo:
+# zero-copy reads, later reads while an earlier one still views the
+# engine buffer, stop() with such a read alive, and the recovery
+# counters of stats().
+
+import sys
+import time
+
+import duoengine
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+
+NUM_FRAMES = 4096
+WAIT_SECONDS = 10.0
+
+failures = 0
+
+
+def check(cond, what):
+    global failures
+    if not cond:
+        print('check failed: %s' % what, file=sys.stderr)
+        failures += 1
+
+
+def wait_stats(engine, key, count):
+    deadline = time.monotonic() + WAIT_SECONDS
+    while time.monotonic() < deadline:
+        stats = engine.stats()
+        if stats[key] >= count:
+            return stats
+        # Keep pulling so the ring does not overflow meanwhile
+        engine.read(NUM_FRAMES, timeout=0.05, copy=True)
+    return engine.stats()
+
+
+def snapshot(frames):
+    return memoryview(frames).tobytes()
+
+
+def check_pinned(engine):
+    # Collected zero-copy reads are not overwritten by the reads after them
+    chunks = []
+    try:
+        for _ in range(16):
+            chunks.append(engine.read(NUM_FRAMES))
+        check(False, 'reads behind a live zero-copy read raise BufferError once the buffer is held back')
+    except BufferError:
+        pass
+    check(len(chunks) >= 2, 'read %d chunks behind a live zero-copy read' % len(chunks))
+    saved = [snapshot(chunk) for chunk in chunks]
+    # Streaming goes on meanwhile
+    time.sleep(0.2)
+    check(all(snapshot(chunk) == data for chunk, data in zip(chunks, saved)), 'collected chunks unchanged')
+    check(len(set(saved)) == len(saved), 'collected chunks hold different frames')
+    del chunks
+    # Once nothing views the buffer, reads go on past the released frames
+    check(len(engine.read(NUM_FRAMES)) > 0, 'read after the chunks are released')
+
+
+def check_with():
+    with duoengine.Engine(100e6, decimation=8, buffer_size=1 << 20) as engine:
+        frames = engine.read(1024)
+        data = snapshot(frames)
+    check(not engine.running, 'with exits while a zero-copy read is alive')
+    check(snapshot(frames) == data, 'zero-copy read outlives the with')
+
+    try:
+        with duoengine.Engine(100e6, decimation=8, buffer_size=1 << 20) as engine:
+            frames = engine.read(1024)
+            raise KeyError('body')
+    except KeyError:
+        pass
+    check(not engine.running, 'with exits on an exception while a zero-copy read is alive')
+    del frames
+
+
+def main():
+    engine = duoengine.Engine(100e6, decimation=8, buffer_size=1 << 20, recover_timeout=0.3)
+    engine.start()
+
+    frames = engine.read(NUM_FRAMES)
+    view = memoryview(frames)
+    check(view.shape == (NUM_FRAMES, 2), 'zero-copy read shape %s' % (view.shape,))
+    check(view.readonly, 'zero-copy read is read-only')
+    if numpy is not None:
+        check(frames.dtype == numpy.complex64, 'float32 frames are complex64')
+        check(not frames.flags.owndata, 'zero-copy read views the engine buffer')
+        # The emulator leads tuner B by 0.7 rad
+        phase = numpy.angle(numpy.vdot(frames[:, 0], frames[:, 1]))
+        check(abs(phase - 0.7) < 0.05, 'phase of tuner B %.3f rad' % phase)
+
+    view.release()
+    del view, frames
+    check_pinned(engine)
+
+    kept = engine.read(NUM_FRAMES, copy=True)
+    check(len(kept) == NUM_FRAMES, 'copied read length %d' % len(kept))
+
+    stats = engine.stats()
+    check(stats['recoveries'] == 0 and stats['device_losses'] == 0, 'no losses before the fault')
+
+    duoengine.emulate_remove(1.5)
+    stats = wait_stats(engine, 'recoveries', 1)
+    check(stats['recoveries'] == 1, 'recovered from removal, stats %s' % stats)
+    check(stats['failed_attempts'] >= 1, 'failed attempts while the device was absent')
+    stats = wait_stats(engine, 'discontinuities', 1)
+    check(stats['discontinuities'] >= 1, 'discontinuity after recovery')
+
+    frames = engine.read(NUM_FRAMES)
+    data = snapshot(frames)
+    engine.stop()
+    check(not engine.running, 'engine stopped with a zero-copy read alive')
+    check(snapshot(frames) == data, 'zero-copy read outlives the engine')
+    check(len(kept) == NUM_FRAMES, 'copied read outlives the engine')
+    del frames
+
+    # The device was released by stop() although the read was alive
+    check_with()
+
+    print('FAILED' if failures else 'PASSED')
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
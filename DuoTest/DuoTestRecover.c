@@ -0,0 +1,160 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/**
+* Unplugs and stalls the emulated RSPduo while streaming and checks
+* that the engine recovers from both and reports it in DuoEngineStats.
+*/
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "DuoEngine.h"
+#include "DuoEmulate.h"
+
+
+#define RECOVER_TIMEOUT (0.3f)
+#define ABSENT_MS (1500)
+#define WAIT_MS (10000)
+#define POLL_MS (20)
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+
+static _Atomic unsigned int transfers;
+static _Atomic unsigned int discontinuities;
+static unsigned int failures;
+
+
+static void sleepMs(unsigned int ms) {
+#if defined(_WIN32) || defined(_WIN64)
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+
+static void onTransfer(struct DuoEngineTransfer* transfer, void* userContext) {
+    (void)userContext;
+    atomic_fetch_add(&transfers, 1);
+    if (transfer->discontinuity) {
+        atomic_fetch_add(&discontinuities, 1);
+    }
+}
+
+
+static void onMessage(const char* msg, void* userContext) {
+    (void)userContext;
+    printf("%s\n", msg);
+}
+
+
+/**
+* Wait until transfers resume past the specified count
+*
+* @return true if they did within WAIT_MS
+*/
+static bool waitTransfers(unsigned int count) {
+    for (unsigned int waited = 0; waited < WAIT_MS; waited += POLL_MS) {
+        if (atomic_load(&transfers) > count) {
+            return true;
+        }
+        sleepMs(POLL_MS);
+    }
+    return false;
+}
+
+
+/**
+* Wait until the engine reports the specified number of recoveries
+*
+* @return true if it did within WAIT_MS
+*/
+static bool waitRecoveries(struct DuoEngineHandle* handle, unsigned int recoveries, struct DuoEngineStats* stats) {
+    for (unsigned int waited = 0; waited < WAIT_MS; waited += POLL_MS) {
+        if (duoEngineGetStats(handle, stats) == 0 && stats->recoveries >= recoveries) {
+            return true;
+        }
+        sleepMs(POLL_MS);
+    }
+    return false;
+}
+
+
+int main(void) {
+    struct DuoEngine engine;
+    struct DuoEngineHandle* handle = NULL;
+    struct DuoEngineStats stats;
+
+    duoEngineInit(&engine);
+    engine.decimFactor = 8;
+    engine.recoverTimeout = RECOVER_TIMEOUT;
+    engine.transferCallback = onTransfer;
+    engine.messageCallback = onMessage;
+
+    if (duoEngineStart(&engine, &handle) != 0) {
+        fprintf(stderr, "duoEngineStart failed\n");
+        return 1;
+    }
+    CHECK(waitTransfers(10));
+
+    // Removal: event, no callbacks, failing Uninit, and missing from the device list for a while
+    duoEmulateRemove(ABSENT_MS);
+    CHECK(waitRecoveries(handle, 1, &stats));
+    CHECK(stats.deviceLosses == 1);
+    CHECK(stats.recoveries == 1);
+    CHECK(stats.failedAttempts >= 1);
+    CHECK(stats.lastRecoveryTime >= ABSENT_MS / 1000.0f);
+    CHECK(!stats.recovering);
+    CHECK(waitTransfers(atomic_load(&transfers) + 10));
+    CHECK(duoEngineGetStats(handle, &stats) == 0);
+    CHECK(stats.discontinuities >= 1);
+    CHECK(atomic_load(&discontinuities) >= 1);
+
+    // Stall: callbacks stop without any event, the device stays present
+    unsigned int failedAttempts = stats.failedAttempts;
+    duoEmulateStall();
+    CHECK(waitRecoveries(handle, 2, &stats));
+    CHECK(stats.deviceLosses == 2);
+    CHECK(stats.failedAttempts == failedAttempts);
+    CHECK(waitTransfers(atomic_load(&transfers) + 10));
+    CHECK(duoEngineGetStats(handle, &stats) == 0);
+    CHECK(stats.discontinuities >= 2);
+    CHECK(atomic_load(&discontinuities) >= 2);
+    CHECK(duoEmulateSessions() == 3);
+
+    CHECK(duoEngineStop(handle) == 0);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
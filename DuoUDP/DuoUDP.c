@@ -21,8 +21,9 @@ SOFTWARE.
 */
 
 #if defined(_WIN32) || defined(_WIN64)
+// winsock2.h, also included by udp.h, has to come before Windows.h
+#include <winsock2.h>
 #include <Windows.h>
-#include <winsock.h>
 #include <wsipv6ok.h>
 #include <conio.h>
 #include "windows_getopt.h"
@@ -39,20 +40,34 @@ SOFTWARE.
 #endif
 
 #include <stdio.h>
+#include <math.h>
 
 #define DEFAULT_AGC_BANDWIDTH (5)
 
 #include "DuoEngine.h"
 #include "DuoParse.h"
+#include "udp.h"
 
 
 static const char* USAGE = "\
 Usage: DuoUDP.exe [-h] [-m mtu] [-a agchz] [-t agcdb] [-l lna] [-d decim]\n\
-                  [-n notch] [-f] [-k] [-x] freq [[ipaddr][:port]]\n\
+                  [-n notch] [-s format] [-p layout] [-c streams]\n\
+                  [-B phases] [-r rate] [-q quality] [-F freq] [-I]\n\
+                  [-K path] [-R priority] [-C cpus] [-L] [-f] [-k]\n\
+                  [-D ms] [-A sec] [-x] [-H]\n\
+                  freq [[ipaddr][:port]]\n\
 \n\
 Options:\n\
   -h: print this help message\n\
   -m mtu: packet MTU (default=1500)\n\
+  -D ms: Send a shorter packet once the oldest frame has waited this\n\
+      many milliseconds instead of waiting for a full packet\n\
+      (default=disabled). Bounds the latency at low sample rates.\n\
+  -A sec: Recover the device once no samples have arrived for this\n\
+      many seconds or it is removed, e.g. after a USB glitch, then\n\
+      carry on streaming with the current settings\n\
+      (default=disabled). With -H the first packet afterwards has\n\
+      the discontinuity flag set.\n\
   -a 0|5|50|100: AGC loop bandwidth in Hz (default=5)\n\
   -t [-72-0]: AGC set point in dBFS (default=-30)\n\
   -l 0-9: LNA state where 0 provides the least RF gain reduction.\n\
@@ -61,11 +76,56 @@ Options:\n\
       For factors 4, 8, 16, and 32, the analog bandwidth will \n\
       be reduced to 600, 300, 200, and 200 kHz respectively unless \n\
       the -x option is also specified. In which case the analog \n\
-      bandwidth remains 1.536 MHz.\n\
+      bandwidth remains 1.536 MHz. While running, the < and > keys\n\
+      halve and double the factor without restarting the stream.\n\
   -n mwfm|dab: Enable MW/FM or DAB notch filter\n\
       Both filters can be enabled by providing the -n option twice\n\
       (once for each filter). By default, both filters are disabled.\n\
-  -f: Convert samples to floating-point\n\
+  -s int16|float32|float16|int14|int12|int8: Sample scalar format\n\
+      (default=int16). float16 is IEEE half precision scaled like float32.\n\
+      int14 and int12 keep the most significant bits of each scalar and\n\
+      are bit-packed. int8 keeps the 8 most significant bits.\n\
+  -p interleaved|planar|split: Scalar layout of each packet\n\
+      (default=interleaved). planar sends all tuner A samples followed\n\
+      by all tuner B samples. split sends separate blocks of tuner A\n\
+      I, tuner A Q, tuner B I, and tuner B Q scalars.\n\
+  -c streams: Comma separated output streams from a, b, sum, diff,\n\
+      beam0, and beam1 (default=a,b). Selected streams appear in each\n\
+      frame in that order as I, Q pairs. sum and diff are (A + B) / 2\n\
+      and (A - B) / 2. Each beam is (A + B * e^{j phase}) / 2.\n\
+  -B phases: Comma separated steering phases of tuner B in degrees\n\
+      for beam0 and beam1 (default=0). 180 nulls a signal that\n\
+      arrives in phase at both tuners. While running, the , and . keys\n\
+      rotate every beam by -5 and +5 degrees.\n\
+  -r rate: Resample both tuners to the specified output rate in Hz\n\
+      (e.g. 250k, 48k, or 2.4M) with a polyphase filter. The ratio to\n\
+      the hardware rate (2 MHz / decim) in lowest terms L/M must have\n\
+      L <= 1024. Use -d to get close to the rate first since the\n\
+      filter cost grows with M. By default no resampling is done.\n\
+  -q low|medium|high: Resampling filter quality (default=medium)\n\
+      Passes 80, 90, or 95 percent of the output bandwidth with 60,\n\
+      80, or 100 dB of stopband attenuation respectively.\n\
+  -F freq: Shift the signal at freq Hz from the tuning frequency\n\
+      (e.g. 250k or -100k) to 0 Hz with a phase continuous NCO, which\n\
+      keeps it away from the DC offset of the tuners. With -r the\n\
+      shift is applied in the same pass as the resampler. While\n\
+      running, the { and } keys move the shift by -10 and +10 kHz.\n\
+  -I: Remove the DC offset and I/Q gain and phase imbalance of each\n\
+      tuner with slowly adapting estimators (default=off)\n\
+  -K path: Remove the phase, delay, and gain of tuner B relative to\n\
+      tuner A using the calibration table at path (see DuoCorr -U)\n\
+  -f: Convert samples to floating-point (same as -s float32)\n\
+  -H: Start each packet with a metadata header describing the\n\
+      sample format, layout, output streams, packet sequence number,\n\
+      frame count, and rate, which follows the < and > keys\n\
+  -R priority: Run the threads that process samples with SCHED_FIFO\n\
+      real-time scheduling at priority 1-99. Usually requires root,\n\
+      CAP_SYS_NICE, or an rtprio limit. Settings that cannot be\n\
+      applied are reported and capture continues without them.\n\
+  -C cpus: Pin the threads that process samples to the comma\n\
+      separated CPUs or ranges of CPUs (e.g. 2,3 or 2-3)\n\
+  -L: Lock the process memory into RAM and write every sample\n\
+      buffer once before streaming starts\n\
   -k: Use USB bulk transfer mode instead of isochronous\n\
   -x: Use the maximum 8 MHz master sample rate.\n\
       This will deliver 12 bit ADC resolution, but with slightly \n\
@@ -91,11 +151,21 @@ Arguments:\n\
 struct Context {
     SOCKET sock;
     struct sockaddr_in dest;
+    // true to prepend a DuoUdpHeader to each packet
+    bool header;
+    struct DuoUdpHeader head;
+    uint32_t sequence;
+    char* packet;
 };
 #else
 struct Context {
     int sock;
     struct sockaddr_in dest;
+    // true to prepend a DuoUdpHeader to each packet
+    bool header;
+    struct DuoUdpHeader head;
+    uint32_t sequence;
+    char* packet;
 };
 #endif
 
@@ -103,8 +173,19 @@ struct Context {
 static void transferCallback(struct DuoEngineTransfer* transfer, void* userContext) {
     int rcode = 0;
     struct Context* context = (struct Context*)userContext;
+    char* payload = (char*)transfer->data;
+    size_t payloadSize = transfer->numBytes;
+    if (context->header) {
+        udpHeaderUpdate(&context->head, context->sequence++, transfer->numFrames);
+        udpHeaderSetRate(&context->head, (uint32_t)transfer->sampleRate);
+        udpHeaderSetFlags(&context->head, transfer->discontinuity ? DUO_UDP_FLAG_DISCONTINUITY : 0);
+        memcpy(context->packet, &context->head, sizeof(context->head));
+        memcpy(context->packet + sizeof(context->head), transfer->data, transfer->numBytes);
+        payload = context->packet;
+        payloadSize += sizeof(context->head);
+    }
     rcode = sendto(
-        context->sock, (char*)transfer->data, transfer->numBytes, 0,
+        context->sock, payload, (int)payloadSize, 0,
         (struct sockaddr*)&context->dest, sizeof(context->dest));
 #if defined(_WIN32) || defined(_WIN64)
     if (rcode == SOCKET_ERROR) {
@@ -132,83 +213,36 @@ static int controlCallback(struct DuoEngineControl* control, void* userContext)
                 control->lnaState--;
             }
         }
-    }
-    return 0;
-}
-
-
-
-/**
-* Parsing function for [addr][:port] arguments.
-* Can accept
-*   1. IP address only with no semicolon (e.g. "192.168.1.1")
-*   2. IP address and port separated by semicolon (e.g. "192.168.1.1:8080")
-*   3. Port only with leading semicolon (e.g. ":8080")
-*
-* @param arg pointer to null-terminated string
-* @param ipStr pointer location to store pointer to IP address string
-*/
-static int parseAddrPort(
-        char* arg, char** ipStr, unsigned long* ipAddr, unsigned int* port) {
-    int sepIdx = -1;
-    int rcode = 1;
-    unsigned long tmpAddr;
-    unsigned int tmpPort;
-    size_t argLen = strlen(arg);
-    for (unsigned int charIdx = 0; charIdx < argLen; charIdx++) {
-        if (arg[charIdx] == ':') {
-            sepIdx = charIdx;
-            break;
-        }
-    }
-    if (sepIdx == 0 && argLen > 1) {
-        // Starts with separator, must be just a port
-        if (parseUintArg(&arg[1], &tmpPort, 10)) {
-            return 1;
-        }
-        if (tmpPort > 65535) {
-            printf("invalid UDP port [%u], must be in [0-65535]\n", tmpPort);
-            return 1;
-        }
-        *port = tmpPort;
-        return 0;
-    }
-    else if (sepIdx == -1) {
-        // No separator, must be just an address
-        tmpAddr = inet_addr(arg);
-        if (tmpAddr == INADDR_NONE) {
-            printf("invalid IPv4 address value [%s]\n", arg);
-            return 1;
+        else if (ctrl == '{' || ctrl == '}') {
+            control->shiftFreq += ctrl == '{' ? -10000.0f : 10000.0f;
+            printf("Frequency Shift: %.0f Hz\n", control->shiftFreq);
         }
-        *ipAddr = tmpAddr;
-        *ipStr = arg;
-        return 0;
-    }
-    else if (argLen > 3 && sepIdx != (argLen - 1)) {
-        // We found the separator somewhere in the middle
-        // Insert a null-termination where the ':' used to be
-        // This effectively separates arg into two C strings
-        arg[sepIdx] = 0;
-        tmpAddr = inet_addr(arg);
-        if (tmpAddr == INADDR_NONE) {
-            printf("invalid IPv4 address value [%s]\n", arg);
-            return 1;
-        }
-        if (parseUintArg(&arg[sepIdx + 1], &tmpPort, 10)) {
-            return 1;
+        else if (ctrl == '<' || ctrl == '>') {
+            // Switch between wideband and narrowband without restarting the stream
+            if (ctrl == '<' && control->decimFactor > 1) {
+                control->decimFactor /= 2;
+            }
+            else if (ctrl == '>' && control->decimFactor < 32) {
+                control->decimFactor *= 2;
+            }
+            printf("Decimation Factor: %u\n", control->decimFactor);
         }
-        if (tmpPort > 65535) {
-            printf("invalid UDP port [%u], must be in [0-65535]\n", tmpPort);
-            return 1;
+        else if (ctrl == ',' || ctrl == '.') {
+            // Rotate the tuner B weight of every beam
+            float step = (ctrl == ',' ? -5.0f : 5.0f) * 3.14159265f / 180.0f;
+            float stepI = cosf(step);
+            float stepQ = sinf(step);
+            for (unsigned int beam = 0; beam < DUO_MAX_BEAMS; beam++) {
+                struct DuoEngineBeam* weights = &control->beams[beam];
+                float weightBI = weights->weightBI * stepI - weights->weightBQ * stepQ;
+                weights->weightBQ = weights->weightBI * stepQ + weights->weightBQ * stepI;
+                weights->weightBI = weightBI;
+            }
+            printf("Beam0 Steering: %.1f\n",
+                   atan2f(control->beams[0].weightBQ, control->beams[0].weightBI) * 180.0f / 3.14159265f);
         }
-        *port = tmpPort;
-        *ipAddr = tmpAddr;
-        *ipStr = arg;
-        return 0;
     }
-    printf("invalid address and port specification [%s] "
-           "(expect [addr][:port])\n", arg);
-    return 1;
+    return 0;
 }
 
 
@@ -229,14 +263,24 @@ int main(int argc, char** argv) {
     char* ipStr = defaultAddr;
     unsigned long ipAddr = inet_addr(defaultAddr);
     unsigned int mtu = 1500;
+    float latencyMs = 0.0f;
+    char defaultOutput[] = "a,b";
+    char* outputStr = defaultOutput;
+    char defaultSteer[] = "0";
+    char* steerStr = defaultSteer;
 
     struct DuoEngine engine;
     duoEngineInit(&engine);
+    struct DuoCalTable calTable;
+    duoCalTableInit(&calTable);
 
     struct Context context;
     int rcode = 0;
+    context.header = false;
+    context.sequence = 0;
+    context.packet = NULL;
 
-    while ((opt = getopt(argc, argv, "hm:a:t:l:d:n:fkx")) != -1) {
+    while ((opt = getopt(argc, argv, "hm:a:t:l:d:n:s:p:c:B:r:q:F:IK:R:C:LD:A:fkxH")) != -1) {
         switch (opt) {
         case 'm':
             if (parseUintArg(optarg, &mtu, 10)) {
@@ -245,6 +289,21 @@ int main(int argc, char** argv) {
                 return EXIT_FAILURE;
             }
             break;
+        case 'D':
+            if (parseFloatArg(optarg, &latencyMs) || latencyMs <= 0.0f) {
+                printf("invalid maximum latency, must be a positive number of milliseconds\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            engine.maxLatency = latencyMs / 1000.0f;
+            break;
+        case 'A':
+            if (parseFloatArg(optarg, &engine.recoverTimeout) || engine.recoverTimeout < 0.0f) {
+                printf("invalid recovery timeout, must be a non-negative number of seconds\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
         case 'a':
             if (parseAgcBandwidth(optarg, &engine.agcBandwidth)) {
                 usage();
@@ -275,9 +334,84 @@ int main(int argc, char** argv) {
                 return EXIT_FAILURE;
             }
             break;
+        case 's':
+            if (parseSampleFormat(optarg, &engine.format)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            if (parseLayout(optarg, &engine.layout)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            if (parseOutputMask(optarg, &engine.outputMask)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            outputStr = optarg;
+            break;
+        case 'B':
+            if (parseBeamSteering(optarg, engine.beams)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            steerStr = optarg;
+            break;
+        case 'r':
+            if (parseSampleRate(optarg, &engine.outputRate)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'q':
+            if (parseResampleQuality(optarg, &engine.resampleQuality)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'F':
+            if (parseFrequency(optarg, &engine.shiftFreq)) {
+                printf("invalid frequency shift argument\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'I':
+            engine.iqCorrection = true;
+            break;
+        case 'K':
+            if (parseCalibrationTable(optarg, &calTable)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            engine.calibration = &calTable;
+            break;
         case 'f':
             engine.floatingPoint = true;
             break;
+        case 'H':
+            context.header = true;
+            break;
+        case 'R':
+            if (parseRealtimePriority(optarg, &engine.schedPriority)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            engine.schedPolicy = DUO_SCHED_FIFO;
+            break;
+        case 'C':
+            if (parseCpuList(optarg, &engine.streamCpus)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'L':
+            engine.lockMemory = true;
+            engine.prefault = true;
+            break;
         case 'k':
             engine.usbBulkMode = true;
             break;
@@ -318,14 +452,40 @@ int main(int argc, char** argv) {
     printf("Destination UDP Port: %u\n", port);
     printf("RF Tune Frequency: %f Hz\n", engine.tuneFreq);
     printf("Packet MTU: %u bytes\n", mtu);
+    if (engine.maxLatency > 0.0f) {
+        printf("Maximum Latency: %g ms\n", latencyMs);
+    }
     printf("AGC Loop Bandwidth: %u Hz\n", engine.agcBandwidth);
     if (engine.agcBandwidth > 0) {
         printf("AGC Set Point: %d dBFS\n", engine.agcSetPoint);
     }
     printf("LNA State: %u\n", engine.lnaState);
     printf("Decimation Factor: %u\n", engine.decimFactor);
-    printf("Floating Point: %s\n", engine.floatingPoint ? "true" : "false");
+    printf("Sample Rate: %u Hz\n", duoEngineSampleRate(&engine));
+    if (engine.outputRate) {
+        printf("Resampler Quality: %s\n", duoEngineResampleQualityName(engine.resampleQuality));
+    }
+    if (engine.shiftFreq != 0.0f) {
+        printf("Frequency Shift: %.0f Hz\n", engine.shiftFreq);
+    }
+    printf("IQ Correction: %s\n", engine.iqCorrection ? "true" : "false");
+    if (engine.calibration) {
+        printf("Calibration Points: %u\n", calTable.numPoints);
+    }
+    printf("Sample Format: %s\n", duoEngineFormatName(duoEngineFormat(&engine)));
+    printf("Layout: %s\n", duoEngineLayoutName(engine.layout));
+    printf("Output Streams: %s\n", outputStr);
+    if (duoEngineOutputMask(&engine) & DUO_OUTPUT_BEAMS) {
+        printf("Beam Steering: %s\n", steerStr);
+    }
+    printf("Metadata Header: %s\n", context.header ? "true" : "false");
     printf("USB Bulk Mode: %s\n", engine.usbBulkMode ? "true" : "false");
+    printf("Real-time Priority: %d\n", engine.schedPolicy == DUO_SCHED_FIFO ? engine.schedPriority : 0);
+    printf("CPU Mask: 0x%llx\n", engine.streamCpus);
+    printf("Lock Memory: %s\n", engine.lockMemory ? "true" : "false");
+    if (engine.recoverTimeout > 0.0f) {
+        printf("Recovery Timeout: %g s\n", engine.recoverTimeout);
+    }
     printf("Max Fs Mode: %s\n", engine.maxSampleRate ? "true" : "false");
 
 #if defined(_WIN32) || (_WIN64)
@@ -354,6 +514,20 @@ int main(int argc, char** argv) {
     // subtract IP and UDP headers
     engine.maxTransferSize = mtu - 20 - 8;
 
+    if (context.header) {
+        enum DuoEngineFormat format = duoEngineFormat(&engine);
+        udpHeaderInit(
+            &context.head, (uint8_t)format, (uint8_t)duoEngineFormatBits(format),
+            (uint8_t)engine.layout, (uint8_t)duoEngineOutputMask(&engine),
+            duoEngineSampleRate(&engine));
+        engine.maxTransferSize -= sizeof(struct DuoUdpHeader);
+        context.packet = (char*)malloc(mtu);
+        if (context.packet == NULL) {
+            printf("failed to allocate packet buffer\n");
+            return EXIT_FAILURE;
+        }
+    }
+
     // Configure callbacks
     engine.userContext = &context;
     engine.transferCallback = transferCallback;
@@ -370,6 +544,9 @@ int main(int argc, char** argv) {
     close(context.sock);
 #endif
 
+    free(context.packet);
+    duoCalTableFree(&calTable);
+
     if (rcode != 0) {
         return EXIT_FAILURE;
     }
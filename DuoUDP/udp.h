@@ -0,0 +1,136 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef UDP_H
+#define UDP_H
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+
+#define DUO_UDP_VERSION (2)
+// the first frame does not follow on from the previous packet, e.g. after a device recovery
+#define DUO_UDP_FLAG_DISCONTINUITY (0x01)
+
+
+/**
+* Optional metadata header at the start of each DuoUDP payload.
+* Multi-byte fields are in network byte order (big-endian).
+* The sample data following the header is in the byte order of
+* the sending machine, as without the header.
+*/
+struct DuoUdpHeader {
+    // "DUOU"
+    int8_t magic[4];
+    uint8_t version;
+    // sample scalar format, see enum DuoEngineFormat
+    uint8_t format;
+    // number of bits used to store each scalar
+    uint8_t bitsPerScalar;
+    // arrangement of scalars in the packet, see enum DuoEngineLayout
+    uint8_t layout;
+    // packet counter, incremented by one for each packet sent
+    uint32_t sequence;
+    // number of frames following the header
+    uint32_t numFrames;
+    // sample rate in samples per second, changes with a runtime decimation change
+    uint32_t sampleRate;
+    // output streams in each frame, see enum DuoEngineOutput
+    uint8_t outputMask;
+    // DUO_UDP_FLAG_* bits describing this packet
+    uint8_t flags;
+    uint8_t reserved[2];
+};
+
+
+/**
+* Initialize the fields of a header that do not change between packets
+*
+* @param head pointer to header struct to initialize
+* @param format sample scalar format, see enum DuoEngineFormat
+* @param bitsPerScalar number of bits used to store each scalar
+* @param layout arrangement of scalars, see enum DuoEngineLayout
+* @param outputMask output streams, see enum DuoEngineOutput
+* @param sampleRate sample rate in samples per second
+*/
+static void udpHeaderInit(
+        struct DuoUdpHeader* head, uint8_t format, uint8_t bitsPerScalar,
+        uint8_t layout, uint8_t outputMask, uint32_t sampleRate) {
+    head->magic[0] = 'D';
+    head->magic[1] = 'U';
+    head->magic[2] = 'O';
+    head->magic[3] = 'U';
+    head->version = DUO_UDP_VERSION;
+    head->format = format;
+    head->bitsPerScalar = bitsPerScalar;
+    head->layout = layout;
+    head->sequence = 0;
+    head->numFrames = 0;
+    head->sampleRate = htonl(sampleRate);
+    head->outputMask = outputMask;
+    head->flags = 0;
+    memset(head->reserved, 0, sizeof(head->reserved));
+}
+
+
+/**
+* Update the per-packet fields of a header
+*
+* @param head pointer to header struct to update
+* @param sequence packet counter
+* @param numFrames number of frames in the packet
+*/
+static void udpHeaderUpdate(struct DuoUdpHeader* head, uint32_t sequence, uint32_t numFrames) {
+    head->sequence = htonl(sequence);
+    head->numFrames = htonl(numFrames);
+}
+
+
+/**
+* Update the sample rate of a header, e.g. after a runtime change
+*
+* @param head pointer to header struct to update
+* @param sampleRate sample rate in samples per second
+*/
+static void udpHeaderSetRate(struct DuoUdpHeader* head, uint32_t sampleRate) {
+    head->sampleRate = htonl(sampleRate);
+}
+
+
+/**
+* Set the flags of a header for the next packet
+*
+* @param head pointer to header struct to update
+* @param flags DUO_UDP_FLAG_* bits
+*/
+static void udpHeaderSetFlags(struct DuoUdpHeader* head, uint8_t flags) {
+    head->flags = flags;
+}
+
+
+#endif
@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "duoz.h"
+
+
+static const char* USAGE = "\
+Usage: DuoDecompress.exe [-h] input [output]\n\
+\n\
+Restores the original WAV (or raw) file captured with DuoWAV -z.\n\
+\n\
+Options:\n\
+  -h: print this help message\n\
+\n\
+Arguments:\n\
+  input: The DuoZ file path\n\
+  [output]: The restored file path (default=duo.wav)\n\
+\n";
+
+
+static void usage(void) {
+    printf(USAGE);
+}
+
+
+static FILE* openFile(const char* path, const char* mode) {
+    FILE* file = NULL;
+#if defined(_WIN32) || defined(_WIN64)
+    if (fopen_s(&file, path, mode) != 0) {
+        file = NULL;
+    }
+#else
+    file = fopen(path, mode);
+#endif
+    if (file == NULL) {
+        perror(path);
+    }
+    return file;
+}
+
+
+int main(int argc, char** argv) {
+    const char* inputPath = NULL;
+    const char* outputPath = "duo.wav";
+    int rcode = EXIT_SUCCESS;
+
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+        usage();
+        return EXIT_SUCCESS;
+    }
+    if (argc != 2 && argc != 3) {
+        printf("invalid number of arguments\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+    inputPath = argv[1];
+    if (argc == 3) {
+        outputPath = argv[2];
+    }
+
+    FILE* in = openFile(inputPath, "rb");
+    if (in == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    struct DuozFileHeader head;
+    if (fread(&head, sizeof(head), 1, in) != 1 || !duozFileHeaderValid(&head)) {
+        printf("%s is not a DuoZ file\n", inputPath);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    FILE* out = openFile(outputPath, "wb");
+    if (out == NULL) {
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    // Copy the original WAV header verbatim
+    uint8_t* buffer = NULL;
+    if (head.wavHeaderSize > 0) {
+        buffer = (uint8_t*)malloc(head.wavHeaderSize);
+        if (buffer == NULL ||
+            fread(buffer, 1, head.wavHeaderSize, in) != head.wavHeaderSize ||
+            fwrite(buffer, 1, head.wavHeaderSize, out) != head.wavHeaderSize) {
+            printf("failed to copy WAV header\n");
+            free(buffer);
+            fclose(in);
+            fclose(out);
+            return EXIT_FAILURE;
+        }
+        free(buffer);
+    }
+
+    size_t payloadCap = duozMaxPayloadSize(head.blockFrames, head.numChannels);
+    uint8_t* payload = (uint8_t*)malloc(payloadCap);
+    int16_t* frames = (int16_t*)malloc((size_t)head.blockFrames * head.numChannels * sizeof(int16_t));
+    if (payload == NULL || frames == NULL) {
+        printf("failed to allocate buffers\n");
+        rcode = EXIT_FAILURE;
+    }
+
+    uint32_t expectIndex = 0;
+    size_t bytesOut = 0;
+    struct DuozBlockHeader block;
+    while (rcode == EXIT_SUCCESS && fread(&block, sizeof(block), 1, in) == 1) {
+        if (!duozBlockHeaderValid(&block) || block.numFrames > head.blockFrames ||
+            block.payloadSize > payloadCap) {
+            printf("corrupt block header after block %u\n", expectIndex);
+            rcode = EXIT_FAILURE;
+            break;
+        }
+        if (block.index != expectIndex) {
+            printf("block index out of sequence expected=%u got=%u\n", expectIndex, block.index);
+            rcode = EXIT_FAILURE;
+            break;
+        }
+        if (fread(payload, 1, block.payloadSize, in) != block.payloadSize) {
+            printf("truncated block %u\n", block.index);
+            rcode = EXIT_FAILURE;
+            break;
+        }
+        if (duozDecodeBlock(payload, block.payloadSize, block.numFrames, head.numChannels, frames)) {
+            printf("failed to decode block %u\n", block.index);
+            rcode = EXIT_FAILURE;
+            break;
+        }
+        size_t count = (size_t)block.numFrames * head.numChannels;
+        if (fwrite(frames, sizeof(int16_t), count, out) != count) {
+            printf("failed to write block %u\n", block.index);
+            rcode = EXIT_FAILURE;
+            break;
+        }
+        bytesOut += count * sizeof(int16_t);
+        expectIndex++;
+    }
+
+    if (rcode == EXIT_SUCCESS) {
+        printf("Restored %u blocks, %zu data bytes to %s\n", expectIndex, bytesOut, outputPath);
+    }
+
+    free(payload);
+    free(frames);
+    fclose(in);
+    fclose(out);
+    return rcode;
+}
@@ -31,21 +31,35 @@ SOFTWARE.
 
 #include <stdio.h>
 #include <time.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
 
 #define DEFAULT_AGC_BANDWIDTH (5)
 
 #include "DuoEngine.h"
 #include "DuoParse.h"
+#include "DuoThread.h"
 #include "wav.h"
+#include "duoz.h"
 
 
 static const char* USAGE = "\
 Usage: DuoWAV.exe [-h] [-m max] [-a agchz] [-t agcdb] [-l lna] [-d decim]\n\
-                  [-n notch] [-w warmup] [-o] [-f] [-k] [-x] freq bytes [path]\n\
+                  [-n notch] [-w warmup] [-j threads] [-s format]\n\
+                  [-p layout] [-c streams] [-B phases] [-r rate]\n\
+                  [-q quality] [-F freq] [-I] [-K path] [-T level]\n\
+                  [-P seconds] [-M seconds] [-R priority] [-C cpus]\n\
+                  [-L] [-D ms] [-o] [-f] [-k] [-x] [-z]\n\
+                  freq bytes [path]\n\
 \n\
 Options:\n\
   -h: print this help message\n\
   -m max: maximum transfer size in bytes (default=10240)\n\
+  -D ms: Write the frames received so far once the oldest has waited\n\
+      this many milliseconds instead of waiting for a full transfer\n\
+      (default=disabled). Not compatible with -T or the planar and\n\
+      split layouts.\n\
   -a 0|5|50|100: AGC loop bandwidth in Hz (default=5)\n\
   -t [-72-0]: AGC set point in dBFS (default=-30)\n\
   -l 0-9: LNA state where 0 provides the least RF gain reduction.\n\
@@ -61,8 +75,68 @@ Options:\n\
   -w seconds: Run the radio for the specified number of seconds to\n\
       warm up and stabilize performance before capture (default=2).\n\
       During the warmup period, samples are discarded.\n\
-  -f: Convert samples to floating point\n\
+  -s int16|float32|float16|int14|int12|int8: Sample scalar format\n\
+      (default=int16). float16 is IEEE half precision scaled like float32.\n\
+      int14 and int12 keep the most significant bits of each scalar and\n\
+      are bit-packed. They cannot be described by a WAV header and\n\
+      require the -o option. int8 keeps the 8 most significant bits and\n\
+      is written as standard unsigned 8-bit WAV samples. float16 is\n\
+      written as 16-bit IEEE float WAV samples, which some readers\n\
+      do not support.\n\
+  -f: Convert samples to floating point (same as -s float32)\n\
+  -p interleaved|planar|split: Scalar layout (default=interleaved)\n\
+      planar and split write the file as consecutive blocks of frames.\n\
+      Each planar block holds all tuner A samples followed by all\n\
+      tuner B samples. Each split block holds separate runs of tuner A\n\
+      I, tuner A Q, tuner B I, and tuner B Q scalars. Both require the\n\
+      -o option and only whole blocks are written.\n\
+  -c streams: Comma separated output streams from a, b, sum, diff,\n\
+      beam0, and beam1 (default=a,b). Selected streams appear in each\n\
+      frame in that order as I, Q pairs. sum and diff are (A + B) / 2\n\
+      and (A - B) / 2. Each beam is (A + B * e^{j phase}) / 2.\n\
+  -B phases: Comma separated steering phases of tuner B in degrees\n\
+      for beam0 and beam1 (default=0). 180 nulls a signal that\n\
+      arrives in phase at both tuners.\n\
+  -r rate: Resample both tuners to the specified output rate in Hz\n\
+      (e.g. 250k, 48k, or 2.4M) with a polyphase filter. The ratio to\n\
+      the hardware rate (2 MHz / decim) in lowest terms L/M must have\n\
+      L <= 1024. Use -d to get close to the rate first since the\n\
+      filter cost grows with M. By default no resampling is done.\n\
+  -q low|medium|high: Resampling filter quality (default=medium)\n\
+      Passes 80, 90, or 95 percent of the output bandwidth with 60,\n\
+      80, or 100 dB of stopband attenuation respectively.\n\
+  -F freq: Shift the signal at freq Hz from the tuning frequency\n\
+      (e.g. 250k or -100k) to 0 Hz with a phase continuous NCO, which\n\
+      keeps it away from the DC offset of the tuners. With -r the\n\
+      shift is applied in the same pass as the resampler.\n\
+  -I: Remove the DC offset and I/Q gain and phase imbalance of each\n\
+      tuner with slowly adapting estimators (default=off)\n\
+  -K path: Remove the phase, delay, and gain of tuner B relative to\n\
+      tuner A using the calibration table at path (see DuoCorr -U)\n\
+  -T level: Only capture bursts, triggered when the mean power of\n\
+      either tuner over a transfer reaches level dBFS (e.g. -40).\n\
+      Each burst is written to a new file named path_NNNN with the\n\
+      extension of path, starting with the pre-trigger history.\n\
+      The trigger re-arms after each capture, and the bytes argument\n\
+      limits each file. Not compatible with -z.\n\
+  -P seconds: Pre-trigger history kept in memory and written at the\n\
+      start of each triggered capture (default=1)\n\
+  -M seconds: Post-trigger time written after the power was last at\n\
+      the trigger level (default=1)\n\
   -o: Omit the WAV header. Samples will start at beginning of file.\n\
+  -z: Write a losslessly compressed DuoZ file instead of a WAV file.\n\
+      Blocks of frames are compressed by a pool of worker threads.\n\
+      Use DuoDecompress to restore the exact original WAV file.\n\
+      Only compatible with the int16 sample format.\n\
+  -j threads: Number of compression worker threads (default=2)\n\
+  -R priority: Run the threads that process samples with SCHED_FIFO\n\
+      real-time scheduling at priority 1-99. Usually requires root,\n\
+      CAP_SYS_NICE, or an rtprio limit. Settings that cannot be\n\
+      applied are reported and capture continues without them.\n\
+  -C cpus: Pin the threads that process samples to the comma\n\
+      separated CPUs or ranges of CPUs (e.g. 2,3 or 2-3)\n\
+  -L: Lock the process memory into RAM and write every sample\n\
+      buffer once before streaming starts\n\
   -k: Use USB bulk transfer mode instead of isochronous\n\
   -x: Use the maximum 8 MHz master sample rate.\n\
       This will deliver 12 bit ADC resolution, but with slightly \n\
@@ -83,10 +157,90 @@ Arguments:\n\
       Can be specified with k, K, m, M, g, or G suffix to indicate\n\
       the value is in KiB, MiB, or GiB respectively (e.g. 10M)\n\
       NOTE: WAV files cannot exceed 4 GiB.\n\
-  [path]: The destination file path (default=duo.wav)\n\
+      With -z, this limits the size of the restored WAV file.\n\
+  [path]: The destination file path (default=duo.wav or duo.duoz)\n\
+      With -T, the pattern of the capture file names.\n\
 \n";
 
 
+#define MAX_COMPRESS_THREADS (64)
+
+
+enum CompressJobState {
+    JOB_FREE,
+    JOB_FILLING,
+    JOB_QUEUED,
+    JOB_BUSY,
+    JOB_DONE
+};
+
+
+// One block of frames moving through the compression pool
+struct CompressJob {
+    enum CompressJobState state;
+    uint32_t index;
+    unsigned int numFrames;
+    int16_t* frames;
+    int32_t* scratch;
+    uint8_t* payload;
+    size_t payloadSize;
+};
+
+
+/**
+* Pool of worker threads compressing blocks in parallel.
+* Blocks are filled and written in order by the transfer callback
+* thread so the file is always written sequentially. Workers only
+* compress, so they never touch the file.
+*/
+struct Compressor {
+    FILE* out;
+    unsigned int numChannels;
+    unsigned int blockFrames;
+    unsigned int numThreads;
+    DuoThread threads[MAX_COMPRESS_THREADS];
+    DuoMutex lock;
+    DuoCond cond;
+    struct CompressJob* jobs;
+    unsigned int numJobs;
+    // Next block index to be filled
+    uint32_t fillIndex;
+    // Next block index to be written
+    uint32_t writeIndex;
+    bool stop;
+    bool failed;
+    size_t bytesOut;
+};
+
+
+/**
+* Triggered capture state.
+* Every transfer is kept in a ring holding the pre-trigger history.
+* When either tuner reaches the trigger level the history is written
+* to a new file followed by the live transfers, until the post-trigger
+* time passes without the level being reached again. The ring is then
+* emptied so no transfer is written twice, and the trigger re-arms.
+*/
+struct Trigger {
+    // trigger level in dBFS
+    float level;
+    // ring of whole transfers, oldest first from ringStart
+    uint8_t* ring;
+    size_t transferBytes;
+    unsigned int ringSlots;
+    unsigned int ringStart;
+    unsigned int ringCount;
+    // frames in the post-trigger period and frames left in the current capture
+    size_t postFrames;
+    size_t framesLeft;
+    bool capturing;
+    // capture file names are the output path with _NNNN before the extension
+    const char* path;
+    char* capturePath;
+    unsigned int numCaptures;
+};
+
+
 struct Context {
     FILE* out;
     size_t maxBytes;
@@ -94,30 +248,413 @@ struct Context {
     time_t startTime;
     bool started;
     bool done;
+    // non-NULL when writing a compressed DuoZ file
+    struct Compressor* compressor;
+    // non-NULL when 8-bit samples must be converted to unsigned for WAV
+    uint8_t* offsetBinary;
+    // non-NULL when only triggered captures are written
+    struct Trigger* trigger;
+    // header of each file, unused if omitHeader is true
+    struct WavHeader wav;
+    bool omitHeader;
 };
 
 
-static void transferCallback(struct DuoEngineTransfer* transfer, void* userContext) {
+static void compressWorker(void* arg) {
+    struct Compressor* comp = (struct Compressor*)arg;
+    duoMutexLock(&comp->lock);
+    while (true) {
+        // Take the oldest queued block
+        struct CompressJob* job = NULL;
+        for (unsigned int idx = 0; idx < comp->numJobs; idx++) {
+            struct CompressJob* curr = &comp->jobs[idx];
+            if (curr->state == JOB_QUEUED && (job == NULL || curr->index < job->index)) {
+                job = curr;
+            }
+        }
+        if (job == NULL) {
+            if (comp->stop) {
+                break;
+            }
+            duoCondWait(&comp->cond, &comp->lock);
+            continue;
+        }
+        job->state = JOB_BUSY;
+        duoMutexUnlock(&comp->lock);
+
+        job->payloadSize = duozEncodeBlock(
+            job->frames, job->numFrames, comp->numChannels, job->scratch, job->payload);
+
+        duoMutexLock(&comp->lock);
+        job->state = JOB_DONE;
+        duoCondBroadcast(&comp->cond);
+    }
+    duoMutexUnlock(&comp->lock);
+}
+
+
+static void compressorDestroy(struct Compressor* comp) {
+    if (comp->jobs) {
+        for (unsigned int idx = 0; idx < comp->numJobs; idx++) {
+            free(comp->jobs[idx].frames);
+            free(comp->jobs[idx].scratch);
+            free(comp->jobs[idx].payload);
+        }
+        free(comp->jobs);
+    }
+    duoCondDestroy(&comp->cond);
+    duoMutexDestroy(&comp->lock);
+    free(comp);
+}
+
+
+/**
+* Allocate job buffers and start the worker threads
+*
+* @return pointer to new compressor or NULL on failure
+*/
+static struct Compressor* compressorCreate(
+        FILE* out, unsigned int numThreads, unsigned int numChannels,
+        unsigned int blockFrames) {
+    struct Compressor* comp = (struct Compressor*)calloc(1, sizeof(struct Compressor));
+    if (comp == NULL) {
+        return NULL;
+    }
+    comp->out = out;
+    comp->numChannels = numChannels;
+    comp->blockFrames = blockFrames;
+    duoMutexInit(&comp->lock);
+    duoCondInit(&comp->cond);
+
+    // Enough jobs to keep every worker busy while others wait to be written
+    comp->numJobs = numThreads * 2 + 2;
+    comp->jobs = (struct CompressJob*)calloc(comp->numJobs, sizeof(struct CompressJob));
+    if (comp->jobs == NULL) {
+        compressorDestroy(comp);
+        return NULL;
+    }
+    for (unsigned int idx = 0; idx < comp->numJobs; idx++) {
+        struct CompressJob* job = &comp->jobs[idx];
+        job->frames = (int16_t*)malloc((size_t)blockFrames * numChannels * sizeof(int16_t));
+        job->scratch = (int32_t*)malloc((size_t)blockFrames * sizeof(int32_t));
+        job->payload = (uint8_t*)malloc(duozMaxPayloadSize(blockFrames, numChannels));
+        if (job->frames == NULL || job->scratch == NULL || job->payload == NULL) {
+            compressorDestroy(comp);
+            return NULL;
+        }
+    }
+    comp->jobs[0].state = JOB_FILLING;
+
+    for (comp->numThreads = 0; comp->numThreads < numThreads; comp->numThreads++) {
+        if (duoThreadCreate(&comp->threads[comp->numThreads], compressWorker, comp)) {
+            printf("failed to start compression thread\n");
+            break;
+        }
+    }
+    if (comp->numThreads == 0) {
+        compressorDestroy(comp);
+        return NULL;
+    }
+    return comp;
+}
+
+
+/**
+* Write all finished blocks that are next in order.
+* Must be called with the lock held. The lock is released while writing.
+*/
+static void compressorWriteReady(struct Compressor* comp) {
+    while (true) {
+        struct CompressJob* job = &comp->jobs[comp->writeIndex % comp->numJobs];
+        if (job->state != JOB_DONE || job->index != comp->writeIndex) {
+            break;
+        }
+        duoMutexUnlock(&comp->lock);
+
+        struct DuozBlockHeader head;
+        duozBlockHeaderInit(&head, job->index, job->numFrames, (uint32_t)job->payloadSize);
+        if (fwrite(&head, sizeof(head), 1, comp->out) != 1 ||
+            fwrite(job->payload, 1, job->payloadSize, comp->out) != job->payloadSize) {
+            printf("failed to write compressed block %u\n", job->index);
+            comp->failed = true;
+        }
+        comp->bytesOut += sizeof(head) + job->payloadSize;
+
+        duoMutexLock(&comp->lock);
+        job->state = JOB_FREE;
+        comp->writeIndex++;
+    }
+}
+
+
+/**
+* Queue the block being filled and move on to the next job.
+* Blocks if the next job is still waiting to be compressed or written.
+*/
+static void compressorSubmit(struct Compressor* comp) {
+    duoMutexLock(&comp->lock);
+    struct CompressJob* job = &comp->jobs[comp->fillIndex % comp->numJobs];
+    job->index = comp->fillIndex++;
+    job->state = JOB_QUEUED;
+    duoCondBroadcast(&comp->cond);
+
+    struct CompressJob* next = &comp->jobs[comp->fillIndex % comp->numJobs];
+    while (true) {
+        compressorWriteReady(comp);
+        if (next->state == JOB_FREE) {
+            break;
+        }
+        duoCondWait(&comp->cond, &comp->lock);
+    }
+    next->state = JOB_FILLING;
+    next->numFrames = 0;
+    duoMutexUnlock(&comp->lock);
+}
+
+
+/**
+* Copy frames into the block being filled, submitting full blocks
+*/
+static void compressorWrite(struct Compressor* comp, const int16_t* frames, size_t numFrames) {
+    while (numFrames > 0) {
+        struct CompressJob* job = &comp->jobs[comp->fillIndex % comp->numJobs];
+        size_t count = comp->blockFrames - job->numFrames;
+        if (count > numFrames) {
+            count = numFrames;
+        }
+        memcpy(
+            job->frames + (size_t)job->numFrames * comp->numChannels, frames,
+            count * comp->numChannels * sizeof(int16_t));
+        job->numFrames += (unsigned int)count;
+        frames += count * comp->numChannels;
+        numFrames -= count;
+        if (job->numFrames == comp->blockFrames) {
+            compressorSubmit(comp);
+        }
+    }
+}
+
+
+/**
+* Submit any partial block, write everything, and stop the workers
+*/
+static void compressorFinish(struct Compressor* comp) {
+    if (comp->jobs[comp->fillIndex % comp->numJobs].numFrames > 0) {
+        compressorSubmit(comp);
+    }
+    duoMutexLock(&comp->lock);
+    while (comp->writeIndex != comp->fillIndex) {
+        compressorWriteReady(comp);
+        if (comp->writeIndex != comp->fillIndex) {
+            duoCondWait(&comp->cond, &comp->lock);
+        }
+    }
+    comp->stop = true;
+    duoCondBroadcast(&comp->cond);
+    duoMutexUnlock(&comp->lock);
+    for (unsigned int idx = 0; idx < comp->numThreads; idx++) {
+        duoThreadJoin(comp->threads[idx]);
+    }
+}
+
+
+/**
+* Write samples to the output file, converting 8-bit samples for WAV
+*
+* @return zero on success, non-zero otherwise
+*/
+static int writeData(struct Context* context, const void* data, size_t numBytes) {
+    if (context->offsetBinary) {
+        // WAV 8-bit samples are unsigned with 128 as zero
+        const uint8_t* in = (const uint8_t*)data;
+        for (size_t idx = 0; idx < numBytes; idx++) {
+            context->offsetBinary[idx] = in[idx] ^ 0x80;
+        }
+        data = context->offsetBinary;
+    }
+    size_t result = fwrite(data, 1, numBytes, context->out);
+    if (result != numBytes) {
+        printf("unexpected result from write expected=%zu got=%zu\n", numBytes, result);
+        return 1;
+    }
+    context->bytesWritten += numBytes;
+    return 0;
+}
+
+
+/**
+* Open the next capture file and write the pre-trigger history
+*
+* @return zero on success, non-zero otherwise
+*/
+static int captureOpen(struct Context* context) {
+    struct Trigger* trigger = context->trigger;
+    const char* path = trigger->path;
+    const char* ext = strrchr(path, '.');
+    const char* sep = strrchr(path, '/');
+    const char* winSep = strrchr(path, '\\');
+    if (ext == NULL || (sep && sep > ext) || (winSep && winSep > ext)) {
+        ext = path + strlen(path);
+    }
+    trigger->numCaptures++;
+    sprintf(trigger->capturePath, "%.*s_%04u%s",
+            (int)(ext - path), path, trigger->numCaptures, ext);
+
+    context->out = fopen(trigger->capturePath, "wb");
+    if (context->out == NULL) {
+        perror(trigger->capturePath);
+        return 1;
+    }
+    context->bytesWritten = 0;
+    if (!context->omitHeader && fwrite(&context->wav, sizeof(context->wav), 1, context->out) != 1) {
+        printf("failed to write wav header\n");
+        return 1;
+    }
+    for (unsigned int idx = 0; idx < trigger->ringCount; idx++) {
+        unsigned int slot = (trigger->ringStart + idx) % trigger->ringSlots;
+        if (writeData(context, trigger->ring + slot * trigger->transferBytes, trigger->transferBytes)) {
+            return 1;
+        }
+    }
+    trigger->ringStart = 0;
+    trigger->ringCount = 0;
+    trigger->capturing = true;
+    return 0;
+}
+
+
+/**
+* Complete the WAV header of the current capture file and close it
+*
+* @return zero on success, non-zero otherwise
+*/
+static int captureClose(struct Context* context) {
+    struct Trigger* trigger = context->trigger;
     int rcode = 0;
+    trigger->capturing = false;
+    if (context->out == NULL) {
+        return 1;
+    }
+    if (!context->omitHeader) {
+        struct WavHeader wav = context->wav;
+        wavHeaderUpdate(&wav, (uint32_t)context->bytesWritten);
+        if (fseek(context->out, 0, SEEK_SET) != 0 ||
+            fwrite(&wav, sizeof(wav), 1, context->out) != 1) {
+            printf("failed to update wav header of %s\n", trigger->capturePath);
+            rcode = 1;
+        }
+    }
+    if (fclose(context->out) != 0) {
+        rcode = 1;
+    }
+    context->out = NULL;
+    printf("Capture %u: wrote %zu bytes to %s\n",
+           trigger->numCaptures, context->bytesWritten, trigger->capturePath);
+    return rcode;
+}
+
+
+/**
+* Keep a transfer in the pre-trigger history, replacing the oldest
+*/
+static void capturePush(struct Trigger* trigger, const void* data) {
+    if (trigger->ringSlots == 0) {
+        return;
+    }
+    unsigned int slot = (trigger->ringStart + trigger->ringCount) % trigger->ringSlots;
+    memcpy(trigger->ring + slot * trigger->transferBytes, data, trigger->transferBytes);
+    if (trigger->ringCount < trigger->ringSlots) {
+        trigger->ringCount++;
+    }
+    else {
+        trigger->ringStart = (trigger->ringStart + 1) % trigger->ringSlots;
+    }
+}
+
+
+/**
+* Handle one transfer in triggered capture mode
+*/
+static void captureTransfer(struct Context* context, struct DuoEngineTransfer* transfer) {
+    struct Trigger* trigger = context->trigger;
+    bool triggered = transfer->powerA >= trigger->level || transfer->powerB >= trigger->level;
+    if (!trigger->capturing && triggered) {
+        printf("Capture %u: triggered at A=%.1f dBFS B=%.1f dBFS\n",
+               trigger->numCaptures + 1, transfer->powerA, transfer->powerB);
+        if (captureOpen(context)) {
+            context->done = true;
+            return;
+        }
+    }
+    if (!trigger->capturing) {
+        capturePush(trigger, transfer->data);
+        return;
+    }
+
+    if (triggered) {
+        // The signal is still present, so keep capturing
+        trigger->framesLeft = trigger->postFrames;
+    }
+    if (context->bytesWritten + transfer->numBytes > context->maxBytes) {
+        // File is full, what follows can start the next capture
+        if (captureClose(context)) {
+            context->done = true;
+        }
+        capturePush(trigger, transfer->data);
+        return;
+    }
+    if (writeData(context, transfer->data, transfer->numBytes)) {
+        context->done = true;
+        return;
+    }
+    if (trigger->framesLeft > transfer->numFrames) {
+        trigger->framesLeft -= transfer->numFrames;
+    }
+    else if (captureClose(context)) {
+        context->done = true;
+    }
+}
+
+
+static void transferCallback(struct DuoEngineTransfer* transfer, void* userContext) {
     struct Context* context = (struct Context*)userContext;
+    if (context->trigger) {
+        if (context->started && !context->done) {
+            captureTransfer(context, transfer);
+        }
+        else if (!context->started && time(NULL) >= context->startTime) {
+            context->started = true;
+        }
+        return;
+    }
     size_t numFrames = transfer->numFrames;
     size_t bytesRemaining = context->maxBytes - context->bytesWritten;
+    // Frames of bit-packed single stream formats are not whole bytes
+    size_t frameBits = (size_t)transfer->bitsPerScalar * 2 * transfer->numStreams;
     if (bytesRemaining < transfer->numBytes) {
-        numFrames = bytesRemaining / transfer->frameSize;
+        numFrames = bytesRemaining * 8 / frameBits;
+        if (frameBits % 8) {
+            numFrames -= numFrames % 2;
+        }
+        if (transfer->layout != DUO_LAYOUT_INTERLEAVED) {
+            // A partial block cannot be interpreted
+            numFrames = 0;
+        }
     }
+    size_t numBytes = numFrames * frameBits / 8;
 
     if (context->started && !context->done) {
-        if (numFrames > 0) {
-            size_t result = fwrite(transfer->data, transfer->frameSize, numFrames, context->out);
-            if (result != numFrames) {
-                printf("unexpected result from write expected=%zu got=%zu\n", numFrames, result);
+        if (numFrames > 0 && context->compressor) {
+            compressorWrite(context->compressor, (const int16_t*)transfer->data, numFrames);
+            context->bytesWritten += numBytes;
+            if (context->compressor->failed || context->bytesWritten >= context->maxBytes) {
                 context->done = true;
             }
-            else {
-                context->bytesWritten += numFrames * transfer->frameSize;
-                if (context->bytesWritten >= context->maxBytes) {
-                    context->done = true;
-                }
+        }
+        else if (numFrames > 0) {
+            if (writeData(context, transfer->data, numBytes) ||
+                context->bytesWritten >= context->maxBytes) {
+                context->done = true;
             }
         }
         else {
@@ -161,12 +698,27 @@ static void usage(void) {
 int main(int argc, char** argv) {
     char opt = 0;
     char defaultPath[] = "duo.wav";
-    char* outputPath = defaultPath;
+    char defaultCompressedPath[] = "duo.duoz";
+    char* outputPath = NULL;
+    char defaultOutput[] = "a,b";
+    char* outputStr = defaultOutput;
+    char defaultSteer[] = "0";
+    char* steerStr = defaultSteer;
     unsigned int warmup = 2;
     bool omitHeader = false;
+    bool compress = false;
+    unsigned int numThreads = 2;
+    bool triggered = false;
+    float preSeconds = 1.0f;
+    float postSeconds = 1.0f;
+    float latencyMs = 0.0f;
+    struct Trigger trigger;
+    memset(&trigger, 0, sizeof(trigger));
 
     struct DuoEngine engine;
     duoEngineInit(&engine);
+    struct DuoCalTable calTable;
+    duoCalTableInit(&calTable);
 
     struct Context context;
     context.out = NULL;
@@ -175,8 +727,12 @@ int main(int argc, char** argv) {
     context.startTime = time(NULL);
     context.started = false;
     context.done = false;
+    context.compressor = NULL;
+    context.offsetBinary = NULL;
+    context.trigger = NULL;
+    context.omitHeader = false;
 
-    while ((opt = getopt(argc, argv, "ha:t:l:d:n:w:ofkx")) != -1) {
+    while ((opt = getopt(argc, argv, "hm:a:t:l:d:n:w:j:s:p:c:B:r:q:F:IK:T:P:M:R:C:LD:ofkxz")) != -1) {
         switch (opt) {
         case 'm':
             if (parseUintArg(optarg, &engine.maxTransferSize, 10)) {
@@ -185,6 +741,14 @@ int main(int argc, char** argv) {
                 return EXIT_FAILURE;
             }
             break;
+        case 'D':
+            if (parseFloatArg(optarg, &latencyMs) || latencyMs <= 0.0f) {
+                printf("invalid maximum latency, must be a positive number of milliseconds\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            engine.maxLatency = latencyMs / 1000.0f;
+            break;
         case 'a':
             if (parseAgcBandwidth(optarg, &engine.agcBandwidth)) {
                 usage();
@@ -222,12 +786,117 @@ int main(int argc, char** argv) {
                 return EXIT_FAILURE;
             }
             break; 
+        case 'j':
+            if (parseUintArg(optarg, &numThreads, 10) ||
+                numThreads == 0 || numThreads > MAX_COMPRESS_THREADS) {
+                printf("invalid number of threads, must be in [1-%d]\n", MAX_COMPRESS_THREADS);
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
         case 'o':
             omitHeader = true;
             break;
+        case 'z':
+            compress = true;
+            break;
+        case 's':
+            if (parseSampleFormat(optarg, &engine.format)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            if (parseLayout(optarg, &engine.layout)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            if (parseOutputMask(optarg, &engine.outputMask)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            outputStr = optarg;
+            break;
+        case 'B':
+            if (parseBeamSteering(optarg, engine.beams)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            steerStr = optarg;
+            break;
+        case 'r':
+            if (parseSampleRate(optarg, &engine.outputRate)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'q':
+            if (parseResampleQuality(optarg, &engine.resampleQuality)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'F':
+            if (parseFrequency(optarg, &engine.shiftFreq)) {
+                printf("invalid frequency shift argument\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'I':
+            engine.iqCorrection = true;
+            break;
+        case 'K':
+            if (parseCalibrationTable(optarg, &calTable)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            engine.calibration = &calTable;
+            break;
+        case 'T':
+            if (parseFloatArg(optarg, &trigger.level)) {
+                printf("invalid trigger level, must be a number of dBFS\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            triggered = true;
+            break;
+        case 'P':
+            if (parseFloatArg(optarg, &preSeconds) || preSeconds < 0.0f) {
+                printf("invalid pre-trigger time, must be a non-negative number of seconds\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'M':
+            if (parseFloatArg(optarg, &postSeconds) || postSeconds < 0.0f) {
+                printf("invalid post-trigger time, must be a non-negative number of seconds\n");
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
         case 'f':
             engine.floatingPoint = true;
             break;
+        case 'R':
+            if (parseRealtimePriority(optarg, &engine.schedPriority)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            engine.schedPolicy = DUO_SCHED_FIFO;
+            break;
+        case 'C':
+            if (parseCpuList(optarg, &engine.streamCpus)) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'L':
+            engine.lockMemory = true;
+            engine.prefault = true;
+            break;
         case 'k':
             engine.usbBulkMode = true;
             break;
@@ -271,12 +940,71 @@ int main(int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
+    enum DuoEngineFormat format = duoEngineFormat(&engine);
+    if (compress && format != DUO_FORMAT_INT16) {
+        printf("compression requires 16-bit integer samples\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (!omitHeader && (format == DUO_FORMAT_INT12 || format == DUO_FORMAT_INT14)) {
+        printf("bit-packed %s samples cannot be described by a WAV header, use -o\n",
+               duoEngineFormatName(format));
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (engine.layout != DUO_LAYOUT_INTERLEAVED && (!omitHeader || compress)) {
+        printf("%s layout cannot be described by a WAV header, use -o without -z\n",
+               duoEngineLayoutName(engine.layout));
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (engine.maxLatency > 0.0f && (triggered || engine.layout != DUO_LAYOUT_INTERLEAVED)) {
+        printf("maximum latency requires whole transfers, omit -D\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (triggered && compress) {
+        printf("triggered capture cannot be compressed, omit -z\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (outputPath == NULL) {
+        outputPath = compress ? defaultCompressedPath : defaultPath;
+    }
+
+    unsigned int transferFrames = duoEngineTransferFrames(&engine);
+    if (triggered) {
+        size_t headerBytes = omitHeader ? 0 : sizeof(struct WavHeader);
+        double sampleRate = duoEngineSampleRate(&engine);
+        trigger.transferBytes = (size_t)transferFrames * duoEngineFormatBits(format) * 2 *
+                                duoEngineNumStreams(duoEngineOutputMask(&engine)) / 8;
+        trigger.ringSlots = (unsigned int)ceil(preSeconds * sampleRate / transferFrames);
+        trigger.postFrames = (size_t)ceil(postSeconds * sampleRate);
+        if (headerBytes + (trigger.ringSlots + 1) * trigger.transferBytes > context.maxBytes) {
+            printf("pre-trigger history does not fit in the maximum file size\n");
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
     printf("Output file: %s\n", outputPath);
     printf("Maximum Bytes: %zu\n", context.maxBytes);
+    if (engine.maxLatency > 0.0f) {
+        printf("Maximum Latency: %g ms\n", latencyMs);
+    }
     printf("Omit WAV header: %s\n", omitHeader ? "true" : "false");
     if (!omitHeader) {
         printf("WAV header size: %zu bytes\n", sizeof(struct WavHeader));
     }
+    printf("Compression: %s\n", compress ? "true" : "false");
+    if (compress) {
+        printf("Compression Threads: %u\n", numThreads);
+    }
+    if (triggered) {
+        printf("Trigger Level: %.1f dBFS\n", trigger.level);
+        printf("Pre-trigger Time: %.3f seconds\n", preSeconds);
+        printf("Post-trigger Time: %.3f seconds\n", postSeconds);
+    }
     printf("Warmup: %u seconds\n", warmup);
     printf("RF Tune Frequency: %f Hz\n", engine.tuneFreq);
     printf("AGC Loop Bandwidth: %u Hz\n", engine.agcBandwidth);
@@ -285,52 +1013,114 @@ int main(int argc, char** argv) {
     }
     printf("LNA State: %u\n", engine.lnaState);
     printf("Decimation Factor: %u\n", engine.decimFactor);
-    printf("Floating Point: %s\n", engine.floatingPoint ? "true" : "false");
+    printf("Sample Rate: %u Hz\n", duoEngineSampleRate(&engine));
+    if (engine.outputRate) {
+        printf("Resampler Quality: %s\n", duoEngineResampleQualityName(engine.resampleQuality));
+    }
+    if (engine.shiftFreq != 0.0f) {
+        printf("Frequency Shift: %.0f Hz\n", engine.shiftFreq);
+    }
+    printf("IQ Correction: %s\n", engine.iqCorrection ? "true" : "false");
+    if (engine.calibration) {
+        printf("Calibration Points: %u\n", calTable.numPoints);
+    }
+    printf("Sample Format: %s\n", duoEngineFormatName(format));
+    printf("Layout: %s\n", duoEngineLayoutName(engine.layout));
+    printf("Output Streams: %s\n", outputStr);
+    if (duoEngineOutputMask(&engine) & DUO_OUTPUT_BEAMS) {
+        printf("Beam Steering: %s\n", steerStr);
+    }
+    if (engine.layout != DUO_LAYOUT_INTERLEAVED) {
+        printf("Frames per Block: %u\n", transferFrames);
+    }
     printf("USB Bulk Mode: %s\n", engine.usbBulkMode ? "true" : "false");
+    printf("Real-time Priority: %d\n", engine.schedPolicy == DUO_SCHED_FIFO ? engine.schedPriority : 0);
+    printf("CPU Mask: 0x%llx\n", engine.streamCpus);
+    printf("Lock Memory: %s\n", engine.lockMemory ? "true" : "false");
     printf("Max Fs Mode: %s\n", engine.maxSampleRate ? "true" : "false");
 
     // Prepare the WAV header metadata
     struct WavHeader wav;
-    uint8_t bytesPerSample = sizeof(short);
-    bool floatingPoint = false;
-    if (engine.floatingPoint) {
-        bytesPerSample = sizeof(float);
-        floatingPoint = true;
-    }
+    uint16_t numChannels = (uint16_t)(2 * duoEngineNumStreams(duoEngineOutputMask(&engine)));
+    uint8_t bytesPerSample = (uint8_t)(duoEngineFormatBits(format) / 8);
+    bool floatingPoint = format == DUO_FORMAT_FLOAT32 || format == DUO_FORMAT_FLOAT16;
     wavHeaderInit(
         &wav,
-        2000000 / engine.decimFactor, // sample rate
-        4, // num channels, one for each scalar: Ia Qa Ib Qb
+        duoEngineSampleRate(&engine), // sample rate
+        numChannels, // one for each scalar, e.g. Ia Qa Ib Qb
         bytesPerSample,
         floatingPoint);
+    context.wav = wav;
+    context.omitHeader = omitHeader;
+    if (!omitHeader) {
+        context.maxBytes -= sizeof(wav);
+    }
 
-    // Open output file
-    // Need the "b" binary option to avoid translations
- #if defined(_WIN32) || defined(_WIN64)
-    errno_t err = fopen_s(&context.out, outputPath, "wb");
-    if (err != 0) {
-        printf("failed to open file rcode=%d\n", err);
-        return EXIT_FAILURE;
+    if (triggered) {
+        trigger.path = outputPath;
+        trigger.capturePath = (char*)malloc(strlen(outputPath) + 16);
+        trigger.ring = (uint8_t*)malloc(trigger.ringSlots * trigger.transferBytes + 1);
+        if (trigger.capturePath == NULL || trigger.ring == NULL) {
+            printf("failed to allocate pre-trigger history\n");
+            return EXIT_FAILURE;
+        }
+        context.trigger = &trigger;
+        engine.measurePower = true;
     }
+    else {
+        // Open output file
+        // Need the "b" binary option to avoid translations
+ #if defined(_WIN32) || defined(_WIN64)
+        errno_t err = fopen_s(&context.out, outputPath, "wb");
+        if (err != 0) {
+            printf("failed to open file rcode=%d\n", err);
+            return EXIT_FAILURE;
+        }
  #else
-    context.out = fopen(outputPath, "wb");
-    if (context.out == NULL) {
-        perror("failed to open file");
-	return EXIT_FAILURE;
-    }
+        context.out = fopen(outputPath, "wb");
+        if (context.out == NULL) {
+            perror("failed to open file");
+	    return EXIT_FAILURE;
+        }
  #endif
 
-    if (!omitHeader) {
-        // Write WAV header, file position will be at start of data portion
-        size_t result = fwrite(&wav, sizeof(wav), 1, context.out);
-        if (result != 1) {
-            printf("failed to write wav header result=%zu\n", result);
-            return EXIT_FAILURE;
+        if (compress) {
+            // DuoZ header is followed by the original WAV header (if any)
+            struct DuozFileHeader duoz;
+            duozFileHeaderInit(
+                &duoz, numChannels, DUOZ_DEFAULT_BLOCK_FRAMES,
+                omitHeader ? 0 : sizeof(struct WavHeader));
+            if (fwrite(&duoz, sizeof(duoz), 1, context.out) != 1) {
+                printf("failed to write DuoZ header\n");
+                return EXIT_FAILURE;
+            }
         }
 
-        // Max bytes is the entire file size,
-        // need to allocate the size taken by the WAV header.
-        context.maxBytes -= sizeof(wav);
+        if (!omitHeader) {
+            // Write WAV header, file position will be at start of data portion
+            size_t result = fwrite(&wav, sizeof(wav), 1, context.out);
+            if (result != 1) {
+                printf("failed to write wav header result=%zu\n", result);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (compress) {
+            context.compressor = compressorCreate(
+                context.out, numThreads, numChannels, DUOZ_DEFAULT_BLOCK_FRAMES);
+            if (context.compressor == NULL) {
+                printf("failed to start compression\n");
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (!omitHeader && format == DUO_FORMAT_INT8) {
+        context.offsetBinary = (uint8_t*)malloc(engine.maxTransferSize);
+        if (context.offsetBinary == NULL) {
+            printf("failed to allocate conversion buffer\n");
+            return EXIT_FAILURE;
+        }
     }
 
     // Configure callbacks
@@ -351,19 +1141,45 @@ int main(int argc, char** argv) {
     printf("PRESS q to QUIT\n");
     int rcode = duoEngineRun(&engine);
 
-    if (!omitHeader) {
-        // Need to update the file and data size values in the header
-        // and overwrite the old header
-        wavHeaderUpdate(&wav, (uint32_t)context.bytesWritten);
-        fseek(context.out, 0, SEEK_SET);
-        size_t result = fwrite(&wav, sizeof(wav), 1, context.out);
-        if (result != 1) {
-            printf("failed to update wav header result=%zu\n", result);
-            return EXIT_FAILURE;
+    if (context.compressor) {
+        compressorFinish(context.compressor);
+        if (context.compressor->failed) {
+            rcode = 1;
         }
+        if (context.bytesWritten > 0) {
+            printf("Compressed %zu bytes to %zu bytes (%.1f%%)\n",
+                   context.bytesWritten, context.compressor->bytesOut,
+                   100.0 * context.compressor->bytesOut / context.bytesWritten);
+        }
+        compressorDestroy(context.compressor);
+        context.compressor = NULL;
     }
 
-    fclose(context.out);
+    if (triggered) {
+        // Finish a burst still being captured when stopped
+        if (trigger.capturing && captureClose(&context)) {
+            rcode = 1;
+        }
+        printf("Captures: %u\n", trigger.numCaptures);
+        free(trigger.ring);
+        free(trigger.capturePath);
+    }
+    else {
+        if (!omitHeader) {
+            // Need to update the file and data size values in the header
+            // and overwrite the old header
+            wavHeaderUpdate(&wav, (uint32_t)context.bytesWritten);
+            fseek(context.out, compress ? sizeof(struct DuozFileHeader) : 0, SEEK_SET);
+            size_t result = fwrite(&wav, sizeof(wav), 1, context.out);
+            if (result != 1) {
+                printf("failed to update wav header result=%zu\n", result);
+                return EXIT_FAILURE;
+            }
+        }
+        fclose(context.out);
+    }
+    free(context.offsetBinary);
+    duoCalTableFree(&calTable);
 
     if (rcode != 0) {
         return EXIT_FAILURE;
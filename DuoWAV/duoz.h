@@ -0,0 +1,532 @@
+/*
+Copyright (c) 2020 Mark Siner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DUOZ_H
+#define DUOZ_H
+
+/**
+* DuoZ is a simple lossless block codec for interleaved 16-bit
+* multi-channel sample data in the style of FLAC.
+*
+* Each channel of a block is coded independently with the best of the
+* fixed polynomial predictors of order 0 to 3, and the prediction
+* residuals are Rice coded with a per-partition parameter.
+* Every block carries its own predictor warmup samples so blocks can be
+* decoded independently of each other.
+*
+* File layout:
+*     struct DuozFileHeader
+*     original WAV header (wavHeaderSize bytes, may be zero)
+*     repeated: struct DuozBlockHeader, payloadSize bytes of coded data
+*
+* NOTE: The header fields are in the byte order of the writing machine.
+* Sample values are stored in the bitstream, not as raw bytes, and the
+* restored data portion is written in the byte order of the decoding
+* machine.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+#define DUOZ_VERSION (1)
+#define DUOZ_MAX_ORDER (3)
+#define DUOZ_MAX_PARTITION_ORDER (8)
+#define DUOZ_VERBATIM (7)
+// Quotients at or above this limit are escaped to a raw value
+#define DUOZ_ESCAPE_QUOTIENT (24)
+// Zigzag encoded order 3 residuals of 16-bit data fit in 20 bits
+#define DUOZ_ESCAPE_BITS (20)
+
+#ifndef DUOZ_DEFAULT_BLOCK_FRAMES
+#define DUOZ_DEFAULT_BLOCK_FRAMES (16384)
+#endif
+
+
+// Header at the start of a DuoZ file
+struct DuozFileHeader {
+    int8_t magic[4];
+    uint16_t version;
+    uint16_t numChannels;
+    uint32_t blockFrames;
+    // Size of the original WAV header that follows this struct
+    uint32_t wavHeaderSize;
+};
+
+
+// Header before each independently decodable block
+struct DuozBlockHeader {
+    int8_t magic[4];
+    uint32_t index;
+    uint32_t numFrames;
+    uint32_t payloadSize;
+};
+
+
+/**
+* Initialize a DuoZ file header
+*
+* @param head pointer to header struct to initialize
+* @param numChannels number of interleaved 16-bit channels per frame
+* @param blockFrames number of frames in each full block
+* @param wavHeaderSize size of original WAV header following this header
+*/
+static void duozFileHeaderInit(
+        struct DuozFileHeader* head, uint16_t numChannels,
+        uint32_t blockFrames, uint32_t wavHeaderSize) {
+    head->magic[0] = 'D';
+    head->magic[1] = 'U';
+    head->magic[2] = 'O';
+    head->magic[3] = 'Z';
+    head->version = DUOZ_VERSION;
+    head->numChannels = numChannels;
+    head->blockFrames = blockFrames;
+    head->wavHeaderSize = wavHeaderSize;
+}
+
+
+/**
+* Check the magic and version of a DuoZ file header
+*
+* @param head pointer to header read from a file
+*
+* @return true if the header is valid
+*/
+static bool duozFileHeaderValid(const struct DuozFileHeader* head) {
+    return head->magic[0] == 'D' && head->magic[1] == 'U' &&
+           head->magic[2] == 'O' && head->magic[3] == 'Z' &&
+           head->version == DUOZ_VERSION && head->numChannels > 0;
+}
+
+
+/**
+* Initialize a DuoZ block header
+*
+* @param head pointer to header struct to initialize
+* @param index sequential block index
+* @param numFrames number of frames coded in the block
+* @param payloadSize number of coded bytes following the header
+*/
+static void duozBlockHeaderInit(
+        struct DuozBlockHeader* head, uint32_t index,
+        uint32_t numFrames, uint32_t payloadSize) {
+    head->magic[0] = 'D';
+    head->magic[1] = 'Z';
+    head->magic[2] = 'B';
+    head->magic[3] = 'K';
+    head->index = index;
+    head->numFrames = numFrames;
+    head->payloadSize = payloadSize;
+}
+
+
+/**
+* Check the magic of a DuoZ block header
+*
+* @param head pointer to header read from a file
+*
+* @return true if the header is valid
+*/
+static bool duozBlockHeaderValid(const struct DuozBlockHeader* head) {
+    return head->magic[0] == 'D' && head->magic[1] == 'Z' &&
+           head->magic[2] == 'B' && head->magic[3] == 'K';
+}
+
+
+/**
+* Worst case coded size of a block, used to size output buffers
+*
+* @param numFrames number of frames in the block
+* @param numChannels number of channels per frame
+*
+* @return maximum number of payload bytes duozEncodeBlock() can produce
+*/
+static size_t duozMaxPayloadSize(unsigned int numFrames, unsigned int numChannels) {
+    // Verbatim coding is selected whenever the Rice estimate exceeds
+    // 16 bits per sample. Escaped values can cost up to twice their
+    // estimate, which bounds the worst case at 32 bits per sample.
+    return (size_t)numFrames * numChannels * 4 + numChannels * 16 + 16;
+}
+
+
+// Bit-level writer with a 64-bit accumulator
+struct DuozBitWriter {
+    uint8_t* out;
+    size_t pos;
+    uint64_t acc;
+    unsigned int bits;
+};
+
+
+static void duozPutBits(struct DuozBitWriter* w, uint32_t value, unsigned int count) {
+    // count is at most 32, so the accumulator never holds more than 39 bits
+    w->acc = (w->acc << count) | (value & (uint32_t)((1ULL << count) - 1));
+    w->bits += count;
+    while (w->bits >= 8) {
+        w->bits -= 8;
+        w->out[w->pos++] = (uint8_t)(w->acc >> w->bits);
+    }
+}
+
+
+static void duozFlushBits(struct DuozBitWriter* w) {
+    if (w->bits > 0) {
+        w->out[w->pos++] = (uint8_t)(w->acc << (8 - w->bits));
+        w->bits = 0;
+    }
+    w->acc = 0;
+}
+
+
+// Bit-level reader with a 64-bit accumulator
+struct DuozBitReader {
+    const uint8_t* in;
+    size_t pos;
+    size_t size;
+    uint64_t acc;
+    unsigned int bits;
+    bool overrun;
+};
+
+
+static uint32_t duozGetBits(struct DuozBitReader* r, unsigned int count) {
+    while (r->bits < count) {
+        uint8_t next = 0;
+        if (r->pos < r->size) {
+            next = r->in[r->pos++];
+        }
+        else {
+            r->overrun = true;
+        }
+        r->acc = (r->acc << 8) | next;
+        r->bits += 8;
+    }
+    r->bits -= count;
+    return (uint32_t)(r->acc >> r->bits) & (uint32_t)((1ULL << count) - 1);
+}
+
+
+static uint32_t duozZigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+
+static int32_t duozUnzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+
+/**
+* Compute fixed polynomial prediction residuals for one channel
+*
+* @param in pointer to first sample of the channel
+* @param stride distance between consecutive samples of the channel
+* @param numFrames number of samples in the channel
+* @param order predictor order in [0-3]
+* @param residual output of numFrames - order residuals
+*/
+static void duozResidual(
+        const int16_t* in, unsigned int stride, unsigned int numFrames,
+        unsigned int order, int32_t* residual) {
+    unsigned int n = 0;
+    switch (order) {
+    case 0:
+        for (n = 0; n < numFrames; n++) {
+            residual[n] = in[n * stride];
+        }
+        break;
+    case 1:
+        for (n = 1; n < numFrames; n++) {
+            residual[n - 1] = in[n * stride] - in[(n - 1) * stride];
+        }
+        break;
+    case 2:
+        for (n = 2; n < numFrames; n++) {
+            residual[n - 2] = in[n * stride] - 2 * in[(n - 1) * stride] +
+                              in[(n - 2) * stride];
+        }
+        break;
+    default:
+        for (n = 3; n < numFrames; n++) {
+            residual[n - 3] = in[n * stride] - 3 * in[(n - 1) * stride] +
+                              3 * in[(n - 2) * stride] - in[(n - 3) * stride];
+        }
+        break;
+    }
+}
+
+
+/**
+* Select the Rice parameter for a partition from the sum of its values
+*/
+static unsigned int duozRiceParam(uint64_t sum, unsigned int count) {
+    unsigned int k = 0;
+    while (k < DUOZ_ESCAPE_BITS && ((uint64_t)count << (k + 1)) < sum) {
+        k++;
+    }
+    return k;
+}
+
+
+/**
+* Estimate the coded size of a partition in bits
+*/
+static uint64_t duozRiceBits(uint64_t sum, unsigned int count, unsigned int k) {
+    return 5 + (uint64_t)count * (k + 1) + (sum >> k);
+}
+
+
+/**
+* Code one channel of a block.
+*
+* @param w bit writer
+* @param in pointer to first sample of the channel
+* @param stride distance between consecutive samples of the channel
+* @param numFrames number of samples in the channel
+* @param scratch scratch space for at least numFrames int32 values
+*/
+static void duozEncodeChannel(
+        struct DuozBitWriter* w, const int16_t* in, unsigned int stride,
+        unsigned int numFrames, int32_t* scratch) {
+    unsigned int order = 0;
+    unsigned int bestOrder = 0;
+    uint64_t bestSum = UINT64_MAX;
+    unsigned int n = 0;
+
+    // Pick the predictor with the smallest residual magnitude
+    for (order = 0; order <= DUOZ_MAX_ORDER && order < numFrames; order++) {
+        uint64_t sum = 0;
+        duozResidual(in, stride, numFrames, order, scratch);
+        for (n = 0; n < numFrames - order; n++) {
+            sum += duozZigzag(scratch[n]);
+        }
+        if (sum < bestSum) {
+            bestSum = sum;
+            bestOrder = order;
+        }
+    }
+
+    unsigned int numResiduals = numFrames - bestOrder;
+    duozResidual(in, stride, numFrames, bestOrder, scratch);
+    for (n = 0; n < numResiduals; n++) {
+        scratch[n] = (int32_t)duozZigzag(scratch[n]);
+    }
+
+    // Pick the partition order with the smallest estimated size
+    unsigned int bestPartOrder = 0;
+    uint64_t bestBits = UINT64_MAX;
+    for (unsigned int partOrder = 0; partOrder <= DUOZ_MAX_PARTITION_ORDER; partOrder++) {
+        unsigned int numParts = 1u << partOrder;
+        unsigned int partLen = numResiduals >> partOrder;
+        if (partOrder > 0 && partLen < 64) {
+            break;
+        }
+        uint64_t bits = 0;
+        for (unsigned int part = 0; part < numParts; part++) {
+            unsigned int start = part * partLen;
+            unsigned int end = (part == numParts - 1) ? numResiduals : start + partLen;
+            uint64_t sum = 0;
+            for (n = start; n < end; n++) {
+                sum += (uint32_t)scratch[n];
+            }
+            bits += duozRiceBits(sum, end - start, duozRiceParam(sum, end - start));
+        }
+        if (bits < bestBits) {
+            bestBits = bits;
+            bestPartOrder = partOrder;
+        }
+    }
+
+    if (bestBits + 4 >= (uint64_t)numResiduals * 16) {
+        // Prediction does not help, store the samples as they are
+        duozPutBits(w, DUOZ_VERBATIM, 3);
+        for (n = 0; n < numFrames; n++) {
+            duozPutBits(w, (uint16_t)in[n * stride], 16);
+        }
+        return;
+    }
+
+    duozPutBits(w, bestOrder, 3);
+    for (n = 0; n < bestOrder; n++) {
+        duozPutBits(w, (uint16_t)in[n * stride], 16);
+    }
+    duozPutBits(w, bestPartOrder, 4);
+
+    unsigned int numParts = 1u << bestPartOrder;
+    unsigned int partLen = numResiduals >> bestPartOrder;
+    for (unsigned int part = 0; part < numParts; part++) {
+        unsigned int start = part * partLen;
+        unsigned int end = (part == numParts - 1) ? numResiduals : start + partLen;
+        uint64_t sum = 0;
+        for (n = start; n < end; n++) {
+            sum += (uint32_t)scratch[n];
+        }
+        unsigned int k = duozRiceParam(sum, end - start);
+        duozPutBits(w, k, 5);
+        for (n = start; n < end; n++) {
+            uint32_t value = (uint32_t)scratch[n];
+            uint32_t q = value >> k;
+            if (q >= DUOZ_ESCAPE_QUOTIENT) {
+                duozPutBits(w, (1u << DUOZ_ESCAPE_QUOTIENT) - 1, DUOZ_ESCAPE_QUOTIENT);
+                duozPutBits(w, value, DUOZ_ESCAPE_BITS);
+            }
+            else {
+                // q ones followed by a zero, then the k low bits
+                duozPutBits(w, ((1u << q) - 1) << 1, q + 1);
+                if (k > 0) {
+                    duozPutBits(w, value, k);
+                }
+            }
+        }
+    }
+}
+
+
+/**
+* Code a block of interleaved 16-bit frames.
+*
+* @param in pointer to numFrames * numChannels interleaved samples
+* @param numFrames number of frames in the block
+* @param numChannels number of channels per frame
+* @param scratch scratch space for at least numFrames int32 values
+* @param out output buffer of at least duozMaxPayloadSize() bytes
+*
+* @return number of payload bytes written to out
+*/
+static size_t duozEncodeBlock(
+        const int16_t* in, unsigned int numFrames, unsigned int numChannels,
+        int32_t* scratch, uint8_t* out) {
+    struct DuozBitWriter w;
+    w.out = out;
+    w.pos = 0;
+    w.acc = 0;
+    w.bits = 0;
+    for (unsigned int chan = 0; chan < numChannels; chan++) {
+        duozEncodeChannel(&w, in + chan, numChannels, numFrames, scratch);
+    }
+    duozFlushBits(&w);
+    return w.pos;
+}
+
+
+/**
+* Decode one channel of a block.
+*
+* @return zero on success, non-zero if the data is corrupt
+*/
+static int duozDecodeChannel(
+        struct DuozBitReader* r, int16_t* out, unsigned int stride,
+        unsigned int numFrames) {
+    unsigned int n = 0;
+    unsigned int order = duozGetBits(r, 3);
+    if (order == DUOZ_VERBATIM) {
+        for (n = 0; n < numFrames; n++) {
+            out[n * stride] = (int16_t)duozGetBits(r, 16);
+        }
+        return r->overrun;
+    }
+    if (order > DUOZ_MAX_ORDER || order > numFrames) {
+        return 1;
+    }
+    for (n = 0; n < order; n++) {
+        out[n * stride] = (int16_t)duozGetBits(r, 16);
+    }
+
+    unsigned int numResiduals = numFrames - order;
+    unsigned int partOrder = duozGetBits(r, 4);
+    unsigned int numParts = 1u << partOrder;
+    unsigned int partLen = numResiduals >> partOrder;
+    n = order;
+    for (unsigned int part = 0; part < numParts; part++) {
+        unsigned int count = (part == numParts - 1) ? numResiduals - part * partLen : partLen;
+        unsigned int k = duozGetBits(r, 5);
+        for (unsigned int idx = 0; idx < count; idx++, n++) {
+            uint32_t q = 0;
+            uint32_t value = 0;
+            while (q < DUOZ_ESCAPE_QUOTIENT && duozGetBits(r, 1)) {
+                q++;
+            }
+            if (q == DUOZ_ESCAPE_QUOTIENT) {
+                value = duozGetBits(r, DUOZ_ESCAPE_BITS);
+            }
+            else {
+                value = (q << k) | (k > 0 ? duozGetBits(r, k) : 0);
+            }
+            int32_t res = duozUnzigzag(value);
+            int32_t pred = 0;
+            switch (order) {
+            case 0:
+                pred = 0;
+                break;
+            case 1:
+                pred = out[(n - 1) * stride];
+                break;
+            case 2:
+                pred = 2 * out[(n - 1) * stride] - out[(n - 2) * stride];
+                break;
+            default:
+                pred = 3 * out[(n - 1) * stride] - 3 * out[(n - 2) * stride] +
+                       out[(n - 3) * stride];
+                break;
+            }
+            out[n * stride] = (int16_t)(pred + res);
+        }
+        if (r->overrun) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+* Decode a block of interleaved 16-bit frames.
+*
+* @param in pointer to coded payload
+* @param size number of payload bytes
+* @param numFrames number of frames in the block
+* @param numChannels number of channels per frame
+* @param out output buffer for numFrames * numChannels samples
+*
+* @return zero on success, non-zero if the data is corrupt
+*/
+static int duozDecodeBlock(
+        const uint8_t* in, size_t size, unsigned int numFrames,
+        unsigned int numChannels, int16_t* out) {
+    struct DuozBitReader r;
+    r.in = in;
+    r.pos = 0;
+    r.size = size;
+    r.acc = 0;
+    r.bits = 0;
+    r.overrun = false;
+    for (unsigned int chan = 0; chan < numChannels; chan++) {
+        if (duozDecodeChannel(&r, out + chan, numChannels, numFrames)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+#endif
@@ -23,8 +23,10 @@ SOFTWARE.
 #ifndef WAV_H
 #define WAV_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 
 // WAV "RIFF" chunk
@@ -82,6 +84,19 @@ struct WavHeader {
 };
 
 
+/**
+* Format details read from an existing WAV file
+*/
+struct WavInfo {
+    uint16_t audioFormat;
+    uint16_t numChannels;
+    uint32_t sampleRate;
+    uint16_t bitsPerSample;
+    // size of the data chunk, zero if the writer did not finish the file
+    uint32_t dataSize;
+};
+
+
 /**
 * Simple function to copy a four character label to a header field.
 * Specifically, this is used for copying string constants to chunkId fields.
@@ -162,6 +177,54 @@ static void wavHeaderInit(
 }
 
 
+/**
+* Read the header of a WAV file, skipping any chunks that are not
+* needed. On success the file position is at the start of the samples.
+*
+* @param in file opened for binary reading, positioned at the start
+* @param info pointer to struct to fill in
+*
+* @return zero on success, non-zero if the file is not a supported WAV
+*/
+static int wavReadHeader(FILE* in, struct WavInfo* info) {
+    struct WavRiffChunk riff;
+    bool haveFmt = false;
+    memset(info, 0, sizeof(struct WavInfo));
+    if (fread(&riff, sizeof(riff), 1, in) != 1 ||
+        memcmp(riff.chunkId, "RIFF", 4) != 0 || memcmp(riff.format, "WAVE", 4) != 0) {
+        return 1;
+    }
+    while (true) {
+        int8_t chunkId[4];
+        uint32_t chunkSize = 0;
+        if (fread(chunkId, sizeof(chunkId), 1, in) != 1 ||
+            fread(&chunkSize, sizeof(chunkSize), 1, in) != 1) {
+            return 1;
+        }
+        if (memcmp(chunkId, "fmt ", 4) == 0 && chunkSize >= 16) {
+            uint8_t fmt[16];
+            if (fread(fmt, sizeof(fmt), 1, in) != 1) {
+                return 1;
+            }
+            memcpy(&info->audioFormat, fmt, 2);
+            memcpy(&info->numChannels, fmt + 2, 2);
+            memcpy(&info->sampleRate, fmt + 4, 4);
+            memcpy(&info->bitsPerSample, fmt + 14, 2);
+            chunkSize -= sizeof(fmt);
+            haveFmt = true;
+        }
+        else if (memcmp(chunkId, "data", 4) == 0) {
+            info->dataSize = chunkSize;
+            return haveFmt ? 0 : 1;
+        }
+        // Chunks are padded to an even size
+        if (fseek(in, (long)(chunkSize + (chunkSize & 1)), SEEK_CUR) != 0) {
+            return 1;
+        }
+    }
+}
+
+
 /**
 * Update the necessary header fields with the actual size of data.
 * This should be used after all data has been written and then
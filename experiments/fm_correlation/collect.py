@@ -2,16 +2,58 @@
 import time
 import os
 import os.path
+import sys
 import shutil
 import random
 import csv
 import json
-from subprocess import check_call, Popen
+import re
+from subprocess import check_call, check_output, Popen
 
 import numpy
 from numpy import fft
 
 
+def correlate(data):
+    data = data.reshape([-1,2])
+    chan_a = data[:,0].ravel()
+    chan_b = data[:,1].ravel()
+    fft_a = fft.fft(chan_a).conjugate()
+    fft_b = fft.fft(chan_b)
+    corr = fft.ifft(fft_a.conjugate() * fft_b)
+    corr = fft.fftshift(corr)
+    peak_i = numpy.argmax(numpy.abs(corr))
+    return numpy.degrees(numpy.angle(corr[peak_i]))
+
+
+def collect_in_process(settings, stations, res_file):
+    # Import the extension module built with -DDUO_PYTHON=ON
+    sys.path.insert(0, settings['duoengine_path'])
+    import duoengine
+
+    engine = duoengine.Engine(
+        float(stations[0][0]) * 1e6,
+        decimation=settings['decimation'],
+        lna_state=settings['lna_state'])
+    # Same number of complex64 frame pairs as the DuoWAV file
+    num_frames = int(settings['file_size'] / 16)
+    warmup_frames = int(settings['warmup'] * engine.sample_rate)
+    with engine:
+        for freq, callsign in stations:
+            print('Testing %s MHz' % freq)
+            freq_val = int(float(freq) * 1e6)
+            engine.retune(freq_val)
+            # Discard frames from before and during the retune
+            while warmup_frames > 0:
+                warmup_frames -= len(engine.read(min(warmup_frames, 65536), timeout=5.0))
+            warmup_frames = int(settings['warmup'] * engine.sample_rate)
+            data = engine.read(num_frames, timeout=5.0, copy=True)
+            corr_angle = correlate(data)
+            print(freq_val, corr_angle)
+            res_file.write('%s,%0.04f\n' % (freq, corr_angle))
+            res_file.flush()
+
+
 def main():
     out_path = 'duo.wav'
     res_path = 'results.csv'
@@ -22,10 +64,16 @@ def main():
     with open('settings.json', 'r') as json_file:
         settings = json.load(json_file)
         
-    if not os.path.exists(settings['duowav_path']):
+    if not settings.get('duoengine_path') and not os.path.exists(settings['duowav_path']):
         raise RuntimeError(
             'DuoWAV executable not found at %s' % settings['duowav_path'])
 
+    # Optional native streaming correlator instead of the numpy path
+    duocorr_path = settings.get('duocorr_path')
+    if duocorr_path and not os.path.exists(duocorr_path):
+        raise RuntimeError(
+            'DuoCorr executable not found at %s' % duocorr_path)
+
     sample_rate = 2e6 / settings['decimation']
     delta_t = 1 / sample_rate
     base_cmd = [
@@ -40,24 +88,36 @@ def main():
         stations = [x for x in reader]
         
     random.shuffle(stations)
+
+    # Optional in-process capture through the duoengine Python module
+    if settings.get('duoengine_path'):
+        collect_in_process(settings, stations, res_file)
+        return
  
     for freq, callsign in stations:
         print('Testing %s MHz' % freq)
         freq_val = int(float(freq) * 1e6)
+        if duocorr_path:
+            # One interval covering the same number of frames as the file
+            interval_ms = int(settings['file_size'] / 16 / sample_rate * 1000)
+            cmd = [
+                duocorr_path, '-c', '1', '-i', str(max(interval_ms, 1)),
+                '-w', str(settings['warmup']),
+                '-d', str(settings['decimation']),
+                '-l', str(settings['lna_state']),
+                str(freq_val)]
+            output = check_output(cmd).decode()
+            corr_angle = float(re.findall(r'phase=(\S+) deg', output)[-1])
+            print(freq_val, corr_angle)
+            res_file.write('%s,%0.04f\n' % (freq, corr_angle))
+            res_file.flush()
+            continue
         if os.path.exists(out_path):
             os.remove(out_path)
         cmd = base_cmd + [str(freq_val), str(settings['file_size']), out_path]
         check_call(cmd)
         data = numpy.fromfile(out_path, dtype=numpy.complex64)
-        data = data.reshape([-1,2])
-        chan_a = data[:,0].ravel()
-        chan_b = data[:,1].ravel()
-        fft_a = fft.fft(chan_a).conjugate()
-        fft_b = fft.fft(chan_b)
-        corr = fft.ifft(fft_a.conjugate() * fft_b)
-        corr = fft.fftshift(corr)
-        peak_i = numpy.argmax(numpy.abs(corr))
-        corr_angle = numpy.degrees(numpy.angle(corr[peak_i]))
+        corr_angle = correlate(data)
         
         # Check results
         #phase_shift = chan_b * numpy.exp(1j * numpy.radians(-corr_angle))